@@ -2,9 +2,11 @@
 
 Measures either how efficiently a CPython compiled-code extension
 can compute the Fourier transform of a random input vector ('runtime'
-mode), or how quickly that extension returns to the interpreter
-when interrupted ('latency' mode).  Summary statistics are written
-to standard output, and all of the raw data is saved in a CSV file.
+mode), how quickly that extension returns to the interpreter
+when interrupted ('latency' mode), or how much faster it can compute
+many small transforms at once using SIMD instructions than one at a
+time ('batch' mode).  Summary statistics are written to standard
+output, and all of the raw data is saved in a CSV file.
 """
 
 # Copyright 2024, 2025 Million Concepts LLC
@@ -26,6 +28,7 @@ import numpy as np
 
 from .signaler import Timer
 from .interruptible import (
+    fft_batch,
     fft_uninterruptible,
     fft_simple_interruptible,
     fft_timed_interruptible,
@@ -54,6 +57,14 @@ except ImportError:
 ALL_ALGORITHMS = list(ALGORITHMS.keys())
 
 
+#: Ways of computing a batch of transforms; the value is the 'simd'
+#: argument to fft_batch.
+BATCH_ALGORITHMS = {
+    "simd"          : True,
+    "loop"          : False,
+}
+
+
 DEFAULT_INTERVALS = [1., 2., 5., 10.]
 DEFAULT_DELAYS = [1., 2., 5., 10., 20., 50., 100.]
 
@@ -120,6 +131,7 @@ def bench_runtime(
     intervals: Iterable[float],
     sizes: Iterable[int],
     repeat: int,
+    planner: str,
 ) -> None:
     """Measure the runtime of a set of FFT algorithms on random input
        arrays."""
@@ -129,6 +141,11 @@ def bench_runtime(
     wr.writerow(("size", "impl", "interval", "rep", "elapsed", "checks"))
     for size in sizes:
         tr, tc, fr, fc = alloc_buffers(size)
+        if planner == "measure":
+            # do the measurement up front so it isn't counted against
+            # whichever algorithm happens to be tested first
+            progress("s={} planning", size)
+            fft_uninterruptible(tc, fc, planner=planner)
         for alg in algorithms:
             fft_impl, uses_interval, release_gil = ALGORITHMS[alg]
             if uses_interval:
@@ -140,7 +157,8 @@ def bench_runtime(
                     rng.random(tr.shape, tr.dtype, tr)
                     progress("s={} a={} i={} {}/{}",
                              size, alg, interval, rep + 1, repeat)
-                    elapsed, checks = fft_impl(tc, fc, interval, release_gil)
+                    elapsed, checks = fft_impl(tc, fc, interval, release_gil,
+                                               planner=planner)
                     wr.writerow((size, alg, interval, rep + 1,
                                  elapsed, checks))
     progress("done")
@@ -157,6 +175,7 @@ def bench_latency(
     delays: Iterable[float],
     sizes: Iterable[int],
     repeat: int,
+    planner: str,
 ):
     """Measure how quickly each of a set of FFT algorithms will abandon
        its work upon receipt of KeyboardInterrupt."""
@@ -168,6 +187,9 @@ def bench_latency(
 
     for size in sizes:
         tr, tc, fr, fc = alloc_buffers(size)
+        if planner == "measure":
+            progress("s={} planning", size)
+            fft_uninterruptible(tc, fc, planner=planner)
         for delay in delays:
             interrupter = Timer(delay, repeat=False)
             for alg in algorithms:
@@ -186,7 +208,7 @@ def bench_latency(
                             try:
                                 with interrupter:
                                     (elapsed, checks) = fft_impl(
-                                        tc, fc, interval
+                                        tc, fc, interval, planner=planner
                                     )
                             except Interrupted as e:
                                 interrupted = True
@@ -196,9 +218,37 @@ def bench_latency(
     progress("done")
 
 
+def bench_batch(
+    data_fp: TextIOBase,
+    stats_fp: TextIOBase,
+    *,
+    summary_stats: bool,
+    progress: Callable,
+    sizes: Iterable[int],
+    batch_samples: int,
+    repeat: int,
+) -> None:
+    """Measure the runtime of batches of small FFTs, computed either
+       several at a time with SIMD instructions or one at a time."""
+
+    rng = np.random.default_rng()
+    wr = csv.writer(data_fp, dialect='unix', quoting=csv.QUOTE_MINIMAL)
+    wr.writerow(("size", "impl", "batch", "rep", "elapsed", "checks"))
+    tr, tc, fr, fc = alloc_buffers(batch_samples)
+    for size in sizes:
+        batch = batch_samples // size
+        for alg, simd in BATCH_ALGORITHMS.items():
+            for rep in range(repeat):
+                rng.random(tr.shape, tr.dtype, tr)
+                progress("s={} a={} {}/{}", size, alg, rep + 1, repeat)
+                elapsed, checks = fft_batch(tc, fc, size, simd=simd)
+                wr.writerow((size, alg, batch, rep + 1, elapsed, checks))
+    progress("done")
+
+
 def main() -> None:
     ap = argparse.ArgumentParser(description=__doc__)
-    ap.add_argument("mode", choices=("runtime", "latency"),
+    ap.add_argument("mode", choices=("runtime", "latency", "batch"),
                     help="Measurement mode")
     ap.add_argument("-a", "--algorithm", dest="algorithms", action="append",
                     choices=ALL_ALGORITHMS,
@@ -214,13 +264,20 @@ def main() -> None:
                     help="Report progress of the measurement")
 
     ap.add_argument("-m", "--min-samples", metavar="SAMPLES",
-                    type=int, default = 1 << 16,
+                    type=int, default=None,
                     help="Minimum number of samples to benchmark with."
-                    " Must be a power of two.")
+                    " Must be a power of two. (default: 2**16, or 4 in"
+                    " 'batch' mode)")
     ap.add_argument("-M", "--max-samples", metavar="SAMPLES",
-                    type=int, default = 1 << 20,
+                    type=int, default=None,
                     help="Maximum number of samples to benchmark with."
-                    f" Must be a power of two and <= {MAX_SAMPLES}.")
+                    f" Must be a power of two and <= {MAX_SAMPLES}."
+                    " (default: 2**20, or 1024 in 'batch' mode)")
+    ap.add_argument("-B", "--batch-samples", metavar="SAMPLES",
+                    type=int, default=1 << 20,
+                    help="Total number of samples in each batch of"
+                    " transforms (only meaningful in 'batch' mode)."
+                    " Must be a power of two and >= --max-samples.")
     ap.add_argument("-i", "--check-interval", metavar="MS", dest="intervals",
                     type=float, action="append",
                     help="FFT implementation should check for interrupts"
@@ -234,8 +291,17 @@ def main() -> None:
     ap.add_argument("-r", "--repeat", metavar="N",
                     type=int, default=5,
                     help="How many times to repeat each measurement.")
+    ap.add_argument("-P", "--planner", choices=("estimate", "measure"),
+                    default="estimate",
+                    help="How the FFT implementation should choose its"
+                    " algorithm for each size (default: estimate)")
 
     args = ap.parse_args()
+    if args.min_samples is None:
+        args.min_samples = 4 if args.mode == "batch" else 1 << 16
+    if args.max_samples is None:
+        args.max_samples = 1 << 10 if args.mode == "batch" else 1 << 20
+
     if args.min_samples <= 0:
         ap.error("argument of --min-samples must be positive")
     if args.min_samples.bit_count() != 1:
@@ -248,6 +314,13 @@ def main() -> None:
     if args.max_samples > MAX_SAMPLES:
         ap.error(f"argument of --max-samples must be <= {MAX_SAMPLES}")
 
+    if args.mode == "batch":
+        if args.batch_samples.bit_count() != 1:
+            ap.error("argument of --batch-samples must be a power of two")
+        if args.batch_samples < args.max_samples:
+            ap.error("argument of --batch-samples must be"
+                     " >= --max-samples")
+
     if args.repeat <= 0:
         ap.error("argument of --repeat must be positive")
 
@@ -290,6 +363,17 @@ def main() -> None:
                 intervals=intervals,
                 sizes=power_of_two_sizes(args.min_samples, args.max_samples),
                 repeat=args.repeat,
+                planner=args.planner,
+            )
+        elif args.mode == "batch":
+            bench_batch(
+                data_fp,
+                stats_fp,
+                summary_stats=args.summary_stats,
+                progress=reporter,
+                sizes=power_of_two_sizes(args.min_samples, args.max_samples),
+                batch_samples=args.batch_samples,
+                repeat=args.repeat,
             )
         else:
             bench_latency(
@@ -302,6 +386,7 @@ def main() -> None:
                 delays=delays,
                 sizes=power_of_two_sizes(args.min_samples, args.max_samples),
                 repeat=args.repeat,
+                planner=args.planner,
             )
 
 
@@ -186,11 +186,133 @@ timed_coarse_interruptible_check(kiss_fft_periodic_cb *payload)
 }
 #endif
 
+// Set up SHOULD_STOP to check for signals at most every S_INTERVAL
+// seconds.  New entry points should use this rather than picking one
+// of the other check functions.
+static void
+init_timed_check(periodic_signal_check *should_stop, double s_interval,
+                 bool release_gil)
+{
+    should_stop->base.check = timed_interruptible_check;
+    should_stop->check_count = 0;
+    should_stop->ns_last_check = 0;
+    should_stop->ns_between_checks = sec_to_nsec(s_interval);
+    should_stop->base.interval_ns = should_stop->ns_between_checks;
+    should_stop->release_gil = release_gil;
+}
+
+// Bookkeeping shared by every entry point that runs a potentially
+// lengthy calculation: begin_interruptible must be called right
+// before starting work, and end_interruptible right after.
+struct interruptible_call
+{
+    sigset_t prev_mask;
+    nanosec start_ns;
+};
+
+static void
+begin_interruptible(struct interruptible_call *call,
+                    periodic_signal_check *should_stop)
+{
+    // benchmark.py blocks SIGINT around latency tests, expecting us
+    // to unblock it again, so that it can only be delivered during
+    // execution of this function; without this we can get stray
+    // KeyboardInterrupts
+    sigset_t sigint;
+    sigemptyset(&sigint);
+    sigaddset(&sigint, SIGINT);
+    sigprocmask(SIG_UNBLOCK, &sigint, &call->prev_mask);
+
+    call->start_ns = monotonic_now_ns();
+    if (should_stop->ns_between_checks)
+        should_stop->ns_last_check = call->start_ns;
+}
+
+// Returns the (elapsed, checks) tuple, or raises Interrupted with it
+// as the argument if INTERRUPTED is nonzero or a signal is pending.
+static PyObject *
+end_interruptible(PyObject *mod, struct interruptible_call *call,
+                  const periodic_signal_check *should_stop, int interrupted)
+{
+    nanosec stop_ns = monotonic_now_ns();
+
+    // Unconditionally check for signals at this point so that,
+    // if there's a pending signal, we throw our special Interrupted
+    // exception instead of letting the interpreter throw a regular
+    // KeyboardInterrupt.
+    if (!interrupted && PyErr_CheckSignals())
+        interrupted = 1;
+
+    sigprocmask(SIG_SETMASK, &call->prev_mask, NULL);
+
+    PyObject *res = Py_BuildValue("dL",
+                                  nsec_to_sec(stop_ns - call->start_ns),
+                                  should_stop->check_count);
+    if (interrupted && res)
+        res = raise_Interrupted(mod, res);
+    return res;
+}
+
+// Parsed arguments for all the functions callable from Python.
+struct interruptible_args
+{
+    PyObject *td;
+    PyObject *fd;
+    double s_between_checks;
+    double s_planning_limit;
+    bool release_gil;
+    bool measure;
+    Py_ssize_t channels;  // for PCM input
+    Py_ssize_t channel;
+    double scale;
+    bool scrambled;       // see kiss_fft_scrambled
+    bool inverse;
+};
+
+// Report failure of kiss_fft_alloc.
+static void
+raise_alloc_error(kiss_fft_state *st)
+{
+    if (st == 0)
+        PyErr_NoMemory();
+    else
+        PyErr_SetString(PyExc_ValueError,
+                        "invalid number of samples for KISS FFT"
+                        " (not a power of two?)");
+}
+
+// Allocate a plan for SAMPLES samples, between begin_interruptible
+// and the work that uses it.  Computing the twiddle factors for a
+// large plan can take a long time, so this checks SHOULD_STOP along
+// the way.  On failure, including interruption, finishes CALL (see
+// end_interruptible) and returns NULL with an exception set.
+static kiss_fft_state *
+alloc_plan(PyObject *mod, size_t samples,
+           periodic_signal_check *should_stop,
+           struct interruptible_call *call)
+{
+    int interrupted;
+    kiss_fft_state *st =
+        kiss_fft_alloc_interruptible(samples, &should_stop->base,
+                                     &interrupted);
+    if (interrupted) {
+        end_interruptible(mod, call, should_stop, interrupted);
+        return 0;
+    }
+    if (st == 0 || st == (kiss_fft_state *)-1) {
+        raise_alloc_error(st);
+        sigprocmask(SIG_SETMASK, &call->prev_mask, NULL);
+        return 0;
+    }
+    return st;
+}
+
 // Shared implementation for all four public functions.
 
 static Py_ssize_t
-maybe_interruptible_get_buffers(PyObject *o1, Py_buffer *b1,
-                                PyObject *o2, Py_buffer *b2)
+maybe_interruptible_get_buffers_n(PyObject *o1, Py_buffer *b1,
+                                  PyObject *o2, Py_buffer *b2,
+                                  Py_ssize_t max_samples)
 {
     if (PyObject_GetBuffer(o1, b1, PyBUF_SIMPLE) < 0) {
         return (Py_ssize_t)-1;
@@ -214,10 +336,10 @@ maybe_interruptible_get_buffers(PyObject *o1, Py_buffer *b1,
         goto fail;
     }
 
-    if (samples > KISS_FFT_MAX_SAMPLES) {
+    if (samples > (size_t) max_samples) {
         PyErr_Format(PyExc_ValueError,
                      "too many samples: have %zd limit %zd",
-                     samples, KISS_FFT_MAX_SAMPLES);
+                     samples, max_samples);
         goto fail;
     }
 
@@ -229,117 +351,293 @@ maybe_interruptible_get_buffers(PyObject *o1, Py_buffer *b1,
     return (Py_ssize_t) -1;
 }
 
+static Py_ssize_t
+maybe_interruptible_get_buffers(PyObject *o1, Py_buffer *b1,
+                                PyObject *o2, Py_buffer *b2)
+{
+    // Py_ssize_t may be too small to represent KISS_FFT_MAX_SAMPLES,
+    // but then no buffer can be that large anyway
+    const Py_ssize_t max_samples =
+        KISS_FFT_MAX_SAMPLES > (uint64_t) PY_SSIZE_T_MAX
+        ? PY_SSIZE_T_MAX : (Py_ssize_t) KISS_FFT_MAX_SAMPLES;
+    return maybe_interruptible_get_buffers_n(o1, b1, o2, b2, max_samples);
+}
+
+
+// Returns the KISS_FFT_PCM_ format of B if it holds 16- or 32-bit
+// integers, which are taken to be real PCM samples, or 0 for anything
+// else, which is taken to be complex64 as always.  Returns -1 with an
+// exception set for integers in the wrong byte order.
+static int
+pcm_format(const Py_buffer *b)
+{
+    const char *f = b->format ? b->format : "B";
+    bool swapped = false;
+    if (*f == '@' || *f == '=')
+        f++;
+    else if (*f == '<' || *f == '>' || *f == '!')
+        swapped = (*f++ == '<') != PY_LITTLE_ENDIAN;
+    if (!f[0] || f[1] || !strchr("hil", f[0])
+        || (b->itemsize != 2 && b->itemsize != 4))
+        return 0;
+    if (swapped) {
+        PyErr_SetString(PyExc_ValueError,
+                        "PCM input must be in native byte order");
+        return -1;
+    }
+    return b->itemsize == 2 ? KISS_FFT_PCM_S16 : KISS_FFT_PCM_S32;
+}
+
+// The input of a function that accepts PCM as well as complex
+// samples, as kiss_fft_pcm and the other _pcm functions want it.
+struct input_samples {
+    int format;         // KISS_FFT_PCM_..., or 0 for complex
+    const void *data;   // the first sample of the wanted channel
+    size_t itemsize;    // bytes per element
+    size_t stride;      // elements from one sample to the next
+    float scale;
+    size_t samples;     // complex samples, or PCM frames
+};
+
+// Get the buffer of OBJ, which may hold PCM (see pcm_format), into B
+// and describe it in IN, given the channels, channel and scale
+// arguments of the function it was passed to.  Returns 0, or -1 with
+// an exception set.
+static int
+get_input_samples(PyObject *obj, Py_buffer *b, Py_ssize_t channels,
+                  Py_ssize_t channel, double scale,
+                  struct input_samples *in)
+{
+    if (PyObject_GetBuffer(obj, b, PyBUF_FORMAT) < 0)
+        return -1;
+    in->format = pcm_format(b);
+    if (in->format < 0)
+        goto fail;
+    if (in->format == 0) {
+        if (channels != 1 || channel != 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "channels and channel only apply to PCM input");
+            goto fail;
+        }
+        in->data = b->buf;
+        in->itemsize = sizeof(kiss_fft_cpx);
+        in->stride = 1;
+        in->scale = 1.0f;
+        in->samples = (size_t) b->len / sizeof(kiss_fft_cpx);
+        return 0;
+    }
+
+    if (channels < 1 || channel < 0 || channel >= channels) {
+        PyErr_Format(PyExc_ValueError,
+                     "channel out of range: %zd (have %zd channels)",
+                     channel, channels);
+        goto fail;
+    }
+    in->data = (const char *)b->buf + channel * b->itemsize;
+    in->itemsize = (size_t) b->itemsize;
+    in->stride = (size_t) channels;
+    in->scale = (float) scale;
+    in->samples = (size_t) (b->len / b->itemsize) / (size_t) channels;
+    return 0;
+
+ fail:
+    PyBuffer_Release(b);
+    return -1;
+}
+
+// Get the buffers for the four transform functions.  Like
+// maybe_interruptible_get_buffers, but also accepts PCM input (see
+// get_input_samples), in which case *FORMAT is set to its format and
+// the output must have one element per frame of PARSED->channels
+// samples.
+static Py_ssize_t
+get_transform_buffers(const struct interruptible_args *parsed,
+                      Py_buffer *tb, Py_buffer *fb, int *format)
+{
+    struct input_samples in;
+    if (get_input_samples(parsed->td, tb, parsed->channels,
+                          parsed->channel, parsed->scale, &in) < 0)
+        return (Py_ssize_t) -1;
+    *format = in.format;
+    if (*format == 0) {
+        PyBuffer_Release(tb);
+        return maybe_interruptible_get_buffers(parsed->td, tb,
+                                               parsed->fd, fb);
+    }
+    if (parsed->scrambled) {
+        PyErr_SetString(PyExc_ValueError,
+                        "scrambled only applies to complex input");
+        goto fail;
+    }
+    if (PyObject_GetBuffer(parsed->fd, fb, PyBUF_SIMPLE) < 0)
+        goto fail;
+
+    size_t frames = in.samples;
+    size_t samples = (size_t) fb->len / sizeof(kiss_fft_cpx);
+    if (frames != samples) {
+        PyErr_Format(PyExc_ValueError,
+                     "output must have one element per input frame:"
+                     " have %zu need %zu", samples, frames);
+        PyBuffer_Release(fb);
+        goto fail;
+    }
+    if (samples == 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "not enough samples: have 0 need 1");
+        PyBuffer_Release(fb);
+        goto fail;
+    }
+    return (Py_ssize_t) samples;
+
+ fail:
+    PyBuffer_Release(tb);
+    return (Py_ssize_t) -1;
+}
+
+// If requested, tune the plan before running the transform.
+// FORMAT is 0 for complex input, or a KISS_FFT_PCM_ format, in which
+// case FIN points at the first sample of the channel to transform.
+// The scrambled transforms don't use the plan's decisions, so there's
+// nothing to tune for them.
+static int
+measure_and_fft(kiss_fft_state *st,
+                const void *fin,
+                int format,
+                size_t channels,
+                float scale,
+                bool scrambled,
+                bool inverse,
+                kiss_fft_cpx *fout,
+                nanosec planning_limit,
+                kiss_fft_periodic_cb *should_stop)
+{
+    if (scrambled)
+        return inverse
+            ? kiss_ifft_scrambled(st, fin, fout, should_stop)
+            : kiss_fft_scrambled(st, fin, fout, should_stop);
+    if (planning_limit) {
+        int rv = kiss_fft_measure(st, planning_limit, should_stop);
+        if (rv) return rv;
+    }
+    if (format)
+        return kiss_fft_pcm(st, fin, format, channels, scale, fout,
+                            should_stop);
+    return kiss_fft(st, fin, fout, should_stop);
+}
 
 static PyObject *
-maybe_interruptible(PyObject *mod, PyObject *td, PyObject *fd,
+maybe_interruptible(PyObject *mod, const struct interruptible_args *parsed,
                     periodic_signal_check *should_stop)
 {
     PyObject *res = 0;
     int interrupted = 0;
 
     Py_buffer tb, fb;
-    Py_ssize_t samples = maybe_interruptible_get_buffers(td, &tb, fd, &fb);
+    int format;
+    Py_ssize_t samples = get_transform_buffers(parsed, &tb, &fb, &format);
     if (samples == (Py_ssize_t) -1) {
         return 0;
     }
 
-    // benchmark.py blocks SIGINT around latency tests, expecting us
-    // to unblock it again, so that it can only be delivered during
-    // execution of this function; without this we can get stray
-    // KeyboardInterrupts
-    sigset_t sigint, prev;
-    sigemptyset(&sigint);
-    sigaddset(&sigint, SIGINT);
-    sigprocmask(SIG_UNBLOCK, &sigint, &prev);
-
-    // start timing at this point because kiss_fft_alloc itself may take
-    // significant time
-    nanosec start_ns = monotonic_now_ns();
-    if (should_stop->ns_between_checks)
-        should_stop->ns_last_check = start_ns;
+    // start timing at this point because allocating the plan may take
+    // significant time; alloc_plan checks for interruption along the way
+    struct interruptible_call call;
+    begin_interruptible(&call, should_stop);
 
     kiss_fft_periodic_cb *ssbase = &should_stop->base;
-    kiss_fft_state *st = kiss_fft_alloc((uint32_t) samples);
-    if (st == 0) {
-        PyErr_NoMemory();
-        goto out;
-    }
-    if (st == (kiss_fft_state *)-1) {
-        PyErr_SetString(PyExc_ValueError,
-                        "invalid number of samples for KISS FFT"
-                        " (not a power of two?)");
+    kiss_fft_state *st =
+        alloc_plan(mod, (size_t) samples, should_stop, &call);
+    if (!st)
         goto out;
-    }
 
-    // kiss_fft_alloc itself may take significant time
-    if (ssbase->check(ssbase)) {
-        interrupted = 1;
-    } else if (should_stop->release_gil) {
+    // measuring stops early, keeping the best plan found so far, once
+    // the planning limit is used up; zero means don't measure at all
+    nanosec planning_limit = 0;
+    if (parsed->measure)
+        planning_limit = sec_to_nsec(parsed->s_planning_limit);
+
+    const char *fin = (const char *)tb.buf
+        + (format ? parsed->channel * tb.itemsize : 0);
+    const size_t channels = (size_t) parsed->channels;
+    const float scale = (float) parsed->scale;
+
+    if (should_stop->release_gil) {
         Py_BEGIN_ALLOW_THREADS
         interrupted =
-            kiss_fft(st, (kiss_fft_cpx *)tb.buf, (kiss_fft_cpx *)fb.buf,
-                     ssbase);
+            measure_and_fft(st, fin, format, channels, scale,
+                            parsed->scrambled, parsed->inverse,
+                            (kiss_fft_cpx *)fb.buf, planning_limit, ssbase);
         Py_END_ALLOW_THREADS
     } else {
         interrupted =
-            kiss_fft(st, (kiss_fft_cpx *)tb.buf, (kiss_fft_cpx *)fb.buf,
-                     ssbase);
+            measure_and_fft(st, fin, format, channels, scale,
+                            parsed->scrambled, parsed->inverse,
+                            (kiss_fft_cpx *)fb.buf, planning_limit, ssbase);
     }
-    nanosec stop_ns = monotonic_now_ns();
-
     free(st);
+    res = end_interruptible(mod, &call, should_stop, interrupted);
 
-    // Unconditionally check for signals at this point so that,
-    // if there's a pending signal, we throw our special Interrupted
-    // exception instead of letting the interpreter throw a regular
-    // KeyboardInterrupt.
-    if (!interrupted && PyErr_CheckSignals())
-        interrupted = 1;
-
-    sigprocmask(SIG_SETMASK, &prev, NULL);
-
-    res = Py_BuildValue("dL",
-                        nsec_to_sec(stop_ns - start_ns),
-                        should_stop ? should_stop->check_count : 0);
-    if (interrupted)
-        res = raise_Interrupted(mod, res);
  out:
     PyBuffer_Release(&fb);
     PyBuffer_Release(&tb);
     return res;
 }
 
-// Parsed arguments for all the functions callable from Python.
-struct interruptible_args
-{
-    PyObject *td;
-    PyObject *fd;
-    double s_between_checks;
-    bool release_gil;
-};
-
 static int
 parse_interruptible_args(struct interruptible_args *parsed,
                          PyObject *args, PyObject *kwargs)
 {
     static const char *const keywords[] = {
-        "input", "output", "interval", "release_gil", NULL
+        "input", "output", "interval", "release_gil",
+        "planner", "planning_limit", "channels", "channel", "scale",
+        "scrambled", "inverse", NULL
     };
 
     parsed->td = NULL;
     parsed->fd = NULL;
     parsed->s_between_checks = 0.005;  // 5 ms
+    parsed->s_planning_limit = 1.0;    // 1 s
     parsed->release_gil = true;
+    parsed->measure = false;
+    parsed->channels = 1;
+    parsed->channel = 0;
+    parsed->scale = 1.0;
     int release_gil = 1;  // 'p' format expects an int
+    int scrambled = 0, inverse = 0;
+    const char *planner = "estimate";
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|dp", (char **)keywords,
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|dpsdnndpp",
+                                     (char **)keywords,
                                      &parsed->td,
                                      &parsed->fd,
                                      &parsed->s_between_checks,
-                                     &release_gil))
+                                     &release_gil,
+                                     &planner,
+                                     &parsed->s_planning_limit,
+                                     &parsed->channels,
+                                     &parsed->channel,
+                                     &parsed->scale,
+                                     &scrambled,
+                                     &inverse))
         return 0;
 
     parsed->release_gil = release_gil; // convert to bool
+    parsed->scrambled = scrambled;
+    parsed->inverse = inverse;
+    if (inverse && !scrambled) {
+        PyErr_SetString(PyExc_ValueError,
+                        "inverse transforms are only available"
+                        " with scrambled=True");
+        return 0;
+    }
+    if (!strcmp(planner, "measure")) {
+        parsed->measure = true;
+    } else if (strcmp(planner, "estimate")) {
+        PyErr_Format(PyExc_ValueError,
+                     "planner must be 'estimate' or 'measure', not '%s'",
+                     planner);
+        return 0;
+    }
     return 1;
 }
 
@@ -355,9 +653,10 @@ uninterruptible(PyObject *self, PyObject *args, PyObject *kwargs)
     should_stop.check_count = 0;
     should_stop.ns_last_check = 0;
     should_stop.ns_between_checks = 0;
+    should_stop.base.interval_ns = 0;
     should_stop.release_gil = parsed.release_gil;
 
-    return maybe_interruptible(self, parsed.td, parsed.fd, &should_stop);
+    return maybe_interruptible(self, &parsed, &should_stop);
 }
 
 static PyObject *
@@ -372,9 +671,10 @@ simple_interruptible(PyObject *self, PyObject *args, PyObject *kwargs)
     should_stop.check_count = 0;
     should_stop.ns_last_check = 0;
     should_stop.ns_between_checks = 0;
+    should_stop.base.interval_ns = 0;
     should_stop.release_gil = parsed.release_gil;
 
-    return maybe_interruptible(self, parsed.td, parsed.fd, &should_stop);
+    return maybe_interruptible(self, &parsed, &should_stop);
 }
 
 static PyObject *
@@ -389,9 +689,10 @@ timed_interruptible(PyObject *self, PyObject *args, PyObject *kwargs)
     should_stop.check_count = 0;
     should_stop.ns_last_check = 0;
     should_stop.ns_between_checks = sec_to_nsec(parsed.s_between_checks);
+    should_stop.base.interval_ns = should_stop.ns_between_checks;
     should_stop.release_gil = parsed.release_gil;
 
-    return maybe_interruptible(self, parsed.td, parsed.fd, &should_stop);
+    return maybe_interruptible(self, &parsed, &should_stop);
 }
 
 #ifdef CLOCK_MONOTONIC_COARSE
@@ -407,101 +708,2701 @@ timed_coarse_interruptible(PyObject *self, PyObject *args, PyObject *kwargs)
     should_stop.check_count = 0;
     should_stop.ns_last_check = 0;
     should_stop.ns_between_checks = sec_to_nsec(parsed.s_between_checks);
+    should_stop.base.interval_ns = should_stop.ns_between_checks;
     should_stop.release_gil = parsed.release_gil;
 
-    return maybe_interruptible(self, parsed.td, parsed.fd, &should_stop);
+    return maybe_interruptible(self, &parsed, &should_stop);
 }
 #endif
 
+// Batched transforms.
 
-static PyMethodDef interruptible_methods[] = {
-    { "fft_uninterruptible",
-      (PyCFunction)uninterruptible,
-      METH_VARARGS | METH_KEYWORDS,
-      "fft_uninterruptible(input, output, interval=0.005, release_gil=True)\n"
-      "    -> (elapsed, checks)"
-      "\n\n"
-      "Performs a Fourier transform, without taking special care to be\n"
-      " interruptible by control-C."
-      "\n\n"
-      "`input` and `output` are the input and output arrays; both must\n"
-      "be interpretable as 'simple buffers' of single-precision complex\n"
-      "numbers, both must have the same number of elements, and that number\n"
-      " must be a power of two.  (NumPy arrays can meet these requirements.)"
-      "\n\n"
-      "`interval` is the desired interval between checks for control-C,\n"
-      "defaulting to 0.005 s (5 ms).  (This function ignores this argument.)"
-      "\n\n"
-      "If `release_gil` is true, the GIL will be released during the\n"
-      "computation of the Fourier transform."
-      "\n\n"
-      "On success, returns a 2-tuple (elapsed, checks); elapsed is\n"
-      "the elapsed time for the calculation, as a floating-point number\n"
-      "of seconds, and checks is the number of times that a manual check\n"
-      "for control-C was performed (always zero for this function)."
-    },
-    { "fft_simple_interruptible",
-      (PyCFunction)simple_interruptible,
-      METH_VARARGS | METH_KEYWORDS,
-      "fft_simple_interruptible(input, output, interval=0.005, release_gil=True)\n"
-      "    -> (elapsed, checks)"
-      "\n\n"
-      "Performs a Fourier transform, checking for control-C at convenient\n"
-      "points within the transform algorithm.  Arguments and return value\n"
-      "are the same as for `fft_uninterruptible`, except that the `checks`\n"
-      "element of the return value won't always be zero."
-    },
-    { "fft_timed_interruptible",
-      (PyCFunction)timed_interruptible,
-      METH_VARARGS | METH_KEYWORDS,
-      "fft_timed_interruptible(input, output, interval=0.005, release_gil=True)\n"
-      "    -> (elapsed, checks)"
-      "\n\n"
-      "Performs a Fourier transform, checking for control-C at convenient\n"
-      "points within the transform algorithm, but only if at least\n"
-      "the interval specified by the third argument has elapsed since\n"
-      "the previous check.  Other arguments are the same as for\n"
-      "`fft_uninterruptible`, as is the return value, except that the\n"
-      "`checks` element won't always be zero."
-    },
-#ifdef CLOCK_MONOTONIC_COARSE
-    { "fft_timed_coarse_interruptible",
-      (PyCFunction)timed_coarse_interruptible,
-      METH_VARARGS | METH_KEYWORDS,
-      "fft_timed_coarse_interruptible(input, output, interval=0.005, release_gil=True)\n"
-      "    -> (elapsed, checks)"
-      "\n\n"
-      "Same as fft_timed_interruptible but uses a clock with coarser"
-      " resolution. It may therefore have lower overhead."
-    },
-#endif
-    { 0, 0, 0, 0 },
-};
-
-static struct PyModuleDef interruptible_module = {
-    .m_base = PyModuleDef_HEAD_INIT,
-    .m_name = "interruptible",
-    .m_doc = interruptible_doc,
-    .m_size = sizeof(PyObject *), // our KeyboardInterrupt subclass
-    .m_methods = interruptible_methods,
-};
+// Run all the transforms one at a time, for comparison with
+// kiss_fft_batch.
+static int
+batch_loop(kiss_fft_state *st, const struct input_samples *in,
+           kiss_fft_cpx *fout, size_t size, size_t batch,
+           kiss_fft_periodic_cb *should_stop)
+{
+    for (size_t b = 0; b < batch; b++) {
+        const char *x = (const char *)in->data
+            + b * size * in->stride * in->itemsize;
+        int rv = in->format
+            ? kiss_fft_pcm(st, x, in->format, in->stride, in->scale,
+                           fout + b * size, should_stop)
+            : kiss_fft(st, (const kiss_fft_cpx *)x, fout + b * size,
+                       should_stop);
+        if (rv) return rv;
+    }
+    return 0;
+}
 
-// called via dlsym; pacify -Wmissing-prototypes
-extern PyMODINIT_FUNC PyInit_interruptible(void);
+static int
+batch_simd(kiss_fft_state *st, const struct input_samples *in,
+           kiss_fft_cpx *fout, size_t batch,
+           kiss_fft_periodic_cb *should_stop)
+{
+    if (in->format)
+        return kiss_fft_batch_pcm(st, in->data, in->format, in->stride,
+                                  in->scale, fout, batch, should_stop);
+    return kiss_fft_batch(st, in->data, fout, batch, should_stop);
+}
 
-PyMODINIT_FUNC
-PyInit_interruptible(void)
+static PyObject *
+fft_batch(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-    PyObject *mod = PyModule_Create(&interruptible_module);
-    if (!mod)
-        return NULL;
+    static const char *const keywords[] = {
+        "input", "output", "size", "interval", "release_gil", "simd",
+        "channels", "channel", "scale", NULL
+    };
+    PyObject *td, *fd;
+    Py_ssize_t size;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+    int simd = 1;
+    Py_ssize_t channels = 1, channel = 0;
+    double scale = 1.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOn|dppnnd",
+                                     (char **)keywords,
+                                     &td, &fd, &size, &s_between_checks,
+                                     &release_gil, &simd, &channels,
+                                     &channel, &scale))
+        return 0;
 
-    if (define_Interrupted(mod) < 0) {
+    if (size <= 0 || (uint64_t)size > KISS_FFT_MAX_SAMPLES) {
+        PyErr_Format(PyExc_ValueError, "invalid transform size: %zd", size);
+        return 0;
+    }
+
+    Py_buffer tb, fb;
+    struct input_samples in;
+    if (get_input_samples(td, &tb, channels, channel, scale, &in) < 0)
+        return 0;
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+
+    PyObject *res = 0;
+    size_t samples = in.samples;
+    if ((size_t) fb.len / sizeof(kiss_fft_cpx) != samples) {
+        if (in.format)
+            PyErr_Format(PyExc_ValueError,
+                         "output must have one element per input frame:"
+                         " have %zu need %zu",
+                         (size_t) fb.len / sizeof(kiss_fft_cpx), samples);
+        else
+            PyErr_SetString(PyExc_ValueError,
+                            "input and output must be same size");
+        goto out;
+    }
+    if (samples == 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "not enough samples: have 0 need 1");
+        goto out;
+    }
+    if (samples % (size_t) size) {
+        PyErr_Format(PyExc_ValueError,
+                     "number of samples (%zu) is not a multiple of"
+                     " the transform size (%zd)", samples, size);
+        goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    kiss_fft_state *st = alloc_plan(self, (size_t) size, &should_stop, &call);
+    if (!st)
+        goto out;
+
+    kiss_fft_cpx *fout = (kiss_fft_cpx *)fb.buf;
+    size_t batch = samples / (size_t) size;
+    int interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = simd
+            ? batch_simd(st, &in, fout, batch, ssbase)
+            : batch_loop(st, &in, fout, (size_t)size, batch, ssbase);
+        Py_END_ALLOW_THREADS
+    } else {
+        interrupted = simd
+            ? batch_simd(st, &in, fout, batch, ssbase)
+            : batch_loop(st, &in, fout, (size_t)size, batch, ssbase);
+    }
+
+    free(st);
+    res = end_interruptible(self, &call, &should_stop, interrupted);
+
+ out:
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&tb);
+    return res;
+}
+
+// Pruned transforms.
+
+// Convert BINS_OBJ, a sequence of bin numbers, each less than SAMPLES,
+// to an array allocated with PyMem_Malloc; store its length in
+// *NBINS.  Returns NULL with an exception set on failure.
+static size_t *
+parse_bins(PyObject *bins_obj, size_t samples, size_t *nbins)
+{
+    PyObject *seq = PySequence_Fast(bins_obj, "bins must be a sequence");
+    if (!seq)
+        return 0;
+
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    size_t *bins = PyMem_Malloc(((size_t) n + 1) * sizeof(size_t));
+    if (!bins) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+    for (Py_ssize_t i = 0; i < n; i++) {
+        // accept anything usable as a list index, e.g. numpy integers
+        PyObject *bin = PyNumber_Index(PySequence_Fast_GET_ITEM(seq, i));
+        if (!bin)
+            goto fail;
+        bins[i] = PyLong_AsSize_t(bin);
+        Py_DECREF(bin);
+        if (bins[i] == (size_t) -1 && PyErr_Occurred())
+            goto fail;
+        if (bins[i] >= samples) {
+            PyErr_Format(PyExc_ValueError,
+                         "bin out of range: %zu (have %zu samples)",
+                         bins[i], samples);
+            goto fail;
+        }
+    }
+    Py_DECREF(seq);
+    *nbins = (size_t) n;
+    return bins;
+
+ fail:
+    PyMem_Free(bins);
+    Py_DECREF(seq);
+    return 0;
+}
+
+static int
+bins_of(kiss_fft_state *st, const struct input_samples *in,
+        const size_t *bins, size_t nbins, kiss_fft_cpx *fout,
+        kiss_fft_periodic_cb *should_stop)
+{
+    if (in->format)
+        return kiss_fft_bins_pcm(st, in->data, in->format, in->stride,
+                                 in->scale, bins, nbins, fout, should_stop);
+    return kiss_fft_bins(st, in->data, bins, nbins, fout, should_stop);
+}
+
+static PyObject *
+fft_bins(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "input", "output", "bins", "interval", "release_gil",
+        "channels", "channel", "scale", NULL
+    };
+    PyObject *td, *fd, *bins_obj;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+    Py_ssize_t channels = 1, channel = 0;
+    double scale = 1.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|dpnnd",
+                                     (char **)keywords,
+                                     &td, &fd, &bins_obj,
+                                     &s_between_checks, &release_gil,
+                                     &channels, &channel, &scale))
+        return 0;
+
+    Py_buffer tb, fb;
+    struct input_samples in;
+    if (get_input_samples(td, &tb, channels, channel, scale, &in) < 0)
+        return 0;
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+
+    PyObject *res = 0;
+    size_t samples = in.samples;
+    size_t nbins;
+    size_t *bins = parse_bins(bins_obj, samples, &nbins);
+    if (!bins)
+        goto out;
+
+    if ((size_t) fb.len / sizeof(kiss_fft_cpx) != nbins) {
+        PyErr_Format(PyExc_ValueError,
+                     "output must have one element per bin:"
+                     " have %zd need %zu",
+                     fb.len / (Py_ssize_t) sizeof(kiss_fft_cpx), nbins);
+        goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    kiss_fft_state *st = alloc_plan(self, samples, &should_stop, &call);
+    if (!st)
+        goto out;
+
+    kiss_fft_cpx *fout = (kiss_fft_cpx *)fb.buf;
+    int interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = bins_of(st, &in, bins, nbins, fout, ssbase);
+        Py_END_ALLOW_THREADS
+    } else {
+        interrupted = bins_of(st, &in, bins, nbins, fout, ssbase);
+    }
+
+    free(st);
+    res = end_interruptible(self, &call, &should_stop, interrupted);
+
+ out:
+    PyMem_Free(bins);
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&tb);
+    return res;
+}
+
+// Fused window, transform, and power spectrum.
+
+static int
+spectrum_of(kiss_fft_state *st, const struct input_samples *in,
+            const float *window, float *fout, int mode,
+            kiss_fft_cpx *scratch, kiss_fft_periodic_cb *should_stop)
+{
+    if (in->format)
+        return kiss_fft_spectrum_pcm(st, in->data, in->format, in->stride,
+                                     in->scale, window, fout, mode,
+                                     scratch, should_stop);
+    return kiss_fft_spectrum(st, in->data, window, fout, mode, scratch,
+                             should_stop);
+}
+
+static PyObject *
+fft_power(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "input", "output", "window", "interval", "release_gil", "phase",
+        "channels", "channel", "scale", NULL
+    };
+    PyObject *td, *fd, *wd = Py_None;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+    int phase = 0;
+    Py_ssize_t channels = 1, channel = 0;
+    double scale = 1.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|Odppnnd",
+                                     (char **)keywords,
+                                     &td, &fd, &wd, &s_between_checks,
+                                     &release_gil, &phase, &channels,
+                                     &channel, &scale))
+        return 0;
+
+    Py_buffer tb, fb, wb = { 0 };
+    struct input_samples in;
+    if (get_input_samples(td, &tb, channels, channel, scale, &in) < 0)
+        return 0;
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+    if (wd != Py_None && PyObject_GetBuffer(wd, &wb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&fb);
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+
+    PyObject *res = 0;
+    kiss_fft_cpx *scratch = 0;
+    size_t samples = in.samples;
+    size_t nout = (size_t) fb.len / sizeof(float);
+    size_t need = phase ? 2 * samples : samples;
+    if (nout != need) {
+        PyErr_Format(PyExc_ValueError,
+                     "output must have %s per sample:"
+                     " have %zu need %zu",
+                     phase ? "two floats" : "one float", nout, need);
+        goto out;
+    }
+    if (wd != Py_None && (size_t) wb.len / sizeof(float) != samples) {
+        PyErr_Format(PyExc_ValueError,
+                     "window must have one float per sample:"
+                     " have %zu need %zu",
+                     (size_t) wb.len / sizeof(float), samples);
+        goto out;
+    }
+
+    scratch = PyMem_Malloc(samples * sizeof(kiss_fft_cpx));
+    if (!scratch) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    kiss_fft_state *st = alloc_plan(self, samples, &should_stop, &call);
+    if (!st)
+        goto out;
+
+    const float *window = wd != Py_None ? (const float *)wb.buf : NULL;
+    float *fout = (float *)fb.buf;
+    int mode = phase ? KISS_FFT_MAGNITUDE_PHASE : KISS_FFT_POWER;
+    int interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = spectrum_of(st, &in, window, fout, mode, scratch,
+                                  ssbase);
+        Py_END_ALLOW_THREADS
+    } else {
+        interrupted = spectrum_of(st, &in, window, fout, mode, scratch,
+                                  ssbase);
+    }
+
+    free(st);
+    res = end_interruptible(self, &call, &should_stop, interrupted);
+
+ out:
+    PyMem_Free(scratch);
+    if (wd != Py_None)
+        PyBuffer_Release(&wb);
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&tb);
+    return res;
+}
+
+// Sparse FFT.
+
+static PyObject *
+fft_sparse(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "input", "output", "k", "tolerance", "interval", "release_gil",
+        NULL
+    };
+    PyObject *td, *fd;
+    Py_ssize_t k;
+    double tolerance = 1e-6;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOn|ddp",
+                                     (char **)keywords,
+                                     &td, &fd, &k, &tolerance,
+                                     &s_between_checks, &release_gil))
+        return 0;
+    if (k <= 0) {
+        PyErr_SetString(PyExc_ValueError, "k must be positive");
+        return 0;
+    }
+    if (!(tolerance >= 0 && tolerance < 1)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "tolerance must be at least 0 and less than 1");
+        return 0;
+    }
+
+    Py_buffer tb, fb;
+    if (PyObject_GetBuffer(td, &tb, PyBUF_SIMPLE) < 0)
+        return 0;
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+
+    PyObject *res = 0;
+    size_t samples = (size_t) tb.len / sizeof(kiss_fft_cpx);
+    if ((size_t) fb.len / sizeof(kiss_fft_cpx) != samples) {
+        PyErr_Format(PyExc_ValueError,
+                     "output must have one element per sample:"
+                     " have %zd need %zu",
+                     fb.len / (Py_ssize_t) sizeof(kiss_fft_cpx), samples);
+        goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    int stopped;
+    kiss_sfft_state *sf = kiss_sfft_alloc(samples, (size_t) k, tolerance,
+                                          ssbase, &stopped);
+    if (stopped) {
+        res = end_interruptible(self, &call, &should_stop, stopped);
+        goto out;
+    }
+    if (sf == 0 || sf == (kiss_sfft_state *)-1) {
+        if (sf == 0)
+            PyErr_NoMemory();
+        else
+            raise_alloc_error((kiss_fft_state *)-1);
+        sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+        goto out;
+    }
+
+    // The plan for a full transform is only made if it's needed.
+    const kiss_fft_cpx *fin = (const kiss_fft_cpx *)tb.buf;
+    kiss_fft_cpx *fout = (kiss_fft_cpx *)fb.buf;
+    size_t nfound = 0;
+    int interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = kiss_sfft(sf, 0, fin, fout, &nfound, ssbase);
+        Py_END_ALLOW_THREADS
+    } else {
+        interrupted = kiss_sfft(sf, 0, fin, fout, &nfound, ssbase);
+    }
+    kiss_sfft_free(sf);
+
+    if (!interrupted && nfound == SIZE_MAX) {
+        kiss_fft_state *st = alloc_plan(self, samples, &should_stop, &call);
+        if (!st)
+            goto out;
+        nfound = samples;
+        if (release_gil) {
+            Py_BEGIN_ALLOW_THREADS
+            interrupted = kiss_fft(st, fin, fout, ssbase);
+            Py_END_ALLOW_THREADS
+        } else {
+            interrupted = kiss_fft(st, fin, fout, ssbase);
+        }
+        free(st);
+    }
+
+    res = end_interruptible(self, &call, &should_stop, interrupted);
+    if (res) {
+        PyObject *r = Py_BuildValue("(OOn)", PyTuple_GET_ITEM(res, 0),
+                                    PyTuple_GET_ITEM(res, 1),
+                                    (Py_ssize_t) nfound);
+        Py_DECREF(res);
+        res = r;
+    }
+
+ out:
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&tb);
+    return res;
+}
+
+// Number-theoretic transform.
+
+static PyObject *
+ntt(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "input", "output", "inverse", "interval", "release_gil", NULL
+    };
+    PyObject *td, *fd;
+    int inverse = 0;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|pdp",
+                                     (char **)keywords,
+                                     &td, &fd, &inverse,
+                                     &s_between_checks, &release_gil))
+        return 0;
+
+    Py_buffer tb, fb;
+    if (PyObject_GetBuffer(td, &tb, PyBUF_SIMPLE) < 0)
+        return 0;
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+
+    PyObject *res = 0;
+    size_t samples = (size_t) tb.len / sizeof(uint64_t);
+    const uint64_t *fin = (const uint64_t *)tb.buf;
+    uint64_t *fout = (uint64_t *)fb.buf;
+    if ((size_t) fb.len / sizeof(uint64_t) != samples) {
+        PyErr_Format(PyExc_ValueError,
+                     "output must have one element per sample:"
+                     " have %zu need %zu",
+                     (size_t) fb.len / sizeof(uint64_t), samples);
+        goto out;
+    }
+    if ((const char *)fin < (const char *)fout + fb.len
+        && (const char *)fout < (const char *)fin + tb.len) {
+        PyErr_SetString(PyExc_ValueError,
+                        "input and output must not overlap");
+        goto out;
+    }
+    for (size_t i = 0; i < samples; i++) {
+        if (fin[i] >= KISS_NTT_MODULUS) {
+            PyErr_Format(PyExc_ValueError,
+                         "input[%zu] is not less than NTT_MODULUS", i);
+            goto out;
+        }
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    int stopped = 0;
+    kiss_ntt_state *st = kiss_ntt_alloc(samples, ssbase, &stopped);
+    if (stopped) {
+        res = end_interruptible(self, &call, &should_stop, stopped);
+        goto out;
+    }
+    if (st == 0 || st == (kiss_ntt_state *)-1) {
+        raise_alloc_error(st ? (kiss_fft_state *)-1 : 0);
+        sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+        goto out;
+    }
+
+    int interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = inverse ? kiss_intt(st, fin, fout, ssbase)
+                              : kiss_ntt(st, fin, fout, ssbase);
+        Py_END_ALLOW_THREADS
+    } else {
+        interrupted = inverse ? kiss_intt(st, fin, fout, ssbase)
+                              : kiss_ntt(st, fin, fout, ssbase);
+    }
+
+    free(st);
+    res = end_interruptible(self, &call, &should_stop, interrupted);
+
+ out:
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&tb);
+    return res;
+}
+
+static PyObject *
+ntt_convolve(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "a", "b", "output", "interval", "release_gil", NULL
+    };
+    PyObject *ad, *bd, *fd;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|dp",
+                                     (char **)keywords,
+                                     &ad, &bd, &fd,
+                                     &s_between_checks, &release_gil))
+        return 0;
+
+    Py_buffer ab, bb, fb;
+    if (PyObject_GetBuffer(ad, &ab, PyBUF_SIMPLE) < 0)
+        return 0;
+    if (PyObject_GetBuffer(bd, &bb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&ab);
+        return 0;
+    }
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&bb);
+        PyBuffer_Release(&ab);
+        return 0;
+    }
+
+    PyObject *res = 0;
+    uint64_t *scratch = 0;
+    size_t na = (size_t) ab.len / sizeof(int64_t);
+    size_t nb = (size_t) bb.len / sizeof(int64_t);
+    size_t nout = (size_t) fb.len / sizeof(int64_t);
+    if (na == 0 || nb == 0) {
+        PyErr_SetString(PyExc_ValueError, "a and b must not be empty");
+        goto out;
+    }
+    if (nout != na + nb - 1) {
+        PyErr_Format(PyExc_ValueError,
+                     "output must have len(a) + len(b) - 1 elements:"
+                     " have %zu need %zu", nout, na + nb - 1);
+        goto out;
+    }
+    // Check this before allocating scratch space for it.
+    if (nout > KISS_FFT_MAX_SAMPLES) {
+        PyErr_Format(PyExc_ValueError,
+                     "invalid number of samples: output has %zu elements,"
+                     " more than MAX_SAMPLES", nout);
+        goto out;
+    }
+    size_t samples = 1;
+    while (samples < nout)
+        samples *= 2;
+
+    scratch = PyMem_Malloc(2 * samples * sizeof(uint64_t));
+    if (!scratch) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    int stopped;
+    kiss_ntt_state *st = kiss_ntt_alloc(samples, ssbase, &stopped);
+    if (stopped) {
+        res = end_interruptible(self, &call, &should_stop, stopped);
+        goto out;
+    }
+    if (st == 0 || st == (kiss_ntt_state *)-1) {
+        raise_alloc_error(st ? (kiss_fft_state *)-1 : 0);
+        sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+        goto out;
+    }
+
+    const int64_t *a = (const int64_t *)ab.buf;
+    const int64_t *b = (const int64_t *)bb.buf;
+    int64_t *fout = (int64_t *)fb.buf;
+    int interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = kiss_ntt_convolve(st, a, na, b, nb, fout, scratch,
+                                        ssbase);
+        Py_END_ALLOW_THREADS
+    } else {
+        interrupted = kiss_ntt_convolve(st, a, na, b, nb, fout, scratch,
+                                        ssbase);
+    }
+
+    free(st);
+    res = end_interruptible(self, &call, &should_stop, interrupted);
+
+ out:
+    PyMem_Free(scratch);
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&bb);
+    PyBuffer_Release(&ab);
+    return res;
+}
+
+// Discrete cosine transforms.
+
+// Check the arguments of a DCT: TB and FB must be buffers of SAMPLES
+// floats each, and TYPE 2 or 3.  Returns 0, or -1 with an exception
+// set.
+static int
+check_dct_args(const Py_buffer *tb, const Py_buffer *fb, size_t samples,
+               int type)
+{
+    if (type != 2 && type != 3) {
+        PyErr_Format(PyExc_ValueError, "type must be 2 or 3, not %d", type);
+        return -1;
+    }
+    if ((size_t) tb->len / sizeof(float) != samples) {
+        PyErr_Format(PyExc_ValueError,
+                     "wrong number of input samples: have %zu need %zu",
+                     (size_t) tb->len / sizeof(float), samples);
+        return -1;
+    }
+    if ((size_t) fb->len / sizeof(float) != samples) {
+        PyErr_Format(PyExc_ValueError,
+                     "output must have one element per sample:"
+                     " have %zu need %zu",
+                     (size_t) fb->len / sizeof(float), samples);
+        return -1;
+    }
+    if ((const char *)tb->buf < (const char *)fb->buf + fb->len
+        && (const char *)fb->buf < (const char *)tb->buf + tb->len) {
+        PyErr_SetString(PyExc_ValueError,
+                        "input and output must not overlap");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+dct(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "input", "output", "type", "interval", "release_gil", NULL
+    };
+    PyObject *td, *fd;
+    int type = 2;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|idp",
+                                     (char **)keywords, &td, &fd, &type,
+                                     &s_between_checks, &release_gil))
+        return 0;
+
+    Py_buffer tb, fb;
+    if (PyObject_GetBuffer(td, &tb, PyBUF_SIMPLE) < 0)
+        return 0;
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+
+    PyObject *res = 0;
+    size_t samples = (size_t) tb.len / sizeof(float);
+    const float *fin = (const float *)tb.buf;
+    float *fout = (float *)fb.buf;
+    if (check_dct_args(&tb, &fb, samples, type) < 0)
+        goto out;
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    int stopped = 0;
+    kiss_dct_state *d = kiss_dct_alloc(samples, ssbase, &stopped);
+    if (stopped) {
+        res = end_interruptible(self, &call, &should_stop, stopped);
+        goto out;
+    }
+    if (d == 0 || d == (kiss_dct_state *)-1) {
+        raise_alloc_error(d ? (kiss_fft_state *)-1 : 0);
+        sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+        goto out;
+    }
+
+    int interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = type == 2 ? kiss_dct2(d, fin, fout, ssbase)
+                                : kiss_dct3(d, fin, fout, ssbase);
+        Py_END_ALLOW_THREADS
+    } else {
+        interrupted = type == 2 ? kiss_dct2(d, fin, fout, ssbase)
+                                : kiss_dct3(d, fin, fout, ssbase);
+    }
+
+    kiss_dct_free(d);
+    res = end_interruptible(self, &call, &should_stop, interrupted);
+
+ out:
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&tb);
+    return res;
+}
+
+// Welch power spectral density.
+
+static int
+welch_of(kiss_welch_state *w, const struct input_samples *in, float *psd,
+         kiss_fft_periodic_cb *should_stop)
+{
+    if (in->format)
+        return kiss_welch_pcm(w, in->data, in->format, in->stride,
+                              in->scale, in->samples, psd, should_stop);
+    return kiss_welch(w, in->data, in->samples, psd, should_stop);
+}
+
+static PyObject *
+fft_welch(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "input", "output", "window", "step", "threads", "interval",
+        "release_gil", "channels", "channel", "scale", NULL
+    };
+    PyObject *td, *fd, *wd = Py_None;
+    Py_ssize_t step = 0;
+    int threads = 0;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+    Py_ssize_t channels = 1, channel = 0;
+    double scale = 1.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|Onidpnnd",
+                                     (char **)keywords,
+                                     &td, &fd, &wd, &step, &threads,
+                                     &s_between_checks, &release_gil,
+                                     &channels, &channel, &scale))
+        return 0;
+    if (step < 0 || threads < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "step and threads must not be negative");
+        return 0;
+    }
+
+    Py_buffer tb, fb, wb = { 0 };
+    struct input_samples in;
+    if (get_input_samples(td, &tb, channels, channel, scale, &in) < 0)
+        return 0;
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+    if (wd != Py_None && PyObject_GetBuffer(wd, &wb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&fb);
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+
+    PyObject *res = 0;
+    size_t len = in.samples;
+    size_t samples = (size_t) fb.len / sizeof(float);
+    if (len < samples) {
+        PyErr_Format(PyExc_ValueError,
+                     "not enough samples for one segment: have %zu need %zu",
+                     len, samples);
+        goto out;
+    }
+    if (wd != Py_None && (size_t) wb.len / sizeof(float) != samples) {
+        PyErr_Format(PyExc_ValueError,
+                     "window must be the same size as output:"
+                     " have %zu need %zu",
+                     (size_t) wb.len / sizeof(float), samples);
+        goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    int stopped;
+    kiss_welch_state *w =
+        kiss_welch_alloc(samples, step ? (size_t) step : (samples + 1) / 2,
+                         len, wd != Py_None ? wb.buf : NULL,
+                         (unsigned) threads, ssbase, &stopped);
+    if (stopped) {
+        res = end_interruptible(self, &call, &should_stop, stopped);
+        goto out;
+    }
+    if (w == 0 || w == (kiss_welch_state *)-1) {
+        if (w == 0)
+            PyErr_NoMemory();
+        else
+            PyErr_SetString(PyExc_ValueError,
+                            "invalid segment size for KISS FFT"
+                            " (not a power of two?)");
+        sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+        goto out;
+    }
+
+    float *psd = (float *)fb.buf;
+    int interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = welch_of(w, &in, psd, ssbase);
+        Py_END_ALLOW_THREADS
+    } else {
+        interrupted = welch_of(w, &in, psd, ssbase);
+    }
+
+    kiss_welch_free(w);
+    res = end_interruptible(self, &call, &should_stop, interrupted);
+
+ out:
+    if (wd != Py_None)
+        PyBuffer_Release(&wb);
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&tb);
+    return res;
+}
+
+// Sharded transforms across processes.
+
+static PyObject *
+fft_shared_layout(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = { "samples", "shards", NULL };
+    Py_ssize_t samples;
+    int shards;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ni", (char **)keywords,
+                                     &samples, &shards))
+        return 0;
+
+    size_t input_offset, output_offset;
+    size_t size = samples <= 0 || shards <= 0 ? 0
+        : kiss_fft_shared_layout((size_t) samples, (unsigned) shards,
+                                 &input_offset, &output_offset);
+    if (size == 0 || size > PY_SSIZE_T_MAX) {
+        PyErr_SetString(PyExc_ValueError,
+                        "invalid number of samples or shards"
+                        " (not a power of two?)");
+        return 0;
+    }
+    return Py_BuildValue("nnn", (Py_ssize_t) size,
+                         (Py_ssize_t) input_offset,
+                         (Py_ssize_t) output_offset);
+}
+
+// Get a writable buffer for a shared segment, checking that it's
+// aligned as kiss_fft_shared_init requires.
+static int
+get_shared_buffer(PyObject *o, Py_buffer *b)
+{
+    if (PyObject_GetBuffer(o, b, PyBUF_WRITABLE) < 0)
+        return -1;
+    if ((uintptr_t) b->buf % _Alignof(max_align_t)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "shared buffer is not suitably aligned");
+        PyBuffer_Release(b);
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+fft_shared_init(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "buffer", "samples", "shards", "interval", "release_gil", NULL
+    };
+    PyObject *bd;
+    Py_ssize_t samples;
+    int shards;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oni|dp",
+                                     (char **)keywords,
+                                     &bd, &samples, &shards,
+                                     &s_between_checks, &release_gil))
+        return 0;
+
+    Py_buffer bb;
+    if (get_shared_buffer(bd, &bb) < 0)
+        return 0;
+
+    PyObject *res = 0;
+    size_t input_offset, output_offset;
+    size_t size = samples <= 0 || shards <= 0 ? 0
+        : kiss_fft_shared_layout((size_t) samples, (unsigned) shards,
+                                 &input_offset, &output_offset);
+    if (size == 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "invalid number of samples or shards"
+                        " (not a power of two?)");
+        goto out;
+    }
+    if ((size_t) bb.len < size) {
+        PyErr_Format(PyExc_ValueError,
+                     "shared buffer too small: have %zd need %zu",
+                     bb.len, size);
+        goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    int interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = kiss_fft_shared_init(bb.buf, (size_t) samples,
+                                           (unsigned) shards, ssbase);
+        Py_END_ALLOW_THREADS
+    } else {
+        interrupted = kiss_fft_shared_init(bb.buf, (size_t) samples,
+                                           (unsigned) shards, ssbase);
+    }
+
+    res = end_interruptible(self, &call, &should_stop, interrupted);
+
+ out:
+    PyBuffer_Release(&bb);
+    return res;
+}
+
+static PyObject *
+fft_shared_run(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "buffer", "shard", "interval", "release_gil", NULL
+    };
+    PyObject *bd;
+    int shard;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oi|dp",
+                                     (char **)keywords,
+                                     &bd, &shard,
+                                     &s_between_checks, &release_gil))
+        return 0;
+
+    Py_buffer bb;
+    if (get_shared_buffer(bd, &bb) < 0)
+        return 0;
+
+    PyObject *res = 0;
+    unsigned shards = kiss_fft_shared_shards(bb.buf, (size_t) bb.len);
+    if (shards == 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "buffer does not hold a segment set up by"
+                        " fft_shared_init");
+        goto out;
+    }
+    if (shard < 0 || (unsigned) shard >= shards) {
+        PyErr_Format(PyExc_ValueError,
+                     "shard out of range: %d (have %u shards)",
+                     shard, shards);
+        goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    int interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = kiss_fft_shared_run(bb.buf, (unsigned) shard, ssbase);
+        Py_END_ALLOW_THREADS
+    } else {
+        interrupted = kiss_fft_shared_run(bb.buf, (unsigned) shard, ssbase);
+    }
+
+    // Being cancelled by another shard isn't an interruption of this
+    // process; it's reported in the return value instead.
+    const bool cancelled = interrupted == KISS_FFT_SHARED_CANCELLED;
+    res = end_interruptible(self, &call, &should_stop,
+                            cancelled ? 0 : interrupted);
+    if (res) {
+        PyObject *r = Py_BuildValue("(OOO)", PyTuple_GET_ITEM(res, 0),
+                                    PyTuple_GET_ITEM(res, 1),
+                                    cancelled ? Py_False : Py_True);
+        Py_DECREF(res);
+        res = r;
+    }
+
+ out:
+    PyBuffer_Release(&bb);
+    return res;
+}
+
+// Apply OP to the segment set up by fft_shared_init in the buffer
+// given as the only argument.
+static PyObject *
+shared_segment_op(PyObject *args, PyObject *kwargs, void (*op)(void *))
+{
+    static const char *const keywords[] = { "buffer", NULL };
+    PyObject *bd;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", (char **)keywords,
+                                     &bd))
+        return 0;
+
+    Py_buffer bb;
+    if (get_shared_buffer(bd, &bb) < 0)
+        return 0;
+
+    PyObject *res = 0;
+    if (kiss_fft_shared_shards(bb.buf, (size_t) bb.len) == 0)
+        PyErr_SetString(PyExc_ValueError,
+                        "buffer does not hold a segment set up by"
+                        " fft_shared_init");
+    else {
+        op(bb.buf);
+        res = Py_NewRef(Py_None);
+    }
+    PyBuffer_Release(&bb);
+    return res;
+}
+
+static PyObject *
+fft_shared_cancel(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return shared_segment_op(args, kwargs, kiss_fft_shared_cancel);
+}
+
+static PyObject *
+fft_shared_reset(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return shared_segment_op(args, kwargs, kiss_fft_shared_reset);
+}
+
+// Sliding DFT.
+
+// Defined at the bottom of the file.  Methods of the types below use
+// it to find the module, and with it the Interrupted exception.
+static struct PyModuleDef interruptible_module;
+
+typedef struct {
+    PyObject_HEAD
+    kiss_sdft *sdft;
+    size_t samples;
+    size_t nbins;
+    // set while a method is running with the GIL released, so that
+    // another thread can't use the object at the same time
+    bool busy;
+} SlidingDFTObject;
+
+static int
+SlidingDFT_init(PyObject *op, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "window", "bins", "resync", "interval", "release_gil", NULL
+    };
+    SlidingDFTObject *self = (SlidingDFTObject *)op;
+    PyObject *wd, *bins_obj = Py_None;
+    Py_ssize_t resync = 0;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Ondp",
+                                     (char **)keywords,
+                                     &wd, &bins_obj, &resync,
+                                     &s_between_checks, &release_gil))
+        return -1;
+    if (resync < 0) {
+        PyErr_SetString(PyExc_ValueError, "resync must not be negative");
+        return -1;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "SlidingDFT is in use");
+        return -1;
+    }
+
+    Py_buffer wb;
+    if (PyObject_GetBuffer(wd, &wb, PyBUF_SIMPLE) < 0)
+        return -1;
+
+    int rv = -1;
+    size_t samples = (size_t) wb.len / sizeof(kiss_fft_cpx);
+    size_t nbins = samples;
+    size_t *bins = 0;
+    if (bins_obj != Py_None) {
+        bins = parse_bins(bins_obj, samples, &nbins);
+        if (!bins)
+            goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    const kiss_fft_cpx *window = (const kiss_fft_cpx *)wb.buf;
+    kiss_sdft *sd;
+    int interrupted;
+    self->busy = true;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        sd = kiss_sdft_alloc(samples, bins, nbins, (size_t) resync,
+                             &should_stop.base, &interrupted);
+        if (!interrupted && sd && sd != (kiss_sdft *)-1)
+            interrupted = kiss_sdft_init(sd, window, &should_stop.base);
+        Py_END_ALLOW_THREADS
+    } else {
+        sd = kiss_sdft_alloc(samples, bins, nbins, (size_t) resync,
+                             &should_stop.base, &interrupted);
+        if (!interrupted && sd && sd != (kiss_sdft *)-1)
+            interrupted = kiss_sdft_init(sd, window, &should_stop.base);
+    }
+    self->busy = false;
+
+    if (interrupted) {
+        if (sd != (kiss_sdft *)-1)
+            kiss_sdft_free(sd);
+        end_interruptible(PyState_FindModule(&interruptible_module),
+                          &call, &should_stop, interrupted);
+        goto out;
+    }
+    sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+    if (sd == 0) {
+        PyErr_NoMemory();
+        goto out;
+    }
+    if (sd == (kiss_sdft *)-1) {
+        PyErr_SetString(PyExc_ValueError,
+                        "invalid number of samples for KISS FFT"
+                        " (not a power of two?)");
+        goto out;
+    }
+
+    kiss_sdft_free(self->sdft);
+    self->sdft = sd;
+    self->samples = samples;
+    self->nbins = nbins;
+    rv = 0;
+
+ out:
+    PyMem_Free(bins);
+    PyBuffer_Release(&wb);
+    return rv;
+}
+
+static void
+SlidingDFT_dealloc(PyObject *op)
+{
+    SlidingDFTObject *self = (SlidingDFTObject *)op;
+    kiss_sdft_free(self->sdft);
+    Py_TYPE(op)->tp_free(op);
+}
+
+// Common checks for all methods.
+static bool
+SlidingDFT_ready(SlidingDFTObject *self)
+{
+    if (!self->sdft) {
+        PyErr_SetString(PyExc_RuntimeError, "SlidingDFT not initialized");
+        return false;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "SlidingDFT is in use");
+        return false;
+    }
+    return true;
+}
+
+static PyObject *
+SlidingDFT_update(PyObject *op, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "samples", "interval", "release_gil", NULL
+    };
+    SlidingDFTObject *self = (SlidingDFTObject *)op;
+    PyObject *xd;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|dp",
+                                     (char **)keywords,
+                                     &xd, &s_between_checks, &release_gil))
+        return 0;
+    if (!SlidingDFT_ready(self))
+        return 0;
+
+    Py_buffer xb;
+    if (PyObject_GetBuffer(xd, &xb, PyBUF_SIMPLE) < 0)
+        return 0;
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    const kiss_fft_cpx *x = (const kiss_fft_cpx *)xb.buf;
+    size_t n = (size_t) xb.len / sizeof(kiss_fft_cpx);
+    int interrupted;
+    if (release_gil) {
+        self->busy = true;
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = kiss_sdft_update(self->sdft, x, n, ssbase);
+        Py_END_ALLOW_THREADS
+        self->busy = false;
+    } else {
+        interrupted = kiss_sdft_update(self->sdft, x, n, ssbase);
+    }
+
+    PyObject *mod = PyState_FindModule(&interruptible_module);
+    PyObject *res = end_interruptible(mod, &call, &should_stop, interrupted);
+    PyBuffer_Release(&xb);
+    return res;
+}
+
+static PyObject *
+SlidingDFT_spectrum(PyObject *op, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = { "output", NULL };
+    SlidingDFTObject *self = (SlidingDFTObject *)op;
+    PyObject *fd;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", (char **)keywords,
+                                     &fd))
+        return 0;
+    if (!SlidingDFT_ready(self))
+        return 0;
+
+    Py_buffer fb;
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0)
+        return 0;
+
+    PyObject *res = 0;
+    if ((size_t) fb.len / sizeof(kiss_fft_cpx) != self->nbins) {
+        PyErr_Format(PyExc_ValueError,
+                     "output must have one element per bin:"
+                     " have %zd need %zu",
+                     fb.len / (Py_ssize_t) sizeof(kiss_fft_cpx),
+                     self->nbins);
+    } else {
+        kiss_sdft_spectrum(self->sdft, (kiss_fft_cpx *)fb.buf);
+        res = Py_NewRef(Py_None);
+    }
+    PyBuffer_Release(&fb);
+    return res;
+}
+
+static PyObject *
+SlidingDFT_get_size(PyObject *op, void *closure)
+{
+    return PyLong_FromSize_t(((SlidingDFTObject *)op)->samples);
+}
+
+static PyObject *
+SlidingDFT_get_nbins(PyObject *op, void *closure)
+{
+    return PyLong_FromSize_t(((SlidingDFTObject *)op)->nbins);
+}
+
+static PyMethodDef SlidingDFT_methods[] = {
+    { "update",
+      (PyCFunction)SlidingDFT_update,
+      METH_VARARGS | METH_KEYWORDS,
+      "update(samples, interval=0.005, release_gil=True)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Push `samples`, a buffer of single-precision complex numbers,\n"
+      "into the window one at a time, updating the spectrum after each.\n"
+      "`interval`, `release_gil`, and the return value are as for\n"
+      "`fft_timed_interruptible`.  If interrupted, some prefix of\n"
+      "`samples` will have been pushed."
+    },
+    { "spectrum",
+      (PyCFunction)SlidingDFT_spectrum,
+      METH_VARARGS | METH_KEYWORDS,
+      "spectrum(output) -> None"
+      "\n\n"
+      "Write the current values of the tracked bins to `output`, which\n"
+      "must have exactly one single-precision complex element per bin."
+    },
+    { 0, 0, 0, 0 },
+};
+
+static PyGetSetDef SlidingDFT_getset[] = {
+    { "size", SlidingDFT_get_size, 0,
+      "Number of samples in the window.", 0 },
+    { "nbins", SlidingDFT_get_nbins, 0,
+      "Number of bins tracked.", 0 },
+    { 0, 0, 0, 0, 0 },
+};
+
+static PyTypeObject SlidingDFT_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "interruptible.SlidingDFT",
+    .tp_basicsize = sizeof(SlidingDFTObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc =
+        "SlidingDFT(window, bins=None, resync=0, interval=0.005,\n"
+        "           release_gil=True)"
+        "\n\n"
+        "Tracks the Fourier transform of a window of samples that advances\n"
+        "one sample at a time, at a cost of O(1) per bin per sample rather\n"
+        "than a whole transform."
+        "\n\n"
+        "`window` is the initial contents of the window, a buffer of\n"
+        "single-precision complex numbers whose length must be a power of\n"
+        "two.  `bins` is a sequence of the bin numbers to track, or None\n"
+        "for all of them.  To bound the accumulation of rounding error,\n"
+        "the spectrum is recomputed from scratch every `resync` samples\n"
+        "(default: the window size)."
+        "\n\n"
+        "Construction computes the initial spectrum, checking for\n"
+        "control-C every `interval` seconds and raising Interrupted if\n"
+        "there was one; `release_gil` is as for\n"
+        "`fft_timed_interruptible`.",
+    .tp_new = PyType_GenericNew,
+    .tp_init = SlidingDFT_init,
+    .tp_dealloc = SlidingDFT_dealloc,
+    .tp_methods = SlidingDFT_methods,
+    .tp_getset = SlidingDFT_getset,
+};
+
+// Chirp-z transform.
+
+typedef struct {
+    PyObject_HEAD
+    kiss_czt_state *czt;
+    size_t samples;
+    size_t nbins;
+    // as for SlidingDFTObject
+    bool busy;
+} ZoomFFTObject;
+
+static int
+ZoomFFT_init(PyObject *op, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "size", "bins", "start", "stop", "interval", "release_gil", NULL
+    };
+    ZoomFFTObject *self = (ZoomFFTObject *)op;
+    Py_ssize_t samples, nbins;
+    double start = 0.0, stop = 1.0;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "nn|dddp",
+                                     (char **)keywords,
+                                     &samples, &nbins, &start, &stop,
+                                     &s_between_checks, &release_gil))
+        return -1;
+    if (samples <= 0 || nbins <= 0) {
+        PyErr_SetString(PyExc_ValueError, "size and bins must be positive");
+        return -1;
+    }
+    if (!isfinite(start) || !isfinite(stop)) {
+        PyErr_SetString(PyExc_ValueError, "start and stop must be finite");
+        return -1;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "ZoomFFT is in use");
+        return -1;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    const double df = (stop - start) / (double) nbins;
+    kiss_czt_state *cz;
+    int interrupted;
+    self->busy = true;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        cz = kiss_czt_alloc((size_t) samples, (size_t) nbins, start, df,
+                            &should_stop.base, &interrupted);
+        Py_END_ALLOW_THREADS
+    } else {
+        cz = kiss_czt_alloc((size_t) samples, (size_t) nbins, start, df,
+                            &should_stop.base, &interrupted);
+    }
+    self->busy = false;
+
+    if (interrupted) {
+        end_interruptible(PyState_FindModule(&interruptible_module),
+                          &call, &should_stop, interrupted);
+        return -1;
+    }
+    sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+    if (cz == 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (cz == (kiss_czt_state *)-1) {
+        PyErr_SetString(PyExc_ValueError,
+                        "size + bins too large for KISS FFT");
+        return -1;
+    }
+
+    kiss_czt_free(self->czt);
+    self->czt = cz;
+    self->samples = (size_t) samples;
+    self->nbins = (size_t) nbins;
+    return 0;
+}
+
+static void
+ZoomFFT_dealloc(PyObject *op)
+{
+    ZoomFFTObject *self = (ZoomFFTObject *)op;
+    kiss_czt_free(self->czt);
+    Py_TYPE(op)->tp_free(op);
+}
+
+static PyObject *
+ZoomFFT_transform(PyObject *op, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "input", "output", "interval", "release_gil", NULL
+    };
+    ZoomFFTObject *self = (ZoomFFTObject *)op;
+    PyObject *td, *fd;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|dp",
+                                     (char **)keywords, &td, &fd,
+                                     &s_between_checks, &release_gil))
+        return 0;
+    if (!self->czt) {
+        PyErr_SetString(PyExc_RuntimeError, "ZoomFFT not initialized");
+        return 0;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "ZoomFFT is in use");
+        return 0;
+    }
+
+    Py_buffer tb, fb;
+    if (PyObject_GetBuffer(td, &tb, PyBUF_SIMPLE) < 0)
+        return 0;
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+
+    PyObject *res = 0;
+    if ((size_t) tb.len / sizeof(kiss_fft_cpx) != self->samples) {
+        PyErr_Format(PyExc_ValueError,
+                     "wrong number of input samples: have %zd need %zu",
+                     tb.len / (Py_ssize_t) sizeof(kiss_fft_cpx),
+                     self->samples);
+        goto out;
+    }
+    if ((size_t) fb.len / sizeof(kiss_fft_cpx) != self->nbins) {
+        PyErr_Format(PyExc_ValueError,
+                     "output must have one element per bin:"
+                     " have %zd need %zu",
+                     fb.len / (Py_ssize_t) sizeof(kiss_fft_cpx),
+                     self->nbins);
+        goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    const kiss_fft_cpx *fin = (const kiss_fft_cpx *)tb.buf;
+    kiss_fft_cpx *fout = (kiss_fft_cpx *)fb.buf;
+    int interrupted;
+    if (release_gil) {
+        self->busy = true;
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = kiss_czt(self->czt, fin, fout, ssbase);
+        Py_END_ALLOW_THREADS
+        self->busy = false;
+    } else {
+        interrupted = kiss_czt(self->czt, fin, fout, ssbase);
+    }
+
+    res = end_interruptible(PyState_FindModule(&interruptible_module),
+                            &call, &should_stop, interrupted);
+ out:
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&tb);
+    return res;
+}
+
+static PyObject *
+ZoomFFT_get_size(PyObject *op, void *closure)
+{
+    return PyLong_FromSize_t(((ZoomFFTObject *)op)->samples);
+}
+
+static PyObject *
+ZoomFFT_get_nbins(PyObject *op, void *closure)
+{
+    return PyLong_FromSize_t(((ZoomFFTObject *)op)->nbins);
+}
+
+static PyMethodDef ZoomFFT_methods[] = {
+    { "transform",
+      (PyCFunction)ZoomFFT_transform,
+      METH_VARARGS | METH_KEYWORDS,
+      "transform(input, output, interval=0.005, release_gil=True)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Compute the bins of `input` and write them to `output`; both\n"
+      "are buffers of single-precision complex numbers, of the sizes\n"
+      "given to the constructor.  `interval`, `release_gil`, and the\n"
+      "return value are as for `fft_timed_interruptible`."
+    },
+    { 0, 0, 0, 0 },
+};
+
+static PyGetSetDef ZoomFFT_getset[] = {
+    { "size", ZoomFFT_get_size, 0,
+      "Number of input samples.", 0 },
+    { "nbins", ZoomFFT_get_nbins, 0,
+      "Number of output bins.", 0 },
+    { 0, 0, 0, 0, 0 },
+};
+
+static PyTypeObject ZoomFFT_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "interruptible.ZoomFFT",
+    .tp_basicsize = sizeof(ZoomFFTObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc =
+        "ZoomFFT(size, bins, start=0.0, stop=1.0, interval=0.005,\n"
+        "        release_gil=True)"
+        "\n\n"
+        "Evaluates `bins` evenly spaced bins of the Fourier transform of\n"
+        "`size` samples, at frequencies from `start` up to but not\n"
+        "including `stop`, in cycles per sample.  This gives arbitrarily\n"
+        "fine resolution over a narrow band, at the cost of two power-of-\n"
+        "two transforms of at least size + bins - 1 points per call.\n"
+        "`size` need not be a power of two.  With the default band,\n"
+        "`bins` == `size` gives the same result as an ordinary transform."
+        "\n\n"
+        "Construction does one of those transforms in advance, checking\n"
+        "for control-C every `interval` seconds and raising Interrupted\n"
+        "if there was one; `release_gil` is as for\n"
+        "`fft_timed_interruptible`.",
+    .tp_new = PyType_GenericNew,
+    .tp_init = ZoomFFT_init,
+    .tp_dealloc = ZoomFFT_dealloc,
+    .tp_methods = ZoomFFT_methods,
+    .tp_getset = ZoomFFT_getset,
+};
+
+// Discrete cosine transforms with a reusable plan.
+
+typedef struct {
+    PyObject_HEAD
+    kiss_dct_state *d;
+    size_t samples;
+    // as for SlidingDFTObject
+    bool busy;
+} DCTObject;
+
+static int
+DCT_init(PyObject *op, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "size", "interval", "release_gil", NULL
+    };
+    DCTObject *self = (DCTObject *)op;
+    Py_ssize_t samples;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|dp",
+                                     (char **)keywords, &samples,
+                                     &s_between_checks, &release_gil))
+        return -1;
+    if (samples <= 0) {
+        raise_alloc_error((kiss_fft_state *)-1);
+        return -1;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "DCT is in use");
+        return -1;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    kiss_dct_state *d;
+    int interrupted;
+    self->busy = true;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        d = kiss_dct_alloc((size_t) samples, &should_stop.base,
+                           &interrupted);
+        Py_END_ALLOW_THREADS
+    } else {
+        d = kiss_dct_alloc((size_t) samples, &should_stop.base,
+                           &interrupted);
+    }
+    self->busy = false;
+
+    if (interrupted) {
+        end_interruptible(PyState_FindModule(&interruptible_module),
+                          &call, &should_stop, interrupted);
+        return -1;
+    }
+    sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+    if (d == 0 || d == (kiss_dct_state *)-1) {
+        raise_alloc_error(d ? (kiss_fft_state *)-1 : 0);
+        return -1;
+    }
+
+    kiss_dct_free(self->d);
+    self->d = d;
+    self->samples = (size_t) samples;
+    return 0;
+}
+
+static void
+DCT_dealloc(PyObject *op)
+{
+    DCTObject *self = (DCTObject *)op;
+    kiss_dct_free(self->d);
+    Py_TYPE(op)->tp_free(op);
+}
+
+static PyObject *
+DCT_transform(PyObject *op, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "input", "output", "type", "interval", "release_gil", NULL
+    };
+    DCTObject *self = (DCTObject *)op;
+    PyObject *td, *fd;
+    int type = 2;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|idp",
+                                     (char **)keywords, &td, &fd, &type,
+                                     &s_between_checks, &release_gil))
+        return 0;
+    if (!self->d) {
+        PyErr_SetString(PyExc_RuntimeError, "DCT not initialized");
+        return 0;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "DCT is in use");
+        return 0;
+    }
+
+    Py_buffer tb, fb;
+    if (PyObject_GetBuffer(td, &tb, PyBUF_SIMPLE) < 0)
+        return 0;
+    if (PyObject_GetBuffer(fd, &fb, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&tb);
+        return 0;
+    }
+
+    PyObject *res = 0;
+    if (check_dct_args(&tb, &fb, self->samples, type) < 0)
+        goto out;
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    const float *fin = (const float *)tb.buf;
+    float *fout = (float *)fb.buf;
+    int interrupted;
+    if (release_gil) {
+        self->busy = true;
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = type == 2 ? kiss_dct2(self->d, fin, fout, ssbase)
+                                : kiss_dct3(self->d, fin, fout, ssbase);
+        Py_END_ALLOW_THREADS
+        self->busy = false;
+    } else {
+        interrupted = type == 2 ? kiss_dct2(self->d, fin, fout, ssbase)
+                                : kiss_dct3(self->d, fin, fout, ssbase);
+    }
+
+    res = end_interruptible(PyState_FindModule(&interruptible_module),
+                            &call, &should_stop, interrupted);
+ out:
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&tb);
+    return res;
+}
+
+static PyObject *
+DCT_get_size(PyObject *op, void *closure)
+{
+    return PyLong_FromSize_t(((DCTObject *)op)->samples);
+}
+
+static PyMethodDef DCT_methods[] = {
+    { "transform",
+      (PyCFunction)DCT_transform,
+      METH_VARARGS | METH_KEYWORDS,
+      "transform(input, output, type=2, interval=0.005, release_gil=True)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Compute the DCT of `input`, of type 2 or 3, and write it to\n"
+      "`output`, as `dct` does; both must have the size given to the\n"
+      "constructor."
+    },
+    { 0, 0, 0, 0 },
+};
+
+static PyGetSetDef DCT_getset[] = {
+    { "size", DCT_get_size, 0,
+      "Number of samples.", 0 },
+    { 0, 0, 0, 0, 0 },
+};
+
+static PyTypeObject DCT_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "interruptible.DCT",
+    .tp_basicsize = sizeof(DCTObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc =
+        "DCT(size, interval=0.005, release_gil=True)"
+        "\n\n"
+        "A plan for discrete cosine transforms of `size` samples, a power\n"
+        "of two, of either type.  `dct` makes one of these for each call;\n"
+        "keeping one saves recomputing its twiddle factors and\n"
+        "reallocating its buffers every time."
+        "\n\n"
+        "Construction computes the twiddle factors, checking for control-C\n"
+        "every `interval` seconds and raising Interrupted if there was\n"
+        "one; `release_gil` is as for `fft_timed_interruptible`.",
+    .tp_new = PyType_GenericNew,
+    .tp_init = DCT_init,
+    .tp_dealloc = DCT_dealloc,
+    .tp_methods = DCT_methods,
+    .tp_getset = DCT_getset,
+};
+
+// Named plans in shared memory.
+
+typedef struct {
+    PyObject_HEAD
+    kiss_fft_state *st;
+    size_t samples;
+    PyObject *name;
+    // as for SlidingDFTObject
+    bool busy;
+} SharedPlanObject;
+
+static int
+SharedPlan_init(PyObject *op, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "name", "size", "interval", "release_gil", NULL
+    };
+    SharedPlanObject *self = (SharedPlanObject *)op;
+    PyObject *name;
+    Py_ssize_t samples;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Un|dp",
+                                     (char **)keywords, &name, &samples,
+                                     &s_between_checks, &release_gil))
+        return -1;
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "SharedPlan is in use");
+        return -1;
+    }
+    const char *cname = PyUnicode_AsUTF8(name);
+    if (!cname)
+        return -1;
+    if (samples <= 0) {
+        raise_alloc_error((kiss_fft_state *)-1);
+        return -1;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    // Another process may be building the plan, so this can wait.
+    kiss_fft_state *st;
+    int interrupted;
+    int save_errno;
+    self->busy = true;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        st = kiss_fft_alloc_named(cname, (size_t) samples,
+                                  &should_stop.base, &interrupted);
+        save_errno = errno;
+        Py_END_ALLOW_THREADS
+    } else {
+        st = kiss_fft_alloc_named(cname, (size_t) samples,
+                                  &should_stop.base, &interrupted);
+        save_errno = errno;
+    }
+    self->busy = false;
+
+    PyObject *mod = PyState_FindModule(&interruptible_module);
+    if (interrupted) {
+        end_interruptible(mod, &call, &should_stop, interrupted);
+        return -1;
+    }
+    sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+    if (st == (kiss_fft_state *)-1) {
+        raise_alloc_error(st);
+        return -1;
+    }
+    if (!st) {
+        errno = save_errno;
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, name);
+        return -1;
+    }
+
+    kiss_fft_free_named(self->st);
+    self->st = st;
+    self->samples = (size_t) samples;
+    Py_INCREF(name);
+    Py_XSETREF(self->name, name);
+    return 0;
+}
+
+static void
+SharedPlan_dealloc(PyObject *op)
+{
+    SharedPlanObject *self = (SharedPlanObject *)op;
+    kiss_fft_free_named(self->st);
+    Py_XDECREF(self->name);
+    Py_TYPE(op)->tp_free(op);
+}
+
+static PyObject *
+SharedPlan_transform(PyObject *op, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "input", "output", "interval", "release_gil", NULL
+    };
+    SharedPlanObject *self = (SharedPlanObject *)op;
+    PyObject *td, *fd;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|dp",
+                                     (char **)keywords, &td, &fd,
+                                     &s_between_checks, &release_gil))
+        return 0;
+    if (!self->st) {
+        PyErr_SetString(PyExc_RuntimeError, "SharedPlan is closed");
+        return 0;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "SharedPlan is in use");
+        return 0;
+    }
+
+    Py_buffer tb, fb;
+    Py_ssize_t samples = maybe_interruptible_get_buffers(td, &tb, fd, &fb);
+    if (samples < 0)
+        return 0;
+
+    PyObject *res = 0;
+    if ((size_t) samples != self->samples) {
+        PyErr_Format(PyExc_ValueError,
+                     "wrong number of samples: have %zd need %zu",
+                     samples, self->samples);
+        goto out;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+    kiss_fft_periodic_cb *ssbase = &should_stop.base;
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    const kiss_fft_cpx *fin = (const kiss_fft_cpx *)tb.buf;
+    kiss_fft_cpx *fout = (kiss_fft_cpx *)fb.buf;
+    int interrupted;
+    if (release_gil) {
+        self->busy = true;
+        Py_BEGIN_ALLOW_THREADS
+        interrupted = kiss_fft(self->st, fin, fout, ssbase);
+        Py_END_ALLOW_THREADS
+        self->busy = false;
+    } else {
+        interrupted = kiss_fft(self->st, fin, fout, ssbase);
+    }
+
+    res = end_interruptible(PyState_FindModule(&interruptible_module),
+                            &call, &should_stop, interrupted);
+ out:
+    PyBuffer_Release(&fb);
+    PyBuffer_Release(&tb);
+    return res;
+}
+
+static PyObject *
+SharedPlan_close(PyObject *op, PyObject *unused)
+{
+    SharedPlanObject *self = (SharedPlanObject *)op;
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "SharedPlan is in use");
+        return 0;
+    }
+    kiss_fft_free_named(self->st);
+    self->st = 0;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+SharedPlan_get_size(PyObject *op, void *closure)
+{
+    return PyLong_FromSize_t(((SharedPlanObject *)op)->samples);
+}
+
+static PyObject *
+SharedPlan_get_name(PyObject *op, void *closure)
+{
+    PyObject *name = ((SharedPlanObject *)op)->name;
+    return Py_NewRef(name ? name : Py_None);
+}
+
+static PyMethodDef SharedPlan_methods[] = {
+    { "transform",
+      (PyCFunction)SharedPlan_transform,
+      METH_VARARGS | METH_KEYWORDS,
+      "transform(input, output, interval=0.005, release_gil=True)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Compute the Fourier transform of `input` into `output`; both\n"
+      "are buffers of single-precision complex numbers, of the size\n"
+      "given to the constructor.  `interval`, `release_gil`, and the\n"
+      "return value are as for `fft_timed_interruptible`."
+    },
+    { "close",
+      SharedPlan_close,
+      METH_NOARGS,
+      "close() -> None"
+      "\n\n"
+      "Release this process's reference to the shared segment now,\n"
+      "rather than when the object is garbage-collected."
+    },
+    { 0, 0, 0, 0 },
+};
+
+static PyGetSetDef SharedPlan_getset[] = {
+    { "size", SharedPlan_get_size, 0,
+      "Number of samples.", 0 },
+    { "name", SharedPlan_get_name, 0,
+      "Name of the shared memory segment.", 0 },
+    { 0, 0, 0, 0, 0 },
+};
+
+static PyTypeObject SharedPlan_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "interruptible.SharedPlan",
+    .tp_basicsize = sizeof(SharedPlanObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc =
+        "SharedPlan(name, size, interval=0.005, release_gil=True)"
+        "\n\n"
+        "A plan for transforms of `size` samples whose twiddle factors\n"
+        "are kept in the POSIX shared memory segment `name` (such as\n"
+        "'/myapp-fft'), so that every process that makes a SharedPlan\n"
+        "with the same name shares one read-only copy of them.  The first\n"
+        "to do so computes them, and any others wait for it, or take over\n"
+        "if it dies first; both are interruptible, as for\n"
+        "`fft_timed_interruptible`.  The segment is removed when the last\n"
+        "SharedPlan using it, in any process, is closed or\n"
+        "garbage-collected.",
+    .tp_new = PyType_GenericNew,
+    .tp_init = SharedPlan_init,
+    .tp_dealloc = SharedPlan_dealloc,
+    .tp_methods = SharedPlan_methods,
+    .tp_getset = SharedPlan_getset,
+};
+
+// Wisdom files.
+
+static PyObject *
+raise_wisdom_error(int rv, PyObject *path)
+{
+    switch (rv) {
+    case KISS_FFT_WISDOM_ERRNO:
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        break;
+    case KISS_FFT_WISDOM_BAD_FORMAT:
+        PyErr_Format(PyExc_ValueError,
+                     "%R is not a KISS FFT wisdom file,"
+                     " or is for a different version", path);
+        break;
+    default:
+        PyErr_SetString(PyExc_ValueError,
+                        "invalid number of samples for KISS FFT"
+                        " (not a power of two?)");
+        break;
+    }
+    return 0;
+}
+
+static PyObject *
+save_wisdom(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "path", "sizes", "interval", "release_gil", NULL
+    };
+    PyObject *path_obj = 0;
+    PyObject *path = 0;
+    PyObject *sizes_obj = 0;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|dp",
+                                     (char **)keywords, &path_obj,
+                                     &sizes_obj, &s_between_checks,
+                                     &release_gil))
+        return 0;
+    if (!PyUnicode_FSConverter(path_obj, &path))
+        return 0;
+
+    PyObject *res = 0;
+    PyObject *seq = PySequence_Fast(sizes_obj, "sizes must be a sequence");
+    if (!seq)
+        goto out;
+
+    Py_ssize_t nsizes = PySequence_Fast_GET_SIZE(seq);
+    size_t sizes[sizeof(size_t) * CHAR_BIT];
+    if (nsizes > (Py_ssize_t)(sizeof sizes / sizeof sizes[0])) {
+        PyErr_SetString(PyExc_ValueError, "too many sizes");
+        goto out;
+    }
+    for (Py_ssize_t i = 0; i < nsizes; i++) {
+        unsigned long long n =
+            PyLong_AsUnsignedLongLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (PyErr_Occurred())
+            goto out;
+        if (n == 0 || n > KISS_FFT_MAX_SAMPLES) {
+            PyErr_Format(PyExc_ValueError,
+                         "invalid number of samples: %llu", n);
+            goto out;
+        }
+        sizes[i] = (size_t) n;
+    }
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    // This computes all of the twiddle factors, which can take a while.
+    int rv, interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        rv = kiss_fft_save_wisdom(PyBytes_AS_STRING(path), sizes,
+                                  (size_t) nsizes, &should_stop.base,
+                                  &interrupted);
+        Py_END_ALLOW_THREADS
+    } else {
+        rv = kiss_fft_save_wisdom(PyBytes_AS_STRING(path), sizes,
+                                  (size_t) nsizes, &should_stop.base,
+                                  &interrupted);
+    }
+
+    if (rv) {
+        sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+        raise_wisdom_error(rv, path_obj);
+    } else {
+        res = end_interruptible(self, &call, &should_stop, interrupted);
+    }
+
+ out:
+    Py_XDECREF(seq);
+    Py_DECREF(path);
+    return res;
+}
+
+static PyObject *
+load_wisdom(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = { "path", NULL };
+    PyObject *path_obj = 0;
+    PyObject *path = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", (char **)keywords,
+                                     &path_obj))
+        return 0;
+    if (!PyUnicode_FSConverter(path_obj, &path))
+        return 0;
+
+    int rv = kiss_fft_load_wisdom(PyBytes_AS_STRING(path));
+    PyObject *res =
+        rv ? raise_wisdom_error(rv, path_obj) : Py_NewRef(Py_None);
+    Py_DECREF(path);
+    return res;
+}
+
+static PyObject *
+share_twiddles(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *const keywords[] = {
+        "max_size", "interval", "release_gil", NULL
+    };
+    Py_ssize_t samples;
+    double s_between_checks = 0.005;  // 5 ms
+    int release_gil = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|dp",
+                                     (char **)keywords, &samples,
+                                     &s_between_checks, &release_gil))
+        return 0;
+    if (samples <= 0)
+        return raise_wisdom_error(KISS_FFT_WISDOM_BAD_SIZE, 0);
+
+    periodic_signal_check should_stop;
+    init_timed_check(&should_stop, s_between_checks, release_gil);
+
+    struct interruptible_call call;
+    begin_interruptible(&call, &should_stop);
+
+    int rv, interrupted;
+    if (release_gil) {
+        Py_BEGIN_ALLOW_THREADS
+        rv = kiss_fft_share_twiddles((size_t) samples, &should_stop.base,
+                                     &interrupted);
+        Py_END_ALLOW_THREADS
+    } else {
+        rv = kiss_fft_share_twiddles((size_t) samples, &should_stop.base,
+                                     &interrupted);
+    }
+
+    if (rv) {
+        sigprocmask(SIG_SETMASK, &call.prev_mask, NULL);
+        return raise_wisdom_error(rv, 0);
+    }
+    return end_interruptible(self, &call, &should_stop, interrupted);
+}
+
+static PyMethodDef interruptible_methods[] = {
+    { "fft_uninterruptible",
+      (PyCFunction)uninterruptible,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_uninterruptible(input, output, interval=0.005, release_gil=True,\n"
+      "                    planner='estimate', planning_limit=1.0,\n"
+      "                    channels=1, channel=0, scale=1.0,\n"
+      "                    scrambled=False, inverse=False)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Performs a Fourier transform, without taking special care to be\n"
+      " interruptible by control-C."
+      "\n\n"
+      "`input` and `output` are the input and output arrays; both must\n"
+      "be interpretable as 'simple buffers' of single-precision complex\n"
+      "numbers, both must have the same number of elements, and that number\n"
+      " must be a power of two.  (NumPy arrays can meet these requirements.)"
+      "\n\n"
+      "`interval` is the desired interval between checks for control-C,\n"
+      "defaulting to 0.005 s (5 ms).  (This function ignores this argument.)"
+      "\n\n"
+      "If `release_gil` is true, the GIL will be released during the\n"
+      "computation of the Fourier transform."
+      "\n\n"
+      "If `planner` is 'measure', the first call for each input size\n"
+      "times several ways of computing the transform on this machine\n"
+      "and remembers the fastest, for use by all later calls with that\n"
+      "input size (regardless of their `planner` setting).  This takes\n"
+      "no more than `planning_limit` seconds, and is included in\n"
+      "`elapsed`; a `planning_limit` of zero skips measurement.  Later\n"
+      "calls with 'measure' reuse what was remembered and don't time\n"
+      "anything.  The default, 'estimate', uses rules of thumb instead."
+      "\n\n"
+      "`input` may instead be a buffer of 16- or 32-bit integers in native\n"
+      "byte order (such as an int16 or int32 NumPy array), holding real\n"
+      "PCM samples with `channels` channels interleaved.  Channel number\n"
+      "`channel` is transformed, with each sample multiplied by `scale`;\n"
+      "`output` must have one element per frame.  The samples are\n"
+      "converted as the transform reads them, without an intermediate\n"
+      "copy."
+      "\n\n"
+      "If `scrambled` is true, the bins of the spectrum are written in\n"
+      "a scrambled order (the base-4 digits of each bin number reversed),\n"
+      "which saves a pass over the data.  This is for spectra that will\n"
+      "only be multiplied pointwise by other spectra in the same order,\n"
+      "as in a convolution, and transformed back with `inverse` true.\n"
+      "That computes the inverse transform of a scrambled spectrum,\n"
+      "unnormalized (N times numpy.fft.ifft), in natural order.  Neither\n"
+      "applies to PCM input, and `planner` is ignored."
+      "\n\n"
+      "On success, returns a 2-tuple (elapsed, checks); elapsed is\n"
+      "the elapsed time for the calculation, as a floating-point number\n"
+      "of seconds, and checks is the number of times that a manual check\n"
+      "for control-C was performed (always zero for this function)."
+    },
+    { "fft_simple_interruptible",
+      (PyCFunction)simple_interruptible,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_simple_interruptible(input, output, interval=0.005, release_gil=True,\n"
+      "                         planner='estimate', planning_limit=1.0,\n"
+      "                         channels=1, channel=0, scale=1.0,\n"
+      "                         scrambled=False, inverse=False)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Performs a Fourier transform, checking for control-C at convenient\n"
+      "points within the transform algorithm.  Arguments and return value\n"
+      "are the same as for `fft_uninterruptible`, except that the `checks`\n"
+      "element of the return value won't always be zero."
+    },
+    { "fft_timed_interruptible",
+      (PyCFunction)timed_interruptible,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_timed_interruptible(input, output, interval=0.005, release_gil=True,\n"
+      "                        planner='estimate', planning_limit=1.0,\n"
+      "                        channels=1, channel=0, scale=1.0,\n"
+      "                        scrambled=False, inverse=False)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Performs a Fourier transform, checking for control-C at convenient\n"
+      "points within the transform algorithm, but only if at least\n"
+      "the interval specified by the third argument has elapsed since\n"
+      "the previous check.  The longest passes of a large transform are\n"
+      "split into pieces timed to fit that interval, so that the checks\n"
+      "keep up at any size.  Other arguments are the same as for\n"
+      "`fft_uninterruptible`, as is the return value, except that the\n"
+      "`checks` element won't always be zero."
+    },
+#ifdef CLOCK_MONOTONIC_COARSE
+    { "fft_timed_coarse_interruptible",
+      (PyCFunction)timed_coarse_interruptible,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_timed_coarse_interruptible(input, output, interval=0.005, release_gil=True,\n"
+      "                               planner='estimate', planning_limit=1.0,\n"
+      "                               channels=1, channel=0, scale=1.0,\n"
+      "                               scrambled=False, inverse=False)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Same as fft_timed_interruptible but uses a clock with coarser"
+      " resolution. It may therefore have lower overhead."
+    },
+#endif
+    { "fft_batch",
+      (PyCFunction)fft_batch,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_batch(input, output, size, interval=0.005, release_gil=True,\n"
+      "          simd=True, channels=1, channel=0, scale=1.0)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Performs many independent Fourier transforms of `size` samples\n"
+      "each.  `input` and `output` are as for `fft_uninterruptible`,\n"
+      "except that they hold one transform after another, so their\n"
+      "length must be a multiple of `size`.  Checks for control-C are\n"
+      "made as for `fft_timed_interruptible`."
+      "\n\n"
+      "If `simd` is true, several transforms are computed at once using\n"
+      "SIMD instructions (for small sizes only).  Otherwise they are\n"
+      "computed one at a time.  The return value is as for\n"
+      "`fft_uninterruptible`."
+      "\n\n"
+      "`input` may instead hold PCM samples, as for\n"
+      "`fft_timed_interruptible`; then `output` has one element per\n"
+      "frame, and `size` counts frames."
+    },
+    { "fft_bins",
+      (PyCFunction)fft_bins,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_bins(input, output, bins, interval=0.005, release_gil=True,\n"
+      "         channels=1, channel=0, scale=1.0)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Computes only some of the bins of the Fourier transform of `input`.\n"
+      "`bins` is a sequence of bin numbers, such as a list or a range.\n"
+      "`output` must have exactly one element per entry in `bins`, and\n"
+      "receives those bins in the same order.  Otherwise, arguments and\n"
+      "return value are as for `fft_timed_interruptible`, including\n"
+      "PCM input."
+      "\n\n"
+      "This is much faster than a full transform when only a small\n"
+      "fraction of the bins are wanted."
+    },
+    { "fft_power",
+      (PyCFunction)fft_power,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_power(input, output, window=None, interval=0.005,\n"
+      "          release_gil=True, phase=False, channels=1, channel=0,\n"
+      "          scale=1.0)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Computes the power spectrum abs(fft(input * window))**2 in a\n"
+      "single pass: the window is applied as the input is read, and the\n"
+      "power is computed as the last stage of the transform produces\n"
+      "each bin.  The transform itself still works in a temporary\n"
+      "buffer of one single-precision complex number per sample, which\n"
+      "is allocated for each call."
+      "\n\n"
+      "`window`, if given, must be a buffer of single-precision floats,\n"
+      "one per sample.  `output` must also be a buffer of\n"
+      "single-precision floats, one per sample."
+      "\n\n"
+      "If `phase` is true, `output` must have two floats per sample,\n"
+      "and receives the magnitudes abs(X) in its first half and the\n"
+      "phases angle(X), in radians, in its second half.  Otherwise,\n"
+      "arguments and return value are as for `fft_timed_interruptible`,\n"
+      "including PCM input, which is converted as it is read, like the\n"
+      "window."
+    },
+    { "fft_sparse",
+      (PyCFunction)fft_sparse,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_sparse(input, output, k, tolerance=1e-6, interval=0.005,\n"
+      "           release_gil=True)\n"
+      "    -> (elapsed, checks, found)"
+      "\n\n"
+      "Computes the Fourier transform of `input`, assuming that only\n"
+      "about `k` of its bins are significant.  Those are found by\n"
+      "randomized hashing, which reads only a small fraction of the\n"
+      "input; `output` is zero except for them.  Bins are found until\n"
+      "the rest of the spectrum holds less than `tolerance` times its\n"
+      "total energy.  If that doesn't happen, because the spectrum is\n"
+      "not sparse, or too noisy for `tolerance`, it falls back to a\n"
+      "full transform."
+      "\n\n"
+      "`found` is the number of bins found, or the number of samples\n"
+      "after falling back.  Otherwise, arguments and return value are\n"
+      "as for `fft_timed_interruptible`."
+    },
+    { "ntt",
+      (PyCFunction)ntt,
+      METH_VARARGS | METH_KEYWORDS,
+      "ntt(input, output, inverse=False, interval=0.005,\n"
+      "    release_gil=True)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Computes the number-theoretic transform of `input`: the DFT of\n"
+      "integers modulo the prime `NTT_MODULUS`, which is exact.  Both\n"
+      "`input` and `output` must be buffers of unsigned 64-bit integers,\n"
+      "one per sample, and must not overlap; each input value must be\n"
+      "less than `NTT_MODULUS`.  If `inverse` is true, computes the\n"
+      "inverse transform instead, including division by the number of\n"
+      "samples.  Otherwise, arguments and return value are as for\n"
+      "`fft_timed_interruptible`."
+    },
+    { "ntt_convolve",
+      (PyCFunction)ntt_convolve,
+      METH_VARARGS | METH_KEYWORDS,
+      "ntt_convolve(a, b, output, interval=0.005, release_gil=True)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Computes the convolution of `a` and `b`, as numpy.convolve does,\n"
+      "using the number-theoretic transform.  All three arguments must\n"
+      "be buffers of signed 64-bit integers, and `output` must have\n"
+      "len(a) + len(b) - 1 elements.  The result is exact as long as\n"
+      "no element of the true result has magnitude NTT_MODULUS / 2 or\n"
+      "more (about 2**61), unlike a convolution done with a floating-\n"
+      "point FFT and rounded.  Otherwise, arguments and return value\n"
+      "are as for `fft_timed_interruptible`."
+    },
+    { "dct",
+      (PyCFunction)dct,
+      METH_VARARGS | METH_KEYWORDS,
+      "dct(input, output, type=2, interval=0.005, release_gil=True)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Computes the discrete cosine transform of `input`, of type 2 or 3,\n"
+      "scaled as scipy.fft.dct with the default norm='backward', so that\n"
+      "type 3 of type 2 is 2N times the input.  `input` and `output` must\n"
+      "be non-overlapping buffers of single-precision floats, with the\n"
+      "same number of elements, a power of two.  The work is one complex\n"
+      "transform of half that many points, with no mirrored copy of the\n"
+      "input.  Otherwise, arguments and return value are as for\n"
+      "`fft_timed_interruptible`.  Each call makes a new plan; to do\n"
+      "many transforms of one size, use a `DCT` object instead."
+    },
+    { "fft_welch",
+      (PyCFunction)fft_welch,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_welch(input, output, window=None, step=0, threads=0,\n"
+      "          interval=0.005, release_gil=True, channels=1, channel=0,\n"
+      "          scale=1.0)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Estimates the power spectral density of `input` by Welch's\n"
+      "method, averaging the power spectra of overlapping windowed\n"
+      "segments.  The segment size is the number of elements of\n"
+      "`output`, a buffer of single-precision floats, which must be a\n"
+      "power of two.  `window`, if given, must be a buffer of the same\n"
+      "size and type.  Segments start every `step` samples, or every\n"
+      "half segment if `step` is 0.  The scaling matches\n"
+      "scipy.signal.welch with fs=1, detrend=False and\n"
+      "return_onesided=False."
+      "\n\n"
+      "The segments are processed in parallel by `threads` threads, or\n"
+      "one per CPU if `threads` is 0, but never by more threads than\n"
+      "there are CPUs or segments.  Only the calling thread checks\n"
+      "for control-C, as for `fft_timed_interruptible`, and stops the\n"
+      "others when it sees one.  The return value is as for\n"
+      "`fft_uninterruptible`."
+      "\n\n"
+      "`input` may instead hold PCM samples, as for\n"
+      "`fft_timed_interruptible`; then `step` counts frames."
+    },
+    { "fft_shared_layout",
+      (PyCFunction)fft_shared_layout,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_shared_layout(samples, shards)\n"
+      "    -> (size, input_offset, output_offset)"
+      "\n\n"
+      "Returns the size in bytes of a shared memory segment for one\n"
+      "transform of `samples` points sharded across `shards` processes,\n"
+      "and the byte offsets in it of the input and output arrays, which\n"
+      "hold `samples` single-precision complex numbers each.  For\n"
+      "instance, with `shm` a multiprocessing.shared_memory.SharedMemory\n"
+      "of that size, numpy.frombuffer(shm.buf, numpy.complex64,\n"
+      "samples, input_offset) is the input."
+    },
+    { "fft_shared_init",
+      (PyCFunction)fft_shared_init,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_shared_init(buffer, samples, shards, interval=0.005,\n"
+      "                release_gil=True)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Sets up the shared segment `buffer` (see `fft_shared_layout`),\n"
+      "including the plan, which every shard then uses.  Otherwise,\n"
+      "arguments and return value are as for `fft_timed_interruptible`."
+    },
+    { "fft_shared_run",
+      (PyCFunction)fft_shared_run,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_shared_run(buffer, shard, interval=0.005, release_gil=True)\n"
+      "    -> (elapsed, checks, completed)"
+      "\n\n"
+      "Computes shard number `shard` of the transform of the input in\n"
+      "the shared segment `buffer`.  Every shard from 0 to shards - 1\n"
+      "must be run once per transform, each in its own process (or\n"
+      "thread, with `release_gil` true); the shards wait for each other\n"
+      "between the passes of the transform, and each call returns when\n"
+      "the output is complete.  Another transform may be started as soon\n"
+      "as that happens."
+      "\n\n"
+      "If this process is interrupted, it raises `Interrupted` as\n"
+      "`fft_timed_interruptible` does, and every other shard stops within\n"
+      "its own check interval and returns with `completed` false.  The\n"
+      "same happens if `fft_shared_cancel` is called, or if a shard dies\n"
+      "while running.  After that, all runs of the segment return at\n"
+      "once with `completed` false until `fft_shared_reset` is called.\n"
+      "Otherwise, arguments and return value are as for\n"
+      "`fft_timed_interruptible`."
+    },
+    { "fft_shared_cancel",
+      (PyCFunction)fft_shared_cancel,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_shared_cancel(buffer) -> None"
+      "\n\n"
+      "Stops the transform in progress in the shared segment `buffer`:\n"
+      "every shard returns with `completed` false within its check\n"
+      "interval.  This works from any process, whether or not it is\n"
+      "running a shard.  A parent that hands the shards to workers\n"
+      "which ignore SIGINT (as multiprocessing.Pool workers usually do)\n"
+      "should call it when interrupted, so that they don't wait for\n"
+      "each other forever:"
+      "\n\n"
+      "    try:\n"
+      "        pool.starmap(fft_shared_run, ...)\n"
+      "    except KeyboardInterrupt:\n"
+      "        fft_shared_cancel(buffer)\n"
+      "        raise"
+      "\n\n"
+      "It is also the only way to stop the others if a shard never\n"
+      "starts.  Call `fft_shared_reset` before the next transform."
+    },
+    { "fft_shared_reset",
+      (PyCFunction)fft_shared_reset,
+      METH_VARARGS | METH_KEYWORDS,
+      "fft_shared_reset(buffer) -> None"
+      "\n\n"
+      "Makes the shared segment `buffer` usable again after a transform\n"
+      "was interrupted.  No shard may be running at the time."
+    },
+    { "save_wisdom",
+      (PyCFunction)save_wisdom,
+      METH_VARARGS | METH_KEYWORDS,
+      "save_wisdom(path, sizes, interval=0.005, release_gil=True)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Write plans for each of the input sizes in `sizes` to the file\n"
+      "`path`.  Plans include both the choices made by the 'measure'\n"
+      "planner, if it has been run for that size, and the precomputed\n"
+      "twiddle factors.  If interrupted while computing those, `path`\n"
+      "is left as it was.  Otherwise, arguments and return value are as\n"
+      "for `fft_timed_interruptible`."
+    },
+    { "load_wisdom",
+      (PyCFunction)load_wisdom,
+      METH_VARARGS | METH_KEYWORDS,
+      "load_wisdom(path) -> None"
+      "\n\n"
+      "Load plans previously written by `save_wisdom`.  The file is\n"
+      "mapped into memory, read-only, and shared with any other process\n"
+      "that loads the same file; subsequent transforms of the sizes it\n"
+      "covers skip computing twiddle factors."
+    },
+    { "share_twiddles",
+      (PyCFunction)share_twiddles,
+      METH_VARARGS | METH_KEYWORDS,
+      "share_twiddles(max_size, interval=0.005, release_gil=True)\n"
+      "    -> (elapsed, checks)"
+      "\n\n"
+      "Compute the twiddle factors for transforms of `max_size` samples\n"
+      "once, and use them from then on for every transform of that size\n"
+      "or smaller, which then skips computing its own.  This costs the\n"
+      "memory of one plan of `max_size` samples, and is never freed.\n"
+      "Otherwise, arguments and return value are as for\n"
+      "`fft_timed_interruptible`."
+    },
+    { 0, 0, 0, 0 },
+};
+
+static struct PyModuleDef interruptible_module = {
+    .m_base = PyModuleDef_HEAD_INIT,
+    .m_name = "interruptible",
+    .m_doc = interruptible_doc,
+    .m_size = sizeof(PyObject *), // our KeyboardInterrupt subclass
+    .m_methods = interruptible_methods,
+};
+
+// called via dlsym; pacify -Wmissing-prototypes
+extern PyMODINIT_FUNC PyInit_interruptible(void);
+
+PyMODINIT_FUNC
+PyInit_interruptible(void)
+{
+    PyObject *mod = PyModule_Create(&interruptible_module);
+    if (!mod)
+        return NULL;
+
+    if (define_Interrupted(mod) < 0) {
+        Py_DECREF(mod);
+        return NULL;
+    }
+
+    // MAX_SAMPLES may not fit in a C long
+    PyObject *max_samples = PyLong_FromUnsignedLongLong(KISS_FFT_MAX_SAMPLES);
+    if (!max_samples
+        || PyModule_AddObjectRef(mod, "MAX_SAMPLES", max_samples) < 0) {
+        Py_XDECREF(max_samples);
+        Py_DECREF(mod);
+        return NULL;
+    }
+    Py_DECREF(max_samples);
+
+    PyObject *ntt_modulus = PyLong_FromUnsignedLongLong(KISS_NTT_MODULUS);
+    if (!ntt_modulus
+        || PyModule_AddObjectRef(mod, "NTT_MODULUS", ntt_modulus) < 0) {
+        Py_XDECREF(ntt_modulus);
+        Py_DECREF(mod);
+        return NULL;
+    }
+    Py_DECREF(ntt_modulus);
+
+    if (PyType_Ready(&SlidingDFT_type) < 0
+        || PyModule_AddObjectRef(mod, "SlidingDFT",
+                                 (PyObject *)&SlidingDFT_type) < 0) {
+        Py_DECREF(mod);
+        return NULL;
+    }
+
+    if (PyType_Ready(&ZoomFFT_type) < 0
+        || PyModule_AddObjectRef(mod, "ZoomFFT",
+                                 (PyObject *)&ZoomFFT_type) < 0) {
+        Py_DECREF(mod);
+        return NULL;
+    }
+
+    if (PyType_Ready(&DCT_type) < 0
+        || PyModule_AddObjectRef(mod, "DCT", (PyObject *)&DCT_type) < 0) {
         Py_DECREF(mod);
         return NULL;
     }
 
-    if (PyModule_AddIntConstant(mod, "MAX_SAMPLES", KISS_FFT_MAX_SAMPLES)) {
+    if (PyType_Ready(&SharedPlan_type) < 0
+        || PyModule_AddObjectRef(mod, "SharedPlan",
+                                 (PyObject *)&SharedPlan_type) < 0) {
         Py_DECREF(mod);
         return NULL;
     }
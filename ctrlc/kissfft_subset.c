@@ -7,43 +7,79 @@
  */
 
 // For purpose of this demo, KISS FFT has been cut down to only the
-// code absolutely required: forward FFT on 32-bit float, max 2**31
-// samples, sample size must be a power of two.
+// code absolutely required: forward FFT on 32-bit float, max
+// KISS_FFT_MAX_SAMPLES samples, sample size must be a power of two.
 
+#define _XOPEN_SOURCE 700
 #include "kissfft_subset.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifndef M_PI
 // far too many digits on purpose
 #define M_PI 3.141592653589793238462643383279502884197169399375105820974944
 #endif
 
-// ZW: I can think of several clever ways to pack this information
-// into less space given its extreme regularity, or even compute it on
-// the fly from the sample size -- it's always a sequence of (4, n)
-// where 2 <= n <= 0x2000_0000, followed by either (4, 1) or (2, 1) --
-// but I don't feel like debugging any of them.
-struct kiss_fft_factor {
-    uint32_t radix;
-    uint32_t stride;
-};
-
-// ZW: 2**31 samples requires 16 factors.  All supported smaller sample
-// sizes require fewer factors.  See kf_factor.
-#define MAXFACTORS ((size_t)16)
+// ZW: The factorization of a power-of-two sample size is completely
+// determined by the size: it's always a sequence of (4, n) where
+// 2 <= n <= KISS_FFT_MAX_SAMPLES/4, followed by either (4, 1) or
+// (2, 1).  Rather than store that sequence in the plan and walk it at
+// runtime, we generate one specialized copy of kf_work per log2 sample
+// size, with the radix and stride of every stage baked in as
+// constants, and the plan only needs to remember which one to call.
+// See kf_work_by_log2.
+#if SIZE_MAX > UINT32_MAX
+#define KF_MAX_LOG2_SAMPLES 40
+#else
+#define KF_MAX_LOG2_SAMPLES 31
+#endif
 
 struct kiss_fft_state {
-    struct kiss_fft_factor factors[MAXFACTORS];
-    kiss_fft_cpx twiddles[];  // actual size [samples - 1]
+    uint32_t log2_samples;
+    uint32_t leaf_log2;       // largest codelet to use; see kf_leaf_log2
+    uint32_t bitrev;          // permute input first?  see kf_bitrev
+    uint32_t depth_log2;      // largest depth-first sub-transform, or 0
+                              // for all of it; see kf_work_top
+    const kiss_fft_cpx *twiddles;  // see kf_stage_twiddles; points either
+                                   // to 'storage', into a wisdom file, or
+                                   // into a named segment
+    struct kf_named_header *named; // that segment, if any; see
+                                   // kiss_fft_alloc_named
+    kiss_fft_cpx storage[];
 };
 
+#if defined __GNUC__
+#define KF_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define KF_ALWAYS_INLINE inline
+#endif
+
+static uint64_t
+kf_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
 /*
   Explanation of macros dealing with complex math:
 
    C_MUL(res, a, b)   : res = a*b
+   C_MULC(res, a, b)  : res = a*conj(b)
    C_SUB(res, a, b)   : res = a - b
    C_SUBFROM(res, a)  : res -= a
    C_ADDTO(res, a)    : res += a
@@ -55,6 +91,12 @@ struct kiss_fft_state {
         (res).i = (a).r*(b).i + (a).i*(b).r;    \
     } while (0)
 
+#define C_MULC(res, a, b)                       \
+    do {                                        \
+        (res).r = (a).r*(b).r + (a).i*(b).i;    \
+        (res).i = (a).i*(b).r - (a).r*(b).i;    \
+    } while (0)
+
 #define C_ADD(res, a, b)                        \
     do {                                        \
         (res).r = (a).r + (b).r;                \
@@ -79,53 +121,69 @@ struct kiss_fft_state {
         (res).i -= (a).i;                       \
     } while (0)
 
-static void
-kf_bfly2(kiss_fft_cpx *Fout,
-         const size_t fstride,
-         const kiss_fft_state *st,
-         uint32_t m)
-{
-    kiss_fft_cpx *Fout2;
-    const kiss_fft_cpx *tw1 = st->twiddles;
-    kiss_fft_cpx t;
-    Fout2 = Fout + m;
-    do {
-        C_MUL(t, *Fout2, *tw1);
-        tw1 += fstride;
-        C_SUB(*Fout2, *Fout, t);
-        C_ADDTO(*Fout, t);
-        ++Fout2;
-        ++Fout;
-    } while (--m);
+// Each radix-4 stage has its own table of twiddle factors, laid out
+// in the order kf_bfly4 uses them: for a stage that combines four
+// DFTs of size M, the table holds the triples
+//
+//    (W**k, W**2k, W**3k) for 0 <= k < M, where W = exp(-2*pi*i/4M)
+//
+// so the butterfly loop streams through it sequentially.  A stage's
+// twiddles depend only on M, not on the overall transform size, so
+// the tables are stored in order of increasing M, and stage M's table
+// starts at offset 3*(1 + 2 + 4 + ... + M/2) = 3*(M - 1).  As a
+// consequence, the tables for N samples are a prefix of the tables
+// for 2N samples.
+static inline const kiss_fft_cpx *
+kf_stage_twiddles(const kiss_fft_state *st, size_t m)
+{
+    return st->twiddles + 3 * (m - 1);
 }
 
-static void
+// Total size of all the per-stage twiddle tables for a transform of
+// 2**LOG2_SAMPLES samples.
+static inline size_t
+kf_twiddle_count(uint32_t log2_samples)
+{
+    if (log2_samples < 2)
+        return 0;
+    return 3 * (((size_t)1 << (log2_samples - 2)) * 2 - 1);
+}
+
+// The radix-2 stage only ever occurs at the bottom of the recursion,
+// with m == 1, where its only twiddle factor is 1.
+static KF_ALWAYS_INLINE void
+kf_bfly2(kiss_fft_cpx *Fout)
+{
+    kiss_fft_cpx t = Fout[1];
+    C_SUB(Fout[1], Fout[0], t);
+    C_ADDTO(Fout[0], t);
+}
+
+// TW points to this stage's twiddles, in the order they are used:
+// see kf_stage_twiddles.  Only the first N of the M butterflies are
+// done; pass FOUT + k and TW + 3*k to start at butterfly k.
+static KF_ALWAYS_INLINE void
 kf_bfly4(kiss_fft_cpx *Fout,
-         const size_t fstride,
-         const kiss_fft_state *st,
-         const size_t m)
+         const kiss_fft_cpx *tw,
+         const size_t m,
+         const size_t n)
 {
-    const kiss_fft_cpx *tw1, *tw2, *tw3;
     kiss_fft_cpx scratch[6];
-    size_t k = m;
+    size_t k = n;
     const size_t m2 = 2 * m;
     const size_t m3 = 3 * m;
 
-    tw3 = tw2 = tw1 = st->twiddles;
-
     do {
-        C_MUL(scratch[0], Fout[m], *tw1);
-        C_MUL(scratch[1], Fout[m2], *tw2);
-        C_MUL(scratch[2], Fout[m3], *tw3);
+        C_MUL(scratch[0], Fout[m], tw[0]);
+        C_MUL(scratch[1], Fout[m2], tw[1]);
+        C_MUL(scratch[2], Fout[m3], tw[2]);
 
         C_SUB(scratch[5], *Fout, scratch[1]);
         C_ADDTO(*Fout, scratch[1]);
         C_ADD(scratch[3], scratch[0], scratch[2]);
         C_SUB(scratch[4], scratch[0], scratch[2]);
         C_SUB(Fout[m2], *Fout, scratch[3]);
-        tw1 += fstride;
-        tw2 += fstride * 2;
-        tw3 += fstride * 3;
+        tw += 3;
         C_ADDTO(*Fout, scratch[3]);
 
         Fout[m].r = scratch[5].r + scratch[4].i;
@@ -137,128 +195,5042 @@ kf_bfly4(kiss_fft_cpx *Fout,
     } while (--k);
 }
 
+// Bounded latency.  A radix-4 stage that combines four DFTs of size M
+// makes M butterflies; at the top of a transform of 2**30 samples,
+// that's 2**28 of them in one loop, which takes far longer than any
+// sensible interval between checks.  So stages with more than
+// KF_CHUNK_MIN butterflies are done a chunk at a time, with a check
+// after each chunk.  If should_stop->interval_ns is set, each chunk
+// is sized to take about half of it, going by the time taken by
+// earlier chunks; otherwise chunks are KF_CHUNK_DEFAULT butterflies.
+#define KF_CHUNK_MIN     ((size_t)1 << 12)
+#define KF_CHUNK_DEFAULT ((size_t)1 << 16)
+
+// Time per butterfly in a chunked stage, in picoseconds, as a moving
+// average over recent chunks; zero until the first chunk is timed.
+// It's only a hint, so all threads share it without locking.
+static _Atomic uint64_t kf_chunk_ps;
+
+// Number of butterflies to do before the next check, out of LEFT.
+static size_t
+kf_chunk_size(const kiss_fft_periodic_cb *should_stop, size_t left)
+{
+    const uint64_t ps =
+        atomic_load_explicit(&kf_chunk_ps, memory_order_relaxed);
+    size_t n = KF_CHUNK_DEFAULT;
+    if (should_stop->interval_ns && ps) {
+        const double want = (double)should_stop->interval_ns * 500.0
+            / (double)ps;
+        n = want < (double)KF_CHUNK_MIN ? KF_CHUNK_MIN
+            : want < (double)left ? (size_t)want : left;
+    }
+    return n < left ? n : left;
+}
+
+// Update kf_chunk_ps after doing N butterflies in NS nanoseconds.
+static void
+kf_chunk_timed(size_t n, uint64_t ns)
+{
+    uint64_t ps = ns * 1000 / n;
+    if (ps == 0)
+        ps = 1;
+    const uint64_t old =
+        atomic_load_explicit(&kf_chunk_ps, memory_order_relaxed);
+    atomic_store_explicit(&kf_chunk_ps, old ? (3 * old + ps) / 4 : ps,
+                          memory_order_relaxed);
+}
+
+// kf_bfly4 for a whole stage, a chunk at a time.
 static int
-kf_work(kiss_fft_cpx *Fout,
-        const kiss_fft_cpx *f,
-        const size_t fstride,
-        const struct kiss_fft_factor *factors,
-        const kiss_fft_state *st,
-        kiss_fft_periodic_cb *should_stop)
+kf_bfly4_chunked(kiss_fft_cpx *Fout,
+                 const kiss_fft_cpx *tw,
+                 const size_t m,
+                 kiss_fft_periodic_cb *should_stop)
+{
+    for (size_t k = 0; k < m;) {
+        const size_t n = kf_chunk_size(should_stop, m - k);
+        const uint64_t t0 = kf_now_ns();
+        kf_bfly4(Fout + k, tw + 3 * k, m, n);
+        kf_chunk_timed(n, kf_now_ns() - t0);
+        k += n;
+
+        int rv = should_stop->check(should_stop);
+        if (rv) return rv;
+    }
+    return 0;
+}
+
+// Leaf codelets.  These compute DFTs of 2, 4, 8, 16, 32, or 64 samples
+// with no calls to should_stop and no loops whose trip count isn't a
+// compile-time constant, so they come out as straight-line code.
+// They take the place of the bottom two or three levels of kf_work's
+// recursion, which would otherwise spend most of their time on call
+// overhead for very small sub-transforms.
+//
+// All the twiddle factors the codelets need are powers of
+// exp(-2*pi*i/64), which are tabulated here.
+static const kiss_fft_cpx kf_codelet_twiddles[48] = {
+    { 1.000000000f,  0.000000000f},
+    { 0.995184727f, -0.098017140f},
+    { 0.980785280f, -0.195090322f},
+    { 0.956940336f, -0.290284677f},
+    { 0.923879533f, -0.382683432f},
+    { 0.881921264f, -0.471396737f},
+    { 0.831469612f, -0.555570233f},
+    { 0.773010453f, -0.634393284f},
+    { 0.707106781f, -0.707106781f},
+    { 0.634393284f, -0.773010453f},
+    { 0.555570233f, -0.831469612f},
+    { 0.471396737f, -0.881921264f},
+    { 0.382683432f, -0.923879533f},
+    { 0.290284677f, -0.956940336f},
+    { 0.195090322f, -0.980785280f},
+    { 0.098017140f, -0.995184727f},
+    { 0.000000000f, -1.000000000f},
+    {-0.098017140f, -0.995184727f},
+    {-0.195090322f, -0.980785280f},
+    {-0.290284677f, -0.956940336f},
+    {-0.382683432f, -0.923879533f},
+    {-0.471396737f, -0.881921264f},
+    {-0.555570233f, -0.831469612f},
+    {-0.634393284f, -0.773010453f},
+    {-0.707106781f, -0.707106781f},
+    {-0.773010453f, -0.634393284f},
+    {-0.831469612f, -0.555570233f},
+    {-0.881921264f, -0.471396737f},
+    {-0.923879533f, -0.382683432f},
+    {-0.956940336f, -0.290284677f},
+    {-0.980785280f, -0.195090322f},
+    {-0.995184727f, -0.098017140f},
+    {-1.000000000f,  0.000000000f},
+    {-0.995184727f,  0.098017140f},
+    {-0.980785280f,  0.195090322f},
+    {-0.956940336f,  0.290284677f},
+    {-0.923879533f,  0.382683432f},
+    {-0.881921264f,  0.471396737f},
+    {-0.831469612f,  0.555570233f},
+    {-0.773010453f,  0.634393284f},
+    {-0.707106781f,  0.707106781f},
+    {-0.634393284f,  0.773010453f},
+    {-0.555570233f,  0.831469612f},
+    {-0.471396737f,  0.881921264f},
+    {-0.382683432f,  0.923879533f},
+    {-0.290284677f,  0.956940336f},
+    {-0.195090322f,  0.980785280f},
+    {-0.098017140f,  0.995184727f},
+};
+
+#if defined __GNUC__
+#define KF_UNROLL _Pragma("GCC unroll 16")
+#else
+#define KF_UNROLL
+#endif
+
+// Recombine four contiguous sub-DFTs of size M, in place, into one
+// DFT of size 4*M.  This is the same calculation as kf_bfly4, except
+// that the twiddles come from kf_codelet_twiddles.
+static KF_ALWAYS_INLINE void
+kf_codelet_bfly4(kiss_fft_cpx *Fout, const size_t m)
+{
+    const size_t tstep = 64 / (4 * m);
+    kiss_fft_cpx scratch[6];
+
+    KF_UNROLL
+    for (size_t j = 0; j < m; j++) {
+        if (j == 0) {
+            scratch[0] = Fout[m];
+            scratch[1] = Fout[2 * m];
+            scratch[2] = Fout[3 * m];
+        } else {
+            C_MUL(scratch[0], Fout[j + m],
+                  kf_codelet_twiddles[j * tstep]);
+            C_MUL(scratch[1], Fout[j + 2 * m],
+                  kf_codelet_twiddles[2 * j * tstep]);
+            C_MUL(scratch[2], Fout[j + 3 * m],
+                  kf_codelet_twiddles[3 * j * tstep]);
+        }
+
+        C_SUB(scratch[5], Fout[j], scratch[1]);
+        C_ADDTO(Fout[j], scratch[1]);
+        C_ADD(scratch[3], scratch[0], scratch[2]);
+        C_SUB(scratch[4], scratch[0], scratch[2]);
+        C_SUB(Fout[j + 2 * m], Fout[j], scratch[3]);
+        C_ADDTO(Fout[j], scratch[3]);
+
+        Fout[j + m].r = scratch[5].r + scratch[4].i;
+        Fout[j + m].i = scratch[5].i - scratch[4].r;
+        Fout[j + 3 * m].r = scratch[5].r - scratch[4].i;
+        Fout[j + 3 * m].i = scratch[5].i + scratch[4].r;
+    }
+}
+
+static KF_ALWAYS_INLINE void
+kf_codelet_2(kiss_fft_cpx *restrict Fout,
+             const kiss_fft_cpx *restrict f,
+             const size_t fstride)
+{
+    const kiss_fft_cpx a = f[0];
+    const kiss_fft_cpx b = f[fstride];
+    C_ADD(Fout[0], a, b);
+    C_SUB(Fout[1], a, b);
+}
+
+static KF_ALWAYS_INLINE void
+kf_codelet_4(kiss_fft_cpx *restrict Fout,
+             const kiss_fft_cpx *restrict f,
+             const size_t fstride)
+{
+    Fout[0] = f[0];
+    Fout[1] = f[fstride];
+    Fout[2] = f[2 * fstride];
+    Fout[3] = f[3 * fstride];
+    kf_codelet_bfly4(Fout, 1);
+}
+
+#define KF_CODELET(N, SUB)                                                \
+    static KF_ALWAYS_INLINE void                                          \
+    kf_codelet_##N(kiss_fft_cpx *restrict Fout,                           \
+                   const kiss_fft_cpx *restrict f,                        \
+                   const size_t fstride)                                  \
+    {                                                                     \
+        kf_codelet_##SUB(Fout,           f,               fstride * 4);   \
+        kf_codelet_##SUB(Fout + SUB,     f + fstride,     fstride * 4);   \
+        kf_codelet_##SUB(Fout + 2 * SUB, f + 2 * fstride, fstride * 4);   \
+        kf_codelet_##SUB(Fout + 3 * SUB, f + 3 * fstride, fstride * 4);   \
+        kf_codelet_bfly4(Fout, SUB);                                      \
+    }
+
+KF_CODELET(8, 2)
+KF_CODELET(16, 4)
+KF_CODELET(32, 8)
+KF_CODELET(64, 16)
+
+#undef KF_CODELET
+
+// All of the specialized copies of kf_work have this signature.
+// Each one computes the DFT of 2**L samples, taken from F at
+// intervals of FSTRIDE, and writes it to FOUT.  If F is NULL, the
+// samples have already been permuted into FOUT by kf_bitrev, and the
+// transform is done in place.
+typedef int kf_work_fn(kiss_fft_cpx *Fout,
+                       const kiss_fft_cpx *f,
+                       const size_t fstride,
+                       const kiss_fft_state *st,
+                       kiss_fft_periodic_cb *should_stop);
+
+// Common body of all the specialized copies of kf_work.  P and M are
+// the radix and stride of this stage; SUB is the copy of kf_work for
+// the next stage down, or NULL if M == 1.  Every caller passes
+// constants for all three, so after inlining, the compiler can see
+// the exact trip count of every loop.
+static KF_ALWAYS_INLINE int
+kf_work_stage(kiss_fft_cpx *Fout,
+              const kiss_fft_cpx *f,
+              const size_t fstride,
+              const kiss_fft_state *st,
+              kiss_fft_periodic_cb *should_stop,
+              const size_t p,
+              const size_t m,
+              kf_work_fn *sub)
 {
-    kiss_fft_cpx *Fout_beg = Fout;
-    const uint32_t p = factors->radix;   /* the radix  */
-    const uint32_t m = factors->stride;   /* stage's fft length/p */
-    const kiss_fft_cpx *Fout_end = Fout + p * m;
     int rv;
 
     if (m == 1) {
-        do {
-            *Fout = *f;
-            f += fstride;
-        } while (++Fout != Fout_end);
+        if (f) {
+            for (size_t q = 0; q < p; q++)
+                Fout[q] = f[q * fstride];
+        }
     } else {
-        do {
+        for (size_t q = 0; q < p; q++) {
             // recursive call:
             // DFT of size m*p performed by doing
             // p instances of smaller DFTs of size m,
             // each one takes a decimated version of the input
-            {
-                int rv = kf_work(Fout, f, fstride * p, factors + 1, st,
-                                 should_stop);
-                if (rv) return rv;
-            }
-            f += fstride;
-        } while ((Fout += m) != Fout_end);
+            rv = sub(Fout + q * m, f ? f + q * fstride : NULL,
+                     fstride * p, st, should_stop);
+            if (rv) return rv;
+        }
     }
 
     rv = should_stop->check(should_stop);
     if (rv) return rv;
 
-    Fout = Fout_beg;
-
     // recombine the p smaller DFTs
-    switch (p) {
-    case 2:
-        kf_bfly2(Fout, fstride, st, m);
-        break;
-    case 4:
-        kf_bfly4(Fout, fstride, st, m);
-        break;
-    default:
-        abort();
-    }
+    if (p == 2)
+        kf_bfly2(Fout);
+    else if (m > KF_CHUNK_MIN)
+        return kf_bfly4_chunked(Fout, kf_stage_twiddles(st, m), m,
+                                should_stop);
+    else
+        kf_bfly4(Fout, kf_stage_twiddles(st, m), m, m);
+
+    return should_stop->check(should_stop);
+}
 
+// A single sample is its own DFT.
+static int
+kf_work_0(kiss_fft_cpx *Fout, const kiss_fft_cpx *f, const size_t fstride,
+          const kiss_fft_state *st, kiss_fft_periodic_cb *should_stop)
+{
+    (void)fstride;
+    (void)st;
+    if (f)
+        *Fout = *f;
     return should_stop->check(should_stop);
 }
 
+#define KF_WORK_LEAF(L, P)                                                \
+    static int                                                            \
+    kf_work_##L(kiss_fft_cpx *Fout, const kiss_fft_cpx *f,                \
+                const size_t fstride, const kiss_fft_state *st,           \
+                kiss_fft_periodic_cb *should_stop)                        \
+    {                                                                     \
+        return kf_work_stage(Fout, f, fstride, st, should_stop,           \
+                             P, 1, NULL);                                 \
+    }
+
+// Copies of kf_work for sizes that have a codelet use it instead of
+// recursing further, if the plan says to.
+#define KF_WORK_CODELET(L, N, SUB)                                        \
+    static int                                                            \
+    kf_work_##L(kiss_fft_cpx *Fout, const kiss_fft_cpx *f,                \
+                const size_t fstride, const kiss_fft_state *st,           \
+                kiss_fft_periodic_cb *should_stop)                        \
+    {                                                                     \
+        if (st->leaf_log2 >= L) {                                         \
+            if (f) {                                                      \
+                kf_codelet_##N(Fout, f, fstride);                         \
+            } else {                                                      \
+                kiss_fft_cpx in[N];                                       \
+                memcpy(in, Fout, sizeof in);                              \
+                kf_codelet_##N(Fout, in, 1);                              \
+            }                                                             \
+            return 0;                                                     \
+        }                                                                 \
+        return kf_work_stage(Fout, f, fstride, st, should_stop,           \
+                             4, (size_t)1 << SUB, kf_work_##SUB);         \
+    }
+
+#define KF_WORK_RADIX4(L, SUB)                                            \
+    static int                                                            \
+    kf_work_##L(kiss_fft_cpx *Fout, const kiss_fft_cpx *f,                \
+                const size_t fstride, const kiss_fft_state *st,           \
+                kiss_fft_periodic_cb *should_stop)                        \
+    {                                                                     \
+        return kf_work_stage(Fout, f, fstride, st, should_stop,           \
+                             4, (size_t)1 << SUB, kf_work_##SUB);         \
+    }
+
+KF_WORK_LEAF(1, 2)
+KF_WORK_LEAF(2, 4)
+KF_WORK_RADIX4(3, 1)
+KF_WORK_CODELET(4, 16, 2)
+KF_WORK_CODELET(5, 32, 3)
+KF_WORK_CODELET(6, 64, 4)
+KF_WORK_RADIX4(7, 5)
+KF_WORK_RADIX4(8, 6)
+KF_WORK_RADIX4(9, 7)
+KF_WORK_RADIX4(10, 8)
+KF_WORK_RADIX4(11, 9)
+KF_WORK_RADIX4(12, 10)
+KF_WORK_RADIX4(13, 11)
+KF_WORK_RADIX4(14, 12)
+KF_WORK_RADIX4(15, 13)
+KF_WORK_RADIX4(16, 14)
+KF_WORK_RADIX4(17, 15)
+KF_WORK_RADIX4(18, 16)
+KF_WORK_RADIX4(19, 17)
+KF_WORK_RADIX4(20, 18)
+KF_WORK_RADIX4(21, 19)
+KF_WORK_RADIX4(22, 20)
+KF_WORK_RADIX4(23, 21)
+KF_WORK_RADIX4(24, 22)
+KF_WORK_RADIX4(25, 23)
+KF_WORK_RADIX4(26, 24)
+KF_WORK_RADIX4(27, 25)
+KF_WORK_RADIX4(28, 26)
+KF_WORK_RADIX4(29, 27)
+KF_WORK_RADIX4(30, 28)
+KF_WORK_RADIX4(31, 29)
+#if KF_MAX_LOG2_SAMPLES > 31
+KF_WORK_RADIX4(32, 30)
+KF_WORK_RADIX4(33, 31)
+KF_WORK_RADIX4(34, 32)
+KF_WORK_RADIX4(35, 33)
+KF_WORK_RADIX4(36, 34)
+KF_WORK_RADIX4(37, 35)
+KF_WORK_RADIX4(38, 36)
+KF_WORK_RADIX4(39, 37)
+KF_WORK_RADIX4(40, 38)
+#endif
+
+#undef KF_WORK_LEAF
+#undef KF_WORK_CODELET
+#undef KF_WORK_RADIX4
+
+static kf_work_fn *const kf_work_by_log2[KF_MAX_LOG2_SAMPLES + 1] = {
+    kf_work_0,  kf_work_1,  kf_work_2,  kf_work_3,
+    kf_work_4,  kf_work_5,  kf_work_6,  kf_work_7,
+    kf_work_8,  kf_work_9,  kf_work_10, kf_work_11,
+    kf_work_12, kf_work_13, kf_work_14, kf_work_15,
+    kf_work_16, kf_work_17, kf_work_18, kf_work_19,
+    kf_work_20, kf_work_21, kf_work_22, kf_work_23,
+    kf_work_24, kf_work_25, kf_work_26, kf_work_27,
+    kf_work_28, kf_work_29, kf_work_30, kf_work_31,
+#if KF_MAX_LOG2_SAMPLES > 31
+    kf_work_32, kf_work_33, kf_work_34, kf_work_35,
+    kf_work_36, kf_work_37, kf_work_38, kf_work_39,
+    kf_work_40,
+#endif
+};
+
+// Reverse the order of the low NDIGITS base-4 digits of X.
+static inline size_t
+kf_rev4(size_t x, unsigned ndigits)
+{
+    size_t r = 0;
+    while (ndigits--) {
+        r = (r << 2) | (x & 3);
+        x >>= 2;
+    }
+    return r;
+}
+
+// Hybrid traversal.  kf_work's depth-first recursion keeps each
+// sub-transform in cache while it's small enough, but above that it
+// jumps between stages of different sizes, each of which streams
+// through a different part of memory.  So for transforms much larger
+// than L2 cache, the plan does only the sub-transforms of
+// 2**depth_log2 samples depth-first, one after another, and then the
+// stages above them breadth-first, each in one sequential pass over
+// the whole array.
+
+// One breadth-first pass over the N samples at F, doing stage M for
+// every group of 4M samples.  Checks between chunks, as
+// kf_bfly4_chunked does, but the chunks can span groups.
+static int
+kf_pass(kiss_fft_cpx *F, const size_t n, const kiss_fft_state *st,
+        const size_t m, kiss_fft_periodic_cb *should_stop)
+{
+    const size_t total = n / 4;
+    const kiss_fft_cpx *tw = kf_stage_twiddles(st, m);
+
+    for (size_t b = 0; b < total;) {
+        const size_t c = kf_chunk_size(should_stop, total - b);
+        const size_t end = b + c;
+        const uint64_t t0 = kf_now_ns();
+        while (b < end) {
+            const size_t k = b % m;
+            const size_t run = m - k < end - b ? m - k : end - b;
+            kf_bfly4(F + b / m * 4 * m + k, tw + 3 * k, m, run);
+            b += run;
+        }
+        kf_chunk_timed(c, kf_now_ns() - t0);
+
+        int rv = should_stop->check(should_stop);
+        if (rv) return rv;
+    }
+    return 0;
+}
+
+// Do every stage of the plan up to and including those of size
+// 2**TOP, leaving the 2**(L - TOP) sub-transforms of that size
+// consecutively in FOUT, as kf_work's recursion would.  F and FOUT
+// are as for kf_work with FSTRIDE 1.  L - TOP must be even; TOP == L
+// is the whole transform.
+static int
+kf_work_top(kiss_fft_cpx *Fout, const kiss_fft_cpx *f,
+            const kiss_fft_state *st, const unsigned top,
+            kiss_fft_periodic_cb *should_stop)
+{
+    const unsigned L = st->log2_samples;
+    const unsigned d = st->depth_log2 && st->depth_log2 < top
+        ? st->depth_log2 : top;
+    const size_t nblocks = (size_t)1 << (L - d);
+    int rv;
+
+    // Sub-transform j's samples are the ones whose index, mod nblocks,
+    // has the base-4 digits of j in reverse; see kf_bitrev.
+    for (size_t j = 0; j < nblocks; j++) {
+        rv = kf_work_by_log2[d](Fout + (j << d),
+                                f ? f + kf_rev4(j, (L - d) / 2) : NULL,
+                                nblocks, st, should_stop);
+        if (rv) return rv;
+    }
+
+    const size_t n = (size_t)1 << L;
+    for (unsigned l = d; l < top; l += 2) {
+        rv = kf_pass(Fout, n, st, (size_t)1 << l, should_stop);
+        if (rv) return rv;
+    }
+    return 0;
+}
+
+// log2 of the size of the blocks at the bottom of the recursion:
+// either the codelet size, or the size of the last (4, 1) or (2, 1)
+// stage.  Within one of these blocks, kf_work reads its input in
+// natural order, at stride 4**(number of radix-4 stages above it).
+static unsigned
+kf_leaf_block_log2(const kiss_fft_state *st)
+{
+    if (st->leaf_log2)
+        return st->leaf_log2;
+    return st->log2_samples % 2 ? 1 : 2;
+}
+
+// kf_bitrev works on tiles of roughly 2**KF_BITREV_LOG2_TILE by
+// 2**KF_BITREV_LOG2_TILE samples, which should fit comfortably in L1
+// cache, and each row of which should span several cache lines.  The
+// tiles can be up to 2**(KF_BITREV_LOG2_TILE + 1) samples wide, to
+// accommodate the 64-sample codelet.
+#define KF_BITREV_LOG2_TILE 5
+
+// kiss_fft_alloc turns on the permutation pre-pass for transforms of
+// at least this many samples.  Below this size, the strided reads in
+// kf_work's leaves mostly hit in L2 and the extra pass doesn't pay.
+#define KF_BITREV_MIN_LOG2 18
+
+#if defined __GNUC__
+#define KF_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define KF_PREFETCH(addr) ((void)(addr))
+#endif
+
+// Where kf_bitrev and kf_gather get their samples: sample I is
+// element I*STRIDE of DATA, which holds kiss_fft_cpx if FORMAT is
+// KF_SOURCE_CPX, or else real PCM samples of the given KISS_FFT_PCM_
+// format, which are multiplied by SCALE.  If WINDOW is not NULL, each
+// sample is also multiplied by WINDOW[I] (see kiss_fft_spectrum).
+struct kf_source {
+    const void *data;
+    int format;
+    size_t stride;
+    float scale;
+    const float *window;
+};
+
+#define KF_SOURCE_CPX 0
+
+static KF_ALWAYS_INLINE size_t
+kf_source_elt_size(int format)
+{
+    switch (format) {
+    case KISS_FFT_PCM_S16: return sizeof(int16_t);
+    case KISS_FFT_PCM_S32: return sizeof(int32_t);
+    default:               return sizeof(kiss_fft_cpx);
+    }
+}
+
+// Convert N samples of SRC, starting at I0 and ISTEP apart, to
+// DST[0], DST[DSTEP], DST[2*DSTEP], ...
+static KF_ALWAYS_INLINE void
+kf_source_row(kiss_fft_cpx *restrict dst, const size_t dstep,
+              const struct kf_source *src, const size_t i0,
+              const size_t istep, const size_t n)
+{
+    const float *restrict win = src->window;
+    const size_t xstep = istep * src->stride;
+
+    if (src->format == KISS_FFT_PCM_S16 || src->format == KISS_FFT_PCM_S32) {
+        const int16_t *x16 = (const int16_t *)src->data + i0 * src->stride;
+        const int32_t *x32 = (const int32_t *)src->data + i0 * src->stride;
+        for (size_t c = 0; c < n; c++) {
+            float v = src->format == KISS_FFT_PCM_S16
+                ? (float)x16[c * xstep] : (float)x32[c * xstep];
+            v *= src->scale;
+            dst[c * dstep].r = win ? v * win[i0 + c * istep] : v;
+            dst[c * dstep].i = 0;
+        }
+        return;
+    }
+
+    const kiss_fft_cpx *x = (const kiss_fft_cpx *)src->data + i0 * src->stride;
+    if (win) {
+        for (size_t c = 0; c < n; c++) {
+            kiss_fft_cpx v = x[c * xstep];
+            v.r *= win[i0 + c * istep];
+            v.i *= win[i0 + c * istep];
+            dst[c * dstep] = v;
+        }
+    } else {
+        for (size_t c = 0; c < n; c++)
+            dst[c * dstep] = x[c * xstep];
+    }
+}
+
+// Whether SRC's samples are stored just as they are wanted, so can be
+// read in place.
+static KF_ALWAYS_INLINE bool
+kf_source_plain(const struct kf_source *src)
+{
+    return src->format == KF_SOURCE_CPX && src->stride == 1 && !src->window;
+}
+
+// Samples I0 to I0 + N - 1 of SRC: in place if it is plain, or else
+// converted into BUF, which has room for N.
+static KF_ALWAYS_INLINE const kiss_fft_cpx *
+kf_source_read(const struct kf_source *src, size_t i0, size_t n,
+               kiss_fft_cpx *buf)
+{
+    if (kf_source_plain(src))
+        return (const kiss_fft_cpx *)src->data + i0;
+    kf_source_row(buf, 1, src, i0, 1, n);
+    return buf;
+}
+
+// SRC moved on by I samples, with its window (if any) still starting
+// at the new first sample.
+static inline struct kf_source
+kf_source_skip(const struct kf_source *src, size_t i)
+{
+    struct kf_source s = *src;
+    s.data = (const char *)src->data
+        + i * src->stride * kf_source_elt_size(src->format);
+    return s;
+}
+
+// Permutation pre-pass.  Without this, each leaf of kf_work reads its
+// input from SRC at a stride of N/(block size) samples, so for large N
+// every load misses cache.  Instead, we can move every sample to the
+// place where the leaf wants it ahead of time, and then run kf_work
+// in place on DST.
+//
+// Write the sample index as i = (k, q[D-1], ..., q[1], q[0]), where
+// the q[d] are the base-4 digits that choose a path down the
+// recursion and k is the index within the leaf block.  The sample
+// belongs at j = (q[0], q[1], ..., q[D-1], k).  This is a close
+// relative of the bit-reversal permutation, and we use the
+// cache-blocked algorithm of Carter and Gatlin, "Towards an optimal
+// bit-reversal permutation program" (1998): split i into
+// (a, b, c), where a and c are a few bits wide; then j is
+// (rev(c), rev(b), rev'(a)).  For each value of b, we read all of
+// the (a, *, c) rows, each of which is contiguous, into a small
+// buffer, and then write out all of the (rev(c), *, rev'(a)) rows,
+// each of which is also contiguous.  The rows for the next b are
+// prefetched while we work on the current one.
+//
+// The samples are read through kf_source_row, so they can be
+// converted and windowed on the way.
+//
+// Requires log2_samples >= 2*KF_BITREV_LOG2_TILE + 2.
+static KF_ALWAYS_INLINE int
+kf_bitrev_body(kiss_fft_cpx *restrict dst,
+               const struct kf_source *src,
+               const kiss_fft_state *st,
+               kiss_fft_periodic_cb *should_stop)
+{
+    const unsigned L = st->log2_samples;
+    const unsigned s = kf_leaf_block_log2(st);
+
+    // tc and ta must both be aligned to the digit boundaries, and a
+    // must take in all of k.
+    const unsigned tc = KF_BITREV_LOG2_TILE & ~1u;
+    const unsigned ta = s > tc ? s : tc + (s & 1);
+    const unsigned tb = L - ta - tc;
+
+    const size_t nc = (size_t)1 << tc;
+    const size_t na = (size_t)1 << ta;
+    const size_t nb = (size_t)1 << tb;
+
+    const size_t elt_size = kf_source_elt_size(src->format);
+    const size_t row_bytes = nc * src->stride * elt_size;
+
+    size_t rev_a[(size_t)1 << (KF_BITREV_LOG2_TILE + 1)];
+    size_t rev_c[(size_t)1 << KF_BITREV_LOG2_TILE];
+    kiss_fft_cpx buf[(size_t)1 << (2 * KF_BITREV_LOG2_TILE + 1)];
+
+    // The high bits of a are the top s bits of the leaf index k, which
+    // stay in order; the rest are digits to be reversed.
+    for (size_t a = 0; a < na; a++)
+        rev_a[a] = (a >> (ta - s))
+            | (kf_rev4(a & (((size_t)1 << (ta - s)) - 1), (ta - s) / 2) << s);
+    for (size_t c = 0; c < nc; c++)
+        rev_c[c] = kf_rev4(c, tc / 2) << (tb + ta);
+
+    for (size_t b = 0; b < nb; b++) {
+        const size_t rev_b = kf_rev4(b, tb / 2) << ta;
+
+        if (b + 1 < nb) {
+            for (size_t a = 0; a < na; a++) {
+                const size_t next = (a << (tb + tc)) + ((b + 1) << tc);
+                const char *x = (const char *)src->data
+                    + next * src->stride * elt_size;
+                for (size_t c = 0; c < row_bytes; c += 64)
+                    KF_PREFETCH(x + c);
+                if (src->window) {
+                    const float *w = src->window + next;
+                    for (size_t c = 0; c < nc; c += 64 / sizeof(float))
+                        KF_PREFETCH(w + c);
+                }
+            }
+        }
+
+        for (size_t a = 0; a < na; a++)
+            kf_source_row(buf + rev_a[a], na, src,
+                          (a << (tb + tc)) + (b << tc), 1, nc);
+
+        for (size_t c = 0; c < nc; c++)
+            memcpy(dst + rev_c[c] + rev_b, buf + (c << ta),
+                   na * sizeof(kiss_fft_cpx));
+
+        int rv = should_stop->check(should_stop);
+        if (rv) return rv;
+    }
+    return 0;
+}
+
+static int
+kf_bitrev(kiss_fft_cpx *restrict dst,
+          const kiss_fft_cpx *restrict src,
+          const kiss_fft_state *st,
+          kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_source source = { src, KF_SOURCE_CPX, 1, 1.0f, NULL };
+    return kf_bitrev_body(dst, &source, st, should_stop);
+}
+
 int
 kiss_fft(kiss_fft_state *st, const kiss_fft_cpx *fin, kiss_fft_cpx *fout,
          kiss_fft_periodic_cb *should_stop)
 {
-    return kf_work(fout, fin, 1, st->factors, st, should_stop);
+    if (st->bitrev) {
+        int rv = kf_bitrev(fout, fin, st, should_stop);
+        if (rv) return rv;
+        fin = NULL;
+    }
+    return kf_work_top(fout, fin, st, st->log2_samples, should_stop);
 }
 
-/* populate facbuf with { p1, m1 }, { p2, m2 }, ....
-    where
-    p[i] * m[i] = m[i-1]
-    m0 = n                  */
-static bool
-kf_factor(uint32_t n, struct kiss_fft_factor facbuf[static MAXFACTORS])
+// Gather SRC into DST in the order kf_work expects when run in place.
+// kf_bitrev does this a tile at a time; it doesn't work for small
+// transforms, which fit in cache anyway, so those go a leaf block at
+// a time.
+static int
+kf_gather(kiss_fft_cpx *restrict dst,
+          const struct kf_source *src,
+          const kiss_fft_state *st,
+          kiss_fft_periodic_cb *should_stop)
 {
-    // Factor out all powers of 4 first
-    size_t i = 0;
-    while (n % 4 == 0) {
-        if (i >= MAXFACTORS)
-            // overrun, should be impossible, handle gracefully anyway
-            return false;
-        n /= 4;
-        facbuf[i].radix = 4;
-        facbuf[i].stride = n;
-        i++;
+    const unsigned L = st->log2_samples;
+    if (L >= 2 * KF_BITREV_LOG2_TILE + 2)
+        return kf_bitrev_body(dst, src, st, should_stop);
+
+    // i = (k, q), j = (rev(q), k); see kf_bitrev
+    const unsigned s = kf_leaf_block_log2(st) < L
+        ? kf_leaf_block_log2(st) : L;
+    const size_t nq = (size_t)1 << (L - s);
+    for (size_t q = 0; q < nq; q++)
+        kf_source_row(dst + (kf_rev4(q, (L - s) / 2) << s), 1,
+                      src, q, nq, (size_t)1 << s);
+    return should_stop->check(should_stop);
+}
+
+// Transform the samples of SRC into FOUT: kiss_fft if they can be
+// read in place, or else gathered into FOUT and transformed there.
+static int
+kf_fft_source(kiss_fft_state *st, const struct kf_source *src,
+              kiss_fft_cpx *fout, kiss_fft_periodic_cb *should_stop)
+{
+    if (kf_source_plain(src))
+        return kiss_fft(st, src->data, fout, should_stop);
+    int rv = kf_gather(fout, src, st, should_stop);
+    if (rv) return rv;
+    return kf_work_top(fout, NULL, st, st->log2_samples, should_stop);
+}
+
+int
+kiss_fft_pcm(kiss_fft_state *st, const void *fin, int format,
+             size_t stride, float scale, kiss_fft_cpx *fout,
+             kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_source src = { fin, format, stride, scale, NULL };
+    return kf_fft_source(st, &src, fout, should_stop);
+}
+
+// Scrambled-order transforms.  When a spectrum is only going to be
+// multiplied pointwise by another and transformed back, as in a
+// convolution, the order of its bins doesn't matter, and the pass
+// that kiss_fft spends putting its input in the order kf_work wants
+// (kf_bitrev or kf_gather) is wasted.  So here the forward transform
+// is done by decimation in frequency, which reads its input in
+// natural order and leaves its output digit-reversed, and the inverse
+// by decimation in time, which undoes exactly that.  Both work in
+// place, and only need the plan's twiddle factors.
+//
+// With N = 4M, the forward step replaces each (x[k], x[k+M],
+// x[k+2M], x[k+3M]) with (y0, W**k y1, W**2k y2, W**3k y3), where
+// y_q = sum over t of x[k+tM] (-i)**(qt), and then the M-point
+// transform of quarter q gives the bins q, q+4, q+8, ...  The
+// inverse step is the same in reverse, with conjugate twiddles and
+// i for -i.
+
+// Forward step for the first N of the M positions, reading from F,
+// which may be FOUT; TW is this stage's twiddles, as for kf_bfly4.
+static KF_ALWAYS_INLINE void
+kf_dif4(kiss_fft_cpx *Fout,
+        const kiss_fft_cpx *f,
+        const kiss_fft_cpx *tw,
+        const size_t m,
+        const size_t n)
+{
+    for (size_t k = 0; k < n; k++) {
+        kiss_fft_cpx s0, s1, s2, s3, t;
+        C_ADD(s0, f[k], f[k + 2 * m]);
+        C_SUB(s1, f[k], f[k + 2 * m]);
+        C_ADD(s2, f[k + m], f[k + 3 * m]);
+        C_SUB(s3, f[k + m], f[k + 3 * m]);
+
+        C_ADD(Fout[k], s0, s2);
+        C_SUB(t, s0, s2);
+        C_MUL(Fout[k + 2 * m], t, tw[3 * k + 1]);
+        t.r = s1.r + s3.i;
+        t.i = s1.i - s3.r;
+        C_MUL(Fout[k + m], t, tw[3 * k]);
+        t.r = s1.r - s3.i;
+        t.i = s1.i + s3.r;
+        C_MUL(Fout[k + 3 * m], t, tw[3 * k + 2]);
     }
+}
 
-    // then remaining powers of 2 (at most one, but we write the loop anyway)
-    while (n % 2 == 0) {
-        if (i >= MAXFACTORS)
-            // overrun, should be impossible, handle gracefully anyway
-            return false;
-        n /= 2;
-        facbuf[i].radix = 2;
-        facbuf[i].stride = n;
-        i++;
+// Inverse step, likewise.
+static KF_ALWAYS_INLINE void
+kf_idit4(kiss_fft_cpx *Fout,
+         const kiss_fft_cpx *tw,
+         const size_t m,
+         const size_t n)
+{
+    for (size_t k = 0; k < n; k++) {
+        kiss_fft_cpx b1, b2, b3, t0, t1, t2, t3;
+        C_MULC(b1, Fout[k + m], tw[3 * k]);
+        C_MULC(b2, Fout[k + 2 * m], tw[3 * k + 1]);
+        C_MULC(b3, Fout[k + 3 * m], tw[3 * k + 2]);
+
+        C_ADD(t0, Fout[k], b2);
+        C_SUB(t1, Fout[k], b2);
+        C_ADD(t2, b1, b3);
+        C_SUB(t3, b1, b3);
+
+        C_ADD(Fout[k], t0, t2);
+        C_SUB(Fout[k + 2 * m], t0, t2);
+        Fout[k + m].r = t1.r - t3.i;
+        Fout[k + m].i = t1.i + t3.r;
+        Fout[k + 3 * m].r = t1.r + t3.i;
+        Fout[k + 3 * m].i = t1.i - t3.r;
     }
+}
 
-    // fail if input was not a power of two
-    return n == 1;
+// Blocks of this many samples or fewer are done a stage at a time,
+// with no checks, rather than by recursion.
+#define KF_SCRAMBLED_LEAF 64
+#define KF_ODD_POWERS_OF_TWO 0xaau  // 2, 8, 32, 128, up to the leaf size
+
+// One step of size 4M on the block at F, a chunk at a time if it's
+// big, as in kf_bfly4_chunked.  A forward step reads from SRC, which
+// may be F; an inverse step is always in place.
+static int
+kf_scrambled_step(kiss_fft_cpx *F, const kiss_fft_cpx *src,
+                  const kiss_fft_state *st, const size_t m,
+                  const bool inverse, kiss_fft_periodic_cb *should_stop)
+{
+    const kiss_fft_cpx *tw = kf_stage_twiddles(st, m);
+    const bool chunked = m > KF_CHUNK_MIN;
+    for (size_t k = 0; k < m;) {
+        const size_t c = chunked ? kf_chunk_size(should_stop, m - k) : m;
+        const uint64_t t0 = chunked ? kf_now_ns() : 0;
+        if (inverse)
+            kf_idit4(F + k, tw + 3 * k, m, c);
+        else
+            kf_dif4(F + k, src + k, tw + 3 * k, m, c);
+        if (chunked)
+            kf_chunk_timed(c, kf_now_ns() - t0);
+        k += c;
+
+        int rv = should_stop->check(should_stop);
+        if (rv) return rv;
+    }
+    return 0;
 }
 
-/*
- *
- * User-callable function to allocate all necessary storage space for the fft.
- *
- * The return value is a contiguous block of memory, allocated with malloc.  As such,
- * It can be freed with free(), rather than a kiss_fft-specific function.
- * */
-kiss_fft_state *kiss_fft_alloc(uint32_t samples)
+// Leaf blocks, in place.  Every caller passes a constant N, so the
+// loops can be unrolled.
+static KF_ALWAYS_INLINE void
+kf_dif_leaf(kiss_fft_cpx *F, const size_t n, const kiss_fft_state *st)
 {
-    size_t memneeded = sizeof(struct kiss_fft_state)
-        + sizeof(kiss_fft_cpx) * (samples - 1);     /* twiddle factors */
+    for (size_t m = n / 4; m >= 1; m /= 4)
+        for (size_t g = 0; g < n; g += 4 * m)
+            kf_dif4(F + g, F + g, kf_stage_twiddles(st, m), m, m);
+    // odd power of two: the radix-2 step comes last
+    if (n & KF_ODD_POWERS_OF_TWO)
+        for (size_t g = 0; g < n; g += 2)
+            kf_bfly2(F + g);
+}
 
-    kiss_fft_state *st = malloc(memneeded);
-    if (!st)
+static KF_ALWAYS_INLINE void
+kf_idit_leaf(kiss_fft_cpx *F, const size_t n, const kiss_fft_state *st)
+{
+    size_t m = 1;
+    if (n & KF_ODD_POWERS_OF_TWO) {
+        // odd power of two: the radix-2 step comes first
+        for (size_t g = 0; g < n; g += 2)
+            kf_bfly2(F + g);
+        m = 2;
+    }
+    for (; 4 * m <= n; m *= 4)
+        for (size_t g = 0; g < n; g += 4 * m)
+            kf_idit4(F + g, kf_stage_twiddles(st, m), m, m);
+}
+
+// Forward transform of the N samples at SRC, which may be F, into F.
+// Only the first step reads from SRC; the rest is done in place.
+static int
+kf_dif(kiss_fft_cpx *F, const kiss_fft_cpx *src, const size_t n,
+       const kiss_fft_state *st, kiss_fft_periodic_cb *should_stop)
+{
+    if (n <= KF_SCRAMBLED_LEAF) {
+        if (src != F)
+            memcpy(F, src, n * sizeof(kiss_fft_cpx));
+        // large transforms always come down to one of these two
+        if (n == KF_SCRAMBLED_LEAF)
+            kf_dif_leaf(F, KF_SCRAMBLED_LEAF, st);
+        else if (n == KF_SCRAMBLED_LEAF / 2)
+            kf_dif_leaf(F, KF_SCRAMBLED_LEAF / 2, st);
+        else
+            kf_dif_leaf(F, n, st);
         return 0;
+    }
 
-    if (!kf_factor(samples, st->factors)) {
-        // samples is not a power of two or is too big
-        free(st);
-        return (kiss_fft_state *)-1;
+    const size_t m = n / 4;
+    int rv = kf_scrambled_step(F, src, st, m, false, should_stop);
+    if (rv) return rv;
+    for (size_t q = 0; q < 4; q++) {
+        rv = kf_dif(F + q * m, F + q * m, m, st, should_stop);
+        if (rv) return rv;
     }
+    return 0;
+}
 
-    for (uint32_t i = 0; i < samples - 1; ++i) {
-        double phase = -2.0 * M_PI * i / samples;
-        // set st->twiddles[i] = cexp(J * phase) where J is the imaginary unit
-        st->twiddles[i].r = cosf((float) phase);
-        st->twiddles[i].i = sinf((float) phase);
+// Inverse transform of the N scrambled bins at SRC, which may be F,
+// into F.  Each leaf block is copied from SRC as it's reached.
+static int
+kf_idit(kiss_fft_cpx *F, const kiss_fft_cpx *src, const size_t n,
+        const kiss_fft_state *st, kiss_fft_periodic_cb *should_stop)
+{
+    if (n <= KF_SCRAMBLED_LEAF) {
+        if (src != F)
+            memcpy(F, src, n * sizeof(kiss_fft_cpx));
+        if (n == KF_SCRAMBLED_LEAF)
+            kf_idit_leaf(F, KF_SCRAMBLED_LEAF, st);
+        else if (n == KF_SCRAMBLED_LEAF / 2)
+            kf_idit_leaf(F, KF_SCRAMBLED_LEAF / 2, st);
+        else
+            kf_idit_leaf(F, n, st);
+        return 0;
     }
-    return st;
+
+    const size_t m = n / 4;
+    int rv;
+    for (size_t q = 0; q < 4; q++) {
+        rv = kf_idit(F + q * m, src + q * m, m, st, should_stop);
+        if (rv) return rv;
+    }
+    return kf_scrambled_step(F, F, st, m, true, should_stop);
+}
+
+int
+kiss_fft_scrambled(kiss_fft_state *st, const kiss_fft_cpx *fin,
+                   kiss_fft_cpx *fout, kiss_fft_periodic_cb *should_stop)
+{
+    const size_t n = (size_t)1 << st->log2_samples;
+    int rv = kf_dif(fout, fin, n, st, should_stop);
+    if (rv) return rv;
+    return should_stop->check(should_stop);
+}
+
+int
+kiss_ifft_scrambled(kiss_fft_state *st, const kiss_fft_cpx *fin,
+                    kiss_fft_cpx *fout, kiss_fft_periodic_cb *should_stop)
+{
+    const size_t n = (size_t)1 << st->log2_samples;
+    int rv = kf_idit(fout, fin, n, st, should_stop);
+    if (rv) return rv;
+    return should_stop->check(should_stop);
+}
+
+// Batched transforms.  Vectorizing within one small transform is
+// awkward, but if we have many of them to do, we can put each one in
+// a different SIMD lane and run the butterflies on whole vectors of
+// transforms at once.  This uses GCC's generic vector extension, which
+// the compiler lowers to whatever SIMD instructions are available.
+
+#if defined __GNUC__
+
+// Use the widest vectors the target supports natively; GCC emulates
+// wider ones, but the emulation is slower than scalar code.
+#if defined __AVX__
+#define KF_BATCH_LANES 8
+#else
+#define KF_BATCH_LANES 4
+#endif
+typedef float kf_vec
+    __attribute__((vector_size(KF_BATCH_LANES * sizeof(float))));
+typedef struct kf_vcpx {
+    kf_vec r;
+    kf_vec i;
+} kf_vcpx;
+
+// Only transforms this small use the vector engine; its working
+// buffer has to stay in L1 cache for it to win.
+#define KF_BATCH_MAX_LOG2 10
+
+// Same as kf_bfly4, but on vectors of transforms.
+static KF_ALWAYS_INLINE void
+kf_vbfly4(kf_vcpx *Fout, const kiss_fft_cpx *tw, const size_t m)
+{
+    for (size_t k = 0; k < m; k++, tw += 3) {
+        kf_vcpx s0, s1, s2, s3, s4, s5;
+        kf_vcpx *F0 = Fout + k, *F1 = F0 + m, *F2 = F1 + m, *F3 = F2 + m;
+        const kf_vec zero = { 0 };
+        const kf_vec w1r = zero + tw[0].r, w1i = zero + tw[0].i;
+        const kf_vec w2r = zero + tw[1].r, w2i = zero + tw[1].i;
+        const kf_vec w3r = zero + tw[2].r, w3i = zero + tw[2].i;
+
+        s0.r = F1->r * w1r - F1->i * w1i;
+        s0.i = F1->r * w1i + F1->i * w1r;
+        s1.r = F2->r * w2r - F2->i * w2i;
+        s1.i = F2->r * w2i + F2->i * w2r;
+        s2.r = F3->r * w3r - F3->i * w3i;
+        s2.i = F3->r * w3i + F3->i * w3r;
+
+        s5.r = F0->r - s1.r;
+        s5.i = F0->i - s1.i;
+        F0->r += s1.r;
+        F0->i += s1.i;
+        s3.r = s0.r + s2.r;
+        s3.i = s0.i + s2.i;
+        s4.r = s0.r - s2.r;
+        s4.i = s0.i - s2.i;
+        F2->r = F0->r - s3.r;
+        F2->i = F0->i - s3.i;
+        F0->r += s3.r;
+        F0->i += s3.i;
+
+        F1->r = s5.r + s4.i;
+        F1->i = s5.i - s4.r;
+        F3->r = s5.r - s4.i;
+        F3->i = s5.i + s4.r;
+    }
+}
+
+// kf_vbfly4 for m == 1, where all the twiddles are 1.
+static KF_ALWAYS_INLINE void
+kf_vbfly4_first(kf_vcpx *F)
+{
+    kf_vcpx s3, s4, s5;
+
+    s5.r = F[0].r - F[2].r;
+    s5.i = F[0].i - F[2].i;
+    F[0].r += F[2].r;
+    F[0].i += F[2].i;
+    s3.r = F[1].r + F[3].r;
+    s3.i = F[1].i + F[3].i;
+    s4.r = F[1].r - F[3].r;
+    s4.i = F[1].i - F[3].i;
+    F[2].r = F[0].r - s3.r;
+    F[2].i = F[0].i - s3.i;
+    F[0].r += s3.r;
+    F[0].i += s3.i;
+
+    F[1].r = s5.r + s4.i;
+    F[1].i = s5.i - s4.r;
+    F[3].r = s5.r - s4.i;
+    F[3].i = s5.i + s4.r;
+}
+
+// Transform LANES (<= KF_BATCH_LANES) consecutive inputs from SRC
+// into FOUT, using BUF as scratch.  PERM maps each sample index to its
+// position after digit reversal, as in kf_bitrev, with blocks of 2 or
+// 4 at the bottom of the recursion; each stage is then done
+// breadth-first across BUF.
+static void
+kf_batch_group(const kiss_fft_state *st,
+               const struct kf_source *src,
+               kiss_fft_cpx *fout,
+               size_t lanes,
+               kf_vcpx *buf,
+               const uint16_t *perm)
+{
+    const uint32_t L = st->log2_samples;
+    const size_t n = (size_t)1 << L;
+
+    if (lanes == KF_BATCH_LANES && kf_source_plain(src)) {
+        const kiss_fft_cpx *fin = src->data;
+        for (size_t j = 0; j < n; j++) {
+            kf_vcpx v;
+            for (size_t l = 0; l < KF_BATCH_LANES; l++) {
+                v.r[l] = fin[l * n + j].r;
+                v.i[l] = fin[l * n + j].i;
+            }
+            buf[perm[j]] = v;
+        }
+    } else {
+        if (lanes < KF_BATCH_LANES)
+            memset(buf, 0, n * sizeof(kf_vcpx));
+        for (size_t l = 0; l < lanes; l++) {
+            for (size_t j = 0; j < n; j++) {
+                kiss_fft_cpx v;
+                kf_source_row(&v, 1, src, l * n + j, 1, 1);
+                buf[perm[j]].r[l] = v.r;
+                buf[perm[j]].i[l] = v.i;
+            }
+        }
+    }
+
+    size_t m;
+    if (L % 2) {
+        for (size_t b = 0; b < n; b += 2) {
+            kf_vcpx t = buf[b + 1];
+            buf[b + 1].r = buf[b].r - t.r;
+            buf[b + 1].i = buf[b].i - t.i;
+            buf[b].r += t.r;
+            buf[b].i += t.i;
+        }
+        m = 2;
+    } else {
+        for (size_t b = 0; b < n; b += 4)
+            kf_vbfly4_first(buf + b);
+        m = 4;
+    }
+    for (; m < n; m *= 4) {
+        const kiss_fft_cpx *tw = kf_stage_twiddles(st, m);
+        for (size_t b = 0; b < n; b += 4 * m)
+            kf_vbfly4(buf + b, tw, m);
+    }
+
+    for (size_t l = 0; l < lanes; l++) {
+        kiss_fft_cpx *out = fout + l * n;
+        for (size_t k = 0; k < n; k++) {
+            out[k].r = buf[k].r[l];
+            out[k].i = buf[k].i[l];
+        }
+    }
+}
+
+#endif // __GNUC__
+
+static int
+kf_batch(kiss_fft_state *st, const struct kf_source *src,
+         kiss_fft_cpx *fout, size_t batch,
+         kiss_fft_periodic_cb *should_stop)
+{
+    const uint32_t L = st->log2_samples;
+    const size_t n = (size_t)1 << L;
+    int rv;
+
+#if defined __GNUC__
+    if (L >= 2 && L <= KF_BATCH_MAX_LOG2) {
+        kf_vcpx *buf;
+        if (posix_memalign((void **)&buf, sizeof(kf_vec),
+                           n * sizeof(kf_vcpx)))
+            goto scalar;
+
+        uint16_t perm[(size_t)1 << KF_BATCH_MAX_LOG2];
+        const unsigned s = L % 2 ? 1 : 2;
+        const unsigned ndigits = (L - s) / 2;
+        for (size_t i = 0; i < n; i++)
+            perm[i] = (uint16_t)((kf_rev4(i, ndigits) << s)
+                                 | (i >> (2 * ndigits)));
+
+        // Check for interruption about every 2**16 samples.
+        const size_t per_group = KF_BATCH_LANES * n;
+        const size_t groups_per_check =
+            per_group >= 65536 ? 1 : 65536 / per_group;
+
+        rv = 0;
+        for (size_t g = 0, done = 0; done < batch; g++) {
+            size_t lanes = batch - done;
+            if (lanes > KF_BATCH_LANES)
+                lanes = KF_BATCH_LANES;
+            const struct kf_source group = kf_source_skip(src, done * n);
+            kf_batch_group(st, &group, fout + done * n, lanes, buf, perm);
+            done += lanes;
+            if ((g + 1) % groups_per_check == 0 || done == batch) {
+                rv = should_stop->check(should_stop);
+                if (rv) break;
+            }
+        }
+        free(buf);
+        return rv;
+    }
+ scalar:
+#endif
+
+    for (size_t b = 0; b < batch; b++) {
+        const struct kf_source one = kf_source_skip(src, b * n);
+        rv = kf_fft_source(st, &one, fout + b * n, should_stop);
+        if (rv) return rv;
+    }
+    return 0;
+}
+
+int
+kiss_fft_batch(kiss_fft_state *st, const kiss_fft_cpx *fin,
+               kiss_fft_cpx *fout, size_t batch,
+               kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_source src = { fin, KF_SOURCE_CPX, 1, 1.0f, NULL };
+    return kf_batch(st, &src, fout, batch, should_stop);
+}
+
+int
+kiss_fft_batch_pcm(kiss_fft_state *st, const void *fin, int format,
+                   size_t stride, float scale, kiss_fft_cpx *fout,
+                   size_t batch, kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_source src = { fin, format, stride, scale, NULL };
+    return kf_batch(st, &src, fout, batch, should_stop);
+}
+
+// Pruned transforms.  If only a few output bins are wanted, most of
+// the butterflies in the upper stages of the recursion compute outputs
+// that nobody will look at.  Output k of a 4m-point stage depends only
+// on outputs (k mod m) of its four m-point sub-transforms, so working
+// down from the top, each level needs only the residues of the
+// requested bins, and the upper levels can compute just those.  Once
+// the residues cover a large enough fraction of a level, pruning stops
+// paying off, and the rest of the recursion is done in full by
+// kf_work.
+
+// The residues of the requested bins, modulo the size of one level of
+// the recursion, sorted and without duplicates; for each of them, CHILD
+// is the index of its own residue in the next level down.
+struct kf_prune_level {
+    size_t count;
+    size_t *residues;
+    size_t *child;
+};
+
+// Stop pruning at a level where at least this fraction of the outputs
+// are needed.  A pruned output costs several times as much as an
+// output of a full radix-4 stage, and the bookkeeping isn't free
+// either.
+#define KF_PRUNE_MIN_SPARSITY 16
+
+// Requests for this many bins or fewer use the Goertzel algorithm
+// instead, which makes one pass over the input per four bins, but
+// doesn't need any scratch memory.
+#define KF_GOERTZEL_MAX_BINS 8
+
+static int
+kf_size_cmp(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Return the index of X in the sorted array V of N elements, which
+// must contain it.
+static size_t
+kf_size_find(const size_t *v, size_t n, size_t x)
+{
+    size_t lo = 0;
+    while (n > 1) {
+        size_t half = n / 2;
+        if (v[lo + half] <= x)
+            lo += half;
+        n -= half;
+    }
+    return lo;
+}
+
+// Sort V, of N elements, and remove duplicates; return the new length.
+static size_t
+kf_sort_unique(size_t *v, size_t n)
+{
+    if (n == 0)
+        return 0;
+    qsort(v, n, sizeof *v, kf_size_cmp);
+    size_t j = 1;
+    for (size_t i = 1; i < n; i++)
+        if (v[i] != v[j - 1])
+            v[j++] = v[i];
+    return j;
+}
+
+// Compute the outputs listed in LV[L] of the 2**L-point transform of
+// the samples at F, F + FSTRIDE, ..., writing them to OUT in the same
+// order.  Levels C and below are done in full.  SCRATCH has room for
+// four sets of outputs of every level below this one.  As with
+// kf_work, if F is NULL the samples have already been permuted by
+// kf_bitrev, into PERM; then the level C transforms are done in place
+// there, and their part of SCRATCH is unused.
+static int
+kf_prune_work(kiss_fft_cpx *out, const kiss_fft_cpx *f, size_t fstride,
+              kiss_fft_cpx *perm, const kiss_fft_state *st,
+              const struct kf_prune_level *lv, unsigned l, unsigned c,
+              kiss_fft_cpx *scratch, kiss_fft_periodic_cb *should_stop)
+{
+    const size_t m = (size_t)1 << (l - 2);
+    const size_t nchild = l - 2 == c ? m : lv[l - 2].count;
+    kiss_fft_cpx *F[4];
+    int rv;
+
+    for (size_t q = 0; q < 4; q++) {
+        F[q] = l - 2 == c && !f ? perm + q * m : scratch + q * nchild;
+        if (l - 2 == c)
+            rv = kf_work_by_log2[c](F[q], f ? f + q * fstride : NULL,
+                                    fstride * 4, st, should_stop);
+        else
+            rv = kf_prune_work(F[q], f ? f + q * fstride : NULL,
+                               fstride * 4, perm + q * m, st, lv, l - 2, c,
+                               scratch + 4 * nchild, should_stop);
+        if (rv) return rv;
+    }
+
+    const kiss_fft_cpx *tw = kf_stage_twiddles(st, m);
+    const kiss_fft_cpx *F0 = F[0], *F1 = F[1], *F2 = F[2], *F3 = F[3];
+    for (size_t i = 0; i < lv[l].count; i++) {
+        const size_t k = lv[l].residues[i];
+        const size_t r = k & (m - 1);
+        const size_t j = l - 2 == c ? r : lv[l].child[i];
+        kiss_fft_cpx s1, s2, s3, a, b, d, e;
+
+        C_MUL(s1, F1[j], tw[3 * r]);
+        C_MUL(s2, F2[j], tw[3 * r + 1]);
+        C_MUL(s3, F3[j], tw[3 * r + 2]);
+
+        // the rows of the radix-4 butterfly in kf_bfly4
+        C_ADD(a, F0[j], s2);
+        C_SUB(b, F0[j], s2);
+        C_ADD(d, s1, s3);
+        C_SUB(e, s1, s3);
+        switch (k >> (l - 2)) {
+        case 0:
+            C_ADD(out[i], a, d);
+            break;
+        case 1:
+            out[i].r = b.r + e.i;
+            out[i].i = b.i - e.r;
+            break;
+        case 2:
+            C_SUB(out[i], a, d);
+            break;
+        default:
+            out[i].r = b.r - e.i;
+            out[i].i = b.i + e.r;
+            break;
+        }
+    }
+    return should_stop->check(should_stop);
+}
+
+// The Goertzel algorithm computes one bin of the DFT with a
+// second-order recurrence over the input.  We run it for up to
+// KF_GOERTZEL_BLOCK bins at once, in double precision, because its
+// rounding error grows with the number of samples.
+#define KF_GOERTZEL_BLOCK 4
+
+// Samples that aren't plain complex are converted this many at a time.
+#define KF_GOERTZEL_READ 256
+
+static int
+kf_goertzel(const struct kf_source *src, size_t n, const size_t *bins,
+            size_t nbins, kiss_fft_cpx *fout,
+            kiss_fft_periodic_cb *should_stop)
+{
+    kiss_fft_cpx buf[KF_GOERTZEL_READ];
+
+    for (size_t b0 = 0; b0 < nbins; b0 += KF_GOERTZEL_BLOCK) {
+        size_t nb = nbins - b0;
+        if (nb > KF_GOERTZEL_BLOCK)
+            nb = KF_GOERTZEL_BLOCK;
+
+        double cw[KF_GOERTZEL_BLOCK], sw[KF_GOERTZEL_BLOCK];
+        double coef[KF_GOERTZEL_BLOCK];
+        double s1r[KF_GOERTZEL_BLOCK] = { 0 }, s1i[KF_GOERTZEL_BLOCK] = { 0 };
+        double s2r[KF_GOERTZEL_BLOCK] = { 0 }, s2i[KF_GOERTZEL_BLOCK] = { 0 };
+        for (size_t b = 0; b < KF_GOERTZEL_BLOCK; b++) {
+            // unused slots of a partial block just repeat the last bin
+            size_t k = bins[b0 + (b < nb ? b : nb - 1)];
+            double w = 2.0 * M_PI * (double)k / (double)n;
+            cw[b] = cos(w);
+            sw[b] = sin(w);
+            coef[b] = 2.0 * cw[b];
+        }
+
+        // check for interruption about every 2**16 samples
+        for (size_t i0 = 0; i0 < n; i0 += 65536) {
+            size_t iend = n - i0 > 65536 ? i0 + 65536 : n;
+            for (size_t j0 = i0; j0 < iend; j0 += KF_GOERTZEL_READ) {
+                size_t len = iend - j0 > KF_GOERTZEL_READ
+                    ? KF_GOERTZEL_READ : iend - j0;
+                const kiss_fft_cpx *x = kf_source_read(src, j0, len, buf);
+                for (size_t i = 0; i < len; i++) {
+                    for (size_t b = 0; b < KF_GOERTZEL_BLOCK; b++) {
+                        double tr = x[i].r + coef[b] * s1r[b] - s2r[b];
+                        double ti = x[i].i + coef[b] * s1i[b] - s2i[b];
+                        s2r[b] = s1r[b];
+                        s2i[b] = s1i[b];
+                        s1r[b] = tr;
+                        s1i[b] = ti;
+                    }
+                }
+            }
+            int rv = should_stop->check(should_stop);
+            if (rv) return rv;
+        }
+
+        // X[k] = exp(J w) s[n-1] - s[n-2], where J is the imaginary unit
+        for (size_t b = 0; b < nb; b++) {
+            fout[b0 + b].r = (float)(cw[b] * s1r[b] - sw[b] * s1i[b] - s2r[b]);
+            fout[b0 + b].i = (float)(cw[b] * s1i[b] + sw[b] * s1r[b] - s2i[b]);
+        }
+    }
+    return 0;
+}
+
+static int
+kf_bins(kiss_fft_state *st, const struct kf_source *src,
+        const size_t *bins, size_t nbins, kiss_fft_cpx *fout,
+        kiss_fft_periodic_cb *should_stop)
+{
+    const unsigned L = st->log2_samples;
+    const size_t n = (size_t)1 << L;
+    if (nbins == 0)
+        return 0;
+    if (nbins <= KF_GOERTZEL_MAX_BINS)
+        return kf_goertzel(src, n, bins, nbins, fout, should_stop);
+
+    // If there are so many bins that pruning can't help, don't bother
+    // sorting them.
+    if (nbins * KF_PRUNE_MIN_SPARSITY >= n) {
+        kiss_fft_cpx *all = malloc(n * sizeof(kiss_fft_cpx));
+        if (!all)
+            return kf_goertzel(src, n, bins, nbins, fout, should_stop);
+        int rv = kf_fft_source(st, src, all, should_stop);
+        if (!rv) {
+            for (size_t i = 0; i < nbins; i++)
+                fout[i] = all[bins[i]];
+        }
+        free(all);
+        return rv;
+    }
+
+    // Work out the residues needed at each level, stopping at the
+    // first level C that is dense enough to do in full.  Each level
+    // has at most as many residues as the top level.  If the input is
+    // to be gathered first, because the plan calls for kf_bitrev or
+    // the input needs converting, C can't be below the size of the
+    // blocks kf_gather leaves in natural order.
+    struct kf_prune_level lv[KF_MAX_LOG2_SAMPLES + 1];
+    size_t *idx = malloc(2 * (L / 2 + 1) * nbins * sizeof(size_t));
+    if (!idx)
+        return kf_goertzel(src, n, bins, nbins, fout, should_stop);
+
+    size_t *next = idx;
+    const bool gather = st->bitrev || !kf_source_plain(src);
+    const unsigned cmin = gather ? kf_leaf_block_log2(st) : 2;
+    unsigned c = L;
+    lv[L].residues = next;
+    memcpy(next, bins, nbins * sizeof *bins);
+    lv[L].count = kf_sort_unique(next, nbins);
+    next += nbins;
+    while (c >= cmin + 2
+           && lv[c].count * KF_PRUNE_MIN_SPARSITY < (size_t)1 << c) {
+        const size_t mask = ((size_t)1 << (c - 2)) - 1;
+        struct kf_prune_level *up = &lv[c], *down = &lv[c - 2];
+        down->residues = next;
+        for (size_t i = 0; i < up->count; i++)
+            down->residues[i] = up->residues[i] & mask;
+        down->count = kf_sort_unique(down->residues, up->count);
+        next += nbins;
+        up->child = next;
+        for (size_t i = 0; i < up->count; i++)
+            up->child[i] = kf_size_find(down->residues, down->count,
+                                        up->residues[i] & mask);
+        next += nbins;
+        c -= 2;
+    }
+
+    // Scratch: the top level's outputs, then four sets of outputs for
+    // each level below it, down to C, which produces all of them, then
+    // the permuted input if needed.
+    const bool gathered = gather && c < L;
+    size_t nscratch = c == L ? n : lv[L].count;
+    for (unsigned l = L; l > c; l -= 2)
+        nscratch += 4 * (l - 2 == c ? (size_t)1 << c : lv[l - 2].count);
+    kiss_fft_cpx *top = malloc((nscratch + (gathered ? n : 0))
+                               * sizeof(kiss_fft_cpx));
+    if (!top) {
+        free(idx);
+        return kf_goertzel(src, n, bins, nbins, fout, should_stop);
+    }
+
+    int rv;
+    if (c == L) {
+        rv = kf_fft_source(st, src, top, should_stop);
+    } else if (gathered) {
+        kiss_fft_cpx *perm = top + nscratch;
+        rv = kf_gather(perm, src, st, should_stop);
+        if (!rv)
+            rv = kf_prune_work(top, NULL, 1, perm, st, lv, L, c,
+                               top + lv[L].count, should_stop);
+    } else {
+        rv = kf_prune_work(top, src->data, 1, NULL, st, lv, L, c,
+                           top + lv[L].count, should_stop);
+    }
+    if (!rv) {
+        for (size_t i = 0; i < nbins; i++)
+            fout[i] = top[c == L ? bins[i]
+                          : kf_size_find(lv[L].residues, lv[L].count,
+                                         bins[i])];
+    }
+    free(top);
+    free(idx);
+    return rv;
+}
+
+int
+kiss_fft_bins(kiss_fft_state *st, const kiss_fft_cpx *fin,
+              const size_t *bins, size_t nbins, kiss_fft_cpx *fout,
+              kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_source src = { fin, KF_SOURCE_CPX, 1, 1.0f, NULL };
+    return kf_bins(st, &src, bins, nbins, fout, should_stop);
+}
+
+int
+kiss_fft_bins_pcm(kiss_fft_state *st, const void *fin, int format,
+                  size_t stride, float scale, const size_t *bins,
+                  size_t nbins, kiss_fft_cpx *fout,
+                  kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_source src = { fin, format, stride, scale, NULL };
+    return kf_bins(st, &src, bins, nbins, fout, should_stop);
+}
+
+// Fused window, transform, and power spectrum.  The window is applied
+// by kf_gather while permuting the input into SCRATCH, which is a
+// pass kf_work would otherwise make implicitly in its leaves, and the
+// last radix-4 stage writes power (or magnitude and phase) straight
+// to the output instead of storing complex values.
+
+#define KF_POWER(c) ((c).r * (c).r + (c).i * (c).i)
+
+// Store the spectrum values for output bin K, whose transform value
+// is C.  N is the number of samples.
+static KF_ALWAYS_INLINE void
+kf_spectrum_store(float *out, size_t k, size_t n, kiss_fft_cpx c, int mode)
+{
+    if (mode == KISS_FFT_POWER) {
+        out[k] = KF_POWER(c);
+    } else {
+        out[k] = sqrtf(KF_POWER(c));
+        out[n + k] = atan2f(c.i, c.r);
+    }
+}
+
+// kf_bfly4 for butterflies K0 to K1 - 1 of the last stage, storing
+// the results with kf_spectrum_store rather than in place.
+static KF_ALWAYS_INLINE void
+kf_bfly4_spectrum(const kiss_fft_cpx *Fout, const kiss_fft_cpx *tw,
+                  const size_t m, const size_t k0, const size_t k1,
+                  float *out, int mode)
+{
+    tw += 3 * k0;
+    for (size_t k = k0; k < k1; k++, tw += 3) {
+        kiss_fft_cpx s0, s1, s2, s3, s4, s5, x0, x1, x2, x3;
+
+        C_MUL(s0, Fout[k + m], tw[0]);
+        C_MUL(s1, Fout[k + 2 * m], tw[1]);
+        C_MUL(s2, Fout[k + 3 * m], tw[2]);
+
+        C_SUB(s5, Fout[k], s1);
+        C_ADD(x0, Fout[k], s1);
+        C_ADD(s3, s0, s2);
+        C_SUB(s4, s0, s2);
+        C_SUB(x2, x0, s3);
+        C_ADDTO(x0, s3);
+
+        x1.r = s5.r + s4.i;
+        x1.i = s5.i - s4.r;
+        x3.r = s5.r - s4.i;
+        x3.i = s5.i + s4.r;
+
+        kf_spectrum_store(out, k, 4 * m, x0, mode);
+        kf_spectrum_store(out, k + m, 4 * m, x1, mode);
+        kf_spectrum_store(out, k + 2 * m, 4 * m, x2, mode);
+        kf_spectrum_store(out, k + 3 * m, 4 * m, x3, mode);
+    }
+}
+
+static int
+kf_spectrum(kiss_fft_state *st, const struct kf_source *src, float *fout,
+            int mode, kiss_fft_cpx *scratch,
+            kiss_fft_periodic_cb *should_stop)
+{
+    const unsigned L = st->log2_samples;
+    const size_t n = (size_t)1 << L;
+    int rv;
+
+    rv = kf_gather(scratch, src, st, should_stop);
+    if (rv) return rv;
+
+    // If the whole transform is a single leaf block (64 samples at
+    // most), there's no last stage to fuse with.
+    if (L < 2 || kf_leaf_block_log2(st) >= L) {
+        rv = kf_work_by_log2[L](scratch, NULL, 1, st, should_stop);
+        if (rv) return rv;
+        for (size_t k = 0; k < n; k++)
+            kf_spectrum_store(fout, k, n, scratch[k], mode);
+        return 0;
+    }
+
+    const size_t m = n / 4;
+    rv = kf_work_top(scratch, NULL, st, L - 2, should_stop);
+    if (rv) return rv;
+
+    // a chunk at a time if it's big enough, like kf_bfly4_chunked;
+    // separate copies, so the mode test isn't in the inner loop
+    const kiss_fft_cpx *tw = kf_stage_twiddles(st, m);
+    const bool chunked = m > KF_CHUNK_MIN;
+    for (size_t k = 0; k < m;) {
+        const size_t c = chunked ? kf_chunk_size(should_stop, m - k) : m;
+        const uint64_t t0 = chunked ? kf_now_ns() : 0;
+        if (mode == KISS_FFT_POWER)
+            kf_bfly4_spectrum(scratch, tw, m, k, k + c, fout,
+                              KISS_FFT_POWER);
+        else
+            kf_bfly4_spectrum(scratch, tw, m, k, k + c, fout,
+                              KISS_FFT_MAGNITUDE_PHASE);
+        if (chunked)
+            kf_chunk_timed(c, kf_now_ns() - t0);
+        k += c;
+
+        rv = should_stop->check(should_stop);
+        if (rv) return rv;
+    }
+    return 0;
+}
+
+int
+kiss_fft_spectrum(kiss_fft_state *st, const kiss_fft_cpx *fin,
+                  const float *window, float *fout, int mode,
+                  kiss_fft_cpx *scratch, kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_source src = { fin, KF_SOURCE_CPX, 1, 1.0f, window };
+    return kf_spectrum(st, &src, fout, mode, scratch, should_stop);
+}
+
+int
+kiss_fft_spectrum_pcm(kiss_fft_state *st, const void *fin, int format,
+                      size_t stride, float scale, const float *window,
+                      float *fout, int mode, kiss_fft_cpx *scratch,
+                      kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_source src = { fin, format, stride, scale, window };
+    return kf_spectrum(st, &src, fout, mode, scratch, should_stop);
+}
+
+/* Returns log2(n) if n is a power of two no larger than
+   2**KF_MAX_LOG2_SAMPLES, or -1 otherwise. */
+static int
+kf_log2(size_t n)
+{
+    if (n == 0 || (n & (n - 1)) != 0)
+        return -1;
+
+    int l = 0;
+    while (n >>= 1)
+        l++;
+    return l <= KF_MAX_LOG2_SAMPLES ? l : -1;
+}
+
+/* Returns the log2 size of the largest codelet that the recursion
+   for a transform of 2**LOG2_SAMPLES samples will reach: 64 if the
+   sample size is an even power of two, 32 if odd.  (N == 16 is the
+   only size that uses the 16-point codelet.)  Returns 0 if no codelet
+   is applicable. */
+static uint32_t
+kf_leaf_log2(uint32_t log2_samples)
+{
+    if (log2_samples < 4)
+        return 0;
+    if (log2_samples == 4)
+        return 4;
+    return log2_samples % 2 ? 5 : 6;
+}
+
+/* Returns the size of L2 cache in bytes, or a guess if the system
+   won't say.  The environment variable KISS_FFT_L2_CACHE_SIZE
+   overrides it, as KISS_FFT_CPUS does kf_online_cpus.  Looked up once
+   and remembered. */
+static size_t
+kf_l2_cache_size(void)
+{
+    static _Atomic size_t cached;
+    size_t size = atomic_load_explicit(&cached, memory_order_relaxed);
+    if (size)
+        return size;
+
+    long l2 = -1;
+    const char *env = getenv("KISS_FFT_L2_CACHE_SIZE");
+    if (env)
+        l2 = strtol(env, NULL, 10);
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    else
+        l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    size = l2 > 0 ? (size_t)l2 : (size_t)1 << 20;
+    atomic_store_explicit(&cached, size, memory_order_relaxed);
+    return size;
+}
+
+// kf_depth_log2 never goes below this, whatever the cache size; it
+// must be even, and at least the largest leaf block.
+#define KF_DEPTH_MIN_LOG2 10
+
+/* Returns the depth_log2 to use for a transform of 2**LOG2_SAMPLES
+   samples (see kf_work_top): the largest sub-transform whose samples
+   fill no more than half of L2 cache, leaving room for its twiddles,
+   with the same parity as LOG2_SAMPLES.  Returns 0, meaning
+   depth-first all the way, if that's the whole transform. */
+static uint32_t
+kf_depth_log2(uint32_t log2_samples)
+{
+    const size_t budget = kf_l2_cache_size() / 2;
+    if (sizeof(kiss_fft_cpx) << log2_samples <= budget)
+        return 0;
+    uint32_t d = KF_DEPTH_MIN_LOG2 + log2_samples % 2;
+    while (d + 2 < log2_samples
+           && sizeof(kiss_fft_cpx) << (d + 2) <= budget)
+        d += 2;
+    return d < log2_samples ? d : 0;
+}
+
+// For work that can't be interrupted, such as kiss_fft_alloc.
+static int
+kf_never_stop(kiss_fft_periodic_cb *cb)
+{
+    (void)cb;
+    return 0;
+}
+
+// Twiddle generation.  Every twiddle factor for a transform of N
+// samples is W**i for some 0 <= i < N, where W = exp(-2*pi*J/N) and J
+// is the imaginary unit.  Calling cosf and sinf for each of them is
+// slow for large N, and loses accuracy because the phase has to be
+// rounded to float first.  Instead, we write i = (hi << h) + lo and
+// compute W**i = W**(hi << h) * W**lo in double precision, from two
+// tables of about sqrt(N) entries that are calculated with cos and
+// sin.  The product is accurate to a few ulps of a double, so it
+// almost always rounds to the nearest float.  Large tables are split
+// among several threads.
+
+struct kf_dcpx {
+    double r;
+    double i;
+};
+
+// State shared by all the threads filling one plan's tables.  Only
+// the calling thread runs SHOULD_STOP, as in kiss_welch; when it says
+// to stop, it sets STOP, which the helpers poll.
+struct kf_twiddle_ctl {
+    kiss_fft_cpx *tw;
+    uint32_t log2_samples;
+    unsigned h;
+    const struct kf_dcpx *lo;     // W**i for i < 2**h
+    const struct kf_dcpx *hi;     // W**(i << h) for i < N >> h
+    kiss_fft_periodic_cb *should_stop;
+    _Atomic int stop;
+    _Atomic unsigned running;     // helpers not yet finished
+};
+
+// One thread's share of the work: triples K0 to K1 - 1 of the top
+// stage, and the corresponding parts of each stage below it.
+struct kf_twiddle_job {
+    struct kf_twiddle_ctl *ctl;
+    size_t k0, k1;
+    bool started;                 // running in its own thread?
+    pthread_t thread;
+};
+
+// The number of CPUs to share work among.  The environment variable
+// KISS_FFT_CPUS overrides the number online, mainly so that the
+// threaded paths can be tested on a machine with one CPU.
+static unsigned
+kf_online_cpus(void)
+{
+    const char *env = getenv("KISS_FFT_CPUS");
+    long ncpu = env ? strtol(env, NULL, 10)
+                    : sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpu > 0 ? (unsigned)ncpu : 1;
+}
+
+// Start a new thread only for at least this many top-stage triples.
+#define KF_TWIDDLE_MIN_PER_THREAD ((size_t)1 << 16)
+#define KF_TWIDDLE_MAX_THREADS 64
+
+// Check for interruption after this many top-stage triples, and the
+// same fraction of each stage below.
+#define KF_TWIDDLE_BLOCK ((size_t)1 << 14)
+
+static KF_ALWAYS_INLINE kiss_fft_cpx
+kf_twiddle(const struct kf_twiddle_ctl *ctl, size_t i)
+{
+    const struct kf_dcpx a = ctl->hi[i >> ctl->h];
+    const struct kf_dcpx b = ctl->lo[i & (((size_t)1 << ctl->h) - 1)];
+    kiss_fft_cpx w;
+    w.r = (float)(a.r * b.r - a.i * b.i);
+    w.i = (float)(a.r * b.i + a.i * b.r);
+    return w;
+}
+
+// Run should_stop->check, and tell the helpers if it says to stop.
+static int
+kf_twiddle_check(struct kf_twiddle_ctl *ctl)
+{
+    int rv = ctl->should_stop->check(ctl->should_stop);
+    if (rv)
+        atomic_store_explicit(&ctl->stop, rv, memory_order_relaxed);
+    return rv;
+}
+
+// The triples of stage M are W**(j*k*N/4M) for j = 1, 2, 3; see
+// kf_stage_twiddles.  For each block [b0, b1) of top-stage triples,
+// stage M/2**s gets triples b0 >> s to b1 >> s, which divides each
+// stage among the blocks the same way as the top.  MAIN is true for
+// the calling thread.
+static int
+kf_twiddle_range(const struct kf_twiddle_job *job, bool main)
+{
+    struct kf_twiddle_ctl *ctl = job->ctl;
+    const size_t samples = (size_t)1 << ctl->log2_samples;
+
+    for (size_t b0 = job->k0; b0 < job->k1; b0 += KF_TWIDDLE_BLOCK) {
+        const size_t b1 = job->k1 - b0 > KF_TWIDDLE_BLOCK
+            ? b0 + KF_TWIDDLE_BLOCK : job->k1;
+        unsigned s = 0;
+        for (size_t m = samples / 4; m >= 1; m /= 2, s++) {
+            kiss_fft_cpx *stage = ctl->tw + 3 * (m - 1);
+            for (size_t k = b0 >> s; k < b1 >> s; k++) {
+                const size_t i = k << s;
+                stage[3 * k + 0] = kf_twiddle(ctl, i);
+                stage[3 * k + 1] = kf_twiddle(ctl, 2 * i);
+                stage[3 * k + 2] = kf_twiddle(ctl, 3 * i);
+            }
+        }
+
+        int rv = main ? kf_twiddle_check(ctl)
+            : atomic_load_explicit(&ctl->stop, memory_order_relaxed);
+        if (rv) return rv;
+    }
+    return 0;
+}
+
+static void *
+kf_twiddle_thread(void *arg)
+{
+    struct kf_twiddle_job *job = arg;
+    kf_twiddle_range(job, false);
+    atomic_fetch_sub_explicit(&job->ctl->running, 1, memory_order_release);
+    return NULL;
+}
+
+// Number of kf_dcpx that kf_fill_twiddles needs for its tables.
+static size_t
+kf_twiddle_tables_len(uint32_t log2_samples)
+{
+    const unsigned h = (log2_samples + 1) / 2;
+    return ((size_t)1 << h) + ((size_t)1 << (log2_samples - h));
+}
+
+// Fill TABLES (kf_twiddle_tables_len entries) with the two tables
+// W**lo for lo < 2**h, then W**(hi << h) for hi < N >> h, where
+// W = exp(-2*pi*J/N) and h = ceil(LOG2_SAMPLES / 2).
+static void
+kf_root_tables(struct kf_dcpx *tables, uint32_t log2_samples)
+{
+    const size_t samples = (size_t)1 << log2_samples;
+    const unsigned h = (log2_samples + 1) / 2;
+    const size_t nlo = (size_t)1 << h;
+    const size_t nhi = samples >> h;
+
+    for (size_t i = 0; i < nlo; i++) {
+        const double phase = -2.0 * M_PI * (double)i / (double)samples;
+        tables[i].r = cos(phase);
+        tables[i].i = sin(phase);
+    }
+    for (size_t i = 0; i < nhi; i++) {
+        const double phase = -2.0 * M_PI * (double)(i << h) / (double)samples;
+        tables[nlo + i].r = cos(phase);
+        tables[nlo + i].i = sin(phase);
+    }
+}
+
+// Compute the per-stage twiddle tables for 2**LOG2_SAMPLES samples
+// into TW, using TABLES (see kf_twiddle_tables_len) as scratch.
+// Returns zero or the value of should_stop->check, like kiss_fft; if
+// interrupted, TW is left partly filled in.
+static int
+kf_fill_twiddles(kiss_fft_cpx *tw, uint32_t log2_samples,
+                 struct kf_dcpx *tables, kiss_fft_periodic_cb *should_stop)
+{
+    if (log2_samples < 2)
+        return 0;
+
+    const size_t samples = (size_t)1 << log2_samples;
+    const size_t m = samples / 4;
+    const unsigned h = (log2_samples + 1) / 2;
+    const size_t nlo = (size_t)1 << h;
+
+    kf_root_tables(tables, log2_samples);
+
+    struct kf_twiddle_ctl ctl = {
+        .tw = tw,
+        .log2_samples = log2_samples,
+        .h = h,
+        .lo = tables,
+        .hi = tables + nlo,
+        .should_stop = should_stop,
+    };
+    atomic_store(&ctl.stop, 0);
+    atomic_store(&ctl.running, 0);
+
+    unsigned nthreads = 1;
+    if (m >= 2 * KF_TWIDDLE_MIN_PER_THREAD) {
+        unsigned ncpu = kf_online_cpus();
+        size_t most = m / KF_TWIDDLE_MIN_PER_THREAD;
+        if (most > KF_TWIDDLE_MAX_THREADS)
+            most = KF_TWIDDLE_MAX_THREADS;
+        nthreads = ncpu < most ? ncpu : (unsigned)most;
+    }
+
+    struct kf_twiddle_job jobs[KF_TWIDDLE_MAX_THREADS];
+    for (unsigned t = 0; t < nthreads; t++) {
+        jobs[t].ctl = &ctl;
+        jobs[t].k0 = m * t / nthreads;
+        jobs[t].k1 = m * (t + 1) / nthreads;
+        jobs[t].started = false;
+    }
+
+    // As in kiss_welch, the helpers shouldn't receive signals, and if
+    // one can't be started, this thread does its share.
+    sigset_t all, prev;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &prev);
+    for (unsigned t = 1; t < nthreads; t++) {
+        atomic_fetch_add(&ctl.running, 1);
+        jobs[t].started = !pthread_create(&jobs[t].thread, NULL,
+                                          kf_twiddle_thread, &jobs[t]);
+        if (!jobs[t].started)
+            atomic_fetch_sub(&ctl.running, 1);
+    }
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+    int rv = 0;
+    for (unsigned t = 0; t < nthreads && !rv; t++)
+        if (!jobs[t].started)
+            rv = kf_twiddle_range(&jobs[t], true);
+
+    // Keep checking while waiting for the helpers to finish.
+    while (!rv && atomic_load_explicit(&ctl.running, memory_order_acquire)) {
+        rv = kf_twiddle_check(&ctl);
+        if (!rv) {
+            struct timespec pause = { 0, 200000 };  // 0.2 ms
+            nanosleep(&pause, NULL);
+        }
+    }
+    for (unsigned t = 1; t < nthreads; t++)
+        if (jobs[t].started)
+            pthread_join(jobs[t].thread, NULL);
+    return rv;
+}
+
+// A plan's tunable decisions, packed into one word so that they can
+// be recorded in kf_wisdom.
+#define KF_DECISION_LEAF   0x000000ffu
+#define KF_DECISION_BITREV 0x00000100u
+#define KF_DECISION_DEPTH  0x003f0000u
+#define KF_DECISION_DEPTH_SHIFT 16
+#define KF_DECISION_VALID  0x80000000u
+
+static uint32_t
+kf_get_decisions(const kiss_fft_state *st)
+{
+    return KF_DECISION_VALID
+        | (st->leaf_log2 & KF_DECISION_LEAF)
+        | (st->bitrev ? KF_DECISION_BITREV : 0)
+        | (st->depth_log2 << KF_DECISION_DEPTH_SHIFT & KF_DECISION_DEPTH);
+}
+
+static void
+kf_set_decisions(kiss_fft_state *st, uint32_t d)
+{
+    st->leaf_log2 = d & KF_DECISION_LEAF;
+    st->bitrev = (d & KF_DECISION_BITREV) != 0;
+    st->depth_log2 = (d & KF_DECISION_DEPTH) >> KF_DECISION_DEPTH_SHIFT;
+}
+
+// The decisions made by kiss_fft_measure for each sample size, if it
+// has been run for that size; otherwise zero.  kiss_fft_alloc uses
+// these in preference to its built-in guesses.
+static _Atomic uint32_t kf_wisdom[KF_MAX_LOG2_SAMPLES + 1];
+
+// Make ST's decisions from wisdom if there is any for its size, and
+// otherwise from the built-in guesses.
+static void
+kf_init_decisions(kiss_fft_state *st)
+{
+    uint32_t wisdom = atomic_load_explicit(&kf_wisdom[st->log2_samples],
+                                           memory_order_relaxed);
+    if (wisdom & KF_DECISION_VALID) {
+        kf_set_decisions(st, wisdom);
+    } else {
+        st->leaf_log2 = kf_leaf_log2(st->log2_samples);
+        st->bitrev = st->log2_samples >= KF_BITREV_MIN_LOG2;
+        st->depth_log2 = kf_depth_log2(st->log2_samples);
+    }
+}
+
+// Twiddle tables for each sample size, mapped from a wisdom file by
+// kiss_fft_load_wisdom or built by kiss_fft_share_twiddles, possibly
+// for a larger size; NULL if there are none for that size.  Neither
+// is ever freed, because there's no way to know whether any plans
+// still point into them.
+static const kiss_fft_cpx *_Atomic kf_mapped_twiddles[KF_MAX_LOG2_SAMPLES + 1];
+
+// Let plans for 2**LOG2_SAMPLES samples or fewer use the prefixes of
+// TW, the twiddle tables for 2**LOG2_SAMPLES samples (see
+// kf_stage_twiddles), unless they already have tables of their own.
+static void
+kf_share_twiddles(const kiss_fft_cpx *tw, uint32_t log2_samples)
+{
+    for (uint32_t l = 0; l <= log2_samples; l++) {
+        const kiss_fft_cpx *none = 0;
+        atomic_compare_exchange_strong_explicit(
+            &kf_mapped_twiddles[l], &none, tw,
+            memory_order_release, memory_order_relaxed);
+    }
+}
+
+/*
+ *
+ * User-callable function to allocate all necessary storage space for the fft.
+ *
+ * The return value is a contiguous block of memory, allocated with malloc.  As such,
+ * It can be freed with free(), rather than a kiss_fft-specific function.
+ * If a wisdom file with a plan for this size or larger has been loaded, or
+ * kiss_fft_share_twiddles has been called for this size or larger, the
+ * twiddle factors are not recomputed; the plan refers to that copy instead.
+ * */
+kiss_fft_state *kiss_fft_alloc(size_t samples)
+{
+    kiss_fft_periodic_cb never = { kf_never_stop, 0 };
+    int stopped;
+    return kiss_fft_alloc_interruptible(samples, &never, &stopped);
+}
+
+kiss_fft_state *
+kiss_fft_alloc_interruptible(size_t samples,
+                             kiss_fft_periodic_cb *should_stop,
+                             int *stopped)
+{
+    *stopped = 0;
+    int log2_samples = kf_log2(samples);
+    if (log2_samples < 0)
+        // samples is not a power of two or is too big
+        return (kiss_fft_state *)-1;
+
+    const kiss_fft_cpx *mapped =
+        atomic_load_explicit(&kf_mapped_twiddles[log2_samples],
+                             memory_order_acquire);
+
+    size_t memneeded = sizeof(struct kiss_fft_state);
+    if (!mapped)
+        memneeded += sizeof(kiss_fft_cpx)
+            * kf_twiddle_count((uint32_t) log2_samples);
+
+    kiss_fft_state *st = malloc(memneeded);
+    if (!st)
+        return 0;
+
+    st->log2_samples = (uint32_t) log2_samples;
+    st->named = 0;
+    kf_init_decisions(st);
+
+    if (mapped) {
+        st->twiddles = mapped;
+        return st;
+    }
+
+    struct kf_dcpx *tables =
+        malloc(kf_twiddle_tables_len((uint32_t) log2_samples)
+               * sizeof *tables);
+    if (!tables) {
+        free(st);
+        return 0;
+    }
+    *stopped = kf_fill_twiddles(st->storage, (uint32_t) log2_samples,
+                                tables, should_stop);
+    free(tables);
+    if (*stopped) {
+        free(st);
+        return 0;
+    }
+    st->twiddles = st->storage;
+    return st;
+}
+
+int
+kiss_fft_share_twiddles(size_t max_samples,
+                        kiss_fft_periodic_cb *should_stop,
+                        int *stopped)
+{
+    *stopped = 0;
+    int log2_samples = kf_log2(max_samples);
+    if (log2_samples < 0)
+        return KISS_FFT_WISDOM_BAD_SIZE;
+
+    const kiss_fft_cpx *mapped =
+        atomic_load_explicit(&kf_mapped_twiddles[log2_samples],
+                             memory_order_acquire);
+    if (mapped) {
+        kf_share_twiddles(mapped, (uint32_t) log2_samples);
+        return 0;
+    }
+
+    // At least one element, so that a NULL return means failure.
+    const size_t count = kf_twiddle_count((uint32_t) log2_samples);
+    kiss_fft_cpx *tw = malloc((count ? count : 1) * sizeof *tw);
+    struct kf_dcpx *tables =
+        malloc(kf_twiddle_tables_len((uint32_t) log2_samples)
+               * sizeof *tables);
+    if (!tw || !tables) {
+        free(tw);
+        free(tables);
+        errno = ENOMEM;
+        return KISS_FFT_WISDOM_ERRNO;
+    }
+    *stopped = kf_fill_twiddles(tw, (uint32_t) log2_samples, tables,
+                                should_stop);
+    free(tables);
+    if (*stopped) {
+        free(tw);
+        return 0;
+    }
+
+    // Like a wisdom file, this is never freed, because plans may
+    // point into it.  If another thread got here first, use theirs.
+    const kiss_fft_cpx *none = 0;
+    if (!atomic_compare_exchange_strong_explicit(
+            &kf_mapped_twiddles[log2_samples], &none, tw,
+            memory_order_release, memory_order_acquire)) {
+        free(tw);
+        tw = (kiss_fft_cpx *) none;
+    }
+    kf_share_twiddles(tw, (uint32_t) log2_samples);
+    return 0;
+}
+
+// Write all of the decisions that are worth trying for a transform of
+// 2**LOG2_SAMPLES samples to OUT, which must have room for at least
+// KF_MAX_CANDIDATES entries, and return how many there are.  The
+// first entry is always the default choice made by kiss_fft_alloc.
+#define KF_MAX_CANDIDATES 12
+static size_t
+kf_candidates(uint32_t log2_samples, uint32_t out[static KF_MAX_CANDIDATES])
+{
+    uint32_t leaves[3];
+    size_t nleaves = 0;
+    leaves[nleaves++] = kf_leaf_log2(log2_samples);
+    if (log2_samples % 2 == 0 && log2_samples > 4)
+        leaves[nleaves++] = 4;
+    if (leaves[0] != 0)
+        leaves[nleaves++] = 0;
+
+    const bool dflt_bitrev = log2_samples >= KF_BITREV_MIN_LOG2;
+    const bool can_bitrev = log2_samples >= 2 * KF_BITREV_LOG2_TILE + 2;
+    const uint32_t dflt_depth =
+        kf_depth_log2(log2_samples) << KF_DECISION_DEPTH_SHIFT;
+
+    size_t n = 0;
+    for (size_t i = 0; i < nleaves; i++) {
+        out[n++] = KF_DECISION_VALID | leaves[i] | dflt_depth
+            | (dflt_bitrev ? KF_DECISION_BITREV : 0);
+        if (can_bitrev)
+            out[n++] = KF_DECISION_VALID | leaves[i] | dflt_depth
+                | (dflt_bitrev ? 0 : KF_DECISION_BITREV);
+    }
+
+    // and all of those again depth-first all the way, if that isn't
+    // the default
+    if (dflt_depth) {
+        const size_t n0 = n;
+        for (size_t i = 0; i < n0; i++)
+            out[n++] = out[i] & ~KF_DECISION_DEPTH;
+    }
+    return n;
+}
+
+// Each candidate is timed until it has run at least this many times
+// and for at least this long, and the best single run is what counts.
+#define KF_MEASURE_MIN_RUNS 3
+#define KF_MEASURE_MIN_NS   (20 * 1000 * 1000)
+
+int
+kiss_fft_measure(kiss_fft_state *st, uint64_t budget_ns,
+                 kiss_fft_periodic_cb *should_stop)
+{
+    const size_t samples = (size_t)1 << st->log2_samples;
+    uint32_t cands[KF_MAX_CANDIDATES];
+    const size_t ncands = kf_candidates(st->log2_samples, cands);
+    const uint32_t original = kf_get_decisions(st);
+
+    if (ncands < 2)
+        return 0;
+
+    // Already measured, by this process or by the one that saved a
+    // wisdom file we loaded.
+    uint32_t wisdom = atomic_load_explicit(&kf_wisdom[st->log2_samples],
+                                           memory_order_relaxed);
+    if (wisdom & KF_DECISION_VALID) {
+        kf_set_decisions(st, wisdom);
+        return 0;
+    }
+
+    kiss_fft_cpx *in = malloc(2 * samples * sizeof(kiss_fft_cpx));
+    if (!in)
+        // measurement is only an optimization, so carry on with the
+        // default decisions
+        return 0;
+    kiss_fft_cpx *out = in + samples;
+
+    // Arbitrary, but not all zeroes, and reproducible.
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < samples; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        in[i].r = (float)(x & 0xffff) / 65536.0f - 0.5f;
+        in[i].i = (float)(x >> 16) / 65536.0f - 0.5f;
+    }
+
+    const uint64_t start = kf_now_ns();
+    uint32_t best = original;
+    uint64_t best_ns = UINT64_MAX;
+    bool complete = true;
+    int rv = 0;
+
+    for (size_t c = 0; c < ncands && !rv; c++) {
+        kf_set_decisions(st, cands[c]);
+
+        uint64_t cand_start = kf_now_ns();
+        uint64_t cand_best = UINT64_MAX;
+        for (unsigned runs = 0;
+             runs < KF_MEASURE_MIN_RUNS
+                 || kf_now_ns() - cand_start < KF_MEASURE_MIN_NS;
+             runs++) {
+            if (kf_now_ns() - start >= budget_ns) {
+                complete = false;
+                break;
+            }
+            uint64_t t0 = kf_now_ns();
+            rv = kiss_fft(st, in, out, should_stop);
+            uint64_t t1 = kf_now_ns();
+            if (rv)
+                break;
+            if (t1 - t0 < cand_best)
+                cand_best = t1 - t0;
+        }
+        if (cand_best < best_ns) {
+            best_ns = cand_best;
+            best = cands[c];
+        }
+        if (!complete)
+            break;
+    }
+
+    // If we ran out of time, remember the best choice among the
+    // candidates we did get to, so the next call doesn't measure again;
+    // but only if we timed at least the first, the default, or the
+    // choice is just the default and the next call should measure.
+    free(in);
+    kf_set_decisions(st, best);
+    if (!rv && best_ns != UINT64_MAX)
+        atomic_store_explicit(&kf_wisdom[st->log2_samples], best,
+                              memory_order_relaxed);
+    return rv;
+}
+
+// Wisdom files.  The layout is
+//
+//    struct kf_wisdom_header
+//    struct kf_wisdom_entry[nplans]
+//    padding to a multiple of KF_WISDOM_ALIGN
+//    twiddle tables for entry 0 (see kf_stage_twiddles)
+//    padding to a multiple of KF_WISDOM_ALIGN
+//    twiddle table for entry 1
+//    ...
+//
+// except that, since the tables for N samples are a prefix of the
+// tables for 2N samples, kiss_fft_save_wisdom only writes the tables
+// for the largest size, and every entry points at them.
+//
+// All integers are in native byte order; the byte_order field lets
+// us reject a file written on a machine with the other byte order.
+// Twiddle tables are page-aligned so that, when several processes map
+// the same file, each page of the tables is shared in the page cache.
+
+#define KF_WISDOM_MAGIC "KFWISDOM"
+#define KF_WISDOM_VERSION 2
+#define KF_WISDOM_BYTE_ORDER UINT32_C(0x01020304)
+#define KF_WISDOM_ALIGN ((uint64_t)4096)
+
+struct kf_wisdom_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t nplans;
+    uint32_t reserved;
+};
+
+struct kf_wisdom_entry {
+    uint32_t log2_samples;
+    uint32_t decisions;
+    uint64_t twiddle_offset;
+    uint64_t twiddle_count;
+};
+
+static uint64_t
+kf_wisdom_align(uint64_t off)
+{
+    return (off + KF_WISDOM_ALIGN - 1) & ~(KF_WISDOM_ALIGN - 1);
+}
+
+static bool
+kf_write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+int
+kiss_fft_save_wisdom(const char *path,
+                     const size_t *sizes,
+                     size_t nsizes,
+                     kiss_fft_periodic_cb *should_stop,
+                     int *stopped)
+{
+    *stopped = 0;
+    struct kf_wisdom_header hdr;
+    memcpy(hdr.magic, KF_WISDOM_MAGIC, sizeof hdr.magic);
+    hdr.version = KF_WISDOM_VERSION;
+    hdr.byte_order = KF_WISDOM_BYTE_ORDER;
+    hdr.nplans = (uint32_t) nsizes;
+    hdr.reserved = 0;
+
+    if (nsizes > KF_MAX_LOG2_SAMPLES + 1)
+        return KISS_FFT_WISDOM_BAD_SIZE;
+
+    struct kf_wisdom_entry entries[KF_MAX_LOG2_SAMPLES + 1];
+    size_t largest = 0;
+    for (size_t i = 0; i < nsizes; i++) {
+        int l = kf_log2(sizes[i]);
+        if (l < 0)
+            return KISS_FFT_WISDOM_BAD_SIZE;
+        kiss_fft_state plan;
+        plan.log2_samples = (uint32_t) l;
+        kf_init_decisions(&plan);
+        entries[i].log2_samples = (uint32_t) l;
+        entries[i].decisions = kf_get_decisions(&plan);
+        entries[i].twiddle_count = kf_twiddle_count((uint32_t) l);
+        if (sizes[i] > sizes[largest])
+            largest = i;
+    }
+    const uint64_t twiddle_offset =
+        kf_wisdom_align(sizeof hdr + nsizes * sizeof entries[0]);
+    for (size_t i = 0; i < nsizes; i++)
+        entries[i].twiddle_offset = twiddle_offset;
+    const uint64_t off = twiddle_offset + (nsizes
+        ? entries[largest].twiddle_count * sizeof(kiss_fft_cpx) : 0);
+
+    // Write to a temporary file and rename it into place, so that
+    // processes loading the file concurrently never see it half
+    // written.
+    size_t plen = strlen(path);
+    char *tmp = malloc(plen + 32);
+    if (!tmp)
+        return KISS_FFT_WISDOM_ERRNO;
+    snprintf(tmp, plen + 32, "%s.tmp%ld", path, (long)getpid());
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        free(tmp);
+        return KISS_FFT_WISDOM_ERRNO;
+    }
+
+    if (ftruncate(fd, (off_t) off))
+        goto fail;
+
+    if (nsizes) {
+        kiss_fft_state *st = kiss_fft_alloc_interruptible(sizes[largest],
+                                                          should_stop,
+                                                          stopped);
+        if (*stopped) {
+            close(fd);
+            unlink(tmp);
+            free(tmp);
+            return 0;
+        }
+        if (!st) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        bool ok =
+            lseek(fd, (off_t) twiddle_offset, SEEK_SET) >= 0
+            && kf_write_all(fd, st->twiddles,
+                            entries[largest].twiddle_count
+                            * sizeof(kiss_fft_cpx));
+        free(st);
+        if (!ok)
+            goto fail;
+    }
+
+    if (lseek(fd, 0, SEEK_SET) < 0
+        || !kf_write_all(fd, &hdr, sizeof hdr)
+        || !kf_write_all(fd, entries, nsizes * sizeof entries[0])
+        || fsync(fd)
+        || close(fd))
+        goto fail_closed;
+
+    if (rename(tmp, path))
+        goto fail_closed;
+    free(tmp);
+    return 0;
+
+ fail:
+    close(fd);
+ fail_closed:
+    {
+        int save_errno = errno;
+        unlink(tmp);
+        free(tmp);
+        errno = save_errno;
+    }
+    return KISS_FFT_WISDOM_ERRNO;
+}
+
+// Is D a set of decisions that kiss_fft could have made for a
+// transform of 2**LOG2_SAMPLES samples?  Anything else could send
+// kf_work off the rails.
+static bool
+kf_decisions_valid(uint32_t log2_samples, uint32_t d)
+{
+    // The depth-first size depends on the cache size of the machine
+    // that made the file, so accept any that kf_work_top can handle.
+    const uint32_t depth = (d & KF_DECISION_DEPTH) >> KF_DECISION_DEPTH_SHIFT;
+    if (depth && (depth < KF_DEPTH_MIN_LOG2 || depth >= log2_samples
+                  || (log2_samples - depth) % 2))
+        return false;
+    d &= ~KF_DECISION_DEPTH;
+
+    uint32_t cands[KF_MAX_CANDIDATES];
+    size_t ncands = kf_candidates(log2_samples, cands);
+    for (size_t i = 0; i < ncands; i++)
+        if ((cands[i] & ~KF_DECISION_DEPTH) == d)
+            return true;
+    return false;
+}
+
+// The wisdom files this process has mapped, so that loading one again
+// reuses its mapping.  They are never unmapped, because plans may
+// point into them; but a file that has been replaced, as
+// kiss_fft_save_wisdom replaces it, by renaming a new one into place,
+// is a different inode, and is mapped afresh.
+struct kf_wisdom_mapping {
+    dev_t dev;
+    ino_t ino;
+    const char *base;
+    struct kf_wisdom_mapping *next;
+};
+
+static struct kf_wisdom_mapping *kf_wisdom_mappings;
+static pthread_mutex_t kf_wisdom_mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The mapping of the file SB describes, if we have one.  Must be
+// called with kf_wisdom_mappings_lock held.
+static const char *
+kf_wisdom_find(const struct stat *sb)
+{
+    for (struct kf_wisdom_mapping *m = kf_wisdom_mappings; m; m = m->next)
+        if (m->dev == sb->st_dev && m->ino == sb->st_ino)
+            return m->base;
+    return 0;
+}
+
+// Use the decisions and twiddles in the valid wisdom file mapped at
+// BASE.
+static void
+kf_wisdom_use(const char *base)
+{
+    const struct kf_wisdom_header *hdr = (const void *) base;
+    const struct kf_wisdom_entry *entries = (const void *) (hdr + 1);
+    const struct kf_wisdom_entry *largest = 0;
+    for (uint32_t i = 0; i < hdr->nplans; i++) {
+        const struct kf_wisdom_entry *e = &entries[i];
+        atomic_store_explicit(&kf_wisdom[e->log2_samples], e->decisions,
+                              memory_order_relaxed);
+        atomic_store_explicit(
+            &kf_mapped_twiddles[e->log2_samples],
+            (const kiss_fft_cpx *) (base + e->twiddle_offset),
+            memory_order_release);
+        if (!largest || e->log2_samples > largest->log2_samples)
+            largest = e;
+    }
+    if (largest)
+        kf_share_twiddles((const kiss_fft_cpx *)
+                          (base + largest->twiddle_offset),
+                          largest->log2_samples);
+}
+
+int
+kiss_fft_load_wisdom(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return KISS_FFT_WISDOM_ERRNO;
+
+    struct stat sb;
+    if (fstat(fd, &sb)) {
+        int save_errno = errno;
+        close(fd);
+        errno = save_errno;
+        return KISS_FFT_WISDOM_ERRNO;
+    }
+
+    pthread_mutex_lock(&kf_wisdom_mappings_lock);
+    const char *mapped = kf_wisdom_find(&sb);
+    pthread_mutex_unlock(&kf_wisdom_mappings_lock);
+    if (mapped) {
+        close(fd);
+        kf_wisdom_use(mapped);
+        return 0;
+    }
+    uint64_t len = (uint64_t) sb.st_size;
+    if (len < sizeof(struct kf_wisdom_header)) {
+        close(fd);
+        return KISS_FFT_WISDOM_BAD_FORMAT;
+    }
+
+    // MAP_SHARED, read-only: every process that loads the same file
+    // shares one copy of it in the page cache.
+    const char *base = mmap(0, (size_t) len, PROT_READ, MAP_SHARED, fd, 0);
+    int save_errno = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+        errno = save_errno;
+        return KISS_FFT_WISDOM_ERRNO;
+    }
+
+    const struct kf_wisdom_header *hdr = (const void *) base;
+    const struct kf_wisdom_entry *entries = (const void *) (hdr + 1);
+    if (memcmp(hdr->magic, KF_WISDOM_MAGIC, sizeof hdr->magic)
+        || hdr->version != KF_WISDOM_VERSION
+        || hdr->byte_order != KF_WISDOM_BYTE_ORDER
+        || hdr->nplans > KF_MAX_LOG2_SAMPLES + 1
+        || len < sizeof *hdr + hdr->nplans * sizeof *entries)
+        goto bad;
+
+    for (uint32_t i = 0; i < hdr->nplans; i++) {
+        const struct kf_wisdom_entry *e = &entries[i];
+        if (e->log2_samples > KF_MAX_LOG2_SAMPLES
+            || e->twiddle_count != kf_twiddle_count(e->log2_samples)
+            || e->twiddle_offset % KF_WISDOM_ALIGN != 0
+            || e->twiddle_offset > len
+            || (len - e->twiddle_offset) / sizeof(kiss_fft_cpx)
+                < e->twiddle_count
+            || !kf_decisions_valid(e->log2_samples, e->decisions))
+            goto bad;
+    }
+
+    // If another thread mapped the same file meanwhile, use theirs.
+    struct kf_wisdom_mapping *m = malloc(sizeof *m);
+    if (!m) {
+        munmap((void *) base, (size_t) len);
+        errno = ENOMEM;
+        return KISS_FFT_WISDOM_ERRNO;
+    }
+    pthread_mutex_lock(&kf_wisdom_mappings_lock);
+    mapped = kf_wisdom_find(&sb);
+    if (!mapped) {
+        m->dev = sb.st_dev;
+        m->ino = sb.st_ino;
+        m->base = base;
+        m->next = kf_wisdom_mappings;
+        kf_wisdom_mappings = m;
+    }
+    pthread_mutex_unlock(&kf_wisdom_mappings_lock);
+    if (mapped) {
+        free(m);
+        munmap((void *) base, (size_t) len);
+        base = mapped;
+    }
+
+    kf_wisdom_use(base);
+    return 0;
+
+ bad:
+    munmap((void *) base, (size_t) len);
+    return KISS_FFT_WISDOM_BAD_FORMAT;
+}
+
+// Named plans.  A plan's twiddles can live in a POSIX shared memory
+// segment, so that a pool of worker processes needs one copy of them
+// rather than one each.  The segment is the header page, then the
+// twiddles.  The first process to ask for a name creates it and
+// computes the twiddles, while any others that ask meanwhile wait for
+// it to finish; after that, the twiddles are mapped read-only
+// everywhere.  REFS counts the plans attached to the segment in all
+// processes, and the one that drops it to zero unlinks the name, so
+// the memory is freed when the last plan is.
+//
+// A segment whose REFS has dropped to zero is on its way out: anyone
+// who opens it before it's unlinked must not attach, but wait and try
+// again, or they could unlink a newer segment of the same name later.
+// For the same reason, a builder that fails unlinks the name itself,
+// before marking the segment as failed.
+//
+// The builder holds BUILDER, a robust, process-shared mutex, until it
+// has marked the segment as ready or failed.  If it dies first, the
+// next waiter to try the mutex gets EOWNERDEAD, and fails the build on
+// its behalf, dropping its reference too; then everyone starts over,
+// and one of them builds the segment afresh.
+//
+// That leaves the builder's first few system calls, from creating the
+// segment to claiming it by setting REFS to one, and the last plan's
+// release, from dropping REFS to zero to unlinking the name.  Dying in
+// either leaves a segment that no one will attach to and no one will
+// unlink.  Both take microseconds, so a waiter that sees the same
+// segment unsized or without references for KF_NAMED_CLAIM_TIMEOUT_NS
+// takes its owner for dead and unlinks it.
+#define KF_NAMED_CLAIM_TIMEOUT_NS UINT64_C(1000000000)  // 1 s
+
+#define KF_NAMED_MAGIC UINT64_C(0x44454d414e464b32)  // "2KFNAMED"
+
+enum {
+    KF_NAMED_BUILDING = 0,
+    KF_NAMED_READY = 1,
+    KF_NAMED_FAILED = 2,
+};
+
+struct kf_named_header {
+    uint64_t magic;
+    uint32_t log2_samples;
+    uint32_t decisions;
+    _Atomic uint32_t state;         // KF_NAMED_...
+    _Atomic uint32_t refs;
+    pthread_mutex_t builder;        // held while building
+    char name[256];                 // for shm_unlink
+};
+
+static size_t
+kf_named_page(void)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? (size_t) page : 4096;
+}
+
+// The size of the twiddle mapping for 2**LOG2_SAMPLES samples.
+static size_t
+kf_named_twiddle_len(uint32_t log2_samples)
+{
+    return kf_twiddle_count(log2_samples) * sizeof(kiss_fft_cpx);
+}
+
+// Drop one reference to the segment at H, unlinking it if that was
+// the last one and it was built.  Doesn't unmap it.
+static void
+kf_named_release(struct kf_named_header *h)
+{
+    if (atomic_fetch_sub(&h->refs, 1) == 1
+        && atomic_load(&h->state) == KF_NAMED_READY)
+        shm_unlink(h->name);
+}
+
+// Create the segment NAME on FD, which was just created empty, and
+// compute the twiddles into it.  Returns the plan, or 0 on failure,
+// with *STOPPED set if interrupted.
+static kiss_fft_state *
+kf_named_build(int fd, const char *name, uint32_t log2_samples,
+               kiss_fft_periodic_cb *should_stop, int *stopped)
+{
+    const size_t page = kf_named_page();
+    const size_t twlen = kf_named_twiddle_len(log2_samples);
+    int save_errno;
+
+    // Claim the segment first, in as few steps as possible: until
+    // REFS is set, waiters can only tell that we died by how long it
+    // takes (see KF_NAMED_CLAIM_TIMEOUT_NS).
+    struct kf_named_header *h = MAP_FAILED;
+    if (ftruncate(fd, (off_t) (page + twlen)) == 0)
+        h = mmap(0, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED) {
+        save_errno = errno;
+        shm_unlink(name);
+        errno = save_errno;
+        return 0;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&h->builder, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_mutex_lock(&h->builder);
+
+    kiss_fft_state plan;
+    plan.log2_samples = log2_samples;
+    kf_init_decisions(&plan);
+    h->magic = KF_NAMED_MAGIC;
+    h->log2_samples = log2_samples;
+    h->decisions = kf_get_decisions(&plan);
+    snprintf(h->name, sizeof h->name, "%s", name);
+    atomic_store(&h->refs, 1);     // others may attach from here on
+
+    kiss_fft_state *st = malloc(sizeof *st);
+    struct kf_dcpx *tables =
+        malloc(kf_twiddle_tables_len(log2_samples) * sizeof *tables);
+    kiss_fft_cpx *tw = 0;
+    save_errno = ENOMEM;
+    if (!st || !tables)
+        goto fail;
+    if (twlen) {
+        tw = mmap(0, twlen, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                  (off_t) page);
+        if (tw == MAP_FAILED) {
+            save_errno = errno;
+            tw = 0;
+            goto fail;
+        }
+    }
+
+    *stopped = kf_fill_twiddles(tw, log2_samples, tables, should_stop);
+    if (*stopped)
+        goto fail;
+    if (tw)
+        mprotect(tw, twlen, PROT_READ);
+    atomic_store(&h->state, KF_NAMED_READY);
+    pthread_mutex_unlock(&h->builder);
+
+    free(tables);
+    st->log2_samples = log2_samples;
+    kf_set_decisions(st, h->decisions);
+    st->twiddles = tw;
+    st->named = h;
+    return st;
+
+ fail:
+    shm_unlink(name);
+    atomic_store(&h->state, KF_NAMED_FAILED);
+    pthread_mutex_unlock(&h->builder);
+    kf_named_release(h);
+    if (tw)
+        munmap(tw, twlen);
+    munmap(h, page);
+    free(tables);
+    free(st);
+    errno = save_errno;
+    return 0;
+}
+
+// Has the builder of the segment at H died without finishing?  If so,
+// fail the build for it, as kf_named_build would have.
+static bool
+kf_named_builder_died(struct kf_named_header *h)
+{
+    int e = pthread_mutex_trylock(&h->builder);
+    if (e == 0)
+        pthread_mutex_unlock(&h->builder);
+    if (e != EOWNERDEAD)
+        return false;
+    shm_unlink(h->name);
+    atomic_store(&h->state, KF_NAMED_FAILED);
+    kf_named_release(h);
+    pthread_mutex_consistent(&h->builder);
+    pthread_mutex_unlock(&h->builder);
+    return true;
+}
+
+// Try to attach to the existing segment on FD, which SB describes.
+// Returns the plan, or 0 with errno set on failure, or 0 with errno ==
+// EAGAIN if the segment isn't ready to be attached to yet or is being
+// removed; in that case, sets *UNCLAIMED if it has no references.
+static kiss_fft_state *
+kf_named_attach(int fd, const struct stat *sb, uint32_t log2_samples,
+                bool *unclaimed,
+                kiss_fft_periodic_cb *should_stop, int *stopped)
+{
+    const size_t page = kf_named_page();
+    const size_t twlen = kf_named_twiddle_len(log2_samples);
+
+    *unclaimed = false;
+    if ((uint64_t) sb->st_size < page) {
+        // not sized yet
+        *unclaimed = true;
+        errno = EAGAIN;
+        return 0;
+    }
+
+    struct kf_named_header *h =
+        mmap(0, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED)
+        return 0;
+
+    uint32_t refs = atomic_load(&h->refs);
+    do {
+        if (refs == 0) {
+            munmap(h, page);
+            *unclaimed = true;
+            errno = EAGAIN;
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak(&h->refs, &refs, refs + 1));
+
+    int save_errno = EINVAL;
+    if (h->magic != KF_NAMED_MAGIC || h->log2_samples != log2_samples
+        || !kf_decisions_valid(log2_samples, h->decisions)
+        || (uint64_t) sb->st_size != page + twlen)
+        goto fail;
+
+    uint32_t state;
+    while ((state = atomic_load(&h->state)) == KF_NAMED_BUILDING) {
+        if ((*stopped = should_stop->check(should_stop)))
+            goto fail;
+        if (kf_named_builder_died(h))
+            continue;
+        struct timespec pause = { 0, 200000 };  // 0.2 ms
+        nanosleep(&pause, NULL);
+    }
+    if (state == KF_NAMED_FAILED) {
+        save_errno = EAGAIN;
+        goto fail;
+    }
+
+    const kiss_fft_cpx *tw = 0;
+    if (twlen) {
+        tw = mmap(0, twlen, PROT_READ, MAP_SHARED, fd, (off_t) page);
+        if (tw == MAP_FAILED) {
+            save_errno = errno;
+            goto fail;
+        }
+    }
+    kiss_fft_state *st = malloc(sizeof *st);
+    if (!st) {
+        if (tw)
+            munmap((void *) tw, twlen);
+        save_errno = ENOMEM;
+        goto fail;
+    }
+    st->log2_samples = log2_samples;
+    kf_set_decisions(st, h->decisions);
+    st->twiddles = tw;
+    st->named = h;
+    return st;
+
+ fail:
+    kf_named_release(h);
+    munmap(h, page);
+    errno = save_errno;
+    return 0;
+}
+
+// Unlink NAME if it still names the segment that SB describes.  Someone
+// could replace it between the check and the unlink; if so, the
+// replacement loses its name, so the next process to ask builds
+// another copy, but no one is left waiting.
+static void
+kf_named_unlink_stale(const char *name, const struct stat *sb)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return;
+    struct stat now;
+    if (fstat(fd, &now) == 0 && now.st_dev == sb->st_dev
+        && now.st_ino == sb->st_ino)
+        shm_unlink(name);
+    close(fd);
+}
+
+kiss_fft_state *
+kiss_fft_alloc_named(const char *name, size_t samples,
+                     kiss_fft_periodic_cb *should_stop, int *stopped)
+{
+    *stopped = 0;
+    int log2_samples = kf_log2(samples);
+    if (log2_samples < 0)
+        return (kiss_fft_state *)-1;
+    if (strlen(name) >= sizeof ((struct kf_named_header *)0)->name) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+
+    // The unclaimed segment we have been waiting on, and since when.
+    struct stat stale = { 0 };
+    uint64_t stale_since = 0;
+
+    for (;;) {
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            kiss_fft_state *st = kf_named_build(fd, name,
+                                                (uint32_t) log2_samples,
+                                                should_stop, stopped);
+            close(fd);
+            return st;
+        }
+        if (errno != EEXIST)
+            return 0;
+
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0 && errno != ENOENT)
+            return 0;
+        struct stat sb;
+        if (fd >= 0 && fstat(fd, &sb)) {
+            int save_errno = errno;
+            close(fd);
+            errno = save_errno;
+            return 0;
+        }
+        if (fd >= 0) {
+            bool unclaimed;
+            kiss_fft_state *st = kf_named_attach(fd, &sb,
+                                                 (uint32_t) log2_samples,
+                                                 &unclaimed,
+                                                 should_stop, stopped);
+            int save_errno = errno;
+            close(fd);
+            if (st || *stopped || save_errno != EAGAIN) {
+                errno = save_errno;
+                return st;
+            }
+            if (!unclaimed) {
+                stale_since = 0;
+            } else if (!stale_since || sb.st_dev != stale.st_dev
+                       || sb.st_ino != stale.st_ino) {
+                stale = sb;
+                stale_since = kf_now_ns();
+            } else if (kf_now_ns() - stale_since
+                       > KF_NAMED_CLAIM_TIMEOUT_NS) {
+                kf_named_unlink_stale(name, &sb);
+                stale_since = 0;
+            }
+        }
+
+        // Someone else is creating or removing the segment.
+        if ((*stopped = should_stop->check(should_stop)))
+            return 0;
+        struct timespec pause = { 0, 200000 };  // 0.2 ms
+        nanosleep(&pause, NULL);
+    }
+}
+
+void
+kiss_fft_free_named(kiss_fft_state *st)
+{
+    if (st && st->named) {
+        const size_t twlen = kf_named_twiddle_len(st->log2_samples);
+        if (twlen)
+            munmap((void *) st->twiddles, twlen);
+        kf_named_release(st->named);
+        munmap(st->named, kf_named_page());
+    }
+    free(st);
+}
+
+// Sliding DFT.  Each time the window advances by one sample, bin k of
+// its DFT changes by a known amount:
+//
+//   X_k(n) = (X_k(n-1) - x(n-N) + x(n)) * exp(2 pi J k / N)
+//
+// so keeping a spectrum up to date costs O(1) per bin per sample
+// instead of a whole transform.  Rounding errors in this recurrence
+// accumulate without bound, so the state is kept in double precision
+// and periodically recomputed from scratch with kiss_fft.
+
+struct kiss_sdft {
+    kiss_fft_state *st;
+    size_t samples;
+    size_t nbins;
+    size_t *bins;           // NULL if tracking all of them
+    size_t resync;          // recompute after this many samples
+    size_t since_resync;
+    size_t pos;             // index of the oldest sample in 'ring'
+    kiss_fft_cpx *ring;     // 2N: each sample is stored twice, N apart,
+                            // so the window is always ring[pos..pos+N)
+    kiss_fft_cpx *scratch;  // nbins
+    double *xr, *xi;        // current spectrum
+    double *wr, *wi;        // per-bin rotation
+};
+
+void
+kiss_sdft_free(kiss_sdft *sd)
+{
+    if (!sd)
+        return;
+    free(sd->st);
+    free(sd->bins);
+    free(sd->ring);
+    free(sd->scratch);
+    free(sd->xr);
+    free(sd->xi);
+    free(sd->wr);
+    free(sd->wi);
+    free(sd);
+}
+
+kiss_sdft *
+kiss_sdft_alloc(size_t samples, const size_t *bins, size_t nbins,
+                size_t resync, kiss_fft_periodic_cb *should_stop,
+                int *stopped)
+{
+    kiss_fft_state *st = kiss_fft_alloc_interruptible(samples, should_stop,
+                                                      stopped);
+    if (st == (kiss_fft_state *)-1)
+        return (kiss_sdft *)-1;
+    if (!st)
+        return 0;
+
+    kiss_sdft *sd = calloc(1, sizeof *sd);
+    if (!sd) {
+        free(st);
+        return 0;
+    }
+    sd->st = st;
+    sd->samples = samples;
+    sd->nbins = bins ? nbins : samples;
+    sd->resync = resync ? resync : samples;
+    if (bins) {
+        sd->bins = malloc(nbins * sizeof *bins + 1);
+        if (sd->bins)
+            memcpy(sd->bins, bins, nbins * sizeof *bins);
+    }
+    sd->ring = malloc(2 * samples * sizeof(kiss_fft_cpx));
+    sd->scratch = malloc(sd->nbins * sizeof(kiss_fft_cpx) + 1);
+    sd->xr = malloc(sd->nbins * sizeof(double) + 1);
+    sd->xi = malloc(sd->nbins * sizeof(double) + 1);
+    sd->wr = malloc(sd->nbins * sizeof(double) + 1);
+    sd->wi = malloc(sd->nbins * sizeof(double) + 1);
+    if ((bins && !sd->bins) || !sd->ring || !sd->scratch
+        || !sd->xr || !sd->xi || !sd->wr || !sd->wi) {
+        kiss_sdft_free(sd);
+        return 0;
+    }
+
+    for (size_t b0 = 0; b0 < sd->nbins; b0 += KF_CHUNK_DEFAULT) {
+        const size_t b1 = sd->nbins - b0 < KF_CHUNK_DEFAULT ? sd->nbins
+            : b0 + KF_CHUNK_DEFAULT;
+        for (size_t b = b0; b < b1; b++) {
+            size_t k = bins ? bins[b] : b;
+            double w = 2.0 * M_PI * (double)k / (double)samples;
+            sd->wr[b] = cos(w);
+            sd->wi[b] = sin(w);
+        }
+        if ((*stopped = should_stop->check(should_stop))) {
+            kiss_sdft_free(sd);
+            return 0;
+        }
+    }
+    return sd;
+}
+
+// Recompute the spectrum of the current window from scratch.
+static int
+kf_sdft_resync(kiss_sdft *sd, kiss_fft_periodic_cb *should_stop)
+{
+    const kiss_fft_cpx *window = sd->ring + sd->pos;
+    int rv = sd->bins
+        ? kiss_fft_bins(sd->st, window, sd->bins, sd->nbins, sd->scratch,
+                        should_stop)
+        : kiss_fft(sd->st, window, sd->scratch, should_stop);
+    if (rv)
+        return rv;
+    for (size_t b = 0; b < sd->nbins; b++) {
+        sd->xr[b] = sd->scratch[b].r;
+        sd->xi[b] = sd->scratch[b].i;
+    }
+    sd->since_resync = 0;
+    return 0;
+}
+
+int
+kiss_sdft_init(kiss_sdft *sd, const kiss_fft_cpx *window,
+               kiss_fft_periodic_cb *should_stop)
+{
+    memcpy(sd->ring, window, sd->samples * sizeof *window);
+    memcpy(sd->ring + sd->samples, window, sd->samples * sizeof *window);
+    sd->pos = 0;
+    return kf_sdft_resync(sd, should_stop);
+}
+
+int
+kiss_sdft_update(kiss_sdft *sd, const kiss_fft_cpx *x, size_t n,
+                 kiss_fft_periodic_cb *should_stop)
+{
+    const size_t nbins = sd->nbins;
+    double *restrict xr = sd->xr, *restrict xi = sd->xi;
+    const double *restrict wr = sd->wr, *restrict wi = sd->wi;
+
+    // check for interruption about every 2**16 bin updates
+    const size_t per_check = nbins >= 65536 ? 1 : 65536 / nbins;
+
+    for (size_t i = 0; i < n; i++) {
+        const kiss_fft_cpx old = sd->ring[sd->pos];
+        sd->ring[sd->pos] = x[i];
+        sd->ring[sd->pos + sd->samples] = x[i];
+        if (++sd->pos == sd->samples)
+            sd->pos = 0;
+
+        const double dr = (double)x[i].r - (double)old.r;
+        const double di = (double)x[i].i - (double)old.i;
+        for (size_t b = 0; b < nbins; b++) {
+            double ar = xr[b] + dr, ai = xi[b] + di;
+            xr[b] = ar * wr[b] - ai * wi[b];
+            xi[b] = ar * wi[b] + ai * wr[b];
+        }
+
+        int rv;
+        if (++sd->since_resync >= sd->resync) {
+            rv = kf_sdft_resync(sd, should_stop);
+            if (rv) return rv;
+        } else if ((i + 1) % per_check == 0) {
+            rv = should_stop->check(should_stop);
+            if (rv) return rv;
+        }
+    }
+    return should_stop->check(should_stop);
+}
+
+void
+kiss_sdft_spectrum(const kiss_sdft *sd, kiss_fft_cpx *out)
+{
+    for (size_t b = 0; b < sd->nbins; b++) {
+        out[b].r = (float)sd->xr[b];
+        out[b].i = (float)sd->xi[b];
+    }
+}
+
+// Chirp-z transform, by Bluestein's algorithm.  We want
+//
+//   X_k = sum_n x_n exp(-2 pi J (f0 + k df) n),  k = 0 .. M-1,
+//
+// for an arbitrary starting frequency F0 and spacing DF, in cycles per
+// sample.  Writing nk = (n^2 + k^2 - (k-n)^2) / 2 turns this into
+//
+//   X_k = c_k^* sum_n (x_n exp(-2 pi J f0 n) c_n^*) c_{k-n},
+//
+// where c_n = exp(pi J df n^2): a convolution with a chirp, which can
+// be done by FFT at any power-of-two size L >= N + M - 1.  The chirp's
+// spectrum only depends on the parameters, so it's computed once, in
+// kiss_czt_alloc.  Only the pointwise product of the spectra is
+// needed, so they're left in scrambled order; see
+// kiss_fft_scrambled.
+
+struct kiss_czt_state {
+    kiss_fft_state *st;     // plan for L points
+    size_t n, m, l;
+    kiss_fft_cpx *pre;      // N: exp(-2 pi J f0 n) c_n^*
+    kiss_fft_cpx *post;     // M: c_k^* / L
+    kiss_fft_cpx *chirp;    // L: FFT(c), suitably wrapped around,
+                            // in scrambled order
+    kiss_fft_cpx *work;     // L
+};
+
+// exp(2 pi J CYCLES), after reducing CYCLES to [0, 1) so that the
+// large phases of the chirps don't lose precision in sin and cos.
+static kiss_fft_cpx
+kf_cis_cycles(double cycles)
+{
+    cycles -= floor(cycles);
+    kiss_fft_cpx c = {
+        (float)cos(2.0 * M_PI * cycles),
+        (float)sin(2.0 * M_PI * cycles),
+    };
+    return c;
+}
+
+// A * B less an integer, which kf_cis_cycles can take without
+// losing the fraction: the rounding error of the product is exact as
+// an fma, and the integer part of the rounded product is subtracted
+// exactly.
+static double
+kf_frac_product(double a, double b)
+{
+    const double p = a * b;
+    const double e = fma(a, b, -p);
+    return (p - floor(p)) + e;
+}
+
+// COEF * j**2 cycles, less an integer.  j**2 itself is only exact in
+// double up to j = 2**26.5, and past that the rounding error, times
+// COEF, would swamp the phase; so j**2 is split into the rounded
+// square and its exact error, each multiplied out by kf_frac_product.
+static double
+kf_chirp_cycles(double coef, size_t j)
+{
+    const double d = (double)j;
+    const double sq = d * d;
+    const double sq_err = fma(d, d, -sq);
+    return kf_frac_product(coef, sq) + kf_frac_product(coef, sq_err);
+}
+
+void
+kiss_czt_free(kiss_czt_state *cz)
+{
+    if (!cz)
+        return;
+    free(cz->st);
+    free(cz->pre);
+    free(cz->post);
+    free(cz->chirp);
+    free(cz->work);
+    free(cz);
+}
+
+// Store exp(2 pi J COEF j**2) for j in [J0, J1) at C, C + STRIDE,
+// C + 2*STRIDE, ..., checking SHOULD_STOP every KF_CHUNK_DEFAULT
+// points.
+static int
+kf_czt_chirp(kiss_fft_cpx *c, ptrdiff_t stride, size_t j0, size_t j1,
+             double coef, kiss_fft_periodic_cb *should_stop)
+{
+    for (size_t k0 = j0; k0 < j1; k0 += KF_CHUNK_DEFAULT) {
+        const size_t k1 = j1 - k0 < KF_CHUNK_DEFAULT ? j1
+            : k0 + KF_CHUNK_DEFAULT;
+        for (size_t j = k0; j < k1; j++)
+            c[(ptrdiff_t)(j - j0) * stride] =
+                kf_cis_cycles(kf_chirp_cycles(coef, j));
+        int rv = should_stop->check(should_stop);
+        if (rv)
+            return rv;
+    }
+    return 0;
+}
+
+kiss_czt_state *
+kiss_czt_alloc(size_t n, size_t m, double f0, double df,
+               kiss_fft_periodic_cb *should_stop, int *stopped)
+{
+    *stopped = 0;
+    if (n == 0 || m == 0 || m > KISS_FFT_MAX_SAMPLES
+        || n > KISS_FFT_MAX_SAMPLES + 1 - m)
+        return (kiss_czt_state *)-1;
+    size_t l = 1;
+    while (l < n + m - 1)
+        l *= 2;
+
+    kiss_fft_state *st = kiss_fft_alloc_interruptible(l, should_stop,
+                                                      stopped);
+    if (st == (kiss_fft_state *)-1)
+        return (kiss_czt_state *)-1;
+    if (!st)
+        return 0;
+
+    kiss_czt_state *cz = calloc(1, sizeof *cz);
+    if (!cz) {
+        free(st);
+        return 0;
+    }
+    cz->st = st;
+    cz->n = n;
+    cz->m = m;
+    cz->l = l;
+    cz->pre = malloc(n * sizeof(kiss_fft_cpx));
+    cz->post = malloc(m * sizeof(kiss_fft_cpx));
+    cz->chirp = malloc(l * sizeof(kiss_fft_cpx));
+    cz->work = malloc(l * sizeof(kiss_fft_cpx));
+    if (!cz->pre || !cz->post || !cz->chirp || !cz->work) {
+        kiss_czt_free(cz);
+        return 0;
+    }
+
+    // See kf_chirp_cycles for why the phases aren't just multiplied
+    // out.
+    for (size_t i0 = 0; i0 < n; i0 += KF_CHUNK_DEFAULT) {
+        const size_t i1 = n - i0 < KF_CHUNK_DEFAULT ? n
+            : i0 + KF_CHUNK_DEFAULT;
+        for (size_t i = i0; i < i1; i++)
+            cz->pre[i] = kf_cis_cycles(-kf_frac_product(f0, (double)i)
+                                       - kf_chirp_cycles(0.5 * df, i));
+        if ((*stopped = should_stop->check(should_stop)))
+            goto stop;
+    }
+    if ((*stopped = kf_czt_chirp(cz->post, 1, 0, m, -0.5 * df,
+                                 should_stop)))
+        goto stop;
+    const float scale = 1.0f / (float)l;
+    for (size_t k = 0; k < m; k++) {
+        cz->post[k].r *= scale;
+        cz->post[k].i *= scale;
+    }
+
+    // c_j for j = -(N-1) .. M-1, with the negative indices wrapped
+    // around to the end
+    kiss_fft_cpx *c = cz->work;
+    memset(c + m, 0, (l - m) * sizeof *c);
+    if ((*stopped = kf_czt_chirp(c, 1, 0, m, 0.5 * df, should_stop))
+        || (*stopped = kf_czt_chirp(c + l - 1, -1, 1, n, 0.5 * df,
+                                    should_stop)))
+        goto stop;
+
+    if ((*stopped = kiss_fft_scrambled(st, c, cz->chirp, should_stop)))
+        goto stop;
+    return cz;
+
+ stop:
+    kiss_czt_free(cz);
+    return 0;
+}
+
+int
+kiss_czt(kiss_czt_state *cz, const kiss_fft_cpx *fin, kiss_fft_cpx *fout,
+         kiss_fft_periodic_cb *should_stop)
+{
+    kiss_fft_cpx *a = cz->work;
+    int rv;
+
+    for (size_t i = 0; i < cz->n; i++)
+        C_MUL(a[i], fin[i], cz->pre[i]);
+    memset(a + cz->n, 0, (cz->l - cz->n) * sizeof *a);
+    rv = kiss_fft_scrambled(cz->st, a, a, should_stop);
+    if (rv) return rv;
+
+    for (size_t j = 0; j < cz->l; j++) {
+        kiss_fft_cpx t;
+        C_MUL(t, a[j], cz->chirp[j]);
+        a[j] = t;
+    }
+    rv = kiss_ifft_scrambled(cz->st, a, a, should_stop);
+    if (rv) return rv;
+
+    for (size_t k = 0; k < cz->m; k++)
+        C_MUL(fout[k], a[k], cz->post[k]);
+    return should_stop->check(should_stop);
+}
+
+// Welch's method.  Each segment is windowed and transformed with
+// kiss_fft_spectrum, and its power added to a double-precision
+// accumulator; the segments are split into one contiguous run per
+// thread, each with its own accumulator, and the accumulators are
+// summed at the end.  Only the calling thread runs SHOULD_STOP,
+// since the check may need the GIL; when it says to stop, it sets a
+// flag that the other threads' check functions return.
+
+struct kf_welch_worker {
+    kiss_fft_periodic_cb base;  // kf_welch_cancelled, or for the
+                                // calling thread, kf_welch_main_check
+    kiss_welch_state *w;
+    kiss_fft_cpx *scratch;      // samples
+    float *power;               // samples
+    double *acc;                // samples
+    size_t first, last;         // segments [first, last) of this call
+    bool started;               // running in its own thread?
+    pthread_t thread;
+};
+
+struct kiss_welch_state {
+    kiss_fft_state *st;
+    size_t samples;
+    size_t step;
+    unsigned nthreads;
+    double scale;               // 1 / sum of squares of the window
+    float *window;              // NULL for a rectangular window
+    struct kf_welch_worker *workers;  // nthreads
+
+    // for the duration of one call to kiss_welch
+    struct kf_source x;         // with WINDOW
+    kiss_fft_periodic_cb *should_stop;
+    _Atomic int stop;           // nonzero: abandon work
+    _Atomic unsigned running;   // threads not yet finished
+};
+
+void
+kiss_welch_free(kiss_welch_state *w)
+{
+    if (!w)
+        return;
+    if (w->workers) {
+        for (unsigned t = 0; t < w->nthreads; t++) {
+            free(w->workers[t].scratch);
+            free(w->workers[t].power);
+            free(w->workers[t].acc);
+        }
+    }
+    free(w->st);
+    free(w->window);
+    free(w->workers);
+    free(w);
+}
+
+kiss_welch_state *
+kiss_welch_alloc(size_t samples, size_t step, size_t max_len,
+                 const float *window, unsigned nthreads,
+                 kiss_fft_periodic_cb *should_stop, int *stopped)
+{
+    *stopped = 0;
+    if (step == 0)
+        return (kiss_welch_state *)-1;
+    kiss_fft_state *st = kiss_fft_alloc_interruptible(samples, should_stop,
+                                                      stopped);
+    if (st == (kiss_fft_state *)-1)
+        return (kiss_welch_state *)-1;
+    if (!st)
+        return 0;
+
+    // Each thread gets its own buffers, so don't have more threads than
+    // there are CPUs to run them or segments to give them.
+    const unsigned max_threads = kf_online_cpus();
+    const size_t max_seg =
+        max_len < samples ? 0 : (max_len - samples) / step + 1;
+    if (nthreads == 0 || nthreads > max_threads)
+        nthreads = max_threads;
+    if (nthreads > max_seg)
+        nthreads = max_seg ? (unsigned)max_seg : 1;
+
+    kiss_welch_state *w = calloc(1, sizeof *w);
+    if (!w) {
+        free(st);
+        return 0;
+    }
+    w->st = st;
+    w->samples = samples;
+    w->step = step;
+    w->nthreads = nthreads;
+    w->workers = calloc(nthreads, sizeof *w->workers);
+    if (!w->workers) {
+        kiss_welch_free(w);
+        return 0;
+    }
+    for (unsigned t = 0; t < nthreads; t++) {
+        struct kf_welch_worker *wk = &w->workers[t];
+        wk->w = w;
+        wk->scratch = malloc(samples * sizeof(kiss_fft_cpx));
+        wk->power = malloc(samples * sizeof(float));
+        wk->acc = malloc(samples * sizeof(double));
+        if (!wk->scratch || !wk->power || !wk->acc) {
+            kiss_welch_free(w);
+            return 0;
+        }
+    }
+
+    double sumsq = 0;
+    if (window) {
+        w->window = malloc(samples * sizeof(float));
+        if (!w->window) {
+            kiss_welch_free(w);
+            return 0;
+        }
+        memcpy(w->window, window, samples * sizeof(float));
+        for (size_t i = 0; i < samples; i++)
+            sumsq += (double)window[i] * (double)window[i];
+    } else {
+        sumsq = (double)samples;
+    }
+    w->scale = sumsq > 0 ? 1.0 / sumsq : 0;
+    return w;
+}
+
+// Sum the power spectra of this worker's segments into its
+// accumulator.
+static int
+kf_welch_segments(struct kf_welch_worker *wk)
+{
+    const kiss_welch_state *w = wk->w;
+    memset(wk->acc, 0, w->samples * sizeof(double));
+    for (size_t s = wk->first; s < wk->last; s++) {
+        const struct kf_source seg = kf_source_skip(&w->x, s * w->step);
+        int rv = kf_spectrum(w->st, &seg, wk->power, KISS_FFT_POWER,
+                             wk->scratch, &wk->base);
+        if (rv) return rv;
+        for (size_t k = 0; k < w->samples; k++)
+            wk->acc[k] += wk->power[k];
+    }
+    return 0;
+}
+
+static int
+kf_welch_cancelled(kiss_fft_periodic_cb *cb)
+{
+    struct kf_welch_worker *wk = (struct kf_welch_worker *)cb;
+    return atomic_load_explicit(&wk->w->stop, memory_order_relaxed);
+}
+
+static int
+kf_welch_main_check(kiss_fft_periodic_cb *cb)
+{
+    kiss_welch_state *w = ((struct kf_welch_worker *)cb)->w;
+    int rv = w->should_stop->check(w->should_stop);
+    if (rv)
+        atomic_store_explicit(&w->stop, rv, memory_order_relaxed);
+    return rv;
+}
+
+static void *
+kf_welch_thread(void *arg)
+{
+    struct kf_welch_worker *wk = arg;
+    kf_welch_segments(wk);
+    atomic_fetch_sub_explicit(&wk->w->running, 1, memory_order_release);
+    return NULL;
+}
+
+static int
+kf_welch(kiss_welch_state *w, const struct kf_source *x, size_t len,
+         float *psd, kiss_fft_periodic_cb *should_stop)
+{
+    const size_t nseg =
+        len < w->samples ? 0 : (len - w->samples) / w->step + 1;
+    const unsigned nthreads =
+        nseg < w->nthreads ? (unsigned)nseg : w->nthreads;
+    int rv = 0;
+
+    w->x = *x;
+    w->x.window = w->window;
+    w->should_stop = should_stop;
+    atomic_store(&w->stop, 0);
+    atomic_store(&w->running, 0);
+
+    for (unsigned t = 0; t < nthreads; t++) {
+        struct kf_welch_worker *wk = &w->workers[t];
+        wk->base.check = t == 0 ? kf_welch_main_check : kf_welch_cancelled;
+        wk->base.interval_ns = should_stop->interval_ns;
+        wk->first = nseg * t / nthreads;
+        wk->last = nseg * (t + 1) / nthreads;
+        wk->started = false;
+    }
+
+    // Signals should be delivered to this thread, which is the one
+    // checking for them, so block them all in the helpers.  If a
+    // helper can't be started, this thread does its share instead.
+    sigset_t all, prev;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &prev);
+    for (unsigned t = 1; t < nthreads; t++) {
+        struct kf_welch_worker *wk = &w->workers[t];
+        atomic_fetch_add(&w->running, 1);
+        wk->started = !pthread_create(&wk->thread, NULL, kf_welch_thread, wk);
+        if (!wk->started)
+            atomic_fetch_sub(&w->running, 1);
+    }
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+    for (unsigned t = 0; t < nthreads && !rv; t++) {
+        struct kf_welch_worker *wk = &w->workers[t];
+        if (wk->started)
+            continue;
+        wk->base.check = kf_welch_main_check;
+        rv = kf_welch_segments(wk);
+    }
+
+    // Keep checking while waiting for the helpers to finish.
+    while (!rv && atomic_load_explicit(&w->running, memory_order_acquire)) {
+        rv = kf_welch_main_check(&w->workers[0].base);
+        if (!rv) {
+            struct timespec pause = { 0, 200000 };  // 0.2 ms
+            nanosleep(&pause, NULL);
+        }
+    }
+    for (unsigned t = 1; t < nthreads; t++)
+        if (w->workers[t].started)
+            pthread_join(w->workers[t].thread, NULL);
+    if (rv)
+        return rv;
+
+    const double scale = nseg ? w->scale / (double)nseg : 0;
+    for (size_t k = 0; k < w->samples; k++) {
+        double sum = 0;
+        for (unsigned t = 0; t < nthreads; t++)
+            sum += w->workers[t].acc[k];
+        psd[k] = (float)(sum * scale);
+    }
+    return should_stop->check(should_stop);
+}
+
+int
+kiss_welch(kiss_welch_state *w, const kiss_fft_cpx *x, size_t len,
+           float *psd, kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_source src = { x, KF_SOURCE_CPX, 1, 1.0f, NULL };
+    return kf_welch(w, &src, len, psd, should_stop);
+}
+
+int
+kiss_welch_pcm(kiss_welch_state *w, const void *x, int format,
+               size_t stride, float scale, size_t len, float *psd,
+               kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_source src = { x, format, stride, scale, NULL };
+    return kf_welch(w, &src, len, psd, should_stop);
+}
+
+// Sparse FFT, after Hassanieh, Indyk, Katabi and Price.  Each round
+// hashes the N bins of the spectrum into B << N buckets, using only
+// O(B) input samples:
+//
+//  - A random odd SIGMA and offset A permute the spectrum: the signal
+//    p_l = x[SIGMA l + A] has bin k of x at bin SIGMA k mod N, rotated
+//    by exp(2 pi J k A / N).
+//
+//  - p is multiplied by a filter g, a sinc times a Gaussian, WIDTH
+//    taps long; its spectrum H is nearly flat over N/B bins and nearly
+//    zero outside a little more than that.  Folding the product modulo
+//    B and taking a B-point FFT gives buckets
+//
+//      z_b = (1/N) sum_k X_k exp(2 pi J k A / N) H(b N/B - SIGMA k).
+//
+//  - A bucket holding one large bin k is the same, up to a factor of
+//    exp(2 pi J k D / N), when A is replaced by A + D.  The phases for
+//    D = 1, 16, 256, ... give k four bits at a time.  Buckets where
+//    the phases or magnitudes don't agree hold more than one bin, and
+//    are left for a later round with a different SIGMA.
+//
+// Bins found are "peeled": their contributions are subtracted from
+// the buckets of every later round, so each round only has to find
+// what's left.  H is evaluated in closed form, as a box convolved
+// with a Gaussian.  Once what's left is below TOLERANCE times the
+// energy of the whole spectrum, we're done; if that hasn't happened
+// after KF_SFFT_MAX_ROUNDS, or more bins have turned up than there
+// is room for, the spectrum isn't sparse and kiss_fft does the work.
+
+#define KF_SFFT_BUCKETS_PER_BIN 4
+#define KF_SFFT_MIN_BUCKETS     64
+#define KF_SFFT_TAPS_PER_BUCKET 32  // filter taps; the Gaussian's sigma
+                                    // is 1/12 of this, so the filter is
+                                    // cut off at 6 sigma
+#define KF_SFFT_SHIFT_LOG2      4   // each shift is 16 times the last
+#define KF_SFFT_MAX_SHIFTS (2 + KF_MAX_LOG2_SAMPLES / KF_SFFT_SHIFT_LOG2)
+#define KF_SFFT_MAX_ROUNDS      12
+#define KF_SFFT_TAP_BLOCK       ((size_t)1 << 12)  // taps between checks
+#define KF_SFFT_PHASE_TOLERANCE 0.05  // cycles
+#define KF_SFFT_MAG_TOLERANCE   0.1
+
+struct kf_sfft_bucket {
+    double energy;
+    size_t b;
+};
+
+struct kiss_sfft_state {
+    kiss_fft_state *bst;        // BUCKETS points, or NULL if hashing
+                                // would cost as much as kiss_fft
+    size_t samples, buckets, width;
+    double tolerance;
+    double sigma_f;             // of the filter's Gaussian, in bins
+    uint64_t seed;
+    unsigned nshifts;
+    size_t shifts[KF_SFFT_MAX_SHIFTS];  // 0, 1, 16, 256, ... < SAMPLES
+    double *taps;               // width
+    struct kf_dcpx *fold;       // nshifts * buckets
+    kiss_fft_cpx *tmp;          // 2 * buckets
+    struct kf_dcpx *z;          // nshifts * buckets
+    struct kf_sfft_bucket *order;  // buckets
+    size_t *bins;               // cap
+    struct kf_dcpx *vals;       // cap, X_k as kiss_fft would compute it
+    size_t nfound, cap;
+};
+
+void
+kiss_sfft_free(kiss_sfft_state *sf)
+{
+    if (!sf)
+        return;
+    free(sf->bst);
+    free(sf->taps);
+    free(sf->fold);
+    free(sf->tmp);
+    free(sf->z);
+    free(sf->order);
+    free(sf->bins);
+    free(sf->vals);
+    free(sf);
+}
+
+kiss_sfft_state *
+kiss_sfft_alloc(size_t samples, size_t k, double tolerance,
+                kiss_fft_periodic_cb *should_stop, int *stopped)
+{
+    *stopped = 0;
+    if (kf_log2(samples) < 0 || k == 0
+        || !(tolerance >= 0 && tolerance < 1))
+        return (kiss_sfft_state *)-1;
+
+    kiss_sfft_state *sf = calloc(1, sizeof *sf);
+    if (!sf)
+        return 0;
+    sf->samples = samples;
+    sf->tolerance = tolerance;
+    sf->seed = UINT64_C(0x9e3779b97f4a7c15);
+
+    size_t b = KF_SFFT_MIN_BUCKETS;
+    while (b / KF_SFFT_BUCKETS_PER_BIN < k && b < sf->samples)
+        b *= 2;
+    // Each round reads WIDTH samples once per shift, at random; that
+    // has to be well short of a whole transform to be worth trying.
+    if (b * KF_SFFT_TAPS_PER_BUCKET * 16 > sf->samples)
+        return sf;
+
+    sf->buckets = b;
+    sf->width = b * KF_SFFT_TAPS_PER_BUCKET;
+    sf->cap = KF_SFFT_BUCKETS_PER_BIN * k;
+    sf->shifts[0] = 0;
+    sf->nshifts = 1;
+    for (size_t d = 1; d < sf->samples; d <<= KF_SFFT_SHIFT_LOG2)
+        sf->shifts[sf->nshifts++] = d;
+
+    sf->bst = kiss_fft_alloc_interruptible(b, should_stop, stopped);
+    if (*stopped) {
+        kiss_sfft_free(sf);
+        return 0;
+    }
+    sf->taps = malloc(sf->width * sizeof(double));
+    sf->fold = malloc(sf->nshifts * b * sizeof(struct kf_dcpx));
+    sf->tmp = malloc(2 * b * sizeof(kiss_fft_cpx));
+    sf->z = malloc(sf->nshifts * b * sizeof(struct kf_dcpx));
+    sf->order = malloc(b * sizeof(struct kf_sfft_bucket));
+    sf->bins = malloc(sf->cap * sizeof(size_t));
+    sf->vals = malloc(sf->cap * sizeof(struct kf_dcpx));
+    if (!sf->bst || !sf->taps || !sf->fold || !sf->tmp || !sf->z
+        || !sf->order || !sf->bins || !sf->vals) {
+        kiss_sfft_free(sf);
+        return 0;
+    }
+
+    // sinc(l / B) / B has a spectrum of exactly 1 for |f| < N/(2B)
+    // bins and 0 elsewhere; the Gaussian smooths the edges of that box
+    // with a Gaussian of sigma N / (2 pi sigma_t) bins.
+    const double sigma_t = (double)sf->width / 12.0;
+    const double half = (double)(sf->width / 2);
+    for (size_t l = 0; l < sf->width; l++) {
+        double t = (double)l - half;
+        double u = M_PI * t / (double)b;
+        double sinc = t == 0 ? 1.0 : sin(u) / u;
+        sf->taps[l] = sinc / (double)b
+            * exp(-0.5 * t * t / (sigma_t * sigma_t));
+    }
+    sf->sigma_f = (double)sf->samples / (2.0 * M_PI * sigma_t);
+    return sf;
+}
+
+static uint64_t
+kf_sfft_random(kiss_sfft_state *sf)
+{
+    // splitmix64
+    uint64_t z = (sf->seed += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+// exp(2 pi J K D / N), exactly reduced modulo N first.
+static struct kf_dcpx
+kf_sfft_cis(const kiss_sfft_state *sf, size_t k, size_t d)
+{
+    const double c = 2.0 * M_PI * (double)((k * d) & (sf->samples - 1))
+        / (double)sf->samples;
+    struct kf_dcpx r = { cos(c), sin(c) };
+    return r;
+}
+
+// The filter's response to a bin F bins from the centre of a bucket.
+static double
+kf_sfft_response(const kiss_sfft_state *sf, double f)
+{
+    const double w = 0.5 * (double)(sf->samples / sf->buckets);
+    const double s = sqrt(2.0) * sf->sigma_f;
+    return 0.5 * (erf((f + w) / s) - erf((f - w) / s));
+}
+
+// Distance in bins from the centre of bucket B to bin POS of the
+// permuted spectrum, wrapped to [-N/2, N/2).
+static double
+kf_sfft_offset(const kiss_sfft_state *sf, size_t b, size_t pos)
+{
+    const size_t n = sf->samples;
+    size_t d = (pos - b * (n / sf->buckets)) & (n - 1);
+    return d < n / 2 ? (double)d : (double)d - (double)n;
+}
+
+static size_t
+kf_sfft_nearest_bucket(const kiss_sfft_state *sf, size_t pos)
+{
+    const size_t w = sf->samples / sf->buckets;
+    return ((pos + w / 2) / w) & (sf->buckets - 1);
+}
+
+// Subtract bin K, with value V, from every shift of the buckets
+// near it.
+static void
+kf_sfft_peel(kiss_sfft_state *sf, size_t k, struct kf_dcpx v,
+             size_t sigma, size_t a)
+{
+    const size_t nb = sf->buckets;
+    const size_t pos = (sigma * k) & (sf->samples - 1);
+    const size_t b0 = kf_sfft_nearest_bucket(sf, pos);
+    const double scale = 1.0 / (double)sf->samples;
+
+    for (size_t i = 0; i < 3; i++) {
+        const size_t b = (b0 + nb - 1 + i) & (nb - 1);
+        const double h = kf_sfft_response(sf, kf_sfft_offset(sf, b, pos))
+            * scale;
+        if (h == 0)
+            continue;
+        for (unsigned s = 0; s < sf->nshifts; s++) {
+            struct kf_dcpx c = kf_sfft_cis(sf, k, a + sf->shifts[s]);
+            struct kf_dcpx *z = &sf->z[s * nb + b];
+            z->r -= h * (v.r * c.r - v.i * c.i);
+            z->i -= h * (v.r * c.i + v.i * c.r);
+        }
+    }
+}
+
+// Phase of A * conj(B), in cycles.
+static double
+kf_sfft_phase(struct kf_dcpx a, struct kf_dcpx b)
+{
+    return atan2(a.i * b.r - a.r * b.i, a.r * b.r + a.i * b.i)
+        / (2.0 * M_PI);
+}
+
+// If bucket B holds one bin, and this is the nearest bucket to it,
+// set *K and *V to that bin and its value, and return true.
+static bool
+kf_sfft_locate(const kiss_sfft_state *sf, size_t b, size_t sigma, size_t a,
+               size_t *k, struct kf_dcpx *v)
+{
+    const size_t n = sf->samples, nb = sf->buckets;
+    const struct kf_dcpx z0 = sf->z[b];
+    const double m0 = hypot(z0.r, z0.i);
+    if (m0 == 0)
+        return false;
+
+    // Each shift D gives k modulo N/D; the last estimate is good to
+    // much better than that, so picks out which one.
+    double est = kf_sfft_phase(sf->z[nb + b], z0) * (double)n;
+    for (unsigned s = 2; s < sf->nshifts; s++) {
+        const double period = (double)(n / sf->shifts[s]);
+        const double c = kf_sfft_phase(sf->z[s * nb + b], z0) * period;
+        est = c + nearbyint((est - c) / period) * period;
+    }
+    est = fmod(est, (double)n);
+    if (est < 0)
+        est += (double)n;
+    const size_t kk = (size_t)llround(est) & (n - 1);
+
+    for (unsigned s = 1; s < sf->nshifts; s++) {
+        const struct kf_dcpx zs = sf->z[s * nb + b];
+        double e = kf_sfft_phase(zs, z0)
+            - (double)((kk * sf->shifts[s]) & (n - 1)) / (double)n;
+        e -= nearbyint(e);
+        if (fabs(e) > KF_SFFT_PHASE_TOLERANCE
+            || fabs(hypot(zs.r, zs.i) - m0) > KF_SFFT_MAG_TOLERANCE * m0)
+            return false;
+    }
+
+    const size_t pos = (sigma * kk) & (n - 1);
+    if (kf_sfft_nearest_bucket(sf, pos) != b)
+        return false;
+
+    const double h = kf_sfft_response(sf, kf_sfft_offset(sf, b, pos));
+    const struct kf_dcpx c = kf_sfft_cis(sf, kk, n - (a & (n - 1)));
+    const double scale = (double)n / h;
+    v->r = (z0.r * c.r - z0.i * c.i) * scale;
+    v->i = (z0.r * c.i + z0.i * c.r) * scale;
+    *k = kk;
+    return true;
+}
+
+static int
+kf_sfft_bucket_cmp(const void *a, const void *b)
+{
+    const double x = ((const struct kf_sfft_bucket *)a)->energy;
+    const double y = ((const struct kf_sfft_bucket *)b)->energy;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Fill z with the buckets of one round, for every shift.
+static int
+kf_sfft_hash(kiss_sfft_state *sf, const kiss_fft_cpx *fin,
+             size_t sigma, size_t a, kiss_fft_periodic_cb *should_stop)
+{
+    const size_t mask = sf->samples - 1, nb = sf->buckets;
+    const unsigned nshifts = sf->nshifts;
+    struct kf_dcpx *restrict fold = sf->fold;
+    int rv;
+
+    memset(fold, 0, nshifts * nb * sizeof *fold);
+    for (size_t l0 = 0; l0 < sf->width; ) {
+        size_t l1 = sf->width - l0 < KF_SFFT_TAP_BLOCK ? sf->width
+            : l0 + KF_SFFT_TAP_BLOCK;
+        for (size_t l = l0; l < l1; l++) {
+            const double t = sf->taps[l];
+            const size_t i = (sigma * (l - sf->width / 2) + a) & mask;
+            struct kf_dcpx *f = fold + (l & (nb - 1));
+            for (unsigned s = 0; s < nshifts; s++) {
+                const kiss_fft_cpx x = fin[(i + sf->shifts[s]) & mask];
+                f[s * nb].r += t * (double)x.r;
+                f[s * nb].i += t * (double)x.i;
+            }
+        }
+        l0 = l1;
+        if ((rv = should_stop->check(should_stop)))
+            return rv;
+    }
+
+    kiss_fft_cpx *in = sf->tmp, *out = sf->tmp + nb;
+    for (unsigned s = 0; s < nshifts; s++) {
+        for (size_t j = 0; j < nb; j++) {
+            in[j].r = (float)fold[s * nb + j].r;
+            in[j].i = (float)fold[s * nb + j].i;
+        }
+        if ((rv = kiss_fft(sf->bst, in, out, should_stop)))
+            return rv;
+        for (size_t j = 0; j < nb; j++) {
+            sf->z[s * nb + j].r = (double)out[j].r;
+            sf->z[s * nb + j].i = (double)out[j].i;
+        }
+    }
+    return 0;
+}
+
+// Add V to bin K of the result so far.  Returns false if there's no
+// room for it.
+static bool
+kf_sfft_add(kiss_sfft_state *sf, size_t k, struct kf_dcpx v)
+{
+    for (size_t i = 0; i < sf->nfound; i++) {
+        if (sf->bins[i] == k) {
+            sf->vals[i].r += v.r;
+            sf->vals[i].i += v.i;
+            return true;
+        }
+    }
+    if (sf->nfound == sf->cap)
+        return false;
+    sf->bins[sf->nfound] = k;
+    sf->vals[sf->nfound] = v;
+    sf->nfound++;
+    return true;
+}
+
+// Sets *SPARSE if the bins found account for all but TOLERANCE of
+// the spectrum.  Returns zero or the value of should_stop->check.
+static int
+kf_sfft_rounds(kiss_sfft_state *sf, const kiss_fft_cpx *fin, bool *sparse,
+               kiss_fft_periodic_cb *should_stop)
+{
+    const size_t nb = sf->buckets;
+    sf->nfound = 0;
+    *sparse = false;
+
+    for (unsigned round = 0; round < KF_SFFT_MAX_ROUNDS; round++) {
+        const size_t sigma = (size_t)kf_sfft_random(sf) | 1;
+        const size_t a = (size_t)kf_sfft_random(sf) & (sf->samples - 1);
+        int rv = kf_sfft_hash(sf, fin, sigma, a, should_stop);
+        if (rv)
+            return rv;
+
+        double total = 0;
+        for (size_t b = 0; b < nb; b++)
+            total += sf->z[b].r * sf->z[b].r + sf->z[b].i * sf->z[b].i;
+        for (size_t i = 0; i < sf->nfound; i++)
+            kf_sfft_peel(sf, sf->bins[i], sf->vals[i], sigma, a);
+
+        double left = 0;
+        size_t nbig = 0;
+        for (size_t b = 0; b < nb; b++) {
+            double e = sf->z[b].r * sf->z[b].r + sf->z[b].i * sf->z[b].i;
+            left += e;
+            if (e > sf->tolerance * total / (double)nb) {
+                sf->order[nbig].energy = e;
+                sf->order[nbig].b = b;
+                nbig++;
+            }
+        }
+        if (left <= sf->tolerance * total) {
+            *sparse = true;
+            return 0;
+        }
+
+        // If no bucket at all holds a single bin, what's left is noise
+        // or too dense to hash.
+        size_t located = 0;
+        qsort(sf->order, nbig, sizeof *sf->order, kf_sfft_bucket_cmp);
+        for (size_t i = 0; i < nbig; i++) {
+            size_t k;
+            struct kf_dcpx v;
+            if (!kf_sfft_locate(sf, sf->order[i].b, sigma, a, &k, &v))
+                continue;
+            if (!kf_sfft_add(sf, k, v))
+                return 0;
+            kf_sfft_peel(sf, k, v, sigma, a);
+            located++;
+        }
+        if (!located)
+            return 0;
+        if ((rv = should_stop->check(should_stop)))
+            return rv;
+    }
+    return 0;
+}
+
+int
+kiss_sfft(kiss_sfft_state *sf, kiss_fft_state *st, const kiss_fft_cpx *fin,
+          kiss_fft_cpx *fout, size_t *nfound,
+          kiss_fft_periodic_cb *should_stop)
+{
+    bool sparse = false;
+    int rv = sf->bst ? kf_sfft_rounds(sf, fin, &sparse, should_stop) : 0;
+    if (rv)
+        return rv;
+    if (!sparse) {
+        *nfound = st ? sf->samples : SIZE_MAX;
+        return st ? kiss_fft(st, fin, fout, should_stop) : 0;
+    }
+
+    memset(fout, 0, sf->samples * sizeof *fout);
+    for (size_t i = 0; i < sf->nfound; i++) {
+        fout[sf->bins[i]].r = (float)sf->vals[i].r;
+        fout[sf->bins[i]].i = (float)sf->vals[i].i;
+    }
+    *nfound = sf->nfound;
+    return should_stop->check(should_stop);
+}
+
+// Number-theoretic transform.  This is kiss_fft with the complex
+// numbers replaced by integers modulo the prime P = 29 * 2**57 + 1,
+// which has a primitive 2**57th root of unity: 3**((P-1)/N) is a
+// primitive Nth root for any power of two N, and plays the part of
+// exp(-2 pi J / N).  The arithmetic is exact, so a convolution done
+// by NTT has no rounding error at all, only wraparound modulo P.
+//
+// The recursion is kf_work's: radix-4 stages with a radix-2 stage at
+// the bottom if N is an odd power of two, each stage with a table of
+// twiddle triples laid out as in kf_stage_twiddles.  Products are
+// done by Montgomery reduction: the twiddles are stored multiplied by
+// 2**64 mod P, so that kf_ntt_mul(x, w 2**64) = x w mod P leaves the
+// data itself in the ordinary representation.
+
+#define KF_NTT_PINV UINT64_C(0x39ffffffffffffff)  // -1/P mod 2**64
+#define KF_NTT_R2 UINT64_C(1878466934230121386)   // 2**128 mod P
+#define KF_NTT_GENERATOR 3
+#define KF_NTT_CHECK_MIN 64  // smaller stages don't check
+
+struct kiss_ntt_state {
+    uint32_t log2_samples;
+    uint64_t j;              // the primitive 4th root, times 2**64
+    uint64_t inv_samples;    // 1/N, times 2**64
+    uint64_t twiddles[];     // see kf_ntt_stage_twiddles
+};
+
+static inline const uint64_t *
+kf_ntt_stage_twiddles(const kiss_ntt_state *st, size_t m)
+{
+    return st->twiddles + 3 * (m - 1);
+}
+
+// Low half of A * B; the high half goes to *HI.
+static KF_ALWAYS_INLINE uint64_t
+kf_mul64(uint64_t a, uint64_t b, uint64_t *hi)
+{
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 u128;
+    u128 t = (u128)a * b;
+    *hi = (uint64_t)(t >> 64);
+    return (uint64_t)t;
+#else
+    const uint64_t a0 = a & 0xffffffffu, a1 = a >> 32;
+    const uint64_t b0 = b & 0xffffffffu, b1 = b >> 32;
+    const uint64_t p00 = a0 * b0, p01 = a0 * b1;
+    const uint64_t p10 = a1 * b0, p11 = a1 * b1;
+    const uint64_t mid = (p00 >> 32) + (p01 & 0xffffffffu)
+        + (p10 & 0xffffffffu);
+    *hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    return (mid << 32) | (p00 & 0xffffffffu);
+#endif
+}
+
+// A * B / 2**64 mod P, for A, B < P.
+static KF_ALWAYS_INLINE uint64_t
+kf_ntt_mul(uint64_t a, uint64_t b)
+{
+    uint64_t hi, mhi;
+    const uint64_t lo = kf_mul64(a, b, &hi);
+    const uint64_t m = lo * KF_NTT_PINV;
+    (void)kf_mul64(m, KISS_NTT_MODULUS, &mhi);
+    // lo + m P is a multiple of 2**64, so its low half carries out
+    // exactly when lo is nonzero; the sum is less than 2 P.
+    const uint64_t u = hi + mhi + (lo != 0);
+    return u >= KISS_NTT_MODULUS ? u - KISS_NTT_MODULUS : u;
+}
+
+static KF_ALWAYS_INLINE uint64_t
+kf_ntt_add(uint64_t a, uint64_t b)
+{
+    const uint64_t s = a + b;
+    return s >= KISS_NTT_MODULUS ? s - KISS_NTT_MODULUS : s;
+}
+
+static KF_ALWAYS_INLINE uint64_t
+kf_ntt_sub(uint64_t a, uint64_t b)
+{
+    return a >= b ? a - b : a + KISS_NTT_MODULUS - b;
+}
+
+// X**E, in the Montgomery representation.
+static uint64_t
+kf_ntt_pow(uint64_t x, uint64_t e)
+{
+    uint64_t r = kf_ntt_mul(1, KF_NTT_R2);
+    for (; e; e >>= 1) {
+        if (e & 1)
+            r = kf_ntt_mul(r, x);
+        x = kf_ntt_mul(x, x);
+    }
+    return r;
+}
+
+kiss_ntt_state *
+kiss_ntt_alloc(size_t samples, kiss_fft_periodic_cb *should_stop,
+               int *stopped)
+{
+    *stopped = 0;
+    const int log2_samples = kf_log2(samples);
+    if (log2_samples < 0)
+        return (kiss_ntt_state *)-1;
+
+    const size_t ntw = kf_twiddle_count((uint32_t)log2_samples);
+    kiss_ntt_state *st = malloc(sizeof *st + ntw * sizeof(uint64_t));
+    if (!st)
+        return 0;
+    st->log2_samples = (uint32_t)log2_samples;
+
+    const uint64_t g = kf_ntt_mul(KF_NTT_GENERATOR, KF_NTT_R2);
+    const uint64_t p1 = KISS_NTT_MODULUS - 1;
+    st->j = kf_ntt_pow(g, p1 / 4);
+    st->inv_samples = kf_ntt_pow(kf_ntt_mul(samples % KISS_NTT_MODULUS,
+                                            KF_NTT_R2),
+                                 KISS_NTT_MODULUS - 2);
+    if (samples < 4)
+        return st;
+
+    // Only the top stage's table is computed; since W**k for 4M
+    // points is W**2k for 8M, each table below it is every other
+    // triple of the one above.
+    const size_t top = samples / 4;
+    uint64_t *tw = st->twiddles + 3 * (top - 1);
+    const uint64_t w = kf_ntt_pow(g, p1 / samples);
+    uint64_t t = kf_ntt_mul(1, KF_NTT_R2);
+    for (size_t k = 0; k < top; k++) {
+        if (k % KF_CHUNK_MIN == 0
+            && (*stopped = should_stop->check(should_stop))) {
+            free(st);
+            return 0;
+        }
+        tw[3 * k] = t;
+        tw[3 * k + 1] = kf_ntt_mul(t, t);
+        tw[3 * k + 2] = kf_ntt_mul(tw[3 * k + 1], t);
+        t = kf_ntt_mul(t, w);
+    }
+    for (size_t m = top / 2; m >= 1; m /= 2) {
+        const uint64_t *above = st->twiddles + 3 * (2 * m - 1);
+        uint64_t *here = st->twiddles + 3 * (m - 1);
+        for (size_t k = 0; k < m; k++) {
+            if (k % KF_CHUNK_DEFAULT == 0
+                && (*stopped = should_stop->check(should_stop))) {
+                free(st);
+                return 0;
+            }
+            memcpy(here + 3 * k, above + 6 * k, 3 * sizeof *here);
+        }
+    }
+    return st;
+}
+
+static KF_ALWAYS_INLINE void
+kf_ntt_bfly4(uint64_t *Fout, const uint64_t *tw, uint64_t j,
+             const size_t m, const size_t n)
+{
+    const size_t m2 = 2 * m;
+    const size_t m3 = 3 * m;
+
+    for (size_t k = 0; k < n; k++) {
+        const uint64_t a0 = Fout[0];
+        const uint64_t a1 = kf_ntt_mul(Fout[m], tw[0]);
+        const uint64_t a2 = kf_ntt_mul(Fout[m2], tw[1]);
+        const uint64_t a3 = kf_ntt_mul(Fout[m3], tw[2]);
+        const uint64_t t0 = kf_ntt_add(a0, a2);
+        const uint64_t t1 = kf_ntt_sub(a0, a2);
+        const uint64_t t2 = kf_ntt_add(a1, a3);
+        const uint64_t t3 = kf_ntt_mul(kf_ntt_sub(a1, a3), j);
+        Fout[0] = kf_ntt_add(t0, t2);
+        Fout[m] = kf_ntt_add(t1, t3);
+        Fout[m2] = kf_ntt_sub(t0, t2);
+        Fout[m3] = kf_ntt_sub(t1, t3);
+        tw += 3;
+        ++Fout;
+    }
+}
+
+// Where the leaves of the recursion get their samples: residues, or
+// signed integers to be reduced, with zeros past the end.
+struct kf_ntt_source {
+    const uint64_t *u;
+    const int64_t *s;
+    size_t len;
+};
+
+static inline uint64_t
+kf_ntt_reduce(int64_t x)
+{
+    // |x| <= 2**63 < 3 P
+    uint64_t u = x < 0 ? (uint64_t)0 - (uint64_t)x : (uint64_t)x;
+    while (u >= KISS_NTT_MODULUS)
+        u -= KISS_NTT_MODULUS;
+    return x < 0 && u ? KISS_NTT_MODULUS - u : u;
+}
+
+static inline uint64_t
+kf_ntt_load(const struct kf_ntt_source *src, size_t i)
+{
+    if (i >= src->len)
+        return 0;
+    return src->u ? src->u[i] : kf_ntt_reduce(src->s[i]);
+}
+
+// The transform of 2**L samples, taken from SRC at intervals of
+// FSTRIDE starting at I, written to FOUT; compare kf_work_stage.
+static int
+kf_ntt_work(uint64_t *Fout, const struct kf_ntt_source *src, size_t i,
+            const size_t fstride, const uint32_t l, const kiss_ntt_state *st,
+            kiss_fft_periodic_cb *should_stop)
+{
+    int rv;
+
+    if (l == 0) {
+        *Fout = kf_ntt_load(src, i);
+        return 0;
+    }
+    if (l == 1) {
+        const uint64_t a = kf_ntt_load(src, i);
+        const uint64_t b = kf_ntt_load(src, i + fstride);
+        Fout[0] = kf_ntt_add(a, b);
+        Fout[1] = kf_ntt_sub(a, b);
+        return 0;
+    }
+    if (l == 2) {
+        // kf_ntt_bfly4 with M = 1, whose twiddles are all 1
+        const uint64_t a0 = kf_ntt_load(src, i);
+        const uint64_t a1 = kf_ntt_load(src, i + fstride);
+        const uint64_t a2 = kf_ntt_load(src, i + 2 * fstride);
+        const uint64_t a3 = kf_ntt_load(src, i + 3 * fstride);
+        const uint64_t t0 = kf_ntt_add(a0, a2);
+        const uint64_t t1 = kf_ntt_sub(a0, a2);
+        const uint64_t t2 = kf_ntt_add(a1, a3);
+        const uint64_t t3 = kf_ntt_mul(kf_ntt_sub(a1, a3), st->j);
+        Fout[0] = kf_ntt_add(t0, t2);
+        Fout[1] = kf_ntt_add(t1, t3);
+        Fout[2] = kf_ntt_sub(t0, t2);
+        Fout[3] = kf_ntt_sub(t1, t3);
+        return 0;
+    }
+
+    const size_t m = (size_t)1 << (l - 2);
+    for (size_t q = 0; q < 4; q++) {
+        rv = kf_ntt_work(Fout + q * m, src, i + q * fstride, fstride * 4,
+                         l - 2, st, should_stop);
+        if (rv) return rv;
+    }
+    if (m < KF_NTT_CHECK_MIN) {
+        kf_ntt_bfly4(Fout, kf_ntt_stage_twiddles(st, m), st->j, m, m);
+        return 0;
+    }
+
+    const uint64_t *tw = kf_ntt_stage_twiddles(st, m);
+    for (size_t k = 0; k < m; k += KF_CHUNK_MIN) {
+        const size_t n = m - k < KF_CHUNK_MIN ? m - k : KF_CHUNK_MIN;
+        rv = should_stop->check(should_stop);
+        if (rv) return rv;
+        kf_ntt_bfly4(Fout + k, tw + 3 * k, st->j, m, n);
+    }
+    return should_stop->check(should_stop);
+}
+
+int
+kiss_ntt(const kiss_ntt_state *st, const uint64_t *fin, uint64_t *fout,
+         kiss_fft_periodic_cb *should_stop)
+{
+    const struct kf_ntt_source src = {
+        fin, NULL, (size_t)1 << st->log2_samples
+    };
+    return kf_ntt_work(fout, &src, 0, 1, st->log2_samples, st, should_stop);
+}
+
+// The inverse transform is the forward transform with the output
+// indices negated modulo N, divided by N.
+static int
+kf_ntt_unscramble(const kiss_ntt_state *st, uint64_t *x,
+                  kiss_fft_periodic_cb *should_stop)
+{
+    const size_t n = (size_t)1 << st->log2_samples;
+    const uint64_t s = st->inv_samples;
+    x[0] = kf_ntt_mul(x[0], s);
+    if (n > 1)
+        x[n / 2] = kf_ntt_mul(x[n / 2], s);
+    for (size_t k0 = 1; k0 < n / 2; k0 += KF_CHUNK_DEFAULT) {
+        const size_t k1 = n / 2 - k0 < KF_CHUNK_DEFAULT ? n / 2
+            : k0 + KF_CHUNK_DEFAULT;
+        for (size_t k = k0; k < k1; k++) {
+            const uint64_t t = x[k];
+            x[k] = kf_ntt_mul(x[n - k], s);
+            x[n - k] = kf_ntt_mul(t, s);
+        }
+        int rv = should_stop->check(should_stop);
+        if (rv) return rv;
+    }
+    return 0;
+}
+
+int
+kiss_intt(const kiss_ntt_state *st, const uint64_t *fin, uint64_t *fout,
+          kiss_fft_periodic_cb *should_stop)
+{
+    int rv = kiss_ntt(st, fin, fout, should_stop);
+    if (rv)
+        return rv;
+    rv = kf_ntt_unscramble(st, fout, should_stop);
+    if (rv)
+        return rv;
+    return should_stop->check(should_stop);
+}
+
+int
+kiss_ntt_convolve(const kiss_ntt_state *st,
+                  const int64_t *a, size_t na,
+                  const int64_t *b, size_t nb,
+                  int64_t *out, uint64_t *scratch,
+                  kiss_fft_periodic_cb *should_stop)
+{
+    const size_t n = (size_t)1 << st->log2_samples;
+    const uint32_t l = st->log2_samples;
+    uint64_t *fa = scratch, *fb = scratch + n;
+    int rv;
+
+    if (na == 0 || nb == 0)
+        return should_stop->check(should_stop);
+    const struct kf_ntt_source sa = { NULL, a, na };
+    const struct kf_ntt_source sb = { NULL, b, nb };
+    if ((rv = kf_ntt_work(fa, &sa, 0, 1, l, st, should_stop)))
+        return rv;
+    if ((rv = kf_ntt_work(fb, &sb, 0, 1, l, st, should_stop)))
+        return rv;
+
+    // Multiplying by 1/N here, in the Montgomery representation,
+    // saves a pass at the end.
+    const uint64_t scale = kf_ntt_mul(st->inv_samples, KF_NTT_R2);
+    for (size_t k0 = 0; k0 < n; k0 += KF_CHUNK_DEFAULT) {
+        const size_t k1 = n - k0 < KF_CHUNK_DEFAULT ? n
+            : k0 + KF_CHUNK_DEFAULT;
+        for (size_t k = k0; k < k1; k++)
+            fa[k] = kf_ntt_mul(kf_ntt_mul(fa[k], fb[k]), scale);
+        if ((rv = should_stop->check(should_stop)))
+            return rv;
+    }
+
+    const struct kf_ntt_source sp = { fa, NULL, n };
+    if ((rv = kf_ntt_work(fb, &sp, 0, 1, l, st, should_stop)))
+        return rv;
+
+    // Convolution coefficients are represented by the residue nearest
+    // zero.
+    const size_t nout = na + nb - 1;
+    for (size_t k0 = 0; k0 < nout; k0 += KF_CHUNK_DEFAULT) {
+        const size_t k1 = nout - k0 < KF_CHUNK_DEFAULT ? nout
+            : k0 + KF_CHUNK_DEFAULT;
+        for (size_t k = k0; k < k1; k++) {
+            const uint64_t r = fb[(n - k) & (n - 1)];
+            out[k] = r > KISS_NTT_MODULUS / 2
+                ? -(int64_t)(KISS_NTT_MODULUS - r) : (int64_t)r;
+        }
+        if ((rv = should_stop->check(should_stop)))
+            return rv;
+    }
+    return 0;
+}
+
+// Sharded transforms across processes.  The four-step algorithm views
+// the N = N1 * N2 inputs as an N1 x N2 matrix, x[n1][n2] = x[N2 n1 +
+// n2], and computes
+//
+//   1. an N1-point transform of each column n2,
+//   2. times W**(n2 k1), where W = exp(-2*pi*J/N), into the work
+//      matrix y[k1][n2],
+//   3. an N2-point transform of each row k1 of y, giving bin
+//      k1 + N1 k2 of the spectrum.
+//
+// Every column, and then every row, is independent of the others, so
+// each shard does its share of the columns, waits at a barrier for
+// the others, and does its share of the rows.  Columns are done
+// KF_SHARED_BLOCK at a time, so that gathering them reads whole
+// cache lines of the input, and so are rows, for the scatter into the
+// output.
+//
+// The segment holds everything the shards need, at offsets from its
+// start, since it may be mapped at a different address in each
+// process: the header, the input, output and work matrices, the
+// per-stage twiddles for N2 points (whose prefix is the N1-point
+// table; see kf_stage_twiddles), the two tables for W**i (see
+// kf_root_tables), and per-shard scratch.  Each shard makes its own
+// plan headers pointing at the shared twiddles, so nothing is
+// allocated while running.
+//
+// Shards wait at a barrier by polling, calling their own should_stop
+// as they go.  A shard whose check says to stop sets CANCEL in the
+// header, which the others notice at their next check, wherever they
+// are.  The barrier counts arrivals without ever resetting, so a
+// shard can start the next transform as soon as it returns; after a
+// cancellation the count no longer adds up, which is why
+// kiss_fft_shared_reset is needed.  Anyone can also set CANCEL from
+// outside, with kiss_fft_shared_cancel.
+//
+// A shard that dies never arrives, so the barrier also has to notice
+// that.  Each shard holds a robust, process-shared mutex of its own
+// while it runs; when its holder dies, whether a process or a thread,
+// the next attempt to lock it fails with EOWNERDEAD.  So every
+// KF_SHARED_PEER_CHECK pauses, a waiting shard tries to lock the
+// others' mutexes, and cancels the transform if one of them is dead.
+// (A shard that never started can't be told from one that hasn't
+// started yet; it's up to whoever started the shards to cancel.)
+
+#define KF_SHARED_MAGIC UINT64_C(0x3144524148534b46)  // "KFSHARD1"
+#define KF_SHARED_ALIGN 64
+#define KF_SHARED_BLOCK 16          // columns or rows per batch
+#define KF_SHARED_PEER_CHECK 50     // barrier pauses per liveness check
+
+struct kf_shared_header {
+    uint64_t magic;
+    uint64_t size;                  // of the whole segment
+    uint32_t log2_rows;             // N1
+    uint32_t log2_cols;             // N2
+    uint32_t nshards;
+    uint32_t decisions[2];          // of the N1- and N2-point plans
+    uint64_t input, output, work;   // offsets from the segment start
+    uint64_t twiddles;              // kf_twiddle_count(log2_cols)
+    uint64_t roots;                 // kf_twiddle_tables_len(N)
+    uint64_t scratch;               // nshards * scratch_len
+    uint64_t scratch_len;           // in kiss_fft_cpx
+    uint64_t running;               // nshards * pthread_mutex_t
+    _Atomic int cancel;
+    _Atomic uint64_t arrived;       // barrier arrivals, ever
+};
+
+static size_t
+kf_shared_align(size_t off)
+{
+    return (off + KF_SHARED_ALIGN - 1) & ~(size_t)(KF_SHARED_ALIGN - 1);
+}
+
+// Work out the layout for SAMPLES and NSHARDS into H (if not NULL),
+// and return the segment size, or 0 if they aren't valid.
+static size_t
+kf_shared_layout(size_t samples, unsigned nshards, struct kf_shared_header *h)
+{
+    const int log2_samples = kf_log2(samples);
+    if (log2_samples < 0 || nshards == 0)
+        return 0;
+    const uint32_t log2_rows = (uint32_t)log2_samples / 2;
+    const uint32_t log2_cols = (uint32_t)log2_samples - log2_rows;
+    const size_t scratch_len = 2 * KF_SHARED_BLOCK * ((size_t)1 << log2_cols);
+    if (nshards > SIZE_MAX / 4 / sizeof(kiss_fft_cpx) / scratch_len)
+        return 0;
+
+    size_t off = kf_shared_align(sizeof(struct kf_shared_header));
+    const size_t input = off;
+    off = kf_shared_align(off + samples * sizeof(kiss_fft_cpx));
+    const size_t output = off;
+    off = kf_shared_align(off + samples * sizeof(kiss_fft_cpx));
+    const size_t work = off;
+    off = kf_shared_align(off + samples * sizeof(kiss_fft_cpx));
+    const size_t twiddles = off;
+    off = kf_shared_align(off + kf_twiddle_count(log2_cols)
+                          * sizeof(kiss_fft_cpx));
+    const size_t roots = off;
+    off = kf_shared_align(off + kf_twiddle_tables_len((uint32_t)log2_samples)
+                          * sizeof(struct kf_dcpx));
+    const size_t running = off;
+    off = kf_shared_align(off + nshards * sizeof(pthread_mutex_t));
+    const size_t scratch = off;
+    off += nshards * scratch_len * sizeof(kiss_fft_cpx);
+
+    if (h) {
+        h->size = off;
+        h->log2_rows = log2_rows;
+        h->log2_cols = log2_cols;
+        h->nshards = nshards;
+        h->input = input;
+        h->output = output;
+        h->work = work;
+        h->twiddles = twiddles;
+        h->roots = roots;
+        h->scratch = scratch;
+        h->scratch_len = scratch_len;
+        h->running = running;
+    }
+    return off;
+}
+
+size_t
+kiss_fft_shared_layout(size_t samples, unsigned nshards,
+                       size_t *input_offset, size_t *output_offset)
+{
+    struct kf_shared_header h;
+    const size_t size = kf_shared_layout(samples, nshards, &h);
+    if (size) {
+        *input_offset = h.input;
+        *output_offset = h.output;
+    }
+    return size;
+}
+
+// Zero LEN bytes at P, KF_SHARED_TOUCH_CHUNK at a time with a check
+// after each.
+#define KF_SHARED_TOUCH_CHUNK ((size_t)1 << 18)
+static int
+kf_shared_touch(char *p, size_t len, kiss_fft_periodic_cb *should_stop)
+{
+    for (size_t i = 0; i < len; i += KF_SHARED_TOUCH_CHUNK) {
+        memset(p + i, 0, len - i < KF_SHARED_TOUCH_CHUNK
+                         ? len - i : KF_SHARED_TOUCH_CHUNK);
+        int rv = should_stop->check(should_stop);
+        if (rv) return rv;
+    }
+    return 0;
+}
+
+int
+kiss_fft_shared_init(void *mem, size_t samples, unsigned nshards,
+                     kiss_fft_periodic_cb *should_stop)
+{
+    struct kf_shared_header *h = mem;
+    char *base = mem;
+
+    // Until the magic number is written, nobody will run it.
+    h->magic = 0;
+    kf_shared_layout(samples, nshards, h);
+    atomic_init(&h->cancel, 0);
+    atomic_init(&h->arrived, 0);
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_t *running = (pthread_mutex_t *)(base + h->running);
+    for (unsigned i = 0; i < nshards; i++)
+        pthread_mutex_init(&running[i], &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    kiss_fft_state plan;
+    plan.log2_samples = h->log2_rows;
+    kf_init_decisions(&plan);
+    h->decisions[0] = kf_get_decisions(&plan);
+    plan.log2_samples = h->log2_cols;
+    kf_init_decisions(&plan);
+    h->decisions[1] = kf_get_decisions(&plan);
+
+    // The work matrix isn't needed yet, and has plenty of room for
+    // kf_fill_twiddles' tables.
+    const uint32_t log2_samples = h->log2_rows + h->log2_cols;
+    kf_root_tables((struct kf_dcpx *)(base + h->roots), log2_samples);
+    int rv = kf_fill_twiddles((kiss_fft_cpx *)(base + h->twiddles),
+                              h->log2_cols,
+                              (struct kf_dcpx *)(base + h->work),
+                              should_stop);
+    if (rv)
+        return rv;
+
+    // Touch the pages the shards will write now, between checks, so
+    // that the first run doesn't take its page faults in the gathers
+    // and scatters, which don't check.
+    const size_t samples_bytes = samples * sizeof(kiss_fft_cpx);
+    if ((rv = kf_shared_touch(base + h->work, samples_bytes, should_stop))
+        || (rv = kf_shared_touch(base + h->output, samples_bytes,
+                                 should_stop))
+        || (rv = kf_shared_touch(base + h->scratch,
+                                 nshards * h->scratch_len
+                                 * sizeof(kiss_fft_cpx), should_stop)))
+        return rv;
+
+    atomic_thread_fence(memory_order_release);
+    h->magic = KF_SHARED_MAGIC;
+    return should_stop->check(should_stop);
+}
+
+unsigned
+kiss_fft_shared_shards(const void *mem, size_t size)
+{
+    const struct kf_shared_header *h = mem;
+    if (size < sizeof *h || h->magic != KF_SHARED_MAGIC || h->size > size)
+        return 0;
+    return h->nshards;
+}
+
+void
+kiss_fft_shared_reset(void *mem)
+{
+    struct kf_shared_header *h = mem;
+    pthread_mutex_t *running = (pthread_mutex_t *)((char *)mem + h->running);
+
+    // Clear the mark left by any shard that died.
+    for (unsigned i = 0; i < h->nshards; i++) {
+        int e = pthread_mutex_trylock(&running[i]);
+        if (e == EOWNERDEAD)
+            pthread_mutex_consistent(&running[i]);
+        if (e == 0 || e == EOWNERDEAD)
+            pthread_mutex_unlock(&running[i]);
+    }
+    atomic_store(&h->arrived, 0);
+    atomic_store(&h->cancel, 0);
+}
+
+void
+kiss_fft_shared_cancel(void *mem)
+{
+    struct kf_shared_header *h = mem;
+    atomic_store(&h->cancel, 1);
+}
+
+// The check function of one shard: returns KISS_FFT_SHARED_CANCELLED
+// once any shard has stopped, and otherwise runs this shard's own
+// should_stop, telling the others if it says to stop.
+struct kf_shard_check {
+    kiss_fft_periodic_cb base;
+    struct kf_shared_header *h;
+    kiss_fft_periodic_cb *should_stop;
+    pthread_mutex_t *running;
+    unsigned shard;
+};
+
+static int
+kf_shard_check(kiss_fft_periodic_cb *cb)
+{
+    struct kf_shard_check *sc = (struct kf_shard_check *)cb;
+    if (atomic_load_explicit(&sc->h->cancel, memory_order_relaxed))
+        return KISS_FFT_SHARED_CANCELLED;
+    int rv = sc->should_stop->check(sc->should_stop);
+    if (rv)
+        atomic_store_explicit(&sc->h->cancel, 1, memory_order_relaxed);
+    return rv;
+}
+
+// Has any other shard died while running?  A shard that isn't
+// running at all is briefly locked and unlocked again.
+static bool
+kf_shared_peer_died(struct kf_shard_check *sc)
+{
+    for (unsigned i = 0; i < sc->h->nshards; i++) {
+        if (i == sc->shard)
+            continue;
+        int e = pthread_mutex_trylock(&sc->running[i]);
+        if (e == EOWNERDEAD)
+            pthread_mutex_consistent(&sc->running[i]);
+        if (e == 0 || e == EOWNERDEAD)
+            pthread_mutex_unlock(&sc->running[i]);
+        if (e == EOWNERDEAD)
+            return true;
+    }
+    return false;
+}
+
+// Wait for every shard to get here.  Arrivals at the b'th barrier of
+// the segment's life are numbered b * nshards to (b + 1) * nshards - 1.
+static int
+kf_shared_barrier(struct kf_shard_check *sc)
+{
+    struct kf_shared_header *h = sc->h;
+    const uint64_t t =
+        atomic_fetch_add_explicit(&h->arrived, 1, memory_order_acq_rel);
+    const uint64_t target = (t / h->nshards + 1) * h->nshards;
+
+    for (unsigned pauses = 0;
+         atomic_load_explicit(&h->arrived, memory_order_acquire) < target;
+         pauses++) {
+        int rv = kf_shard_check(&sc->base);
+        if (rv) return rv;
+        if (pauses % KF_SHARED_PEER_CHECK == KF_SHARED_PEER_CHECK - 1
+            && kf_shared_peer_died(sc)) {
+            atomic_store_explicit(&h->cancel, 1, memory_order_relaxed);
+            return KISS_FFT_SHARED_CANCELLED;
+        }
+        struct timespec pause = { 0, 200000 };  // 0.2 ms
+        nanosleep(&pause, NULL);
+    }
+    return 0;
+}
+
+static KF_ALWAYS_INLINE kiss_fft_cpx
+kf_shared_twiddle(kiss_fft_cpx x, const struct kf_dcpx *lo,
+                  const struct kf_dcpx *hi, unsigned h, size_t i)
+{
+    const struct kf_dcpx a = hi[i >> h];
+    const struct kf_dcpx b = lo[i & (((size_t)1 << h) - 1)];
+    const double wr = a.r * b.r - a.i * b.i;
+    const double wi = a.r * b.i + a.i * b.r;
+    kiss_fft_cpx y;
+    y.r = (float)(x.r * wr - x.i * wi);
+    y.i = (float)(x.r * wi + x.i * wr);
+    return y;
+}
+
+// Steps 1 and 2 for columns C0 to C1 - 1.
+static int
+kf_shared_columns(const struct kf_shared_header *h, char *base,
+                  kiss_fft_state *plan, size_t c0, size_t c1,
+                  kiss_fft_cpx *a, kiss_fft_cpx *b,
+                  kiss_fft_periodic_cb *cb)
+{
+    const size_t rows = (size_t)1 << h->log2_rows;
+    const size_t cols = (size_t)1 << h->log2_cols;
+    const unsigned rh = (h->log2_rows + h->log2_cols + 1) / 2;
+    const kiss_fft_cpx *x = (const kiss_fft_cpx *)(base + h->input);
+    kiss_fft_cpx *y = (kiss_fft_cpx *)(base + h->work);
+    const struct kf_dcpx *lo = (const struct kf_dcpx *)(base + h->roots);
+    const struct kf_dcpx *hi = lo + ((size_t)1 << rh);
+
+    for (size_t j = c0; j < c1; j += KF_SHARED_BLOCK) {
+        const size_t w = c1 - j < KF_SHARED_BLOCK ? c1 - j : KF_SHARED_BLOCK;
+        for (size_t n1 = 0; n1 < rows; n1++) {
+            const kiss_fft_cpx *src = x + n1 * cols + j;
+            for (size_t c = 0; c < w; c++)
+                a[c * rows + n1] = src[c];
+        }
+        int rv = kiss_fft_batch(plan, a, b, w, cb);
+        if (rv) return rv;
+        for (size_t k1 = 0; k1 < rows; k1++) {
+            kiss_fft_cpx *dst = y + k1 * cols + j;
+            for (size_t c = 0; c < w; c++)
+                dst[c] = kf_shared_twiddle(b[c * rows + k1], lo, hi, rh,
+                                           (j + c) * k1);
+        }
+    }
+    return 0;
+}
+
+// Step 3 for rows R0 to R1 - 1.
+static int
+kf_shared_rows(const struct kf_shared_header *h, char *base,
+               kiss_fft_state *plan, size_t r0, size_t r1,
+               kiss_fft_cpx *b, kiss_fft_periodic_cb *cb)
+{
+    const size_t rows = (size_t)1 << h->log2_rows;
+    const size_t cols = (size_t)1 << h->log2_cols;
+    const kiss_fft_cpx *y = (const kiss_fft_cpx *)(base + h->work);
+    kiss_fft_cpx *out = (kiss_fft_cpx *)(base + h->output);
+
+    for (size_t j = r0; j < r1; j += KF_SHARED_BLOCK) {
+        const size_t w = r1 - j < KF_SHARED_BLOCK ? r1 - j : KF_SHARED_BLOCK;
+        int rv = kiss_fft_batch(plan, y + j * cols, b, w, cb);
+        if (rv) return rv;
+        for (size_t k2 = 0; k2 < cols; k2++) {
+            kiss_fft_cpx *dst = out + k2 * rows + j;
+            for (size_t c = 0; c < w; c++)
+                dst[c] = b[c * cols + k2];
+        }
+    }
+    return 0;
+}
+
+static int
+kf_shared_run(struct kf_shard_check *sc)
+{
+    struct kf_shared_header *h = sc->h;
+    char *base = (char *)h;
+    const unsigned shard = sc->shard;
+    int rv;
+
+    const kiss_fft_cpx *twiddles = (const kiss_fft_cpx *)(base + h->twiddles);
+    kiss_fft_state row_plan, col_plan;
+    row_plan.log2_samples = h->log2_rows;
+    kf_set_decisions(&row_plan, h->decisions[0]);
+    row_plan.twiddles = twiddles;
+    col_plan.log2_samples = h->log2_cols;
+    kf_set_decisions(&col_plan, h->decisions[1]);
+    col_plan.twiddles = twiddles;
+
+    kiss_fft_cpx *a = (kiss_fft_cpx *)(base + h->scratch)
+        + shard * h->scratch_len;
+    kiss_fft_cpx *b = a + h->scratch_len / 2;
+    const size_t rows = (size_t)1 << h->log2_rows;
+    const size_t cols = (size_t)1 << h->log2_cols;
+    const unsigned s = h->nshards;
+
+    if ((rv = kf_shared_columns(h, base, &row_plan, cols * shard / s,
+                                cols * (shard + 1) / s, a, b, &sc->base)))
+        return rv;
+    if ((rv = kf_shared_barrier(sc)))
+        return rv;
+    if ((rv = kf_shared_rows(h, base, &col_plan, rows * shard / s,
+                             rows * (shard + 1) / s, b, &sc->base)))
+        return rv;
+    if ((rv = kf_shared_barrier(sc)))
+        return rv;
+    return sc->should_stop->check(sc->should_stop);
+}
+
+int
+kiss_fft_shared_run(void *mem, unsigned shard,
+                    kiss_fft_periodic_cb *should_stop)
+{
+    struct kf_shared_header *h = mem;
+    struct kf_shard_check sc = {
+        { kf_shard_check, should_stop->interval_ns }, h, should_stop,
+        (pthread_mutex_t *)((char *)mem + h->running), shard
+    };
+
+    if (atomic_load(&h->cancel))
+        return KISS_FFT_SHARED_CANCELLED;
+
+    // If the last shard to run with this number died, the transform
+    // it was part of can't be completed, and kiss_fft_shared_reset
+    // (which clears the mark) is needed before another.
+    int e = pthread_mutex_lock(&sc.running[shard]);
+    if (e == EOWNERDEAD) {
+        pthread_mutex_consistent(&sc.running[shard]);
+        pthread_mutex_unlock(&sc.running[shard]);
+        atomic_store(&h->cancel, 1);
+    }
+    if (e)
+        return KISS_FFT_SHARED_CANCELLED;
+    int rv = kf_shared_run(&sc);
+    pthread_mutex_unlock(&sc.running[shard]);
+    return rv;
+}
+
+// Discrete cosine transforms, by Makhoul's method.  For DCT-II of N
+// real samples, the permutation
+//
+//   v_j = x_2j (j < N/2),  v_j = x_(2N-2j-1) (j >= N/2)
+//
+// turns it into Re(exp(-pi J k / 2N) V_k), where V is the DFT of v.
+// Since v is real, V comes from the N/2-point transform Z of the
+// complex sequence v_0 + J v_1, v_2 + J v_3, ..., by the usual split
+// into even and odd parts:
+//
+//   V_k = (Z_k + conj Z_(N/2-k)) / 2
+//         - J exp(-2 pi J k / N) (Z_k - conj Z_(N/2-k)) / 2.
+//
+// The split and the final rotation are done in the same pass, which
+// produces bins k and N - k together.  DCT-III runs the same steps
+// backwards, with an inverse transform done as a forward transform of
+// the conjugate.  Both rotations are roots of unity of order 4N, which
+// are computed with the two-table method (see kf_root_tables).
+
+struct kiss_dct_state {
+    kiss_fft_state *st;         // N/2 points, or NULL if N == 1
+    size_t samples;
+    kiss_fft_cpx *tw;           // for k <= N/2: exp(-pi J k / 2N),
+                                // exp(-2 pi J k / N)
+    kiss_fft_cpx *buf;          // N: transform input, then output
+};
+
+void
+kiss_dct_free(kiss_dct_state *d)
+{
+    if (!d)
+        return;
+    free(d->st);
+    free(d->tw);
+    free(d->buf);
+    free(d);
+}
+
+kiss_dct_state *
+kiss_dct_alloc(size_t samples, kiss_fft_periodic_cb *should_stop,
+               int *stopped)
+{
+    *stopped = 0;
+    int log2_samples = kf_log2(samples);
+    if (log2_samples < 0)
+        return (kiss_dct_state *)-1;
+
+    kiss_dct_state *d = calloc(1, sizeof *d);
+    if (!d)
+        return 0;
+    d->samples = samples;
+    if (samples == 1)
+        return d;
+
+    const size_t m = samples / 2;
+    d->st = kiss_fft_alloc_interruptible(m, should_stop, stopped);
+    if (*stopped || !d->st) {
+        d->st = 0;
+        kiss_dct_free(d);
+        return 0;
+    }
+    d->tw = malloc(2 * (m + 1) * sizeof *d->tw);
+    d->buf = malloc(samples * sizeof *d->buf);
+    const uint32_t l4 = (uint32_t) log2_samples + 2;
+    struct kf_dcpx *tables = malloc(kf_twiddle_tables_len(l4) * sizeof *tables);
+    if (!d->tw || !d->buf || !tables) {
+        free(tables);
+        kiss_dct_free(d);
+        return 0;
+    }
+
+    kf_root_tables(tables, l4);
+    const unsigned h = (l4 + 1) / 2;
+    const struct kf_twiddle_ctl ctl = {
+        .h = h,
+        .lo = tables,
+        .hi = tables + ((size_t)1 << h),
+    };
+    for (size_t k0 = 0; k0 <= m; k0 += KF_CHUNK_DEFAULT) {
+        const size_t k1 = m + 1 - k0 < KF_CHUNK_DEFAULT ? m + 1
+            : k0 + KF_CHUNK_DEFAULT;
+        for (size_t k = k0; k < k1; k++) {
+            d->tw[2 * k] = kf_twiddle(&ctl, k);
+            d->tw[2 * k + 1] = kf_twiddle(&ctl, 4 * k);
+        }
+        if ((*stopped = should_stop->check(should_stop))) {
+            free(tables);
+            kiss_dct_free(d);
+            return 0;
+        }
+    }
+    free(tables);
+    return d;
+}
+
+int
+kiss_dct2(kiss_dct_state *d, const float *fin, float *fout,
+          kiss_fft_periodic_cb *should_stop)
+{
+    const size_t n = d->samples, m = n / 2;
+    int rv;
+
+    if (n == 1) {
+        fout[0] = 2 * fin[0];
+        return should_stop->check(should_stop);
+    }
+
+    // The permuted samples, as M complex numbers.
+    float *v = (float *)d->buf;
+    for (size_t j0 = 0; j0 < n; j0 += KF_CHUNK_DEFAULT) {
+        const size_t j1 = n - j0 < KF_CHUNK_DEFAULT ? n : j0 + KF_CHUNK_DEFAULT;
+        for (size_t j = j0; j < j1; j++)
+            v[j] = j < m ? fin[2 * j] : fin[2 * n - 2 * j - 1];
+        if ((rv = should_stop->check(should_stop)))
+            return rv;
+    }
+
+    kiss_fft_cpx *z = d->buf + m;
+    if ((rv = kiss_fft(d->st, d->buf, z, should_stop)))
+        return rv;
+
+    // 2 exp(-pi J k / 2N) V_k, whose real part is bin k, and whose
+    // imaginary part is minus bin N - k.
+    for (size_t k0 = 0; k0 <= m; k0 += KF_CHUNK_DEFAULT) {
+        const size_t k1 = m + 1 - k0 < KF_CHUNK_DEFAULT ? m + 1
+            : k0 + KF_CHUNK_DEFAULT;
+        for (size_t k = k0; k < k1; k++) {
+            const kiss_fft_cpx a = z[k == m ? 0 : k];
+            const kiss_fft_cpx b = z[k == 0 ? 0 : m - k];
+            kiss_fft_cpx e, o, t, u;
+            e.r = a.r + b.r;            // 2 * even part
+            e.i = a.i - b.i;
+            t.r = a.i + b.i;            // -J * (a - conj b) = 2 * odd part
+            t.i = b.r - a.r;
+            C_MUL(o, t, d->tw[2 * k + 1]);
+            C_ADDTO(e, o);
+            C_MUL(u, e, d->tw[2 * k]);
+            fout[k] = u.r;
+            if (k && k < m)
+                fout[n - k] = -u.i;
+        }
+        if ((rv = should_stop->check(should_stop)))
+            return rv;
+    }
+    return 0;
+}
+
+int
+kiss_dct3(kiss_dct_state *d, const float *fin, float *fout,
+          kiss_fft_periodic_cb *should_stop)
+{
+    const size_t n = d->samples, m = n / 2;
+    int rv;
+
+    if (n == 1) {
+        fout[0] = fin[0];
+        return should_stop->check(should_stop);
+    }
+
+    // Undo the rotation to get V_k and V_(M-k), then combine them into
+    // Z_k and Z_(M-k), stored conjugated for the inverse transform.
+    kiss_fft_cpx *zc = d->buf;
+    for (size_t k0 = 0; k0 <= m / 2; k0 += KF_CHUNK_DEFAULT) {
+        const size_t k1 = m / 2 + 1 - k0 < KF_CHUNK_DEFAULT ? m / 2 + 1
+            : k0 + KF_CHUNK_DEFAULT;
+        for (size_t k = k0; k < k1; k++) {
+            const size_t kk[2] = { k, m - k };
+            kiss_fft_cpx vv[2];
+            for (int s = 0; s < 2; s++) {
+                const size_t j = kk[s];
+                kiss_fft_cpx y, r = d->tw[2 * j];
+                y.r = fin[j];
+                y.i = j ? -fin[n - j] : 0;
+                r.i = -r.i;
+                C_MUL(vv[s], y, r);
+            }
+            for (int s = 0; s < 2; s++) {
+                const size_t j = kk[s];
+                if (j == m || (s && j == k))
+                    continue;
+                const kiss_fft_cpx a = vv[s], b = vv[1 - s];
+                kiss_fft_cpx e, t, o, w = d->tw[2 * j + 1];
+                e.r = a.r + b.r;        // a + conj b
+                e.i = a.i - b.i;
+                t.r = -(a.i + b.i);     // J (a - conj b)
+                t.i = a.r - b.r;
+                w.i = -w.i;
+                C_MUL(o, t, w);
+                zc[j].r = e.r + o.r;
+                zc[j].i = -(e.i + o.i);
+            }
+        }
+        if ((rv = should_stop->check(should_stop)))
+            return rv;
+    }
+
+    kiss_fft_cpx *z = d->buf + m;
+    if ((rv = kiss_fft(d->st, zc, z, should_stop)))
+        return rv;
+
+    // Conjugate back while undoing the permutation.
+    const float *v = (const float *)z;
+    for (size_t j0 = 0; j0 < n; j0 += KF_CHUNK_DEFAULT) {
+        const size_t j1 = n - j0 < KF_CHUNK_DEFAULT ? n : j0 + KF_CHUNK_DEFAULT;
+        for (size_t j = j0; j < j1; j++) {
+            const float x = j % 2 ? -v[j] : v[j];
+            fout[j < m ? 2 * j : 2 * n - 2 * j - 1] = x;
+        }
+        if ((rv = should_stop->check(should_stop)))
+            return rv;
+    }
+    return 0;
 }
@@ -9,10 +9,18 @@
 #ifndef KISS_FFT_H
 #define KISS_FFT_H
 
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 
-#define KISS_FFT_MAX_SAMPLES (UINT32_C(1) << 31)
+// Largest transform kiss_fft_alloc will accept.  With 64-bit size_t,
+// 2**40 samples (8 TiB of input) is an arbitrary limit that keeps the
+// table of specialized kf_work copies small.
+#if SIZE_MAX > UINT32_MAX
+#define KISS_FFT_MAX_SAMPLES (UINT64_C(1) << 40)
+#else
+#define KISS_FFT_MAX_SAMPLES (UINT64_C(1) << 31)
+#endif
 
 typedef struct kiss_fft_cpx {
     float r;
@@ -21,7 +29,7 @@ typedef struct kiss_fft_cpx {
 
 typedef struct kiss_fft_state kiss_fft_state;
 
-kiss_fft_state *kiss_fft_alloc(uint32_t samples);
+kiss_fft_state *kiss_fft_alloc(size_t samples);
 
 // Added for this demo: if the SHOULD_STOP argument to kiss_fft is not
 // NULL, should_stop->check(should_stop) will be called at suitable
@@ -29,8 +37,16 @@ kiss_fft_state *kiss_fft_alloc(uint32_t samples);
 // will abandon its work and return that value as quickly as possible.
 // Passing NULL is equivalent to passing a check function that always
 // returns zero.
+//
+// If INTERVAL_NS is nonzero, it is the desired time between calls to
+// check, in nanoseconds.  Long loops that would otherwise run without
+// a check, such as the butterflies of the top stage of a large
+// transform, are cut into pieces that should each take no more than
+// about half that long.  If it is zero, they are cut into pieces of a
+// fixed size instead.
 typedef struct kiss_fft_periodic_cb {
     int (*check)(struct kiss_fft_periodic_cb *);
+    uint64_t interval_ns;
 } kiss_fft_periodic_cb;
 
 int kiss_fft(kiss_fft_state *restrict st,
@@ -38,4 +54,509 @@ int kiss_fft(kiss_fft_state *restrict st,
              kiss_fft_cpx *restrict fout,
              kiss_fft_periodic_cb *should_stop);
 
+// Added for this demo: like kiss_fft_alloc, but calls
+// should_stop->check periodically while computing the twiddle
+// factors, which for large sizes can take a long time.  If it returns
+// a nonzero value, everything allocated so far is freed, its value is
+// stored in *STOPPED, and the return value is 0.  Otherwise *STOPPED
+// is set to zero, and the return value is as for kiss_fft_alloc.
+kiss_fft_state *kiss_fft_alloc_interruptible(size_t samples,
+                                             kiss_fft_periodic_cb *should_stop,
+                                             int *stopped);
+
+// Added for this demo: perform BATCH independent transforms, each of
+// the size ST was planned for.  The inputs are stored consecutively in
+// FIN, and the outputs are written consecutively to FOUT.  For small
+// sizes, this is much faster than calling kiss_fft in a loop, because
+// it can run several transforms in parallel using SIMD instructions.
+int kiss_fft_batch(kiss_fft_state *restrict st,
+                   const kiss_fft_cpx *restrict fin,
+                   kiss_fft_cpx *restrict fout,
+                   size_t batch,
+                   kiss_fft_periodic_cb *should_stop);
+
+// Added for this demo: compute only the NBINS output bins listed in
+// BINS, each of which must be less than the number of samples ST was
+// planned for, and write them to FOUT in the same order.  This skips
+// all the work that only feeds bins that weren't asked for, which is
+// most of it if NBINS is small.  Returns zero or the value of
+// should_stop->check, like kiss_fft.
+int kiss_fft_bins(kiss_fft_state *restrict st,
+                  const kiss_fft_cpx *restrict fin,
+                  const size_t *restrict bins,
+                  size_t nbins,
+                  kiss_fft_cpx *restrict fout,
+                  kiss_fft_periodic_cb *should_stop);
+
+// Added for this demo: window, transform, and compute the power
+// spectrum, all in one pass.  FIN is multiplied elementwise by WINDOW
+// (as many floats as samples, or NULL for none) and transformed, and
+// then, depending on
+// MODE, either the power |X_k|**2 of each bin is written to FOUT (as
+// many floats as samples), or the magnitude |X_k| of each bin is
+// written to the first half of FOUT and the phase arg(X_k), in
+// radians, to the second half (twice as many floats as samples).
+// SCRATCH must have room for as many complex numbers as samples.
+// Returns zero or the value of should_stop->check, like kiss_fft.
+enum {
+    KISS_FFT_POWER = 0,
+    KISS_FFT_MAGNITUDE_PHASE = 1,
+};
+
+int kiss_fft_spectrum(kiss_fft_state *restrict st,
+                      const kiss_fft_cpx *restrict fin,
+                      const float *restrict window,
+                      float *restrict fout,
+                      int mode,
+                      kiss_fft_cpx *restrict scratch,
+                      kiss_fft_periodic_cb *should_stop);
+
+// Added for this demo: transform real integer PCM samples, converting
+// them to complex as they are read, so that no converted copy of the
+// input is needed.  Sample i is element i*STRIDE of FIN (so for
+// interleaved multichannel data, pass the channel count as STRIDE and
+// point FIN at the first sample of the wanted channel), of type
+// int16_t or int32_t according to FORMAT, multiplied by SCALE.
+// Returns zero or the value of should_stop->check, like kiss_fft.
+enum {
+    KISS_FFT_PCM_S16 = 1,
+    KISS_FFT_PCM_S32 = 2,
+};
+
+int kiss_fft_pcm(kiss_fft_state *restrict st,
+                 const void *restrict fin,
+                 int format,
+                 size_t stride,
+                 float scale,
+                 kiss_fft_cpx *restrict fout,
+                 kiss_fft_periodic_cb *should_stop);
+
+// kiss_fft_batch, kiss_fft_bins and kiss_fft_spectrum for PCM input,
+// which is read as for kiss_fft_pcm.  In a batch, transform B reads
+// samples B*N to B*N + N - 1, where N is the size ST was planned for.
+// kiss_welch_pcm (below) is likewise.
+int kiss_fft_batch_pcm(kiss_fft_state *restrict st,
+                       const void *restrict fin,
+                       int format,
+                       size_t stride,
+                       float scale,
+                       kiss_fft_cpx *restrict fout,
+                       size_t batch,
+                       kiss_fft_periodic_cb *should_stop);
+int kiss_fft_bins_pcm(kiss_fft_state *restrict st,
+                      const void *restrict fin,
+                      int format,
+                      size_t stride,
+                      float scale,
+                      const size_t *restrict bins,
+                      size_t nbins,
+                      kiss_fft_cpx *restrict fout,
+                      kiss_fft_periodic_cb *should_stop);
+int kiss_fft_spectrum_pcm(kiss_fft_state *restrict st,
+                          const void *restrict fin,
+                          int format,
+                          size_t stride,
+                          float scale,
+                          const float *restrict window,
+                          float *restrict fout,
+                          int mode,
+                          kiss_fft_cpx *restrict scratch,
+                          kiss_fft_periodic_cb *should_stop);
+
+// Added for this demo: transforms with the spectrum in scrambled
+// order, for convolution and other work that only multiplies spectra
+// pointwise, which can skip the permutation pass that kiss_fft makes.
+// kiss_fft_scrambled computes the same spectrum as kiss_fft, but
+// stores bin k at the index whose base-4 digits are those of k in
+// reverse order (for an odd power of two, the top bit of k counts as
+// a final base-2 digit).  kiss_ifft_scrambled takes a spectrum in
+// that order and computes its inverse transform, unnormalized (i.e.
+// N times the inverse DFT), in natural order.  FIN may equal FOUT.
+// Both return zero or the value of should_stop->check, like kiss_fft.
+int kiss_fft_scrambled(kiss_fft_state *st,
+                       const kiss_fft_cpx *fin,
+                       kiss_fft_cpx *fout,
+                       kiss_fft_periodic_cb *should_stop);
+int kiss_ifft_scrambled(kiss_fft_state *st,
+                        const kiss_fft_cpx *fin,
+                        kiss_fft_cpx *fout,
+                        kiss_fft_periodic_cb *should_stop);
+
+// Added for this demo: kiss_fft_alloc makes its choices of codelet
+// size, permutation strategy, etc. based on fixed rules of thumb.
+// kiss_fft_measure instead times each plausible combination of
+// choices on this machine, on scratch buffers, and updates ST to use
+// the fastest one.  The winner is remembered, and subsequent calls to
+// kiss_fft_alloc for the same number of samples will use it too.  If
+// there is already a remembered winner, kiss_fft_measure just updates
+// ST to use it, without timing anything.
+//
+// Measurement stops early, keeping the best choice found so far, if
+// it takes longer than BUDGET_NS nanoseconds.  It also calls
+// should_stop->check periodically, and returns its value if nonzero,
+// like kiss_fft.  ST is always left in a usable state.
+int kiss_fft_measure(kiss_fft_state *st,
+                     uint64_t budget_ns,
+                     kiss_fft_periodic_cb *should_stop);
+
+// Added for this demo: wisdom files.  kiss_fft_save_wisdom writes the
+// plans for each of the NSIZES sample sizes in SIZES to PATH,
+// including their tuned decisions (see kiss_fft_measure) and twiddle
+// factors.  kiss_fft_load_wisdom maps such a file into memory,
+// read-only; after that, kiss_fft_alloc for any of the sizes in the
+// file uses the saved decisions, and points the plan at the file's
+// twiddle factors instead of computing them, as does kiss_fft_alloc
+// for any smaller size (see kiss_fft_share_twiddles).  The mapping is
+// shared with every other process that loads the same file, and is
+// never unmapped; loading the same file again reuses it, but a file
+// that has been replaced since is mapped again.
+//
+// kiss_fft_save_wisdom computes the twiddle factors for the largest
+// size, checking should_stop as it goes like
+// kiss_fft_alloc_interruptible; if that says to stop, it stores its
+// value in *STOPPED, otherwise zero, and returns 0 without writing
+// anything to PATH.
+//
+// Both functions return 0 on success or one of these codes:
+enum {
+    KISS_FFT_WISDOM_ERRNO = -1,       // system error, see errno
+    KISS_FFT_WISDOM_BAD_FORMAT = -2,  // not a wisdom file, or wrong version
+    KISS_FFT_WISDOM_BAD_SIZE = -3,    // invalid sample size in SIZES
+};
+
+int kiss_fft_save_wisdom(const char *path,
+                         const size_t *sizes,
+                         size_t nsizes,
+                         kiss_fft_periodic_cb *should_stop,
+                         int *stopped);
+int kiss_fft_load_wisdom(const char *path);
+
+// Added for this demo: the twiddle tables for N samples are a prefix
+// of those for 2N samples, so one table for the largest size can serve
+// every smaller size too.  kiss_fft_share_twiddles computes the tables
+// for MAX_SAMPLES samples, unless a wisdom file or an earlier call
+// has provided them, and from then on kiss_fft_alloc for any size up
+// to MAX_SAMPLES points the plan into them instead of computing its
+// own, like kiss_fft_load_wisdom does.  (Wisdom files only store the
+// tables for their largest size, for the same reason.)  The tables are
+// never freed.  Returns 0 or one of the KISS_FFT_WISDOM_ codes above
+// (KISS_FFT_WISDOM_ERRNO with errno == ENOMEM if out of memory); like
+// kiss_fft_alloc_interruptible, it checks should_stop while computing
+// the tables, and if that says to stop, it stores its value in
+// *STOPPED, otherwise zero, and returns 0 without sharing anything.
+int kiss_fft_share_twiddles(size_t max_samples,
+                            kiss_fft_periodic_cb *should_stop,
+                            int *stopped);
+
+// Added for this demo: named plans, for pools of worker processes
+// that all transform the same size.  kiss_fft_alloc_named returns a
+// plan whose twiddle factors are in the POSIX shared memory segment
+// NAME (as for shm_open, e.g. "/myapp-fft-24"), creating and filling
+// it in if it doesn't exist, or waiting for another process that is
+// doing so, and then mapping it read-only.  So however many processes
+// ask for the same NAME, there is one copy of the twiddles.  Each plan
+// holds a reference to the segment, which is removed when the last
+// plan in any process is freed with kiss_fft_free_named.  (A process
+// that dies without freeing its plans leaves the segment behind until
+// it is removed with shm_unlink.)  kiss_fft_free_named also frees
+// ordinary plans.
+//
+// kiss_fft_alloc_named is like kiss_fft_alloc_interruptible, checking
+// should_stop while computing twiddles or waiting for another process
+// to do so.  If that process dies before it finishes, one of the
+// waiters computes them instead; if it dies within moments of creating
+// the segment, before it can say it is building, the waiters give it a
+// second before deciding so.  It returns 0 with errno set if the
+// segment can't be created or mapped, or EINVAL if NAME holds a plan
+// for another size.
+kiss_fft_state *kiss_fft_alloc_named(const char *name,
+                                     size_t samples,
+                                     kiss_fft_periodic_cb *should_stop,
+                                     int *stopped);
+void kiss_fft_free_named(kiss_fft_state *st);
+
+
+// Added for this demo: sliding DFT.  A kiss_sdft tracks some or all of
+// the bins of the DFT of a window of SAMPLES samples, as new samples
+// are pushed into the window one at a time, at a cost of O(1) per bin
+// per sample.  kiss_sdft_alloc returns 0 if out of memory, or
+// (kiss_sdft*)-1 if SAMPLES is not a valid transform size, and checks
+// for interruption like kiss_fft_alloc_interruptible.  If BINS is
+// NULL, all SAMPLES bins are tracked; otherwise the NBINS bins listed
+// in BINS, each less than SAMPLES.  To limit the accumulation of
+// rounding error, the spectrum is recomputed from scratch every
+// RESYNC samples, or every SAMPLES samples if RESYNC is zero.
+//
+// kiss_sdft_init sets the initial contents of the window, which must
+// be called before kiss_sdft_update.  kiss_sdft_update pushes the N
+// samples at X into the window.  Both return zero or the value of
+// should_stop->check, like kiss_fft; if kiss_sdft_update is
+// interrupted, the state reflects some prefix of X.
+// kiss_sdft_spectrum writes the current values of the tracked bins to
+// OUT, in the order they were listed in BINS.
+typedef struct kiss_sdft kiss_sdft;
+
+kiss_sdft *kiss_sdft_alloc(size_t samples,
+                           const size_t *bins,
+                           size_t nbins,
+                           size_t resync,
+                           kiss_fft_periodic_cb *should_stop,
+                           int *stopped);
+void kiss_sdft_free(kiss_sdft *sd);
+int kiss_sdft_init(kiss_sdft *sd,
+                   const kiss_fft_cpx *window,
+                   kiss_fft_periodic_cb *should_stop);
+int kiss_sdft_update(kiss_sdft *sd,
+                     const kiss_fft_cpx *x,
+                     size_t n,
+                     kiss_fft_periodic_cb *should_stop);
+void kiss_sdft_spectrum(const kiss_sdft *sd, kiss_fft_cpx *out);
+
+
+// Added for this demo: chirp-z transform.  A kiss_czt_state computes
+// M bins of the DTFT of N samples, at frequencies F0 + k*DF for
+// k = 0 .. M-1, in cycles per sample; this gives arbitrarily fine
+// resolution over a narrow band without zero-padding the input to a
+// huge transform.  N need not be a power of two.  The work is done by
+// two power-of-two transforms of at least N + M - 1 points per call,
+// plus one more in kiss_czt_alloc, whose result is reused by every
+// call.  kiss_czt_alloc returns 0 if out of memory, or
+// (kiss_czt_state*)-1 if N or M is zero or the transforms would be
+// too large; it checks for interruption like
+// kiss_fft_alloc_interruptible.  kiss_czt returns zero or the value
+// of should_stop->check, like kiss_fft.
+typedef struct kiss_czt_state kiss_czt_state;
+
+kiss_czt_state *kiss_czt_alloc(size_t n,
+                               size_t m,
+                               double f0,
+                               double df,
+                               kiss_fft_periodic_cb *should_stop,
+                               int *stopped);
+void kiss_czt_free(kiss_czt_state *cz);
+int kiss_czt(kiss_czt_state *cz,
+             const kiss_fft_cpx *fin,
+             kiss_fft_cpx *fout,
+             kiss_fft_periodic_cb *should_stop);
+
+
+// Added for this demo: Welch power spectral density estimate.  The
+// input is cut into segments of SAMPLES samples, starting every STEP
+// samples (so consecutive segments overlap if STEP < SAMPLES); each
+// segment is multiplied by WINDOW (SAMPLES floats, or NULL for none)
+// and transformed, and the power spectra of all the segments are
+// averaged.  The result is scaled as a density for a sample rate of
+// 1, i.e. divided by the sum of the squares of the window, matching
+// scipy.signal.welch with return_onesided=False and detrend=False.
+//
+// The segments are divided among NTHREADS threads, or one per online
+// CPU if NTHREADS is zero; the calling thread is one of them, and is
+// the only one that calls should_stop->check.  Each thread has its own
+// buffers, so kiss_welch_alloc uses no more threads than there are
+// online CPUs, or segments in an input of MAX_LEN samples (longer
+// inputs work too, but get no more threads).  It returns 0 if out of
+// memory, or (kiss_welch_state*)-1 if SAMPLES is not a valid transform
+// size or STEP is zero, and checks for interruption like
+// kiss_fft_alloc_interruptible.
+//
+// kiss_welch estimates the spectrum of the LEN samples at X and
+// writes it to PSD (SAMPLES floats); if LEN < SAMPLES there are no
+// segments and the estimate is all zeros.  Returns zero or the value
+// of should_stop->check, like kiss_fft.  A kiss_welch_state may only
+// be used by one call to kiss_welch at a time.
+typedef struct kiss_welch_state kiss_welch_state;
+
+kiss_welch_state *kiss_welch_alloc(size_t samples,
+                                   size_t step,
+                                   size_t max_len,
+                                   const float *window,
+                                   unsigned nthreads,
+                                   kiss_fft_periodic_cb *should_stop,
+                                   int *stopped);
+void kiss_welch_free(kiss_welch_state *w);
+int kiss_welch(kiss_welch_state *w,
+               const kiss_fft_cpx *x,
+               size_t len,
+               float *psd,
+               kiss_fft_periodic_cb *should_stop);
+int kiss_welch_pcm(kiss_welch_state *w,
+                   const void *x,
+                   int format,
+                   size_t stride,
+                   float scale,
+                   size_t len,
+                   float *psd,
+                   kiss_fft_periodic_cb *should_stop);
+
+
+// Added for this demo: sparse FFT.  When all but about K of the bins
+// of a spectrum are negligible, kiss_sfft can find those K without
+// computing the rest, reading only O(K log N) input samples per round
+// of hashing; see the comments in kissfft_subset.c.  The result is
+// randomized, but the bins it does find are accurate, and it stops
+// once the bins it hasn't found hold less than TOLERANCE times the
+// energy of the whole spectrum (so TOLERANCE = 0 never stops).  If
+// that doesn't happen within a few rounds, or the spectrum turns out
+// to have more than about 4 K significant bins, it gives up and calls
+// kiss_fft with the plan ST instead.  Either way, FOUT (SAMPLES
+// elements) gets the spectrum, zero except for the bins found, and
+// *NFOUND is set to the number of bins found, or to SAMPLES if
+// kiss_fft did the work.  ST may be NULL if making a plan for SAMPLES
+// points is to be put off until it's needed; then if kiss_sfft gives
+// up, it sets *NFOUND to SIZE_MAX and leaves FOUT alone.  Returns
+// zero or the value of should_stop->check, like kiss_fft.
+//
+// kiss_sfft_alloc returns 0 if out of memory, or (kiss_sfft_state*)-1
+// if SAMPLES is not a valid transform size, K is zero, or TOLERANCE is
+// not in [0, 1), and checks for interruption like
+// kiss_fft_alloc_interruptible.  For small transforms, or K close to
+// SAMPLES, hashing would cost as much as kiss_fft, and kiss_sfft
+// always gives up.  A kiss_sfft_state may only be used by one call to
+// kiss_sfft at a time.
+typedef struct kiss_sfft_state kiss_sfft_state;
+
+kiss_sfft_state *kiss_sfft_alloc(size_t samples,
+                                 size_t k,
+                                 double tolerance,
+                                 kiss_fft_periodic_cb *should_stop,
+                                 int *stopped);
+void kiss_sfft_free(kiss_sfft_state *sf);
+int kiss_sfft(kiss_sfft_state *sf,
+              kiss_fft_state *st,
+              const kiss_fft_cpx *fin,
+              kiss_fft_cpx *fout,
+              size_t *nfound,
+              kiss_fft_periodic_cb *should_stop);
+
+
+// Added for this demo: number-theoretic transform, for exact
+// convolution of integers.  kiss_ntt is the DFT of SAMPLES integers
+// modulo the prime KISS_NTT_MODULUS, with 3**((P-1)/SAMPLES) as the
+// root of unity; FIN holds residues, each less than the modulus, and
+// FOUT receives residues.  kiss_intt is the inverse, including the
+// division by SAMPLES.  In both, FIN and FOUT must not overlap.
+//
+// kiss_ntt_convolve computes the NA + NB - 1 coefficients of the
+// convolution of A and B (the product of two polynomials) into OUT,
+// where NA + NB - 1 must be at most SAMPLES; SCRATCH must have room
+// for 2 * SAMPLES residues.  The result is exact as long as every
+// coefficient of the true convolution has magnitude less than half
+// the modulus (about 2**61), and is the residue nearest zero
+// otherwise.  For instance, convolving 16-bit limbs of big numbers is
+// exact up to 2**29 limbs.
+//
+// kiss_ntt_alloc is like kiss_fft_alloc_interruptible: it returns 0
+// if out of memory, or (kiss_ntt_state*)-1 if SAMPLES is not a valid
+// transform size, or 0 with the value of should_stop->check in
+// *STOPPED if that says to stop.  The result can be freed with free().
+// The other three functions return zero or the value of
+// should_stop->check, like kiss_fft.
+#define KISS_NTT_MODULUS UINT64_C(4179340454199820289)  // 29 * 2**57 + 1
+
+typedef struct kiss_ntt_state kiss_ntt_state;
+
+kiss_ntt_state *kiss_ntt_alloc(size_t samples,
+                               kiss_fft_periodic_cb *should_stop,
+                               int *stopped);
+int kiss_ntt(const kiss_ntt_state *st,
+             const uint64_t *fin,
+             uint64_t *fout,
+             kiss_fft_periodic_cb *should_stop);
+int kiss_intt(const kiss_ntt_state *st,
+              const uint64_t *fin,
+              uint64_t *fout,
+              kiss_fft_periodic_cb *should_stop);
+int kiss_ntt_convolve(const kiss_ntt_state *st,
+                      const int64_t *a, size_t na,
+                      const int64_t *b, size_t nb,
+                      int64_t *out,
+                      uint64_t *scratch,
+                      kiss_fft_periodic_cb *should_stop);
+
+
+// Added for this demo: one transform sharded across processes.  A
+// segment of shared memory (e.g. from shm_open, or Python's
+// multiprocessing.shared_memory) holds the input, output, plan and
+// scratch for a transform of SAMPLES points, to be computed by
+// NSHARDS cooperating processes, or threads.  The transform is done
+// by the four-step method, one batch of small transforms per step,
+// with each shard doing its share of each batch; see the comments in
+// kissfft_subset.c.
+//
+// kiss_fft_shared_layout returns the size of the segment in bytes,
+// and stores the byte offsets of the input and output arrays (SAMPLES
+// kiss_fft_cpx each) in *INPUT_OFFSET and *OUTPUT_OFFSET; it returns
+// 0 if SAMPLES is not a valid transform size or NSHARDS is zero.
+// kiss_fft_shared_init lays out and plans a segment of that size at
+// MEM, which must be suitably aligned for any type (as a mapping
+// is); it returns zero or the value of should_stop->check, like
+// kiss_fft, and if interrupted the segment isn't usable.
+// kiss_fft_shared_shards returns the NSHARDS of the initialized
+// segment in the SIZE bytes at MEM, or 0 if there isn't one.
+//
+// To transform, fill in the input, then call kiss_fft_shared_run
+// once for each SHARD from 0 to NSHARDS - 1, each in its own process
+// or thread, with the segment mapped at any address.  Each call
+// returns when every shard has finished, with the output complete,
+// and the next transform may begin as soon as that happens.  If any
+// shard's should_stop->check says to stop, it returns that value, and
+// every other shard returns KISS_FFT_SHARED_CANCELLED at its next
+// check.  The same happens if any process calls kiss_fft_shared_cancel
+// (for instance, whoever started the shards, on being interrupted
+// itself), or a shard dies while running, which the others notice
+// within about 10 ms while waiting for it.  After that, every run of
+// the segment returns KISS_FFT_SHARED_CANCELLED at once, until
+// kiss_fft_shared_reset is called, which must only be done while no
+// shard is running.
+#define KISS_FFT_SHARED_CANCELLED INT_MIN
+
+size_t kiss_fft_shared_layout(size_t samples,
+                              unsigned nshards,
+                              size_t *input_offset,
+                              size_t *output_offset);
+int kiss_fft_shared_init(void *mem,
+                         size_t samples,
+                         unsigned nshards,
+                         kiss_fft_periodic_cb *should_stop);
+unsigned kiss_fft_shared_shards(const void *mem, size_t size);
+int kiss_fft_shared_run(void *mem,
+                        unsigned shard,
+                        kiss_fft_periodic_cb *should_stop);
+void kiss_fft_shared_cancel(void *mem);
+void kiss_fft_shared_reset(void *mem);
+
+
+// Added for this demo: discrete cosine transforms of SAMPLES real
+// samples, by way of one complex transform of SAMPLES / 2 points.
+// kiss_dct2 computes the DCT-II,
+//
+//   y_k = 2 sum_n x_n cos(pi k (2n + 1) / 2N),
+//
+// and kiss_dct3 the DCT-III,
+//
+//   x_n = y_0 + 2 sum_(k>0) y_k cos(pi k (2n + 1) / 2N),
+//
+// both scaled as scipy.fft.dct with norm="backward", so that DCT-III
+// of DCT-II is 2N times the input.  FIN and FOUT (SAMPLES floats each)
+// must not overlap.  Both return zero or the value of
+// should_stop->check, like kiss_fft.
+//
+// kiss_dct_alloc is like kiss_ntt_alloc, and the plan it makes can be
+// reused for any number of transforms of either kind, but only by one
+// call at a time, since it holds their scratch space.
+typedef struct kiss_dct_state kiss_dct_state;
+
+kiss_dct_state *kiss_dct_alloc(size_t samples,
+                               kiss_fft_periodic_cb *should_stop,
+                               int *stopped);
+void kiss_dct_free(kiss_dct_state *d);
+int kiss_dct2(kiss_dct_state *d,
+              const float *fin,
+              float *fout,
+              kiss_fft_periodic_cb *should_stop);
+int kiss_dct3(kiss_dct_state *d,
+              const float *fin,
+              float *fout,
+              kiss_fft_periodic_cb *should_stop);
+
 #endif
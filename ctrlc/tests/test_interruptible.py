@@ -0,0 +1,1707 @@
+"""Tests of the transforms in ctrlc.interruptible."""
+
+import errno
+import gc
+import os
+import resource
+import subprocess
+import sys
+import traceback
+from mmap import MAP_ANONYMOUS, MAP_PRIVATE, mmap
+from signal import SIGKILL, SIGUSR1, signal
+from threading import Thread
+from time import perf_counter, sleep
+
+import numpy as np
+import pytest
+
+from ctrlc import interruptible
+from ctrlc.signaler import Timer
+
+FFT_FUNCTIONS = [
+    interruptible.fft_uninterruptible,
+    interruptible.fft_simple_interruptible,
+    interruptible.fft_timed_interruptible,
+]
+
+def ms(ms):
+    """Convert milliseconds to fractional seconds"""
+    return ms / 1000
+
+# How long to wait before pressing control-C, in the tests that do.
+STD_DELAY = ms(10)
+# How long after that an interruptible call may take to stop.  They
+# check every 5 ms, but the test machine may be busy.
+MAX_LATENCY = ms(250)
+
+def random_complex(n, seed=0):
+    """Return n random single-precision complex numbers."""
+    rng = np.random.default_rng(seed)
+    return (rng.standard_normal(n) + 1j * rng.standard_normal(n)) \
+        .astype(np.complex64)
+
+def assert_close(actual, expected, rtol=1e-5):
+    """Check that actual is within rtol of expected, relative to the
+       largest element of expected (single-precision rounding error
+       in a transform scales with the whole spectrum, not each bin)."""
+    expected = np.asarray(expected)
+    scale = max(np.max(np.abs(expected)), 1)
+    assert np.max(np.abs(np.asarray(actual) - expected)) <= rtol * scale
+
+def assert_interrupted(func, *args, **kwargs):
+    """Call func(*args, **kwargs), press control-C once after
+       STD_DELAY seconds, check that it raises Interrupted soon after,
+       and return the exception."""
+    start = perf_counter()
+    with pytest.raises(interruptible.Interrupted) as info:
+        with Timer(STD_DELAY, repeat=False):
+            func(*args, **kwargs)
+    assert perf_counter() - start < STD_DELAY + MAX_LATENCY
+    elapsed, _checks = info.value.args
+    assert elapsed < STD_DELAY + MAX_LATENCY
+    return info.value
+
+def run_in_child(func, *args):
+    """Run func(*args) in a forked child process, so that anything it
+       sets up for the whole process, such as loaded wisdom, doesn't
+       carry over into other tests; check that it succeeds."""
+    pid = os.fork()
+    if pid == 0:
+        status = 1
+        try:
+            func(*args)
+            status = 0
+        except BaseException:
+            traceback.print_exc()
+        finally:
+            os._exit(status)
+    assert os.waitstatus_to_exitcode(os.waitpid(pid, 0)[1]) == 0
+
+
+@pytest.mark.parametrize("fft", FFT_FUNCTIONS)
+@pytest.mark.parametrize("log2", range(21))
+def test_each_size(fft, log2):
+    """Test the copy of kf_work specialized for each size against
+       numpy, down to a single sample, which has no stages at all."""
+    x = random_complex(1 << log2)
+    y = np.empty_like(x)
+    fft(x, y)
+    assert_close(y, np.fft.fft(x))
+
+
+def test_sizes_not_power_of_two():
+    """Test that sizes with no specialized kf_work are rejected."""
+    for n in (0, 3, 12, 1000):
+        x = np.zeros(n, np.complex64)
+        with pytest.raises(ValueError):
+            interruptible.fft_timed_interruptible(x, np.empty_like(x))
+
+
+@pytest.mark.parametrize("n", [16, 32, 64])
+def test_codelet_matrix(n):
+    """Test every constant in the 16-, 32- and 64-point codelets: the
+       transform of an impulse at j is row j of the DFT matrix."""
+    k = np.arange(n)
+    y = np.empty(n, np.complex64)
+    for j in range(n):
+        x = np.zeros(n, np.complex64)
+        x[j] = 1
+        interruptible.fft_timed_interruptible(x, y)
+        assert_close(y, np.exp(-2j * np.pi * j * k / n), 1e-6)
+
+
+@pytest.mark.parametrize("log2", [7, 8, 9, 10])
+def test_codelet_leaves(log2):
+    """Test sizes whose leaves are 32-point (odd powers of two) and
+       64-point (even powers) codelets, on inputs concentrated in one
+       leaf's samples, which are every N/64 or N/32 samples apart."""
+    n = 1 << log2
+    leaf = 64 if log2 % 2 == 0 else 32
+    x = np.zeros(n, np.complex64)
+    x[3::n // leaf] = random_complex(leaf)
+    y = np.empty_like(x)
+    interruptible.fft_timed_interruptible(x, y)
+    assert_close(y, np.fft.fft(x))
+
+
+@pytest.mark.parametrize("log2", [17, 18, 19, 20, 21])
+def test_permutation_prepass(log2):
+    """Test sizes on either side of 2**18, where kf_bitrev starts
+       moving the input into the output buffer before the transform
+       runs there in place, with both leaf sizes.  The input must be
+       left alone."""
+    x = random_complex(1 << log2)
+    original = x.copy()
+    y = np.empty_like(x)
+    interruptible.fft_timed_interruptible(x, y)
+    np.testing.assert_array_equal(x, original)
+    assert_close(y, np.fft.fft(x))
+
+
+@pytest.mark.parametrize("log2", [18, 19])
+def test_permutation_prepass_readers(log2):
+    """Test the other entry points that kf_bitrev reads for, from
+       2**18, against numpy on random input: fft_power, fft_bins with
+       every bin, and PCM input to the transform and to both of those.
+       At 2**19 the transform that follows has a radix-2 top stage."""
+    n = 1 << log2
+    pcm, x = pcm_and_complex(np.int16, n)
+    spectrum = np.fft.fft(x)
+    bins = np.random.default_rng(1).permutation(n)
+    for data, kwargs in ((x, {}), (pcm, PCM_KWARGS)):
+        y = np.empty(n, np.complex64)
+        interruptible.fft_timed_interruptible(data, y, **kwargs)
+        assert_close(y, spectrum)
+        power = np.empty(n, np.float32)
+        interruptible.fft_power(data, power, **kwargs)
+        assert_close(power, np.abs(spectrum) ** 2, 1e-4)
+        interruptible.fft_bins(data, y, bins, **kwargs)
+        assert_close(y, spectrum[bins])
+
+
+@pytest.mark.parametrize("log2", [4, 10, 15, 18, 19])
+def test_measure(log2):
+    """Test that whichever candidate the 'measure' planner picks gives
+       numpy's result, both on the call that measures and on later
+       calls that reuse its choice without being asked to."""
+    x = random_complex(1 << log2)
+    y = np.empty_like(x)
+    interruptible.fft_timed_interruptible(x, y, planner="measure",
+                                          planning_limit=0.2)
+    assert_close(y, np.fft.fft(x))
+    y[:] = 0
+    interruptible.fft_timed_interruptible(x, y)
+    assert_close(y, np.fft.fft(x))
+
+
+def test_measure_limit():
+    """Test that measuring stops at about planning_limit, even when
+       there isn't time to try every candidate."""
+    x = np.zeros(1 << 20, np.complex64)
+    elapsed, _checks = interruptible.fft_timed_interruptible(
+        x, np.empty_like(x), planner="measure", planning_limit=0.05)
+    # Allow for the transform itself and one candidate that was
+    # started just before the limit.
+    assert elapsed < 0.5
+
+
+def test_bad_planner():
+    """Test that an unknown planner is rejected."""
+    x = np.zeros(16, np.complex64)
+    with pytest.raises(ValueError):
+        interruptible.fft_timed_interruptible(x, np.empty_like(x),
+                                              planner="patient")
+
+
+def check_measure_once():
+    """The part of test_measure_once that runs in a child, since what
+       it measures is remembered for the rest of the process."""
+    x = random_complex(1 << 14)
+    y = np.empty_like(x)
+    def measure(limit):
+        return interruptible.fft_timed_interruptible(
+            x, y, planner="measure", planning_limit=limit)[0]
+    skipped = measure(0)
+    cut_short = measure(1e-9)
+    first = measure(1.0)
+    again = measure(1.0)
+    assert skipped < first / 10
+    assert cut_short < first / 10
+    assert again < first / 10
+    assert_close(y, np.fft.fft(x))
+
+
+def test_measure_once():
+    """Test that a planning limit of zero, or one too short to time any
+       candidate, skips measurement, rather than remembering the untimed
+       default, and that a size is only ever measured once."""
+    run_in_child(check_measure_once)
+
+
+def load_and_transform(path, sizes):
+    """The part of test_wisdom_roundtrip that runs in a fresh child."""
+    interruptible.load_wisdom(str(path))
+    with open("/proc/self/maps") as maps:
+        assert str(path) in maps.read()
+    x = random_complex(max(sizes))
+    for n in sizes:
+        y = np.empty(n, np.complex64)
+        interruptible.fft_timed_interruptible(x[:n], y)
+        assert_close(y, np.fft.fft(x[:n]))
+
+
+def test_wisdom_roundtrip(tmp_path):
+    """Test that a process that loads a wisdom file maps it, rather
+       than reading it, and that transforms using its plans (one of them
+       measured) match numpy."""
+    sizes = [1 << 10, 1 << 13]
+    x = np.zeros(sizes[1], np.complex64)
+    interruptible.fft_timed_interruptible(x, np.empty_like(x),
+                                          planner="measure",
+                                          planning_limit=0.1)
+    path = tmp_path / "wisdom"
+    interruptible.save_wisdom(str(path), sizes)
+    # written under another name and renamed into place
+    assert os.listdir(tmp_path) == ["wisdom"]
+    run_in_child(load_and_transform, path, sizes)
+
+
+def test_wisdom_errors(tmp_path):
+    """Test that bad sizes and bad files are reported as such."""
+    path = tmp_path / "wisdom"
+    for sizes in ([3], [1 << 10, 0]):
+        with pytest.raises(ValueError, match="invalid number of samples"):
+            interruptible.save_wisdom(str(path), sizes)
+    with pytest.raises(FileNotFoundError):
+        interruptible.load_wisdom(str(path))
+
+    interruptible.save_wisdom(str(path), [1 << 10])
+    whole = path.read_bytes()
+    for bad in (b"\0" * 4096, whole[:len(whole) // 2]):
+        path.write_bytes(bad)
+        with pytest.raises(ValueError, match="not a KISS FFT wisdom file"):
+            interruptible.load_wisdom(str(path))
+
+
+def test_wisdom_save_interrupted(tmp_path):
+    """Test control-C while saving a wisdom file for a large size,
+       which leaves neither the file nor its temporary behind, and
+       that saving afterwards still works."""
+    path = tmp_path / "wisdom"
+    assert_interrupted(interruptible.save_wisdom, str(path), [1 << 24])
+    assert os.listdir(tmp_path) == []
+    elapsed, _checks = interruptible.save_wisdom(str(path), [1 << 10])
+    assert elapsed >= 0
+    assert os.listdir(tmp_path) == ["wisdom"]
+
+
+def wisdom_mappings(path):
+    """How many of this process's mappings are of the file at PATH."""
+    with open("/proc/self/maps") as maps:
+        return sum(str(path) in line for line in maps)
+
+
+def load_wisdom_repeatedly(path):
+    """The part of test_wisdom_reload that runs in a fresh child."""
+    interruptible.load_wisdom(str(path))
+    mappings = wisdom_mappings(path)
+    assert mappings > 0
+    for _ in range(3):
+        interruptible.load_wisdom(str(path))
+    assert wisdom_mappings(path) == mappings
+    interruptible.save_wisdom(str(path), [1 << 10])
+    interruptible.load_wisdom(str(path))
+    interruptible.load_wisdom(str(path))
+    assert wisdom_mappings(path) == 2 * mappings
+
+
+def test_wisdom_reload(tmp_path):
+    """Test that loading a wisdom file again reuses its mapping, and
+       that loading one that has been replaced maps the new file."""
+    path = tmp_path / "wisdom"
+    interruptible.save_wisdom(str(path), [1 << 10])
+    run_in_child(load_wisdom_repeatedly, path)
+
+
+@pytest.mark.parametrize("log2", [2, 3, 6, 9, 12, 15, 18, 20])
+def test_pure_tones(log2):
+    """Test that a pure tone at bin k transforms to N at k and nothing
+       elsewhere, for bins spread across the spectrum.  Each bin
+       number reads different entries of each stage's twiddle table."""
+    n = 1 << log2
+    t = np.arange(n)
+    y = np.empty(n, np.complex64)
+    for k in {1, 3, n // 4 - 1, n // 4 + 1, n // 2, 3 * n // 4 + 2, n - 1}:
+        k %= n
+        x = np.exp(2j * np.pi * k * t / n).astype(np.complex64)
+        interruptible.fft_timed_interruptible(x, y)
+        expected = np.zeros(n)
+        expected[k] = n
+        assert_close(y, expected, 1e-6)
+
+
+@pytest.mark.parametrize("simd", [True, False])
+@pytest.mark.parametrize("size", [1, 4, 8, 64, 1024, 2048])
+@pytest.mark.parametrize("count", [1, 7, 16, 37])
+def test_batch(size, count, simd):
+    """Test fft_batch against numpy on each row, for sizes in and out
+       of the SIMD range, and counts that leave a partial group of
+       vector lanes."""
+    x = random_complex(count * size)
+    y = np.empty_like(x)
+    interruptible.fft_batch(x, y, size, simd=simd)
+    expected = np.fft.fft(x.reshape(count, size), axis=1)
+    assert_close(y.reshape(count, size), expected)
+
+
+def test_batch_length_mismatch():
+    """Test that input not made of whole transforms is rejected."""
+    x = np.zeros(100, np.complex64)
+    with pytest.raises(ValueError):
+        interruptible.fft_batch(x, np.empty_like(x), 64)
+
+
+def test_batch_interrupted():
+    """Test that an interrupted fft_batch stops between groups of
+       transforms: every transform in the output is either finished
+       or untouched, and the finished ones come first."""
+    size = 256
+    block = random_complex(size)
+    x = np.tile(block, 1 << 15)
+    y = np.full_like(x, np.nan)
+    assert_interrupted(interruptible.fft_batch, x, y, size)
+    rows = y.reshape(-1, size)
+    finished = ~np.isnan(rows).all(axis=1)
+    assert not np.isnan(rows[finished]).any()
+    count = np.count_nonzero(finished)
+    assert 0 < count < len(rows)
+    assert finished[:count].all()
+    assert_close(rows[:count],
+                 np.broadcast_to(np.fft.fft(block), (count, size)))
+
+
+def test_max_samples(tmp_path):
+    """Test that MAX_SAMPLES is 2**40 (on 64-bit builds), and that
+       sizes beyond it are rejected rather than truncated."""
+    if np.dtype(np.intp).itemsize == 8:
+        assert interruptible.MAX_SAMPLES == 1 << 40
+    else:
+        assert interruptible.MAX_SAMPLES == 1 << 31
+    path = str(tmp_path / "wisdom")
+    for size in (interruptible.MAX_SAMPLES * 2,
+                 interruptible.MAX_SAMPLES * 3,
+                 3 << 33):
+        with pytest.raises(ValueError, match="invalid number of samples"):
+            interruptible.save_wisdom(path, [size])
+    assert not os.path.exists(path)
+
+
+@pytest.mark.parametrize("log2", [12, 18])
+@pytest.mark.parametrize("count", [1, 5, 8, 9, 64, "N/16", "N"])
+def test_bins(log2, count):
+    """Test fft_bins against numpy with each of its methods: Goertzel
+       for up to 8 bins, pruning (with the pre-pass, from 2**18) for
+       sparse requests, and a full transform for dense ones.  Bins are
+       random, unsorted, and may repeat."""
+    n = 1 << log2
+    count = {"N/16": n // 16, "N": n}.get(count, count)
+    x = random_complex(n)
+    bins = np.random.default_rng(1).integers(0, n, count)
+    y = np.empty(count, np.complex64)
+    interruptible.fft_bins(x, y, bins)
+    assert_close(y, np.fft.fft(x)[bins])
+
+
+def test_bins_sequences():
+    """Test that bins may be given as a list, a range or an array."""
+    x = random_complex(256)
+    expected = np.fft.fft(x)[10:200:7]
+    for bins in (list(range(10, 200, 7)), range(10, 200, 7),
+                 np.arange(10, 200, 7, dtype=np.uint16)):
+        y = np.empty(len(bins), np.complex64)
+        interruptible.fft_bins(x, y, bins)
+        assert_close(y, expected)
+
+
+def test_bins_errors():
+    """Test that bins outside the spectrum, and an output of the wrong
+       size, are rejected."""
+    x = np.zeros(256, np.complex64)
+    with pytest.raises(ValueError, match="bin out of range"):
+        interruptible.fft_bins(x, np.empty(2, np.complex64), [3, 256])
+    with pytest.raises(OverflowError):
+        interruptible.fft_bins(x, np.empty(1, np.complex64), [-1])
+    with pytest.raises(ValueError):
+        interruptible.fft_bins(x, np.empty(3, np.complex64), [1, 2])
+
+
+@pytest.mark.parametrize("count", [4, 64, 1 << 18])
+def test_bins_interrupted(count):
+    """Test that each method of fft_bins stops promptly on control-C."""
+    n = 1 << 22
+    x = np.ones(n, np.complex64)
+    assert_interrupted(interruptible.fft_bins, x,
+                       np.empty(count, np.complex64),
+                       range(0, n, n // count))
+
+
+@pytest.mark.parametrize("bins", [None, [0, 3, 200, 255, 3]])
+@pytest.mark.parametrize("resync", [0, 1, 16])
+def test_sliding_dft(bins, resync):
+    """Test that a SlidingDFT tracks numpy's transform of its window
+       as samples are pushed, in one update or several, with resyncs
+       landing in the middle of updates."""
+    n = 256
+    x = random_complex(n + 600)
+    sdft = interruptible.SlidingDFT(x[:n], bins, resync)
+    assert sdft.size == n
+    assert sdft.nbins == (n if bins is None else len(bins))
+    which = slice(None) if bins is None else bins
+    y = np.empty(sdft.nbins, np.complex64)
+
+    sdft.spectrum(y)
+    assert_close(y, np.fft.fft(x[:n])[which])
+    sdft.update(x[n:n + 100])
+    sdft.spectrum(y)
+    assert_close(y, np.fft.fft(x[100:n + 100])[which], 1e-4)
+    for start in range(n + 100, n + 600, 50):
+        sdft.update(x[start:start + 50])
+    sdft.spectrum(y)
+    assert_close(y, np.fft.fft(x[600:])[which], 1e-4)
+
+
+def test_sliding_dft_drift():
+    """Test that resyncs keep rounding error from building up over a
+       long stream."""
+    n = 64
+    x = random_complex(n * 1000)
+    sdft = interruptible.SlidingDFT(x[:n])
+    sdft.update(x[n:])
+    y = np.empty(n, np.complex64)
+    sdft.spectrum(y)
+    assert_close(y, np.fft.fft(x[-n:]), 1e-5)
+
+
+def test_sliding_dft_errors():
+    """Test that bad windows, bins and outputs are rejected."""
+    with pytest.raises(ValueError):
+        interruptible.SlidingDFT(np.zeros(100, np.complex64))
+    with pytest.raises(ValueError):
+        interruptible.SlidingDFT(np.zeros(64, np.complex64), [64])
+    sdft = interruptible.SlidingDFT(np.zeros(64, np.complex64), [1, 2])
+    with pytest.raises(ValueError):
+        sdft.spectrum(np.empty(64, np.complex64))
+
+
+def test_sliding_dft_interrupted():
+    """Test that an interrupted update has pushed some prefix of its
+       samples, and no more.  The samples count up, so the first sample
+       of the window, recovered from the spectrum, says how many."""
+    n = 1 << 12
+    ramp = np.arange(n + (1 << 16), dtype=np.float32).astype(np.complex64)
+    sdft = interruptible.SlidingDFT(ramp[:n])
+    assert_interrupted(sdft.update, ramp[n:])
+    y = np.empty(n, np.complex64)
+    sdft.spectrum(y)
+    pushed = int(round(np.fft.ifft(y)[0].real))
+    assert 0 < pushed < 1 << 16
+    assert_close(y, np.fft.fft(ramp[pushed:pushed + n]), 1e-5)
+
+
+@pytest.mark.parametrize("release_gil", [True, False])
+def test_sliding_dft_build_interrupted(release_gil):
+    """Test control-C while a SlidingDFT makes its plan and initial
+       spectrum, which for 2**23 samples takes most of a second."""
+    window = np.ones(1 << 23, np.complex64)
+    assert_interrupted(interruptible.SlidingDFT, window,
+                       release_gil=release_gil)
+    x = random_complex(256)
+    sdft = interruptible.SlidingDFT(x, interval=ms(1),
+                                    release_gil=release_gil)
+    y = np.empty_like(x)
+    sdft.spectrum(y)
+    assert_close(y, np.fft.fft(x))
+
+
+def dft_at(x, freqs):
+    """The DFT of x at arbitrary frequencies, in cycles per sample,
+       summed directly in double precision."""
+    return np.exp(-2j * np.pi * np.outer(freqs, np.arange(len(x)))) @ x
+
+
+@pytest.mark.parametrize("n", [1, 256, 300, 1000])
+def test_zoom_fft_whole_band(n):
+    """Test that a ZoomFFT over the whole band, with one bin per
+       sample, is an ordinary transform, even when the size is not a
+       power of two."""
+    x = random_complex(n)
+    y = np.empty(n, np.complex64)
+    zoom = interruptible.ZoomFFT(n, n)
+    assert (zoom.size, zoom.nbins) == (n, n)
+    zoom.transform(x, y)
+    assert_close(y, np.fft.fft(x), 1e-4)
+
+
+@pytest.mark.parametrize("n,bins,start,stop", [
+    (300, 50, 0.1, 0.2),
+    (300, 1000, 0.1, 0.1001),
+    (64, 7, -0.25, 0.25),
+    (1000, 3, 0.9, 1.3),
+])
+def test_zoom_fft_band(n, bins, start, stop):
+    """Test ZoomFFTs of narrow, very narrow, negative and wrapping
+       bands, with fewer or more bins than samples, against the DFT
+       summed directly at the same frequencies."""
+    x = random_complex(n)
+    y = np.empty(bins, np.complex64)
+    interruptible.ZoomFFT(n, bins, start, stop).transform(x, y)
+    freqs = start + (stop - start) * np.arange(bins) / bins
+    assert_close(y, dft_at(x, freqs), 1e-4)
+
+
+def test_zoom_fft_interrupted():
+    """Test that an interrupted ZoomFFT transform leaves the object
+       usable for the next one."""
+    n = 1 << 20
+    zoom = interruptible.ZoomFFT(n, 16, 0.25, 0.25 + 16 / n)
+    x = np.zeros(n, np.complex64)
+    y = np.empty(16, np.complex64)
+    assert_interrupted(zoom.transform, x, y)
+    x[:1000] = random_complex(1000)
+    zoom.transform(x, y)
+    assert_close(y, dft_at(x[:1000], 0.25 + np.arange(16) / n), 1e-4)
+
+
+@pytest.mark.parametrize("release_gil", [True, False])
+def test_zoom_fft_build_interrupted(release_gil):
+    """Test control-C while a ZoomFFT computes its chirp's spectrum,
+       which at 2**22 bins takes about a second."""
+    n = 1 << 22
+    assert_interrupted(interruptible.ZoomFFT, n, n, release_gil=release_gil)
+    zoom = interruptible.ZoomFFT(256, 256, interval=ms(1),
+                                 release_gil=release_gil)
+    x = random_complex(256)
+    y = np.empty_like(x)
+    zoom.transform(x, y)
+    assert_close(y, np.fft.fft(x), 1e-4)
+
+
+@pytest.mark.parametrize("windowed", [False, True])
+@pytest.mark.parametrize("log2", [0, 1, 3, 10, 11, 18])
+def test_power(log2, windowed):
+    """Test fft_power against numpy's power spectrum, and its planar
+       magnitudes and phases with phase=True, for sizes whose top stage
+       is radix 2 or radix 4, with the permutation done by a gather or
+       by kf_bitrev.  The input and window must be left alone."""
+    n = 1 << log2
+    x = random_complex(n)
+    window = (np.hanning(n) + 0.5).astype(np.float32) if windowed else None
+    spectrum = np.fft.fft(x if window is None else x * window)
+    originals = x.copy(), None if window is None else window.copy()
+
+    y = np.empty(n, np.float32)
+    interruptible.fft_power(x, y, window)
+    assert_close(y, np.abs(spectrum) ** 2, 1e-4)
+
+    y = np.empty(2 * n, np.float32)
+    interruptible.fft_power(x, y, window, phase=True)
+    assert_close(y[:n], np.abs(spectrum))
+    # Compare phases only where the magnitude makes them meaningful,
+    # and modulo 2 pi.
+    big = np.abs(spectrum) > 1e-3 * np.max(np.abs(spectrum))
+    diff = np.angle(np.exp(1j * (y[n:] - np.angle(spectrum))))
+    assert np.max(np.abs(diff[big])) < 1e-3
+
+    np.testing.assert_array_equal(x, originals[0])
+    if windowed:
+        np.testing.assert_array_equal(window, originals[1])
+
+
+def test_power_errors():
+    """Test that outputs and windows of the wrong size are rejected."""
+    x = np.zeros(64, np.complex64)
+    for output, window in ((np.empty(64, np.complex64), None),
+                           (np.empty(128, np.float32), None),
+                           (np.empty(64, np.float32),
+                            np.ones(32, np.float32))):
+        with pytest.raises(ValueError):
+            interruptible.fft_power(x, output, window)
+
+
+def test_power_interrupted():
+    """Test that fft_power stops promptly on control-C, without having
+       windowed the input in place."""
+    n = 1 << 22
+    x = np.ones(n, np.complex64)
+    window = np.full(n, 2, np.float32)
+    assert_interrupted(interruptible.fft_power, x,
+                       np.empty(n, np.float32), window)
+    assert (x == 1).all()
+
+
+def welch_reference(x, n, window, step):
+    """Welch's estimate as scipy.signal.welch(x, fs=1, window, n,
+       n - step, detrend=False, return_onesided=False) computes it."""
+    w = np.ones(n) if window is None else window.astype(np.float64)
+    segments = [x[i:i + n] * w for i in range(0, len(x) - n + 1, step)]
+    power = np.abs(np.fft.fft(segments, axis=1)) ** 2
+    return power.mean(axis=0) / np.sum(w ** 2)
+
+
+@pytest.mark.parametrize("windowed", [False, True])
+@pytest.mark.parametrize("step", [0, 100, 256, 300])
+@pytest.mark.parametrize("threads", [0, 1, 3])
+def test_welch(monkeypatch, windowed, step, threads):
+    """Test fft_welch against Welch's method written out with numpy,
+       with overlapping segments, adjacent ones, and gaps between
+       them.  Threads are capped at the number of CPUs, so pretend
+       there are enough."""
+    monkeypatch.setenv("KISS_FFT_CPUS", "4")
+    n = 256
+    x = random_complex(5000)
+    window = np.hanning(n).astype(np.float32) if windowed else None
+    y = np.empty(n, np.float32)
+    interruptible.fft_welch(x, y, window, step, threads)
+    assert_close(y, welch_reference(x, n, window, step or n // 2), 1e-4)
+
+
+def test_welch_deterministic(monkeypatch):
+    """Test that for a given thread count the result is the same to
+       the bit every time, since each thread sums a fixed run of
+       segments."""
+    monkeypatch.setenv("KISS_FFT_CPUS", "4")
+    x = random_complex(1 << 16)
+    for threads in (1, 2, 3):
+        first, again = np.empty(256, np.float32), np.empty(256, np.float32)
+        interruptible.fft_welch(x, first, threads=threads)
+        interruptible.fft_welch(x, again, threads=threads)
+        np.testing.assert_array_equal(first, again)
+
+
+def test_welch_thread_cap(monkeypatch):
+    """Test that fft_welch makes buffers for no more threads than there
+       are CPUs or segments, however many are asked for: a million
+       would need about 64 GB."""
+    monkeypatch.setenv("KISS_FFT_CPUS", "4")
+    for length in (1 << 16, 512):
+        x = random_complex(length)
+        expected, y = np.empty(256, np.float32), np.empty(256, np.float32)
+        interruptible.fft_welch(x, expected, threads=1)
+        interruptible.fft_welch(x, y, threads=1 << 20)
+        assert_close(y, expected)
+
+
+def test_welch_errors():
+    """Test that input shorter than one segment, a segment size that
+       isn't a power of two, and a window of the wrong size are
+       rejected."""
+    y = np.empty(256, np.float32)
+    with pytest.raises(ValueError, match="not enough samples"):
+        interruptible.fft_welch(random_complex(255), y)
+    with pytest.raises(ValueError):
+        interruptible.fft_welch(random_complex(1000),
+                                np.empty(100, np.float32))
+    with pytest.raises(ValueError):
+        interruptible.fft_welch(random_complex(1000), y,
+                                np.ones(128, np.float32))
+
+
+@pytest.mark.parametrize("threads", [1, 4])
+def test_welch_interrupted(monkeypatch, threads):
+    """Test that fft_welch stops promptly on control-C, helper threads
+       included, and works normally afterwards."""
+    monkeypatch.setenv("KISS_FFT_CPUS", "4")
+    x = np.ones(1 << 22, np.complex64)
+    y = np.empty(1 << 10, np.float32)
+    assert_interrupted(interruptible.fft_welch, x, y, threads=threads)
+    interruptible.fft_welch(x[:1 << 12], y, threads=threads)
+    assert_close(y, welch_reference(x[:1 << 12], 1 << 10, None, 1 << 9))
+
+
+def test_welch_plan_interrupted():
+    """Test control-C while fft_welch makes its plan for segments of
+       2**23 samples, which takes over 100 ms, as test_plan_interrupted
+       does for the transforms."""
+    x = np.empty(1 << 23, np.complex64)
+    y = np.empty(len(x), np.float32)
+    exc = assert_interrupted(interruptible.fft_welch, x, y)
+    assert exc.args[0] < STD_DELAY + ms(40)
+
+
+@pytest.mark.parametrize("fft", FFT_FUNCTIONS)
+@pytest.mark.parametrize("dtype", [np.int16, np.int32])
+@pytest.mark.parametrize("channels,channel", [(1, 0), (2, 1), (3, 2)])
+@pytest.mark.parametrize("log2", [0, 10, 18])
+def test_pcm(fft, dtype, channels, channel, log2):
+    """Test that transforming one channel of interleaved integer PCM
+       samples matches numpy on that channel, scaled, whether the
+       samples are converted by a gather or by kf_bitrev."""
+    n, scale = 1 << log2, 1 / 32768
+    info = np.iinfo(dtype)
+    pcm = np.random.default_rng(0).integers(info.min, info.max,
+                                            n * channels, dtype=dtype)
+    y = np.empty(n, np.complex64)
+    fft(pcm, y, channels=channels, channel=channel, scale=scale)
+    expected = np.fft.fft(pcm.reshape(n, channels)[:, channel] * scale)
+    assert_close(y, expected)
+
+
+def test_pcm_channels():
+    """Test that a channel outside the layout is rejected, and that a
+       partial frame at the end of the input is ignored."""
+    y = np.empty(64, np.complex64)
+    for kwargs in (dict(channels=2, channel=2), dict(channels=0)):
+        with pytest.raises(ValueError, match="channel out of range"):
+            interruptible.fft_timed_interruptible(np.zeros(128, np.int16),
+                                                  y, **kwargs)
+    pcm = np.arange(129, dtype=np.int16)
+    interruptible.fft_timed_interruptible(pcm, y, channels=2, channel=1)
+    assert_close(y, np.fft.fft(pcm[1:128:2]))
+
+
+def test_pcm_interrupted():
+    """Test that a transform of PCM input stops promptly on control-C."""
+    n = 1 << 22
+    pcm = np.ones(2 * n, np.int16)
+    assert_interrupted(interruptible.fft_timed_interruptible, pcm,
+                       np.empty(n, np.complex64), channels=2)
+
+
+def pcm_and_complex(dtype, frames, seed=0):
+    """Random PCM samples, three channels interleaved, and channel 1 of
+       them as PCM_KWARGS has them read, as complex numbers."""
+    info = np.iinfo(dtype)
+    pcm = np.random.default_rng(seed).integers(info.min, info.max,
+                                               3 * frames, dtype=dtype)
+    x = (pcm.reshape(frames, 3)[:, 1] / 32768).astype(np.complex64)
+    return pcm, x
+
+PCM_KWARGS = dict(channels=3, channel=1, scale=1 / 32768)
+
+
+@pytest.mark.parametrize("dtype", [np.int16, np.int32])
+@pytest.mark.parametrize("log2", [4, 10, 18])
+def test_pcm_power(dtype, log2):
+    """Test that fft_power gives the same result for PCM input as for
+       the same samples as complex numbers, with and without a window
+       and phase."""
+    n = 1 << log2
+    pcm, x = pcm_and_complex(dtype, n)
+    for window in (None, np.hanning(n).astype(np.float32)):
+        for phase in (False, True):
+            expected = np.empty(2 * n if phase else n, np.float32)
+            actual = np.empty_like(expected)
+            interruptible.fft_power(x, expected, window, phase=phase)
+            interruptible.fft_power(pcm, actual, window, phase=phase,
+                                    **PCM_KWARGS)
+            np.testing.assert_array_equal(actual, expected)
+
+
+@pytest.mark.parametrize("dtype", [np.int16, np.int32])
+@pytest.mark.parametrize("log2", [6, 10, 13, 18])
+@pytest.mark.parametrize("nbins", [4, 40])
+def test_pcm_bins(dtype, log2, nbins):
+    """Test fft_bins on PCM input against numpy, with few enough bins
+       for the Goertzel algorithm and enough for a pruned transform."""
+    n = 1 << log2
+    pcm, x = pcm_and_complex(dtype, n)
+    bins = np.random.default_rng(1).integers(0, n, nbins)
+    y = np.empty(nbins, np.complex64)
+    interruptible.fft_bins(pcm, y, bins, **PCM_KWARGS)
+    assert_close(y, np.fft.fft(x)[bins])
+
+
+@pytest.mark.parametrize("simd", [True, False])
+@pytest.mark.parametrize("size", [4, 64, 1 << 12])
+def test_pcm_batch(simd, size):
+    """Test fft_batch on PCM input against numpy, with and without
+       SIMD, and for a size too big for it."""
+    pcm, x = pcm_and_complex(np.int16, 7 * size)
+    y = np.empty(7 * size, np.complex64)
+    interruptible.fft_batch(pcm, y, size, simd=simd, **PCM_KWARGS)
+    assert_close(y.reshape(7, size), np.fft.fft(x.reshape(7, size)))
+
+
+def test_pcm_welch():
+    """Test that fft_welch gives the same result for PCM input as for
+       the same samples as complex numbers."""
+    pcm, x = pcm_and_complex(np.int32, 10000)
+    window = np.hanning(256).astype(np.float32)
+    expected, actual = np.empty(256, np.float32), np.empty(256, np.float32)
+    interruptible.fft_welch(x, expected, window)
+    interruptible.fft_welch(pcm, actual, window, **PCM_KWARGS)
+    np.testing.assert_array_equal(actual, expected)
+
+
+def test_pcm_arguments():
+    """Test that the functions besides the transforms that take PCM
+       input check its layout and their output size, and that they
+       reject channels for complex input."""
+    pcm = np.zeros(3 * 64, np.int16)
+    calls = [
+        lambda x, **kw: interruptible.fft_power(
+            x, np.empty(64, np.float32), **kw),
+        lambda x, **kw: interruptible.fft_bins(
+            x, np.empty(1, np.complex64), [1], **kw),
+        lambda x, **kw: interruptible.fft_batch(
+            x, np.empty(64, np.complex64), 16, **kw),
+        lambda x, **kw: interruptible.fft_welch(
+            x, np.empty(16, np.float32), **kw),
+    ]
+    for call in calls:
+        call(pcm, channels=3)
+        with pytest.raises(ValueError, match="channel out of range"):
+            call(pcm, channels=3, channel=3)
+        with pytest.raises(ValueError, match="only apply to PCM input"):
+            call(np.zeros(64, np.complex64), channels=3)
+    with pytest.raises(ValueError, match="one element per input frame"):
+        interruptible.fft_batch(pcm, np.empty(64, np.complex64), 16)
+    with pytest.raises(ValueError, match="one float per sample"):
+        interruptible.fft_power(pcm, np.empty(64, np.float32))
+
+
+def check_gaps(x, y, interval):
+    """Transform x into y, timestamping each check with a SIGUSR1
+       handler while the signal is sent every 0.2 ms, and return the
+       longest time between checks.  The first gap also covers making
+       the plan and the pre-pass, and the last freeing the plan, so
+       only those in between count.  The handler allocates, so the
+       garbage collector is kept from adding gaps of its own."""
+    stamps = []
+    previous = signal(SIGUSR1, lambda *_: stamps.append(perf_counter()))
+    gc.disable()
+    try:
+        with Timer(ms(0.2), signal=SIGUSR1):
+            interruptible.fft_timed_interruptible(x, y, interval=interval)
+    finally:
+        gc.enable()
+        signal(SIGUSR1, previous)
+    gaps = np.diff(stamps)[1:-1]
+    assert len(gaps) > 10
+    return gaps.max()
+
+
+def test_check_gaps():
+    """Test that the top stages of a large transform, which run far
+       longer than the check interval, check it between chunks.  Other
+       load on the machine can stretch any one gap, but the stages
+       without chunks would do so every time, so the best of three
+       runs has to pass."""
+    interval = ms(2)
+    x = np.ones(1 << 23, np.complex64)
+    y = np.empty_like(x)
+    interruptible.fft_timed_interruptible(x, y)
+    assert min(check_gaps(x, y, interval) for _ in range(3)) < 5 * interval
+
+
+@pytest.mark.parametrize("cpus", ["1", "4"])
+@pytest.mark.parametrize("log2_samples", [2, 5, 10, 16, 19, 22])
+def test_twiddles(monkeypatch, cpus, log2_samples):
+    """Test that the transform of an impulse at index 1, which is
+       exactly the twiddle factors W**k, is within about half a float
+       ulp of them.  Tables for 2**19 samples and more are generated by
+       several threads when more than one CPU is available."""
+    monkeypatch.setenv("KISS_FFT_CPUS", cpus)
+    n = 1 << log2_samples
+    x = np.zeros(n, np.complex64)
+    x[1] = 1
+    y = np.empty_like(x)
+    interruptible.fft_uninterruptible(x, y)
+    expected = np.exp(-2j * np.pi * np.arange(n) / n)
+    assert np.abs(y - expected).max() < 6e-8
+
+
+def resident_bytes():
+    with open("/proc/self/statm") as f:
+        return int(f.read().split()[1]) * os.sysconf("SC_PAGE_SIZE")
+
+
+def test_plan_interrupted():
+    """Test that control-C while the plan for 2**24 samples is being
+       built, which takes over 100 ms, is answered within a few check
+       intervals, and that the parts of the plan built so far
+       are freed.  The input and output are left uninitialized and
+       never touched, so they take no memory."""
+    x = np.empty(1 << 24, np.complex64)
+    y = np.empty_like(x)
+    before = resident_bytes()
+    exc = assert_interrupted(interruptible.fft_timed_interruptible, x, y)
+    assert exc.args[0] < STD_DELAY + ms(40)
+    assert resident_bytes() - before < 16 << 20
+    x = random_complex(1 << 10)
+    y = np.empty_like(x)
+    interruptible.fft_timed_interruptible(x, y)
+    assert_close(y, np.fft.fft(x))
+
+
+HYBRID_SCRIPT = """
+import sys
+import numpy as np
+from ctrlc import interruptible
+x = np.random.default_rng(0).standard_normal(2 << int(sys.argv[1]))
+x = x.astype(np.float32).view(np.complex64)
+y = np.empty_like(x)
+interruptible.fft_uninterruptible(x, y)
+p = np.empty(len(x), np.float32)
+interruptible.fft_power(x, p)
+sys.stdout.buffer.write(y.tobytes() + p.tobytes())
+"""
+
+
+@pytest.mark.parametrize("log2_samples", [18, 19])
+def test_hybrid_traversal(log2_samples):
+    """Test that doing the top stages breadth-first gives exactly the
+       same result as doing everything depth-first.  The switch point
+       depends on the size of L2 cache, which is only looked up once,
+       so each cache size gets its own process: one small enough for
+       the smallest depth-first sub-transforms, one in between, and
+       one that holds the whole transform."""
+    results = [
+        subprocess.run(
+            [sys.executable, "-c", HYBRID_SCRIPT, str(log2_samples)],
+            env=dict(os.environ, KISS_FFT_L2_CACHE_SIZE=str(cache_size)),
+            check=True, stdout=subprocess.PIPE).stdout
+        for cache_size in (1, 1 << 16, 1 << 40)
+    ]
+    assert results[0] == results[2]
+    assert results[1] == results[2]
+
+
+def digit_reversed(n):
+    """The index of each bin 0 to n-1 in a scrambled spectrum of n
+       samples: its base-4 digits reversed, with the top bit as a
+       final base-2 digit when n is an odd power of two."""
+    log2_samples = n.bit_length() - 1
+    result = np.zeros(n, np.int64)
+    k = np.arange(n)
+    for _ in range(log2_samples // 2):
+        result = result * 4 + k % 4
+        k //= 4
+    if log2_samples % 2:
+        result = result * 2 + k
+    return result
+
+
+@pytest.mark.parametrize("log2_samples", [0, 1, 2, 3, 6, 9, 12, 18, 19])
+def test_scrambled_order(log2_samples):
+    n = 1 << log2_samples
+    x = random_complex(n)
+    y = np.empty_like(x)
+    interruptible.fft_timed_interruptible(x, y, scrambled=True)
+    expected = np.empty_like(x)
+    expected[digit_reversed(n)] = np.fft.fft(x)
+    assert_close(y, expected)
+
+
+@pytest.mark.parametrize("log2_samples", [0, 1, 4, 11, 18, 19])
+def test_scrambled_inverse(log2_samples):
+    """Test that the inverse takes a scrambled spectrum back to N times
+       the input, both in place."""
+    n = 1 << log2_samples
+    x = random_complex(n)
+    y = x.copy()
+    interruptible.fft_timed_interruptible(y, y, scrambled=True)
+    interruptible.fft_timed_interruptible(y, y, scrambled=True,
+                                          inverse=True)
+    assert_close(y, n * x)
+
+
+@pytest.mark.parametrize("n", [1 << 10, 1 << 11])
+def test_scrambled_convolution(n):
+    """Test circular convolution through scrambled spectra, which is
+       what they're for, against numpy."""
+    a, b = random_complex(n, 1), random_complex(n, 2)
+    fa, fb, y = (np.empty_like(a) for _ in range(3))
+    interruptible.fft_timed_interruptible(a, fa, scrambled=True)
+    interruptible.fft_timed_interruptible(b, fb, scrambled=True)
+    interruptible.fft_timed_interruptible(fa * fb, y, scrambled=True,
+                                          inverse=True)
+    expected = n * np.fft.ifft(np.fft.fft(a) * np.fft.fft(b))
+    assert_close(y, expected, 1e-4)
+
+
+def test_scrambled_errors():
+    x = random_complex(16)
+    y = np.empty_like(x)
+    with pytest.raises(ValueError, match="only available with scrambled"):
+        interruptible.fft_timed_interruptible(x, y, inverse=True)
+    pcm = np.zeros(16, np.int16)
+    with pytest.raises(ValueError, match="only applies to complex input"):
+        interruptible.fft_timed_interruptible(pcm, y, scrambled=True)
+
+
+@pytest.mark.parametrize("inverse", [False, True])
+def test_scrambled_interrupted(inverse):
+    x = np.ones(1 << 22, np.complex64)
+    assert_interrupted(interruptible.fft_timed_interruptible, x,
+                       np.empty_like(x), scrambled=True, inverse=inverse)
+
+
+def sparse_signal(n, k, noise=0.0):
+    """Return a signal of n samples whose spectrum has k bins of
+       magnitude 1 to 2, plus white noise with about `noise` times
+       their energy, and the numbers of those bins."""
+    rng = np.random.default_rng(0)
+    bins = rng.choice(n, k, replace=False)
+    spectrum = np.zeros(n, np.complex128)
+    spectrum[bins] = (rng.uniform(1, 2, k)
+                      * np.exp(2j * np.pi * rng.random(k)))
+    x = np.fft.ifft(spectrum)
+    x += (np.sqrt(noise * k) / n
+          * (rng.standard_normal(n) + 1j * rng.standard_normal(n)))
+    return x.astype(np.complex64), bins
+
+
+@pytest.mark.parametrize("n,k", [(1 << 16, 8), (1 << 20, 1), (1 << 20, 50)])
+def test_sparse(n, k):
+    """Test that fft_sparse finds exactly the bins of a sparse
+       spectrum, without falling back, and leaves the rest zero."""
+    x, bins = sparse_signal(n, k)
+    y = np.full_like(x, np.nan)
+    _elapsed, _checks, found = interruptible.fft_sparse(x, y, k)
+    assert found == k
+    assert set(np.flatnonzero(y)) == set(bins)
+    assert_close(y, np.fft.fft(x))
+
+
+def test_sparse_tolerance():
+    """Test that noise below the tolerance is left out, and noise above
+       it makes fft_sparse fall back to the full transform.  The noise
+       that shares a hash bucket with each bin found is a few 1e-3 of
+       it."""
+    n, k = 1 << 16, 8
+    x, bins = sparse_signal(n, k, noise=1e-5)
+    expected = np.fft.fft(x)
+    y = np.empty_like(x)
+    _elapsed, _checks, found = interruptible.fft_sparse(x, y, k, 1e-4)
+    assert found == k
+    assert set(np.flatnonzero(y)) == set(bins)
+    assert_close(y[bins], expected[bins], 1e-2)
+    _elapsed, _checks, found = interruptible.fft_sparse(x, y, k, 1e-7)
+    assert found == n
+    assert_close(y, expected)
+
+
+def test_sparse_falls_back():
+    """Test that a spectrum that isn't sparse, or one with more bins
+       than are worth finding, gets the full transform."""
+    for x in (random_complex(1 << 16), sparse_signal(1 << 18, 200)[0]):
+        y = np.empty_like(x)
+        _elapsed, _checks, found = interruptible.fft_sparse(x, y, 8)
+        assert found == len(x)
+        assert_close(y, np.fft.fft(x))
+
+
+def test_sparse_errors():
+    x = random_complex(1 << 10)
+    y = np.empty_like(x)
+    with pytest.raises(ValueError, match="k must be positive"):
+        interruptible.fft_sparse(x, y, 0)
+    with pytest.raises(ValueError, match="tolerance must be"):
+        interruptible.fft_sparse(x, y, 4, 1.0)
+    with pytest.raises(ValueError, match="one element per sample"):
+        interruptible.fft_sparse(x, y[1:], 4)
+
+
+def test_sparse_interrupted():
+    """Test control-C during the fallback to a full transform: a
+       period that doesn't divide the size leaks into every bin."""
+    x = (np.arange(1 << 22) % 7).astype(np.complex64)
+    assert_interrupted(interruptible.fft_sparse, x, np.empty_like(x), 8)
+
+
+@pytest.mark.parametrize("log2_samples", [0, 1, 2, 5, 10, 17])
+def test_ntt_roundtrip(log2_samples):
+    """Test that the inverse NTT exactly undoes the forward one, and
+       that the transforms of an impulse and of a constant are what
+       any DFT gives."""
+    n, p = 1 << log2_samples, interruptible.NTT_MODULUS
+    rng = np.random.default_rng(0)
+    x = rng.integers(0, p, n, dtype=np.uint64)
+    fx, back = np.empty_like(x), np.empty_like(x)
+    interruptible.ntt(x, fx)
+    interruptible.ntt(fx, back, inverse=True)
+    np.testing.assert_array_equal(back, x)
+
+    impulse = np.zeros(n, np.uint64)
+    impulse[0] = 1
+    interruptible.ntt(impulse, fx)
+    np.testing.assert_array_equal(fx, np.ones(n, np.uint64))
+    interruptible.ntt(np.full(n, 3, np.uint64), fx)
+    np.testing.assert_array_equal(fx, [3 * n] + [0] * (n - 1))
+
+
+@pytest.mark.parametrize("n", [64, 128])
+def test_ntt_circular_convolution(n):
+    """Test the convolution theorem modulo NTT_MODULUS against a
+       circular convolution computed with Python integers."""
+    p = interruptible.NTT_MODULUS
+    rng = np.random.default_rng(0)
+    a = rng.integers(0, p, n, dtype=np.uint64)
+    b = rng.integers(0, p, n, dtype=np.uint64)
+    fa, fb, y = (np.empty(n, np.uint64) for _ in range(3))
+    interruptible.ntt(a, fa)
+    interruptible.ntt(b, fb)
+    product = (fa.astype(object) * fb.astype(object)) % p
+    interruptible.ntt(product.astype(np.uint64), y, inverse=True)
+    a, b = a.astype(object), b.astype(object)
+    expected = [sum(a[j] * b[(i - j) % n] for j in range(n)) % p
+                for i in range(n)]
+    np.testing.assert_array_equal(y.astype(object), expected)
+
+
+@pytest.mark.parametrize("la,lb", [(1, 1), (1000, 1), (1000, 777),
+                                   (1 << 16, 1 << 16)])
+def test_ntt_convolve(la, lb):
+    """Test that ntt_convolve matches numpy.convolve exactly, for
+       values large enough that a floating-point FFT would round."""
+    rng = np.random.default_rng(0)
+    a = rng.integers(-(1 << 26), 1 << 26, la, dtype=np.int64)
+    b = rng.integers(-(1 << 26), 1 << 26, lb, dtype=np.int64)
+    y = np.empty(la + lb - 1, np.int64)
+    interruptible.ntt_convolve(a, b, y)
+    np.testing.assert_array_equal(y, np.convolve(a, b))
+
+
+def test_ntt_convolve_range():
+    """Test results just inside +-NTT_MODULUS / 2, where the residues
+       nearest zero have to be chosen correctly."""
+    half = interruptible.NTT_MODULUS // 2
+    a = np.array([half // 3, -(half // 3)], np.int64)
+    b = np.array([3, 0, -3], np.int64)
+    y = np.empty(4, np.int64)
+    interruptible.ntt_convolve(a, b, y)
+    np.testing.assert_array_equal(y, np.convolve(a, b))
+    assert np.abs(y).max() > half - 3
+
+
+def test_ntt_errors():
+    p = interruptible.NTT_MODULUS
+    x = np.zeros(8, np.uint64)
+    with pytest.raises(ValueError, match="one element per sample"):
+        interruptible.ntt(x, np.empty(4, np.uint64))
+    with pytest.raises(ValueError, match="must not overlap"):
+        interruptible.ntt(x, x)
+    x[5] = p
+    with pytest.raises(ValueError, match=r"input\[5\] is not less than"):
+        interruptible.ntt(x, np.empty_like(x))
+    a = np.ones(4, np.int64)
+    with pytest.raises(ValueError, match="must not be empty"):
+        interruptible.ntt_convolve(a, a[:0], np.empty(3, np.int64))
+    with pytest.raises(ValueError, match="len.a. . len.b. - 1 elements"):
+        interruptible.ntt_convolve(a, a, np.empty(8, np.int64))
+
+
+def sparse_int64(n):
+    """An array of N zeros that is only address space: its pages are
+       neither touched nor charged against memory until written."""
+    MAP_NORESERVE = 0x4000  # Linux
+    flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+    return np.frombuffer(mmap(-1, 8 * n, flags=flags), np.int64)
+
+
+@pytest.mark.skipif(sys.platform != "linux" or sys.maxsize < 1 << 62,
+                    reason="needs 32 TiB of address space")
+def test_ntt_convolve_too_large():
+    """Test that a convolution with more than MAX_SAMPLES outputs is
+       rejected as such, before allocating scratch space for it."""
+    n = interruptible.MAX_SAMPLES
+    a = sparse_int64(n)
+    y = sparse_int64(2 * n - 1)
+    for b, out in ((a[:2], y[:n + 1]), (a, y)):
+        with pytest.raises(ValueError, match="invalid number of samples"):
+            interruptible.ntt_convolve(a, b, out)
+
+
+def test_ntt_interrupted():
+    x = np.ones(1 << 22, np.uint64)
+    assert_interrupted(interruptible.ntt, x, np.empty_like(x))
+    a = np.ones(1 << 21, np.int64)
+    assert_interrupted(interruptible.ntt_convolve, a, a,
+                       np.empty(2 * len(a) - 1, np.int64))
+
+
+def shared_segment(samples, shards, buffer=None):
+    """Set up a segment for fft_shared_run in buffer, or a new array,
+       returning it and views of its input and output arrays."""
+    size, input_offset, output_offset = \
+        interruptible.fft_shared_layout(samples, shards)
+    if buffer is None:
+        buffer = np.zeros(size, np.uint8)
+    interruptible.fft_shared_init(buffer, samples, shards)
+    x = np.frombuffer(buffer, np.complex64, samples, input_offset)
+    y = np.frombuffer(buffer, np.complex64, samples, output_offset)
+    return buffer, x, y
+
+
+def run_shards(buffer, shards):
+    """Run every shard of the transform in buffer, each in its own
+       thread, and return their `completed` results in order."""
+    results = [None] * shards
+    def run(shard):
+        results[shard] = interruptible.fft_shared_run(buffer, shard)[2]
+    threads = [Thread(target=run, args=(i,)) for i in range(shards)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    return results
+
+
+@pytest.mark.parametrize("log2_samples", [12, 16, 17])
+@pytest.mark.parametrize("shards", [1, 2, 4])
+def test_shared(log2_samples, shards):
+    """Test that a sharded transform matches numpy, and that the
+       segment can be reused for a second input straight away."""
+    n = 1 << log2_samples
+    buffer, x, y = shared_segment(n, shards)
+    for seed in (0, 1):
+        x[:] = random_complex(n, seed)
+        assert run_shards(buffer, shards) == [True] * shards
+        assert_close(y, np.fft.fft(x))
+
+
+def map_file(path, size):
+    """Map `size` bytes of the file at path, shared."""
+    fd = os.open(path, os.O_RDWR | os.O_CREAT)
+    try:
+        os.ftruncate(fd, size)
+        return mmap(fd, size)
+    finally:
+        os.close(fd)
+
+
+def test_shared_processes(tmp_path):
+    """Test shards in separate processes, each of which maps the
+       segment again, at a different address."""
+    n, shards = 1 << 16, 4
+    path = tmp_path / "segment"
+    size = interruptible.fft_shared_layout(n, shards)[0]
+    buffer, x, y = shared_segment(n, shards, map_file(path, size))
+    x[:] = random_complex(n)
+    pids = []
+    for shard in range(1, shards):
+        pid = os.fork()
+        if pid == 0:
+            completed = interruptible.fft_shared_run(
+                map_file(path, size), shard)[2]
+            os._exit(0 if completed else 1)
+        pids.append(pid)
+    assert interruptible.fft_shared_run(buffer, 0)[2]
+    for pid in pids:
+        assert os.waitstatus_to_exitcode(os.waitpid(pid, 0)[1]) == 0
+    assert_close(y, np.fft.fft(x))
+
+
+def test_shared_errors():
+    with pytest.raises(ValueError, match="invalid number of samples"):
+        interruptible.fft_shared_layout(3, 2)
+    with pytest.raises(ValueError, match="invalid number of samples"):
+        interruptible.fft_shared_layout(1 << 10, 0)
+    size = interruptible.fft_shared_layout(1 << 10, 2)[0]
+    with pytest.raises(ValueError, match="shared buffer too small"):
+        interruptible.fft_shared_init(np.zeros(size - 1, np.uint8),
+                                      1 << 10, 2)
+    buffer = np.zeros(size, np.uint8)
+    with pytest.raises(ValueError, match="set up by fft_shared_init"):
+        interruptible.fft_shared_run(buffer, 0)
+    interruptible.fft_shared_init(buffer, 1 << 10, 2)
+    with pytest.raises(ValueError, match="shard out of range"):
+        interruptible.fft_shared_run(buffer, 2)
+
+
+def test_shared_interrupted():
+    """Test control-C while setting up a segment, which leaves it
+       unusable until it is set up again.  Then test that control-C in
+       one shard stops the other, which returns with `completed` false,
+       that later runs return at once until fft_shared_reset, and that
+       the segment works after that."""
+    n = 1 << 22
+    size = interruptible.fft_shared_layout(n, 2)[0]
+    buffer = np.zeros(size, np.uint8)
+    assert_interrupted(interruptible.fft_shared_init, buffer, n, 2)
+    with pytest.raises(ValueError, match="set up by fft_shared_init"):
+        interruptible.fft_shared_run(buffer, 0)
+
+    buffer, x, y = shared_segment(n, 2, buffer)
+    x[:] = 1
+    results = []
+    peer = Thread(target=lambda: results.append(
+        interruptible.fft_shared_run(buffer, 1)[2]))
+    peer.start()
+    assert_interrupted(interruptible.fft_shared_run, buffer, 0)
+    peer.join(MAX_LATENCY)
+    assert not peer.is_alive()
+    assert results == [False]
+    assert run_shards(buffer, 2) == [False, False]
+    interruptible.fft_shared_reset(buffer)
+    x[:] = random_complex(n)
+    assert run_shards(buffer, 2) == [True, True]
+    assert_close(y, np.fft.fft(x))
+
+
+def test_shared_cancel():
+    """Test that fft_shared_cancel, called by something that runs no
+       shard, stops a shard waiting for a peer that never starts, and
+       that the segment works again after fft_shared_reset."""
+    buffer, x, y = shared_segment(1 << 16, 2)
+    x[:] = random_complex(1 << 16)
+    results = []
+    shard = Thread(target=lambda: results.append(
+        interruptible.fft_shared_run(buffer, 0)[2]))
+    shard.start()
+    sleep(STD_DELAY)
+    interruptible.fft_shared_cancel(buffer)
+    shard.join(MAX_LATENCY)
+    assert not shard.is_alive()
+    assert results == [False]
+    interruptible.fft_shared_reset(buffer)
+    assert run_shards(buffer, 2) == [True, True]
+    assert_close(y, np.fft.fft(x))
+
+
+def test_shared_dead_peer():
+    """Test that a shard waiting at a barrier notices that a peer
+       process died while running, rather than waiting for it forever,
+       and that the segment works again after fft_shared_reset."""
+    n = 1 << 16
+    size = interruptible.fft_shared_layout(n, 2)[0]
+    buffer, x, y = shared_segment(n, 2, mmap(-1, size))
+    pid = os.fork()
+    if pid == 0:
+        # Shard 1 waits for shard 0, which doesn't start until this
+        # process is gone.
+        try:
+            interruptible.fft_shared_run(buffer, 1)
+        finally:
+            os._exit(0)
+    sleep(5 * STD_DELAY)
+    os.kill(pid, SIGKILL)
+    os.waitpid(pid, 0)
+    start = perf_counter()
+    assert not interruptible.fft_shared_run(buffer, 0)[2]
+    assert perf_counter() - start < MAX_LATENCY
+    interruptible.fft_shared_reset(buffer)
+    x[:] = random_complex(n)
+    assert run_shards(buffer, 2) == [True, True]
+    assert_close(y, np.fft.fft(x))
+
+
+def shm_name(tag):
+    """A shared memory segment name unique to this process and tag."""
+    return f"/ctrlc-test-{os.getpid()}-{tag}"
+
+
+def shm_exists(name):
+    """True if the shared memory segment `name` exists (on Linux)."""
+    return os.path.exists("/dev/shm" + name)
+
+
+@pytest.mark.parametrize("n", [1, 4, 1 << 12, 1 << 17])
+def test_shared_plan(n):
+    """Test that SharedPlans with the same name agree with numpy, and
+       that the segment goes away when the last one is closed."""
+    name = shm_name("plan")
+    first = interruptible.SharedPlan(name, n)
+    second = interruptible.SharedPlan(name, n)
+    assert (first.name, first.size) == (name, n)
+    x = random_complex(n)
+    for plan in (first, second):
+        y = np.empty_like(x)
+        plan.transform(x, y)
+        assert_close(y, np.fft.fft(x))
+    first.close()
+    assert shm_exists(name)
+    second.close()
+    assert not shm_exists(name)
+
+
+def twiddle_mappings(name):
+    """The permissions of each mapping of the twiddles in segment
+       `name`, which follow its one-page header."""
+    with open("/proc/self/maps") as maps:
+        fields = [line.split() for line in maps]
+    return [f[1] for f in fields
+            if f[-1] == "/dev/shm" + name and int(f[2], 16) > 0]
+
+
+def attach_shared_plan(name, n):
+    """The part of test_shared_plan_processes that runs in a child,
+       which inherits the parent's mapping."""
+    before = twiddle_mappings(name)
+    plan = interruptible.SharedPlan(name, n)
+    after = twiddle_mappings(name)
+    assert len(after) == len(before) + 1
+    assert set(after) == {"r--s"}
+    x = random_complex(n)
+    y = np.empty_like(x)
+    plan.transform(x, y)
+    assert_close(y, np.fft.fft(x))
+    plan.close()
+
+
+def test_shared_plan_processes():
+    """Test that another process maps the same segment read-only, and
+       that the segment outlives it while this process still uses it."""
+    n, name = 1 << 16, shm_name("processes")
+    plan = interruptible.SharedPlan(name, n)
+    run_in_child(attach_shared_plan, name, n)
+    assert shm_exists(name)
+    plan.close()
+    assert not shm_exists(name)
+
+
+def test_shared_plan_errors():
+    n, name = 1 << 10, shm_name("errors")
+    with pytest.raises(ValueError, match="invalid number of samples"):
+        interruptible.SharedPlan(name, 3)
+    assert not shm_exists(name)
+    plan = interruptible.SharedPlan(name, n)
+    with pytest.raises(OSError) as info:
+        interruptible.SharedPlan(name, 2 * n)
+    assert info.value.errno == errno.EINVAL
+    x = random_complex(n)
+    with pytest.raises(ValueError, match="wrong number of samples"):
+        plan.transform(x[:n // 2], np.empty(n // 2, np.complex64))
+    plan.close()
+    with pytest.raises(RuntimeError, match="SharedPlan is closed"):
+        plan.transform(x, np.empty_like(x))
+
+
+def test_shared_plan_interrupted():
+    """Test control-C while building a large SharedPlan, which leaves no
+       segment behind, and while waiting for another process to build
+       one."""
+    n, name = 1 << 24, shm_name("interrupted")
+    assert_interrupted(interruptible.SharedPlan, name, n)
+    assert not shm_exists(name)
+
+    pid = os.fork()
+    if pid == 0:
+        try:
+            interruptible.SharedPlan(name, n).close()
+        finally:
+            os._exit(0)
+    while not shm_exists(name):
+        sleep(ms(1))
+    assert_interrupted(interruptible.SharedPlan, name, n)
+    os.waitpid(pid, 0)
+    assert not shm_exists(name)
+
+
+@pytest.mark.parametrize("reap", [True, False])
+def test_shared_plan_dead_builder(reap):
+    """Test that a process waiting for another to build a SharedPlan
+       takes over if that process dies first, whether or not it has
+       been reaped yet, and that the segment is still removed when the
+       last plan is closed."""
+    n, name = 1 << 22, shm_name("dead-builder")
+    pid = os.fork()
+    if pid == 0:
+        try:
+            interruptible.SharedPlan(name, n)
+        finally:
+            os._exit(0)
+    while not shm_exists(name):
+        sleep(ms(1))
+    sleep(STD_DELAY)
+    os.kill(pid, SIGKILL)
+    if reap:
+        os.waitpid(pid, 0)
+    try:
+        plan = interruptible.SharedPlan(name, n)
+    finally:
+        if not reap:
+            os.waitpid(pid, 0)
+    # The transform of an impulse at 1 is every twiddle factor; check
+    # a sample of them.
+    x = np.zeros(n, np.complex64)
+    x[1] = 1
+    y = np.empty_like(x)
+    plan.transform(x, y)
+    plan.close()
+    assert not shm_exists(name)
+    k = np.random.default_rng(0).integers(0, n, 1000)
+    assert_close(y[k], np.exp(-2j * np.pi * k / n))
+
+
+@pytest.mark.parametrize("sized", [False, True])
+def test_shared_plan_unclaimed(sized):
+    """Test that a SharedPlan is still built if a builder is killed
+       after creating its segment but before claiming it, whether or
+       not it had sized it yet, once the segment has gone unclaimed for
+       a second."""
+    n, name = 1 << 12, shm_name(f"unclaimed-{sized}")
+    pid = os.fork()
+    if pid == 0:
+        fd = os.open("/dev/shm" + name,
+                     os.O_RDWR | os.O_CREAT | os.O_EXCL, 0o600)
+        if sized:
+            os.ftruncate(fd, 1 << 20)
+        os.kill(os.getpid(), SIGKILL)
+    os.waitpid(pid, 0)
+    assert shm_exists(name)
+    start = perf_counter()
+    plan = interruptible.SharedPlan(name, n)
+    elapsed = perf_counter() - start
+    x = random_complex(n)
+    y = np.empty_like(x)
+    plan.transform(x, y)
+    plan.close()
+    assert not shm_exists(name)
+    assert_close(y, np.fft.fft(x))
+    assert 1 <= elapsed < 1 + MAX_LATENCY
+
+
+def plan_growth(share):
+    """How much a transform of 2**21 samples raises the peak resident
+       memory, in bytes, after share_twiddles(2**22) if `share`."""
+    if share:
+        interruptible.share_twiddles(1 << 22)
+    x = np.ones(1 << 21, np.complex64)
+    y = np.ones_like(x)
+    before = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    interruptible.fft_timed_interruptible(x, y)
+    after = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return (after - before) * 1024
+
+
+def check_shared_twiddles():
+    """The part of test_share_twiddles that runs in a child, since
+       share_twiddles lasts for the rest of the process."""
+    interruptible.share_twiddles(1 << 16)
+    for log2_samples in range(17):
+        x = random_complex(1 << log2_samples)
+        y = np.empty_like(x)
+        interruptible.fft_timed_interruptible(x, y)
+        assert_close(y, np.fft.fft(x))
+    assert plan_growth(True) < 4 << 20
+
+
+def check_unshared_twiddles():
+    # the plan's own table is about 24 MB
+    assert plan_growth(False) > 16 << 20
+
+
+def test_share_twiddles():
+    """Test that transforms of every size up to that given to
+       share_twiddles match numpy using its tables, and that a plan
+       that can use them doesn't allocate its own."""
+    run_in_child(check_shared_twiddles)
+    run_in_child(check_unshared_twiddles)
+
+
+def test_wisdom_largest_table(tmp_path):
+    """Test that a wisdom file holds only the table for its largest
+       size, which serves the smaller ones."""
+    sizes = [1 << 10, 1 << 12, 1 << 14]
+    interruptible.save_wisdom(str(tmp_path / "all"), sizes)
+    interruptible.save_wisdom(str(tmp_path / "largest"), sizes[-1:])
+    all_size = os.path.getsize(tmp_path / "all")
+    assert all_size - os.path.getsize(tmp_path / "largest") < 4096
+    run_in_child(load_and_transform, tmp_path / "largest", sizes)
+
+
+def interrupt_share_twiddles():
+    assert_interrupted(interruptible.share_twiddles, 1 << 24)
+    check_shared_twiddles()
+
+
+def test_share_twiddles_interrupted():
+    """Test control-C while building the shared table, after which the
+       process can still share a smaller one."""
+    run_in_child(interrupt_share_twiddles)
+
+
+def dct_reference(x, type):
+    """scipy.fft.dct(x, type) with norm='backward', as a matrix
+       product."""
+    n = len(x)
+    k, j = np.meshgrid(np.arange(n), np.arange(n), indexing="ij")
+    if type == 2:
+        return 2 * np.cos(np.pi * k * (2 * j + 1) / (2 * n)) @ x
+    terms = 2 * np.cos(np.pi * j * (2 * k + 1) / (2 * n))
+    terms[:, 0] = 1
+    return terms @ x
+
+
+def random_real(n, seed=0):
+    return np.random.default_rng(seed).standard_normal(n).astype(np.float32)
+
+
+@pytest.mark.parametrize("type", [2, 3])
+@pytest.mark.parametrize("n", [1, 2, 4, 16, 256, 2048])
+def test_dct(type, n):
+    """Test dct of types 2 and 3 against the sums they stand for."""
+    x = random_real(n)
+    y = np.empty_like(x)
+    interruptible.dct(x, y, type)
+    assert_close(y, dct_reference(x.astype(np.float64), type))
+
+
+def test_dct_large():
+    """Test a DCT-II of 2**18 samples against the real part of the
+       mirrored transform that Makhoul's method avoids, rotated."""
+    n = 1 << 18
+    x = random_real(n)
+    y = np.empty_like(x)
+    interruptible.dct(x, y)
+    mirrored = np.fft.fft(np.concatenate([x, x[::-1]]).astype(np.float64))
+    rotation = np.exp(-1j * np.pi * np.arange(n) / (2 * n))
+    assert_close(y, (rotation * mirrored[:n]).real)
+
+
+@pytest.mark.parametrize("log2_samples", [1, 5, 12, 17])
+def test_dct_roundtrip(log2_samples):
+    """Test that type 3 of type 2 is 2N times the input."""
+    n = 1 << log2_samples
+    x = random_real(n)
+    y, z = np.empty_like(x), np.empty_like(x)
+    interruptible.dct(x, y, 2)
+    interruptible.dct(y, z, 3)
+    assert_close(z, 2 * n * x)
+
+
+def test_dct_errors():
+    x = random_real(16)
+    with pytest.raises(ValueError, match="type must be 2 or 3, not 4"):
+        interruptible.dct(x, np.empty_like(x), 4)
+    with pytest.raises(ValueError, match="one element per sample"):
+        interruptible.dct(x, np.empty(8, np.float32))
+    with pytest.raises(ValueError, match="must not overlap"):
+        interruptible.dct(x, x)
+    with pytest.raises(ValueError, match="invalid number of samples"):
+        interruptible.dct(x[:12], np.empty(12, np.float32))
+
+
+@pytest.mark.parametrize("type", [2, 3])
+def test_dct_interrupted(type):
+    x = np.ones(1 << 22, np.float32)
+    assert_interrupted(interruptible.dct, x, np.empty_like(x), type)
+
+
+@pytest.mark.parametrize("n", [1, 16, 2048])
+def test_dct_object(n):
+    """Test that a DCT object gives what dct does, for both types, and
+       keeps doing so when reused."""
+    d = interruptible.DCT(n)
+    assert d.size == n
+    y, z = np.empty(n, np.float32), np.empty(n, np.float32)
+    for seed in range(3):
+        x = random_real(n, seed)
+        for type in (2, 3):
+            d.transform(x, y, type)
+            interruptible.dct(x, z, type)
+            np.testing.assert_array_equal(y, z)
+            assert_close(y, dct_reference(x.astype(np.float64), type))
+
+
+def test_dct_object_errors():
+    for n in (0, -1, 12):
+        with pytest.raises(ValueError, match="invalid number of samples"):
+            interruptible.DCT(n)
+    d = interruptible.DCT(16)
+    x = random_real(16)
+    with pytest.raises(ValueError, match="type must be 2 or 3, not 1"):
+        d.transform(x, np.empty_like(x), 1)
+    with pytest.raises(ValueError, match="wrong number of input samples"):
+        d.transform(x[:8], np.empty(8, np.float32))
+    with pytest.raises(ValueError, match="one element per sample"):
+        d.transform(x, np.empty(8, np.float32))
+    with pytest.raises(ValueError, match="must not overlap"):
+        d.transform(x, x)
+
+
+def test_dct_object_interrupted():
+    """Test that control-C stops a DCT object's construction and its
+       transforms, and that an interrupted transform leaves the object
+       usable."""
+    n = 1 << 23
+    assert_interrupted(interruptible.DCT, n)
+    d = interruptible.DCT(1 << 22)
+    x = random_real(1 << 22)
+    y, z = np.empty_like(x), np.empty_like(x)
+    assert_interrupted(d.transform, x, y)
+    d.transform(x, y)
+    interruptible.dct(x, z)
+    np.testing.assert_array_equal(y, z)
@@ -1,3 +1,5 @@
+import sys
+
 from setuptools import Extension, setup
 
 # assumes gcc-compatible command line options
@@ -23,6 +25,8 @@ setup(ext_modules=[
             "ctrlc/kissfft_subset.c",
         ],
         extra_compile_args = WARNING_OPTIONS,
+        # shm_open is in librt before glibc 2.34
+        libraries = ["rt"] if sys.platform.startswith("linux") else [],
     ),
     Extension(
         "ctrlc.signaler",